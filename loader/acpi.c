@@ -0,0 +1,143 @@
+#define MSG_FMT(msg) "ACPI: " msg
+
+#include "common/bug.h"
+#include "common/log.h"
+#include "common/string.h"
+#include "common/string_view.h"
+#include "acpi.h"
+
+BUILD_BUG_ON(sizeof(struct acpi_sdt_header) != 36);
+BUILD_BUG_ON(offsetof(struct acpi_madt_gicc, mpidr) != 68);
+BUILD_BUG_ON(sizeof(struct acpi_srat) != 48);
+BUILD_BUG_ON(sizeof(struct acpi_srat_memory_affinity) != 40);
+BUILD_BUG_ON(sizeof(struct acpi_srat_x2apic_affinity) != 24);
+
+#define RSDP_V1_SIZE offsetof(struct acpi_rsdp, length)
+
+static bool checksum_ok(const void *ptr, size_t size)
+{
+    const u8 *bytes = ptr;
+    u8 sum = 0;
+
+    while (size--)
+        sum += *bytes++;
+
+    return sum == 0;
+}
+
+static const struct acpi_sdt_header *table_at(u64 address)
+{
+    // Unreachable from a 32-bit loader
+    if (address != (ptr_t)address)
+        return NULL;
+
+    return ADDR_TO_PTR((ptr_t)address);
+}
+
+const struct acpi_sdt_header *acpi_find_table(ptr_t rsdp_addr,
+                                              const char *signature)
+{
+    const struct acpi_rsdp *rsdp = ADDR_TO_PTR(rsdp_addr);
+    const struct acpi_sdt_header *root = NULL, *table;
+    size_t i, entry_width, entry_count;
+    const u8 *entries;
+
+    if (!rsdp || !checksum_ok(rsdp, RSDP_V1_SIZE)) {
+        print_warn("invalid RSDP at 0x%016llX\n", (u64)rsdp_addr);
+        return NULL;
+    }
+
+    if (rsdp->revision >= 2 && rsdp->xsdt_address &&
+        checksum_ok(rsdp, rsdp->length)) {
+        root = table_at(rsdp->xsdt_address);
+        entry_width = 8;
+    }
+
+    if (!root) {
+        root = table_at(rsdp->rsdt_address);
+        entry_width = 4;
+    }
+
+    if (!root || root->length < sizeof(*root))
+        return NULL;
+
+    entries = (const u8*)root + sizeof(*root);
+    entry_count = (root->length - sizeof(*root)) / entry_width;
+
+    for (i = 0; i < entry_count; ++i) {
+        u64 address = entry_width == 8 ? ((const u64*)entries)[i] :
+                                         ((const u32*)entries)[i];
+
+        table = table_at(address);
+        if (!table)
+            continue;
+
+        if (memcmp(table->signature, signature, ACPI_SIGNATURE_LEN) != 0)
+            continue;
+
+        if (!checksum_ok(table, table->length)) {
+            struct string_view sig_str = {
+                .text = signature,
+                .size = ACPI_SIGNATURE_LEN
+            };
+
+            print_warn("table '%pSV' at 0x%016llX has an invalid checksum, "
+                       "skipping\n", &sig_str, address);
+            continue;
+        }
+
+        return table;
+    }
+
+    return NULL;
+}
+
+/*
+ * Both the MADT and the SRAT are a fixed header followed by a list of
+ * { u8 type; u8 length; } prefixed entries. Returns the entry at '*cursor' and
+ * advances past it, or NULL once the end or a malformed entry is reached.
+ */
+static const void *next_entry(const u8 **cursor, const u8 *table,
+                              const char *table_name)
+{
+    const u8 *entry = *cursor;
+    const u8 *end = table + ((const struct acpi_sdt_header*)table)->length;
+    u8 length;
+
+    if ((size_t)(end - entry) < 2)
+        return NULL;
+
+    length = entry[1];
+    if (length < 2 || length > (size_t)(end - entry)) {
+        print_warn("malformed %s entry at offset %zu\n", table_name,
+                   (size_t)(entry - table));
+        return NULL;
+    }
+
+    *cursor += length;
+    return entry;
+}
+
+void acpi_madt_foreach(const struct acpi_madt *madt, acpi_madt_foreach_t cb,
+                       void *user)
+{
+    const struct acpi_madt_entry_header *entry;
+    const u8 *cursor = madt->entries;
+
+    while ((entry = next_entry(&cursor, (const u8*)madt, "MADT"))) {
+        if (!cb(user, entry))
+            return;
+    }
+}
+
+void acpi_srat_foreach(const struct acpi_srat *srat, acpi_srat_foreach_t cb,
+                       void *user)
+{
+    const struct acpi_srat_entry_header *entry;
+    const u8 *cursor = srat->entries;
+
+    while ((entry = next_entry(&cursor, (const u8*)srat, "SRAT"))) {
+        if (!cb(user, entry))
+            return;
+    }
+}
@@ -8,6 +8,7 @@
 
 #include "services.h"
 #include "memory_services.h"
+#include "numa.h"
 
 #include "allocator.h"
 
@@ -57,16 +58,34 @@ static void allocation_spray(u64 ptr, size_t pages)
 }
 #endif
 
+static u64 allocate_on_node(u32 node, size_t pages, u64 ceiling, u32 type)
+{
+    u64 addr;
+
+    if (node == NUMA_NODE_ANY)
+        return 0;
+
+    addr = numa_find_free_pages(node, pages, ceiling);
+    if (!addr)
+        return 0;
+
+    return ms_allocate_pages_at(addr, pages, type);
+}
+
 u64 allocate_pages_ex(const struct allocation_spec *spec)
 {
-    u64 result;
+    u64 result = 0;
     u32 type = spec->type ?: ALLOCATOR_DEFAULT_ALLOC_TYPE;
 
     if (spec->flags & ALLOCATE_PRECISE) {
         result = ms_allocate_pages_at(spec->addr, spec->pages, type);
     } else {
         u64 ceiling = spec->ceiling ?: ALLOCATOR_DEFAULT_CEILING;
-        result = ms_allocate_pages(spec->pages, ceiling, type);
+
+        if (spec->flags & ALLOCATE_PREFER_NODE)
+            result = allocate_on_node(spec->node, spec->pages, ceiling, type);
+        if (!result)
+            result = ms_allocate_pages(spec->pages, ceiling, type);
     }
 
     if (!result) {
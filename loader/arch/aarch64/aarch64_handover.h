@@ -19,6 +19,8 @@
 #else
 #include "common/types.h"
 #include "common/attributes.h"
+#include "common/align.h"
+#include "handover.h"
 
 // Make sure the macros above are aligned with these fields if changing them
 struct handover_info_aarch64 {
@@ -37,12 +39,44 @@ struct handover_info_aarch64 {
     bool enable_vhe;
 };
 
+/*
+ * Fills 'hia' with the state the kernel is entered with, including the
+ * translation registers for the page table in 'hi'.
+ */
+void handover_info_aarch64_init(struct handover_info *hi,
+                                struct handover_info_aarch64 *hia);
+
 NORETURN
 void kernel_handover_aarch64(struct handover_info_aarch64 *hia);
 
 // Marks the end of the trampoline code, for cache maintenance purposes
 extern char kernel_handover_aarch64_end[];
 
+#define CTR_IMINLINE_MASK 0xF
+#define CTR_DMINLINE_SHIFT 16
+#define CTR_DMINLINE_MASK 0xF
+#define CTR_IDC (1ull << 28)
+#define CTR_DIC (1ull << 29)
+
+// Both are log2 of the line size in words, hence the 4ull
+static inline u64 ctr_dcache_line_size(u64 ctr)
+{
+    return 4ull << ((ctr >> CTR_DMINLINE_SHIFT) & CTR_DMINLINE_MASK);
+}
+
+static inline u64 ctr_icache_line_size(u64 ctr)
+{
+    return 4ull << (ctr & CTR_IMINLINE_MASK);
+}
+
+#define CACHE_OP_RANGE(op, start, end, line)                  \
+    do {                                                      \
+        u64 addr_ = ALIGN_DOWN(start, line);                  \
+                                                              \
+        for (; addr_ < (end); addr_ += (line))                \
+            asm volatile(op ", %0" :: "r"(addr_) : "memory"); \
+    } while (0)
+
 u32 current_el(void);
 u64 read_id_aa64mmfr0_el1(void);
 u64 read_id_aa64mmfr1_el1(void);
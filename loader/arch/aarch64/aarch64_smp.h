@@ -0,0 +1,46 @@
+#pragma once
+
+#ifdef __ASSEMBLER__
+#define smp_trampoline_data_ttbr0 0
+#define smp_trampoline_data_ttbr1 8
+#define smp_trampoline_data_mair 16
+#define smp_trampoline_data_tcr 24
+#define smp_trampoline_data_sctlr 32
+#define smp_trampoline_data_direct_map_base 40
+#define smp_trampoline_data_pointer_offset 48
+#define smp_trampoline_data_enable_vhe 56
+#define smp_trampoline_data_unmap_lower_half 57
+#define smp_trampoline_data_size 64
+
+// Offsets into struct smp_cpu from include/smp.h
+#define smp_cpu_entrypoint 8
+#define smp_cpu_stack 16
+#define smp_cpu_argument 24
+#define smp_cpu_flags 36
+
+#define SMP_CPU_PARKED (1 << 1)
+
+#else
+#include "common/types.h"
+
+// Make sure the macros above are aligned with these fields if changing them
+struct smp_trampoline_data {
+    u64 ttbr0, ttbr1;
+    u64 mair, tcr;
+
+    // Written verbatim, not OR'd onto the live register
+    u64 sctlr;
+
+    u64 direct_map_base;
+
+    // Added to the descriptor address handed to the kernel
+    u64 pointer_offset;
+
+    bool enable_vhe;
+    bool unmap_lower_half;
+};
+
+extern char smp_trampoline_begin[];
+extern char smp_trampoline_data[];
+extern char smp_trampoline_end[];
+#endif
@@ -40,6 +40,14 @@ u64 ultra_max_binary_address(u32 flags)
     return 0xFFFFFFFFFFFFFFFF;
 }
 
+u64 ultra_huge_page_size(u32 flags)
+{
+    UNUSED(flags);
+
+    // Level 2 block with the 4K granule
+    return 2 * MB;
+}
+
 u64 ultra_direct_map_max_size(u32 flags)
 {
     UNUSED(flags);
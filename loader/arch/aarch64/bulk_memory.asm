@@ -0,0 +1,115 @@
+/*
+ * aarch64 implementation of bulk_memory.h, see string.asm for the register
+ * usage rules.
+ */
+
+// Needed despite -mgeneral-regs-only, see string.asm
+.arch_extension fp
+.arch_extension simd
+
+// Anything below this most likely fits in the cache anyway
+#define STREAMING_THRESHOLD (256 * 1024)
+
+#define DCZID_DZP_BIT 4
+#define DCZID_BS_MASK 0xF
+
+.text
+
+// void bulk_copy(void *dest, const void *src, size_t count)
+.global bulk_copy
+bulk_copy:
+    mov x4, STREAMING_THRESHOLD
+    cmp x2, x4
+    b.lo 2f
+
+    // Non-temporal pairs hint that the data shouldn't be kept in the cache
+1:
+    ldnp q0, q1, [x1]
+    ldnp q2, q3, [x1, #32]
+    add x1, x1, #64
+    stnp q0, q1, [x0]
+    stnp q2, q3, [x0, #32]
+    add x0, x0, #64
+    sub x2, x2, #64
+    cmp x2, #64
+    b.hs 1b
+
+2:
+    b memcpy
+
+// void bulk_zero(void *dest, size_t count)
+.global bulk_zero
+bulk_zero:
+    mov x2, x1
+    mov w1, #0
+
+    mov x4, STREAMING_THRESHOLD
+    cmp x2, x4
+    b.lo 3f
+
+    // DC ZVA might be prohibited, e.g. trapped by a hypervisor
+    mrs x5, dczid_el0
+    tbnz x5, DCZID_DZP_BIT, 3f
+
+    // Block size is 4 << BS bytes
+    and x5, x5, DCZID_BS_MASK
+    mov x6, #4
+    lsl x6, x6, x5
+    sub x7, x6, #1
+
+    // x8 = end, x9 = first aligned block, x10 = end of the last aligned block
+    add x8, x0, x2
+    add x9, x0, x7
+    bic x9, x9, x7
+    bic x10, x8, x7
+    cmp x9, x10
+    b.hs 3f
+
+    /*
+     * Zero whole blocks without reading them into the cache first, the
+     * unaligned head and tail are left to memset().
+     */
+    mov x11, x9
+1:
+    dc zva, x11
+    add x11, x11, x6
+    cmp x11, x10
+    b.lo 1b
+
+    stp x29, x30, [sp, #-32]!
+    mov x29, sp
+    stp x19, x20, [sp, #16]
+    mov x19, x10
+    mov x20, x8
+
+    // memset(dest, 0, head)
+    sub x2, x9, x0
+    bl memset
+
+    // memset(aligned end, 0, tail)
+    mov x0, x19
+    mov w1, #0
+    sub x2, x20, x19
+    bl memset
+
+    ldp x19, x20, [sp, #16]
+    ldp x29, x30, [sp], #32
+    ret
+
+3:
+    b memset
+
+/*
+ * UEFI already enables FP/SIMD at EL1 (CPACR_EL1.FPEN), which is all the
+ * routines above need, and it's allowed to stay enabled at handover.
+ */
+
+// void bulk_memory_enable_cpu_state(void)
+.global bulk_memory_enable_cpu_state
+bulk_memory_enable_cpu_state:
+    ret
+
+// void bulk_memory_restore_cpu_state(void)
+.global bulk_memory_restore_cpu_state
+bulk_memory_restore_cpu_state:
+    ret
@@ -6,6 +6,7 @@
 
 #include "handover.h"
 #include "aarch64_handover.h"
+#include "bulk_memory.h"
 
 static u8 g_current_el;
 static u64 g_ips_bits;
@@ -164,20 +165,6 @@ u64 handover_get_max_pt_address(u64 direct_map_base, u32 flags)
     return 0xFFFFFFFFFFFFFFFF;
 }
 
-#define CTR_IMINLINE_MASK 0xF
-#define CTR_DMINLINE_SHIFT 16
-#define CTR_DMINLINE_MASK 0xF
-#define CTR_IDC (1ull << 28)
-#define CTR_DIC (1ull << 29)
-
-#define CACHE_OP_RANGE(op, start, end, line)                  \
-    do {                                                      \
-        u64 addr_ = ALIGN_DOWN(start, line);                  \
-                                                              \
-        for (; addr_ < (end); addr_ += (line))                \
-            asm volatile(op ", %0" :: "r"(addr_) : "memory"); \
-    } while (0)
-
 /*
  * Make the freshly-loaded kernel image coherent with the instruction stream:
  * clean it out of the data cache to the Point of Unification, then invalidate
@@ -190,10 +177,8 @@ void handover_prepare_for(struct handover_info *hi)
     u64 ctr, dline, iline, end;
 
     asm volatile("mrs %0, ctr_el0" : "=r"(ctr));
-
-    // Both are log2 of the line size in words, hence the 4ull
-    dline = 4ull << ((ctr >> CTR_DMINLINE_SHIFT) & CTR_DMINLINE_MASK);
-    iline = 4ull << (ctr & CTR_IMINLINE_MASK);
+    dline = ctr_dcache_line_size(ctr);
+    iline = ctr_icache_line_size(ctr);
 
     /*
      * CTR_EL0.{IDC,DIC} waive the respective PoU maintenance steps for
@@ -301,10 +286,10 @@ static u64 build_tcr(struct handover_info *hi)
 
 #define MAIR_ATTR(idx, val) ((val) << ((idx) * 8))
 
-NORETURN
-void kernel_handover(struct handover_info *hi)
+void handover_info_aarch64_init(struct handover_info *hi,
+                                struct handover_info_aarch64 *hia)
 {
-    struct handover_info_aarch64 hia = (struct handover_info_aarch64) {
+    *hia = (struct handover_info_aarch64) {
         .arg0 = hi->arg0,
         .arg1 = hi->arg1,
         .direct_map_base = hi->direct_map_base,
@@ -322,20 +307,28 @@ void kernel_handover(struct handover_info *hi)
         .enable_vhe = g_current_el == 2,
     };
 
-    hia.ttbr0 = pt_get_root_pte_at(&hi->pt, 0x0000000000000000);
-    hia.ttbr1 = pt_get_root_pte_at(&hi->pt, hi->direct_map_base);
+    hia->ttbr0 = pt_get_root_pte_at(&hi->pt, 0x0000000000000000);
+    hia->ttbr1 = pt_get_root_pte_at(&hi->pt, hi->direct_map_base);
 
-    hia.mair = MAIR_ATTR(0, MAIR_NORMAL_WB) |
-               MAIR_ATTR(1, MAIR_DEVICE_nGnRnE) |
-               MAIR_ATTR(2, MAIR_NORMAL_NC);
-    hia.tcr = build_tcr(hi);
+    hia->mair = MAIR_ATTR(0, MAIR_NORMAL_WB) |
+                MAIR_ATTR(1, MAIR_DEVICE_nGnRnE) |
+                MAIR_ATTR(2, MAIR_NORMAL_NC);
+    hia->tcr = build_tcr(hi);
 
     /*
      * Bits the trampoline forces on in SCTLR (OR'd onto the live register so
      * reserved bits are preserved): MMU, data & instruction caches, stack
      * alignment checking.
      */
-    hia.sctlr = SCTLR_M | SCTLR_C | SCTLR_I | SCTLR_SA;
+    hia->sctlr = SCTLR_M | SCTLR_C | SCTLR_I | SCTLR_SA;
+}
+
+NORETURN
+void kernel_handover(struct handover_info *hi)
+{
+    struct handover_info_aarch64 hia;
 
+    bulk_memory_restore_cpu_state();
+    handover_info_aarch64_init(hi, &hia);
     kernel_handover_aarch64(&hia);
 }
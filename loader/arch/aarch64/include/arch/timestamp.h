@@ -0,0 +1,20 @@
+#pragma once
+
+#include "common/types.h"
+
+static inline u64 arch_read_timestamp(void)
+{
+    u64 ret;
+
+    // Don't let the counter read get speculated ahead of what came before
+    asm volatile("isb; mrs %0, cntvct_el0" : "=r"(ret) :: "memory");
+    return ret;
+}
+
+static inline u64 arch_timestamp_frequency(void)
+{
+    u64 ret;
+
+    asm volatile("mrs %0, cntfrq_el0" : "=r"(ret));
+    return ret;
+}
@@ -0,0 +1,461 @@
+#define MSG_FMT(msg) "SMP-AARCH64: " msg
+
+#include "common/align.h"
+#include "common/log.h"
+#include "common/minmax.h"
+#include "common/string.h"
+#include "common/string_view.h"
+#include "acpi.h"
+#include "allocator.h"
+#include "services.h"
+#include "smp.h"
+#include "aarch64_handover.h"
+#include "aarch64_smp.h"
+
+#define MPIDR_AFFINITY_MASK 0xFF00FFFFFFull
+
+#define PSCI_CPU_ON_64 0xC4000003
+
+#define PSCI_SUCCESS            0
+#define PSCI_NOT_SUPPORTED     -1
+#define PSCI_INVALID_PARAMETERS -2
+#define PSCI_DENIED            -3
+#define PSCI_ALREADY_ON        -4
+#define PSCI_ON_PENDING        -5
+#define PSCI_INTERNAL_FAILURE  -6
+#define PSCI_INVALID_ADDRESS   -9
+
+/*
+ * RES1 bits of SCTLR_EL1 (as well as SCTLR_EL2 with E2H set) on ARMv8.0,
+ * together with MMU, data & instruction caches and stack alignment checking.
+ */
+#define SCTLR_RES1 ((1 << 29) | (1 << 28) | (1 << 23) | (1 << 22) | \
+                    (1 << 20) | (1 << 11))
+#define SCTLR_M  (1 << 0)
+#define SCTLR_C  (1 << 2)
+#define SCTLR_SA (1 << 3)
+#define SCTLR_I  (1 << 12)
+#define AP_SCTLR (SCTLR_RES1 | SCTLR_M | SCTLR_C | SCTLR_I | SCTLR_SA)
+
+static bool psci_use_hvc;
+
+static u64 current_mpidr(void)
+{
+    u64 mpidr;
+
+    asm volatile("mrs %0, mpidr_el1" : "=r"(mpidr));
+    return mpidr & MPIDR_AFFINITY_MASK;
+}
+
+struct enumerate_ctx {
+    struct smp_cpu *cpus;
+    size_t capacity;
+    size_t count;
+    u64 bsp_mpidr;
+};
+
+static void add_cpu(struct enumerate_ctx *ctx, u64 mpidr, u32 uid)
+{
+    struct smp_cpu *cpu;
+
+    if (ctx->count++ >= ctx->capacity)
+        return;
+
+    cpu = &ctx->cpus[ctx->count - 1];
+    cpu->hardware_id = mpidr & MPIDR_AFFINITY_MASK;
+    cpu->acpi_uid = uid;
+
+    if (cpu->hardware_id == ctx->bsp_mpidr)
+        cpu->flags |= SMP_CPU_BSP;
+}
+
+static bool madt_add_cpu(void *user, const struct acpi_madt_entry_header *entry)
+{
+    const struct acpi_madt_gicc *gicc = (const void*)entry;
+
+    if (entry->type != ACPI_MADT_ENTRY_TYPE_GICC ||
+        entry->length < sizeof(*gicc) ||
+        !(gicc->flags & ACPI_MADT_GICC_ENABLED))
+        return true;
+
+    add_cpu(user, gicc->mpidr, gicc->acpi_processor_uid);
+    return true;
+}
+
+static bool acpi_enumerate(ptr_t rsdp, struct enumerate_ctx *ctx)
+{
+    const struct acpi_sdt_header *fadt, *madt;
+    u16 boot_flags;
+
+    fadt = acpi_find_table(rsdp, "FACP");
+    madt = acpi_find_table(rsdp, "APIC");
+    if (!fadt || !madt)
+        return false;
+
+    if (fadt->length < ACPI_FADT_ARM_BOOT_ARCH_OFFSET + sizeof(u16))
+        return false;
+
+    memcpy(&boot_flags, (const u8*)fadt + ACPI_FADT_ARM_BOOT_ARCH_OFFSET,
+           sizeof(boot_flags));
+    if (!(boot_flags & ACPI_ARM_BOOT_ARCH_PSCI_COMPLIANT)) {
+        print_warn("platform is not PSCI compliant\n");
+        return false;
+    }
+
+    psci_use_hvc = boot_flags & ACPI_ARM_BOOT_ARCH_PSCI_USE_HVC;
+    acpi_madt_foreach((const struct acpi_madt*)madt, madt_add_cpu, ctx);
+    return true;
+}
+
+/*
+ * A bare-bones flattened device tree walk, only looking at what we need:
+ * /psci { method } and /cpus/cpu@N { device_type, reg, enable-method, status }
+ */
+#define FDT_MAGIC      0xD00DFEED
+#define FDT_BEGIN_NODE 0x00000001
+#define FDT_END_NODE   0x00000002
+#define FDT_PROP       0x00000003
+#define FDT_NOP        0x00000004
+#define FDT_END        0x00000009
+
+struct fdt_header {
+    u32 magic;
+    u32 totalsize;
+    u32 off_dt_struct;
+    u32 off_dt_strings;
+    u32 off_mem_rsvmap;
+    u32 version;
+    u32 last_comp_version;
+    u32 boot_cpuid_phys;
+    u32 size_dt_strings;
+    u32 size_dt_struct;
+};
+
+static u32 fdt32(const void *ptr)
+{
+    u32 value;
+
+    memcpy(&value, ptr, sizeof(value));
+    return __builtin_bswap32(value);
+}
+
+struct fdt_cpu_node {
+    u64 reg;
+    bool has_reg;
+    bool is_cpu;
+    bool is_psci;
+    bool is_disabled;
+};
+
+struct fdt_walk_ctx {
+    const u8 *structs;
+    const char *strings;
+    size_t struct_size;
+    size_t cursor;
+
+    u32 depth;
+    bool in_cpus, in_psci, have_psci;
+    u32 address_cells;
+    u32 cpu_index;
+    struct fdt_cpu_node node;
+};
+
+static bool fdt_string_equals(const void *value, u32 len, const char *str)
+{
+    size_t str_len = strlen(str);
+
+    // Property strings are NUL-terminated, the first one in a list is enough
+    return len > str_len && memcmp(value, str, str_len + 1) == 0;
+}
+
+static void fdt_on_prop(struct fdt_walk_ctx *wctx, const char *name,
+                        const u8 *value, u32 len)
+{
+    struct fdt_cpu_node *node = &wctx->node;
+
+    if (wctx->in_psci && wctx->depth == 1 && sv_equals(SV(name), SV("method"))) {
+        wctx->have_psci = true;
+        psci_use_hvc = fdt_string_equals(value, len, "hvc");
+        return;
+    }
+
+    if (!wctx->in_cpus)
+        return;
+
+    if (wctx->depth == 1) {
+        if (sv_equals(SV(name), SV("#address-cells")) && len == 4)
+            wctx->address_cells = fdt32(value);
+        return;
+    }
+
+    if (wctx->depth != 2)
+        return;
+
+    if (sv_equals(SV(name), SV("device_type"))) {
+        node->is_cpu = fdt_string_equals(value, len, "cpu");
+    } else if (sv_equals(SV(name), SV("enable-method"))) {
+        node->is_psci = fdt_string_equals(value, len, "psci");
+    } else if (sv_equals(SV(name), SV("status"))) {
+        node->is_disabled = !fdt_string_equals(value, len, "okay") &&
+                            !fdt_string_equals(value, len, "ok");
+    } else if (sv_equals(SV(name), SV("reg"))) {
+        if (wctx->address_cells == 1 && len >= 4) {
+            node->reg = fdt32(value);
+            node->has_reg = true;
+        } else if (wctx->address_cells == 2 && len >= 8) {
+            node->reg = ((u64)fdt32(value) << 32) | fdt32(value + 4);
+            node->has_reg = true;
+        }
+    }
+}
+
+static void fdt_on_end_node(struct fdt_walk_ctx *wctx, struct enumerate_ctx *ctx)
+{
+    struct fdt_cpu_node *node = &wctx->node;
+
+    if (wctx->in_cpus && wctx->depth == 2 && node->is_cpu) {
+        if (!node->has_reg || node->is_disabled) {
+            // Not enabled, nothing to do
+        } else if (!node->is_psci) {
+            print_warn("CPU 0x%llX has an unsupported enable-method, "
+                       "skipping\n", node->reg);
+        } else {
+            add_cpu(ctx, node->reg, wctx->cpu_index);
+        }
+
+        wctx->cpu_index++;
+    }
+
+    if (wctx->depth == 1) {
+        wctx->in_cpus = false;
+        wctx->in_psci = false;
+    }
+
+    wctx->depth--;
+}
+
+static bool fdt_enumerate(ptr_t dtb, struct enumerate_ctx *ctx)
+{
+    const struct fdt_header *hdr = ADDR_TO_PTR(dtb);
+    struct fdt_walk_ctx wctx = {
+        // Devicetree specification default
+        .address_cells = 2,
+    };
+
+    if (fdt32(&hdr->magic) != FDT_MAGIC)
+        return false;
+
+    wctx.structs = ADDR_TO_PTR(dtb + fdt32(&hdr->off_dt_struct));
+    wctx.strings = ADDR_TO_PTR(dtb + fdt32(&hdr->off_dt_strings));
+    wctx.struct_size = fdt32(&hdr->size_dt_struct);
+
+    while (wctx.cursor + 4 <= wctx.struct_size) {
+        u32 token = fdt32(wctx.structs + wctx.cursor);
+        wctx.cursor += 4;
+
+        switch (token) {
+        case FDT_BEGIN_NODE: {
+            const char *name = (const char*)wctx.structs + wctx.cursor;
+
+            wctx.cursor += ALIGN_UP(strlen(name) + 1, 4);
+            wctx.depth++;
+
+            if (wctx.depth == 1) {
+                wctx.in_cpus = sv_equals(SV(name), SV("cpus"));
+                wctx.in_psci = memcmp(name, "psci", 4) == 0;
+            } else if (wctx.depth == 2) {
+                memzero(&wctx.node, sizeof(wctx.node));
+            }
+            break;
+        }
+        case FDT_END_NODE:
+            if (!wctx.depth)
+                return false;
+
+            fdt_on_end_node(&wctx, ctx);
+            break;
+        case FDT_PROP: {
+            u32 len, name_offset;
+
+            if (wctx.cursor + 8 > wctx.struct_size)
+                return false;
+
+            len = fdt32(wctx.structs + wctx.cursor);
+            name_offset = fdt32(wctx.structs + wctx.cursor + 4);
+            wctx.cursor += 8;
+
+            if (wctx.cursor + len > wctx.struct_size)
+                return false;
+
+            fdt_on_prop(&wctx, wctx.strings + name_offset,
+                        wctx.structs + wctx.cursor, len);
+            wctx.cursor += ALIGN_UP(len, 4);
+            break;
+        }
+        case FDT_NOP:
+            break;
+        case FDT_END:
+            goto out;
+        default:
+            print_warn("invalid FDT token 0x%08X\n", token);
+            return false;
+        }
+    }
+
+out:
+    if (!wctx.have_psci) {
+        print_warn("no PSCI node in the device tree\n");
+        return false;
+    }
+
+    return true;
+}
+
+size_t smp_arch_enumerate(struct smp_cpu *cpus, size_t capacity)
+{
+    ptr_t rsdp, dtb;
+    struct enumerate_ctx ctx = {
+        .cpus = cpus,
+        .capacity = capacity,
+        .bsp_mpidr = current_mpidr(),
+    };
+
+    rsdp = services_find_rsdp();
+    if (rsdp && acpi_enumerate(rsdp, &ctx))
+        goto out;
+
+    ctx.count = 0;
+    dtb = services_find_dtb();
+    if (dtb && fdt_enumerate(dtb, &ctx))
+        goto out;
+
+    return 0;
+
+out:
+    return cpus ? MIN(ctx.count, capacity) : ctx.count;
+}
+
+static i64 psci_cpu_on(u64 mpidr, u64 entrypoint, u64 context_id)
+{
+    register u64 x0 asm("x0") = PSCI_CPU_ON_64;
+    register u64 x1 asm("x1") = mpidr;
+    register u64 x2 asm("x2") = entrypoint;
+    register u64 x3 asm("x3") = context_id;
+
+    // SMCCC allows the callee to clobber x4-x17
+    if (psci_use_hvc) {
+        asm volatile("hvc #0"
+                     : "+r"(x0), "+r"(x1), "+r"(x2), "+r"(x3)
+                     :: "x4", "x5", "x6", "x7", "x8", "x9", "x10", "x11",
+                        "x12", "x13", "x14", "x15", "x16", "x17", "memory");
+    } else {
+        asm volatile("smc #0"
+                     : "+r"(x0), "+r"(x1), "+r"(x2), "+r"(x3)
+                     :: "x4", "x5", "x6", "x7", "x8", "x9", "x10", "x11",
+                        "x12", "x13", "x14", "x15", "x16", "x17", "memory");
+    }
+
+    return x0;
+}
+
+static const char *psci_error_to_str(i64 err)
+{
+    switch (err) {
+    case PSCI_NOT_SUPPORTED:
+        return "not supported";
+    case PSCI_INVALID_PARAMETERS:
+        return "invalid parameters";
+    case PSCI_DENIED:
+        return "denied";
+    case PSCI_ALREADY_ON:
+        return "already on";
+    case PSCI_ON_PENDING:
+        return "on pending";
+    case PSCI_INTERNAL_FAILURE:
+        return "internal failure";
+    case PSCI_INVALID_ADDRESS:
+        return "invalid address";
+    default:
+        return "unknown error";
+    }
+}
+
+static ptr_t trampoline_setup(struct handover_info *hi, u64 pointer_offset)
+{
+    struct handover_info_aarch64 hia;
+    struct smp_trampoline_data *data;
+    size_t tramp_size = smp_trampoline_end - smp_trampoline_begin;
+    u64 ctr;
+    ptr_t tramp;
+
+    BUILD_BUG_ON(sizeof(struct smp_cpu) != 64);
+    BUG_ON(tramp_size > PAGE_SIZE);
+
+    tramp = (ptr_t)allocate_critical_pages(1);
+    memcpy(ADDR_TO_PTR(tramp), smp_trampoline_begin, tramp_size);
+    data = ADDR_TO_PTR(tramp + (smp_trampoline_data - smp_trampoline_begin));
+
+    handover_info_aarch64_init(hi, &hia);
+    *data = (struct smp_trampoline_data) {
+        .ttbr0 = hia.ttbr0,
+        .ttbr1 = hia.ttbr1,
+        .mair = hia.mair,
+        .tcr = hia.tcr,
+        .sctlr = AP_SCTLR,
+        .direct_map_base = hi->direct_map_base,
+        .pointer_offset = pointer_offset,
+        .enable_vhe = hia.enable_vhe,
+        .unmap_lower_half = hia.unmap_lower_half,
+    };
+
+    // Started CPUs fetch & read this with the MMU off, see the trampoline
+    asm volatile("mrs %0, ctr_el0" : "=r"(ctr));
+    CACHE_OP_RANGE("dc cvac", tramp, tramp + tramp_size,
+                   ctr_dcache_line_size(ctr));
+    asm volatile("dsb sy" ::: "memory");
+
+    return tramp;
+}
+
+enum smp_start_result smp_arch_start(struct handover_info *hi,
+                                     struct smp_cpu *cpus, size_t count,
+                                     u64 pointer_offset)
+{
+    size_t i, started = 0;
+    ptr_t tramp;
+    i64 ret;
+
+    tramp = trampoline_setup(hi, pointer_offset);
+    print_info("starting CPUs via PSCI CPU_ON (%s), trampoline at 0x%016llX\n",
+               psci_use_hvc ? "HVC" : "SMC", (u64)tramp);
+
+    for (i = 0; i < count; ++i) {
+        if (cpus[i].flags & SMP_CPU_BSP)
+            continue;
+
+        ret = psci_cpu_on(cpus[i].hardware_id, tramp, (ptr_t)&cpus[i]);
+        if (ret != PSCI_SUCCESS) {
+            print_warn("failed to start CPU 0x%llX: %s\n",
+                       cpus[i].hardware_id, psci_error_to_str(ret));
+            continue;
+        }
+
+        started++;
+    }
+
+    return started ? SMP_START_SENT : SMP_START_FAILED;
+}
+
+// PSCI lives below the firmware, CPUs are never deferred
+void smp_arch_start_deferred(struct smp_cpu *cpus, size_t count)
+{
+    UNUSED(cpus);
+    UNUSED(count);
+    BUG();
+}
+
+void smp_arch_deferred_stall(u32 us)
+{
+    UNUSED(us);
+    BUG();
+}
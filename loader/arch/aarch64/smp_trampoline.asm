@@ -0,0 +1,155 @@
+#include "aarch64_smp.h"
+
+/*
+ * Application processor entry point handed to PSCI CPU_ON.
+ *
+ * This is never executed in place, smp_arch_start() copies everything between
+ * smp_trampoline_begin and smp_trampoline_end to a page of its own, so the
+ * code below must stay position independent.
+ *
+ * PSCI starts us at the caller's exception level with the MMU and caches off
+ * and the context ID in x0, which is the physical address of this CPU's
+ * 'struct smp_cpu'. We switch to the kernel's translation tables the same way
+ * kernel_handover_aarch64 does, jump to the direct map copy of this code and
+ * park there until the kernel releases us. Nothing here needs a stack, CPUs
+ * only get one once released.
+ *
+ * The trampoline page is cleaned to the PoC before any CPU is started, so the
+ * data below is safe to read with the MMU off.
+ */
+
+#define HCR_E2H (1 << 34)
+#define HCR_TGE (1 << 27)
+#define SPSEL_ELX 0b1
+
+.text
+
+.global smp_trampoline_begin
+smp_trampoline_begin:
+    adr x1, smp_trampoline_data
+    ldr x2, [x1, smp_trampoline_data_ttbr0]
+    ldr x3, [x1, smp_trampoline_data_ttbr1]
+    ldr x4, [x1, smp_trampoline_data_mair]
+    ldr x5, [x1, smp_trampoline_data_tcr]
+    ldr x6, [x1, smp_trampoline_data_sctlr]
+    ldr x9, [x1, smp_trampoline_data_direct_map_base]
+    ldr x10, [x1, smp_trampoline_data_pointer_offset]
+    ldrb w7, [x1, smp_trampoline_data_enable_vhe]
+    ldrb w8, [x1, smp_trampoline_data_unmap_lower_half]
+
+    // See kernel_handover_aarch64 for why this has to be done with the MMU off
+    cbz w7, .set_translation
+
+    mrs x11, hcr_el2
+    orr x11, x11, #HCR_E2H
+    orr x11, x11, #HCR_TGE
+    msr hcr_el2, x11
+    isb
+
+.set_translation:
+    msr mair_el1, x4
+    msr tcr_el1, x5
+    msr ttbr0_el1, x2
+    msr ttbr1_el1, x3
+
+    dsb ish
+    cbz w7, .flush_el1
+
+    tlbi alle2
+    b .flush_done
+
+.flush_el1:
+    tlbi vmalle1
+
+.flush_done:
+    // Whatever the firmware left in the instruction cache is of no use to us
+    ic iallu
+    dsb ish
+    isb
+
+    /*
+     * Unlike the BSP, whose SCTLR holds whatever the firmware configured, this
+     * CPU's SCTLR is in an unknown state, so write the full value.
+     */
+    msr sctlr_el1, x6
+    isb
+
+    adr x11, .higher_half
+    add x11, x11, x9
+    br x11
+
+.higher_half:
+    // x12 -> descriptor via the direct map, x13 -> as the kernel sees it
+    add x12, x0, x9
+    add x13, x0, x10
+
+    ldr w14, [x12, smp_cpu_flags]
+    orr w14, w14, #SMP_CPU_PARKED
+    str w14, [x12, smp_cpu_flags]
+
+    add x15, x12, smp_cpu_entrypoint
+
+.spin:
+    // Acquire, so that the stack & argument are read after the entrypoint
+    ldar x16, [x15]
+    cbnz x16, .released
+    yield
+    b .spin
+
+.released:
+    cbz w8, .unmap_done
+
+    msr ttbr0_el1, xzr
+    dsb ish
+    tlbi vmalle1
+    dsb ish
+    isb
+
+.unmap_done:
+    ldr x17, [x12, smp_cpu_stack]
+    msr spsel, #SPSEL_ELX
+    mov sp, x17
+
+    mov x30, x16
+    mov x0, x13
+    ldr x1, [x12, smp_cpu_argument]
+
+    mov x2, xzr
+    mov x3, xzr
+    mov x4, xzr
+    mov x5, xzr
+    mov x6, xzr
+    mov x7, xzr
+    mov x8, xzr
+    mov x9, xzr
+    mov x10, xzr
+    mov x11, xzr
+    mov x12, xzr
+    mov x13, xzr
+    mov x14, xzr
+    mov x15, xzr
+    mov x16, xzr
+    mov x17, xzr
+    mov x18, xzr
+    mov x19, xzr
+    mov x20, xzr
+    mov x21, xzr
+    mov x22, xzr
+    mov x23, xzr
+    mov x24, xzr
+    mov x25, xzr
+    mov x26, xzr
+    mov x27, xzr
+    mov x28, xzr
+    mov x29, xzr
+
+    msr nzcv, xzr
+    ret
+
+.balign 8
+.global smp_trampoline_data
+smp_trampoline_data:
+    .skip smp_trampoline_data_size
+
+.global smp_trampoline_end
+smp_trampoline_end:
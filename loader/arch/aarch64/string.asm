@@ -0,0 +1,215 @@
+/*
+ * aarch64 versions of the common/string.h primitives.
+ *
+ * The C side of the loader is built with -mgeneral-regs-only, but UEFI runs
+ * us with FP/SIMD enabled, so these are free to use the 128-bit Q registers.
+ * Only registers that are caller-saved under AAPCS64 are used (x0-x17 &
+ * v0-v7), and the firmware doesn't require unaligned accesses to be avoided.
+ *
+ * Size classes:
+ * - 64+ bytes: LDP/STP of Q register pairs, a cache line per iteration
+ * - 16+ bytes: single Q register loads/stores
+ * - the rest: a power-of-two ladder of 8/4/2/1 byte accesses
+ */
+
+/*
+ * Assembly files are built as C (see the top-level CMakeLists.txt), so they
+ * get -mgeneral-regs-only as well, which makes the assembler reject anything
+ * touching FP/SIMD registers unless it's re-enabled here.
+ */
+.arch_extension fp
+.arch_extension simd
+
+.text
+
+// void *memcpy(void *dest, const void *src, size_t count)
+.global memcpy
+memcpy:
+    mov x3, x0
+    cmp x2, #64
+    b.lo 2f
+
+    /*
+     * Both pairs are loaded before anything is stored, which also makes this
+     * safe for memmove() when dest is below src.
+     */
+1:
+    ldp q0, q1, [x1], #32
+    ldp q2, q3, [x1], #32
+    sub x2, x2, #64
+    stp q0, q1, [x3], #32
+    stp q2, q3, [x3], #32
+    cmp x2, #64
+    b.hs 1b
+
+    // Tail, fewer than 64 bytes left
+2:
+    cmp x2, #16
+    b.lo 3f
+    ldr q0, [x1], #16
+    sub x2, x2, #16
+    str q0, [x3], #16
+    b 2b
+
+3:
+    tbz x2, #3, 4f
+    ldr x4, [x1], #8
+    str x4, [x3], #8
+4:
+    tbz x2, #2, 5f
+    ldr w4, [x1], #4
+    str w4, [x3], #4
+5:
+    tbz x2, #1, 6f
+    ldrh w4, [x1], #2
+    strh w4, [x3], #2
+6:
+    tbz x2, #0, 7f
+    ldrb w4, [x1]
+    strb w4, [x3]
+7:
+    ret
+
+// void *memmove(void *dest, const void *src, size_t count)
+.global memmove
+memmove:
+    /*
+     * A forward copy is safe unless dest lands within [src, src + count).
+     * Note that (dest - src) wraps around to a huge value if dest is below src.
+     */
+    sub x4, x0, x1
+    cmp x4, x2
+    b.hs memcpy
+
+    add x1, x1, x2
+    add x3, x0, x2
+
+1:
+    cmp x2, #16
+    b.lo 2f
+    ldr q0, [x1, #-16]!
+    sub x2, x2, #16
+    str q0, [x3, #-16]!
+    b 1b
+
+2:
+    cbz x2, 3f
+    ldrb w4, [x1, #-1]!
+    sub x2, x2, #1
+    strb w4, [x3, #-1]!
+    b 2b
+
+3:
+    ret
+
+// void *memset(void *dest, int ch, size_t count)
+.global memset
+memset:
+    dup v0.16b, w1
+    mov x3, x0
+    cmp x2, #64
+    b.lo 2f
+
+1:
+    stp q0, q0, [x3], #32
+    stp q0, q0, [x3], #32
+    sub x2, x2, #64
+    cmp x2, #64
+    b.hs 1b
+
+2:
+    cmp x2, #16
+    b.lo 3f
+    str q0, [x3], #16
+    sub x2, x2, #16
+    b 2b
+
+3:
+    umov x4, v0.d[0]
+
+    tbz x2, #3, 4f
+    str x4, [x3], #8
+4:
+    tbz x2, #2, 5f
+    str w4, [x3], #4
+5:
+    tbz x2, #1, 6f
+    strh w4, [x3], #2
+6:
+    tbz x2, #0, 7f
+    strb w4, [x3]
+7:
+    ret
+
+// int memcmp(const void *lhs, const void *rhs, size_t count)
+.global memcmp
+memcmp:
+    /*
+     * Skip whole matching 16 byte chunks, then let the byte loop pinpoint the
+     * first mismatch within the differing chunk.
+     */
+1:
+    cmp x2, #16
+    b.lo 2f
+    ldr q0, [x0]
+    ldr q1, [x1]
+    cmeq v2.16b, v0.16b, v1.16b
+    uminv b2, v2.16b
+    umov w4, v2.b[0]
+    cbz w4, 2f
+    add x0, x0, #16
+    add x1, x1, #16
+    sub x2, x2, #16
+    b 1b
+
+2:
+    cbz x2, 4f
+3:
+    ldrb w4, [x0], #1
+    ldrb w5, [x1], #1
+    subs w4, w4, w5
+    b.ne 5f
+    subs x2, x2, #1
+    b.ne 3b
+
+4:
+    mov w0, #0
+    ret
+
+5:
+    mov w0, w4
+    ret
+
+// size_t strlen(const char *str)
+.global strlen
+strlen:
+    mov x1, x0
+
+    // Handle the unaligned head so the vector scan below can't straddle a page
+1:
+    tst x1, #15
+    b.eq 2f
+    ldrb w2, [x1]
+    cbz w2, 4f
+    add x1, x1, #1
+    b 1b
+
+    // Scan 16 bytes at a time until one of them is zero
+2:
+    ldr q0, [x1]
+    cmeq v0.16b, v0.16b, #0
+    umaxv b0, v0.16b
+    umov w2, v0.b[0]
+    cbnz w2, 3f
+    add x1, x1, #16
+    b 2b
+
+3:
+    ldrb w2, [x1]
+    cbz w2, 4f
+    add x1, x1, #1
+    b 3b
+
+4:
+    sub x0, x1, x0
+    ret
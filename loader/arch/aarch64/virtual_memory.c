@@ -1,6 +1,5 @@
 #include "common/bug.h"
 #include "common/string.h"
-#include "common/rw_helpers.h"
 
 #include "virtual_memory.h"
 #include "virtual_memory_impl.h"
@@ -19,7 +18,12 @@ static u8 unified_pt_depth(enum pt_type type)
 void page_table_init(struct page_table *pt, enum pt_type type,
                      u64 max_table_address)
 {
-    ptr_t root_page = pt_get_table_page(max_table_address);
+    ptr_t root_page;
+
+    pt->max_table_address = max_table_address;
+    memzero(&pt->pool, sizeof(pt->pool));
+
+    root_page = pt_get_table_page(pt);
     OOPS_ON(!root_page);
 
     /*
@@ -32,15 +36,17 @@ void page_table_init(struct page_table *pt, enum pt_type type,
     pt->root = ADDR_TO_PTR(root_page);
     pt->levels = unified_pt_depth(type);
     pt->base_shift = PAGE_SHIFT;
-    pt->max_table_address = max_table_address;
 
     // We currently don't support 52-bit OA, so this is the mask
     pt->entry_address_mask = ~(BIT_MASK(48, 64) | BIT_MASK(0, PAGE_SHIFT));
 
     pt->entry_width = 8;
     pt->table_width_shift = 9;
-    pt->write_slot = write_u64;
-    pt->read_slot = read_u64;
+
+    // Level 1 block descriptors are always supported with the 4K granule
+    pt->gigantic_pages = true;
+
+    pt_init_levels(pt);
 }
 
 #define LOOKUP_LEVEL_MINUS_1 4
@@ -41,6 +41,12 @@ REAL_MODE_DATA_SELECTOR: equ 0x20
 PROTECTED_MODE_BIT: equ 1
 
 SIZEOF_REGISTER_STATE: equ 40
+REGISTER_STATE_FLAGS_OFFSET: equ 36
+CARRY_FLAG_BIT: equ 1
+
+; struct bios_call_request, register state followed by the interrupt number
+SIZEOF_BIOS_CALL_REQUEST: equ SIZEOF_REGISTER_STATE + 4
+BIOS_CALL_STOP_ON_CARRY: equ 1
 
 section .real_code
 
@@ -192,6 +198,162 @@ BITS 32
 
     ret
 
+;  Same as bios_call, except multiple calls are made in one real-mode stay,
+;  so the GDT and segment reloads are paid once per batch rather than per call.
+; NOTE: this function assumes all pointers are located within
+;       the first 64K of memory.
+; -----------------------------------------------------------------------------
+; size_t bios_call_batch(struct bios_call_request *requests, size_t count,
+;                        u32 flags)
+; esp + 12 [flags]
+; esp + 8  [count]
+; esp + 4  [requests]
+; esp + 0  [ret]
+global bios_call_batch
+bios_call_batch:
+BITS 32
+    mov eax, [esp + 4]
+    mov [batch_ptr], eax
+
+    mov eax, [esp + 8]
+    mov [batch_remaining], eax
+
+    mov eax, [esp + 12]
+    mov [batch_flags], eax
+
+    mov dword [batch_done], 0
+
+    ; save non-scratch
+    push ebx
+    push esi
+    push edi
+    push ebp
+    mov [batch_esp], esp
+
+    jmp REAL_MODE_CODE_SELECTOR:.real_mode_transition
+
+.real_mode_transition:
+BITS 16
+
+    mov ax, REAL_MODE_DATA_SELECTOR
+    mov ss, ax
+    mov ds, ax
+    mov es, ax
+    mov fs, ax
+    mov gs, ax
+
+    mov eax, cr0
+    and eax, ~PROTECTED_MODE_BIT
+    mov cr0, eax
+
+    jmp 0x0:.real_mode_code
+
+.real_mode_code:
+    xor ax, ax
+    mov ss, ax
+
+    ; ds is whatever the previous call left it as, so only rely on ss below
+.next_call:
+    cmp dword [ss:batch_remaining], 0
+    je .out
+
+    mov si, [ss:batch_ptr]
+    mov al, [ss:si + SIZEOF_REGISTER_STATE]
+    mov [ss:.call_number], al
+
+    ; computed ahead of time, the flags must survive until they're pushed
+    lea ax, [si + SIZEOF_REGISTER_STATE]
+    mov [ss:batch_out_ptr], ax
+
+    ; flush the prefetch queue after patching the call number
+    jmp .load_state
+
+.load_state:
+    ; pop requested register state pre-call
+    mov sp, si
+    pop eax
+    pop ebx
+    pop ecx
+    pop edx
+    pop esi
+    pop edi
+    pop ebp
+    pop gs
+    pop fs
+    pop es
+    pop ds
+    popfd
+
+    mov sp, [ss:batch_esp]
+
+    sti
+
+    db 0xCD ; int followed by number
+.call_number:
+    db 0
+
+    cli
+
+    ; push final state post-call over the request
+    mov sp, [ss:batch_out_ptr]
+    pushfd
+    push ds
+    push es
+    push fs
+    push gs
+    push ebp
+    push edi
+    push esi
+    push edx
+    push ecx
+    push ebx
+    push eax
+
+    inc dword [ss:batch_done]
+    dec dword [ss:batch_remaining]
+
+    test byte [ss:batch_flags], BIOS_CALL_STOP_ON_CARRY
+    jz .advance
+
+    mov si, [ss:batch_ptr]
+    test byte [ss:si + REGISTER_STATE_FLAGS_OFFSET], CARRY_FLAG_BIT
+    jnz .out
+
+.advance:
+    add word [ss:batch_ptr], SIZEOF_BIOS_CALL_REQUEST
+    jmp .next_call
+
+.out:
+    ; switch back to protected mode
+    lgdt [ss:gdt_ptr]
+
+    mov eax, cr0
+    or  eax, PROTECTED_MODE_BIT
+    mov cr0, eax
+
+    jmp PROTECTED_MODE_CODE_SELECTOR:.protected_mode_code
+
+.protected_mode_code:
+BITS 32
+
+    ; restore data segments
+    mov ax, PROTECTED_MODE_DATA_SELECTOR
+    mov ds, ax
+    mov es, ax
+    mov fs, ax
+    mov gs, ax
+    mov ss, ax
+
+    ; restore non-scratch
+    mov esp, [batch_esp]
+    pop ebp
+    pop edi
+    pop esi
+    pop ebx
+
+    mov eax, [batch_done]
+    ret
+
 section .real_code
 
 ; The PXE API is reached through a real-mode far call (not an interrupt), with
@@ -295,6 +457,13 @@ in_regs_ptr:  dd 0
 out_regs_ptr: dd 0
 initial_esp:  dd 0
 
+batch_ptr:       dd 0
+batch_remaining: dd 0
+batch_flags:     dd 0
+batch_done:      dd 0
+batch_esp:       dd 0
+batch_out_ptr:   dw 0
+
 global g_bios_pxe_entry
 g_bios_pxe_entry:  dd 0
 pxe_saved_esp:     dd 0
@@ -41,6 +41,26 @@ void bios_jmp_to_reset_vector(void);
 
 void bios_call(u32 number, const struct real_mode_regs *in, struct real_mode_regs *out);
 
+struct bios_call_request {
+    // Register state to make the call with, replaced with the post-call state
+    struct real_mode_regs regs;
+    u32 number;
+};
+BUILD_BUG_ON(sizeof(struct bios_call_request) != 44);
+
+// Stop the batch after the first call that returns with CF set
+#define BIOS_CALL_STOP_ON_CARRY (1 << 0)
+
+/*
+ * Makes 'count' calls in order, all within one real mode transition, which
+ * is considerably cheaper than as many separate bios_call() invocations.
+ * Requests must be located within the first 64K of memory.
+ * Returns the number of calls made, which is less than 'count' if the batch
+ * was stopped early because of 'flags'.
+ */
+size_t bios_call_batch(struct bios_call_request *requests, size_t count,
+                       u32 flags);
+
 /*
  * Real-mode far pointer to the PXE API entry point (offset in the low word,
  * segment in the high word). Must be initialized before calling
@@ -2,6 +2,7 @@
 
 #include "common/format.h"
 #include "common/log.h"
+#include "common/minmax.h"
 #include "common/string.h"
 #include "common/string_view.h"
 #include "arch/constants.h"
@@ -139,11 +140,94 @@ static bool edpt_is_removable_disk(struct enhanced_disk_drive_parameter_table *e
 
 #define DRIVE_PARAMS_V2 0x1E
 
-static void fetch_all_disks(void)
+static bool edd_config_present(const struct drive_parameters *dp)
+{
+    if (dp->buffer_size < DRIVE_PARAMS_V2)
+        return false;
+    if (dp->edd_config_offset == 0x0000 && dp->edd_config_segment == 0x0000)
+        return false;
+
+    return dp->edd_config_offset != 0xFFFF || dp->edd_config_segment != 0xFFFF;
+}
+
+static void set_up_drive_params_call(struct bios_call_request *req, u8 drive_index,
+                                     struct drive_parameters *drive_params)
 {
     // https://oldlinux.superglobalmegacorp.com/Linux.old/docs/interrupts/int-html/rb-0715.htm
-    struct real_mode_regs regs;
-    struct drive_parameters drive_params;
+    memzero(req, sizeof(*req));
+    memzero(drive_params, sizeof(*drive_params));
+
+    req->number = 0x13;
+    req->regs.eax = 0x4800;
+    req->regs.edx = drive_index;
+    req->regs.esi = (u32)drive_params;
+    drive_params->buffer_size = sizeof(*drive_params);
+    drive_params->flags = 0;
+}
+
+/*
+ * Probing every possible drive number one real mode transition at a time is
+ * slow, so they're queried in batches. Stack allocated to stay within the
+ * first 64K, as required by bios_call_batch().
+ */
+#define DRIVE_PROBE_BATCH_SIZE 16
+
+struct drive_probe_batch {
+    struct bios_call_request requests[DRIVE_PROBE_BATCH_SIZE];
+    struct drive_parameters params[DRIVE_PROBE_BATCH_SIZE];
+    u8 first_drive;
+    u8 count;
+};
+
+static bool drive_params_call_ok(const struct real_mode_regs *regs)
+{
+    return !is_carry_set(regs) && (regs->eax & 0xFF00) == 0x0000;
+}
+
+/*
+ * The EDD configuration pointer may refer to a single BIOS buffer that is
+ * refreshed on every call, in which case it only describes the last drive
+ * that was queried. Re-query the drive on its own if a later drive in the
+ * same batch might've clobbered it. Returns false if the pointer can't be
+ * trusted, in which case only the EDD check should be skipped: the rest of
+ * the batch result for this drive is still valid and is left untouched.
+ */
+static bool refresh_edd_config(struct drive_probe_batch *batch, u8 idx)
+{
+    struct drive_parameters *dp = &batch->params[idx];
+    struct drive_parameters fresh;
+    struct bios_call_request req;
+    u8 i;
+
+    for (i = idx + 1; i < batch->count; ++i) {
+        const struct drive_parameters *later = &batch->params[i];
+
+        if (!drive_params_call_ok(&batch->requests[i].regs))
+            continue;
+        if (later->edd_config_offset == dp->edd_config_offset &&
+            later->edd_config_segment == dp->edd_config_segment)
+            break;
+    }
+    if (i == batch->count)
+        return true;
+
+    set_up_drive_params_call(&req, batch->first_drive + idx, &fresh);
+    bios_call(req.number, &req.regs, &req.regs);
+
+    if (!drive_params_call_ok(&req.regs) || !edd_config_present(&fresh)) {
+        print_warn("failed to re-query EDD for drive 0x%X, ignoring it\n",
+                   batch->first_drive + idx);
+        return false;
+    }
+
+    dp->edd_config_offset = fresh.edd_config_offset;
+    dp->edd_config_segment = fresh.edd_config_segment;
+    return true;
+}
+
+static void fetch_all_disks(void)
+{
+    struct drive_probe_batch batch;
     u16 drive_index;
     u8 detected_non_removable_disks = 0;
     u8 number_of_bios_detected_disks;
@@ -152,53 +236,56 @@ static void fetch_all_disks(void)
     print_info("BIOS-detected disks: %d\n", number_of_bios_detected_disks);
 
     for (drive_index = FIRST_DRIVE_INDEX; drive_index <= LAST_DRIVE_INDEX; ++drive_index) {
+        struct drive_parameters *drive_params;
         bool is_removable = false, checked_edd = false;
-        memzero(&regs, sizeof(regs));
-        memzero(&drive_params, sizeof(drive_params));
+        u8 idx;
 
-        regs.eax = 0x4800;
-        regs.edx = drive_index;
-        regs.esi = (u32)&drive_params;
-        drive_params.buffer_size = sizeof(drive_params);
-        drive_params.flags = 0;
+        if (((drive_index - FIRST_DRIVE_INDEX) % DRIVE_PROBE_BATCH_SIZE) == 0) {
+            batch.first_drive = drive_index;
+            batch.count = MIN(DRIVE_PROBE_BATCH_SIZE,
+                              LAST_DRIVE_INDEX - drive_index + 1);
 
-        bios_call(0x13, &regs, &regs);
+            for (idx = 0; idx < batch.count; ++idx) {
+                set_up_drive_params_call(&batch.requests[idx], drive_index + idx,
+                                         &batch.params[idx]);
+            }
 
-        if (is_carry_set(&regs))
-            continue;
+            bios_call_batch(batch.requests, batch.count, 0);
+        }
+
+        idx = drive_index - batch.first_drive;
+        drive_params = &batch.params[idx];
 
-        if ((regs.eax & 0xFF00) != 0x0000)
+        if (!drive_params_call_ok(&batch.requests[idx].regs))
             continue;
 
-        if (drive_params.total_sector_count == 0 || drive_params.bytes_per_sector == 0)
+        if (drive_params->total_sector_count == 0 || drive_params->bytes_per_sector == 0)
             continue;
 
-        if (unlikely(__builtin_popcount(drive_params.bytes_per_sector) != 1)) {
+        if (unlikely(__builtin_popcount(drive_params->bytes_per_sector) != 1)) {
             print_warn("skipping a non-power-of-two block size (%u) disk %X\n",
-                       drive_params.bytes_per_sector, drive_index);
+                       drive_params->bytes_per_sector, drive_index);
             continue;
         }
 
-        if (unlikely(drive_params.bytes_per_sector > PAGE_SIZE)) {
+        if (unlikely(drive_params->bytes_per_sector > PAGE_SIZE)) {
             print_warn("disk %X block size is too large (%u), skipped\n",
-                       drive_index, drive_params.bytes_per_sector);
+                       drive_index, drive_params->bytes_per_sector);
             continue;
         }
 
-        is_removable = drive_params.flags & REMOVABLE_DRIVE;
+        is_removable = drive_params->flags & REMOVABLE_DRIVE;
 
         // VMWare doesn't report removable device in the main drive parameters, check EDD instead
-        if (drive_params.buffer_size >= DRIVE_PARAMS_V2 &&
-           (drive_params.edd_config_offset != 0x0000 || drive_params.edd_config_segment != 0x0000) &&
-           (drive_params.edd_config_offset != 0xFFFF || drive_params.edd_config_segment != 0xFFFF)) {
-            void *edpt = from_real_mode_addr(drive_params.edd_config_segment,
-                                             drive_params.edd_config_offset);
+        if (edd_config_present(drive_params) && refresh_edd_config(&batch, idx)) {
+            void *edpt = from_real_mode_addr(drive_params->edd_config_segment,
+                                             drive_params->edd_config_offset);
             is_removable |= edpt_is_removable_disk(edpt);
             checked_edd = true;
         }
 
-        pretty_print_drive_info(drive_index, drive_params.total_sector_count,
-                                drive_params.bytes_per_sector, is_removable);
+        pretty_print_drive_info(drive_index, drive_params->total_sector_count,
+                                drive_params->bytes_per_sector, is_removable);
 
         /*
          * Removable disks are not reported in BDA_DISK_COUNT_ADDRESS,
@@ -216,7 +303,7 @@ static void fetch_all_disks(void)
              * via this discovery mechanism, and it has the index 0x9F.
              */
             if (unlikely(should_skip && !checked_edd && drive_index == 0x9F &&
-                         drive_params.bytes_per_sector == 2048)) {
+                         drive_params->bytes_per_sector == 2048)) {
                 should_skip = false;
                 print_warn("allowing unaccounted non-removable drive 0x9F\n");
             }
@@ -230,9 +317,9 @@ static void fetch_all_disks(void)
         }
 
         disks_buffer[drive_index - FIRST_DRIVE_INDEX] = (struct bios_disk) {
-            .sectors = drive_params.total_sector_count,
+            .sectors = drive_params->total_sector_count,
             .drive = drive_index,
-            .block_shift = __builtin_ctz(drive_params.bytes_per_sector),
+            .block_shift = __builtin_ctz(drive_params->bytes_per_sector),
             .status = is_removable ? DISK_STS_REMOVABLE : 0
         };
         disk_count++;
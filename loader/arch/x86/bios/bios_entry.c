@@ -2,6 +2,7 @@
 #include "common/panic.h"
 #include "common/string.h"
 #include "services.h"
+#include "services_impl.h"
 
 #include "bios_memory_services.h"
 #include "bios_video_services.h"
@@ -51,6 +52,32 @@ void loader_abort(void)
     bios_jmp_to_reset_vector();
 }
 
+void services_stall(u32 microseconds)
+{
+    /*
+     * INT 0x15, AH = 0x86
+     * https://oldlinux.superglobalmegacorp.com/Linux.old/docs/interrupts/int-html/rb-1525.htm
+     */
+    struct real_mode_regs regs = {
+        .eax = 0x8600,
+        .ecx = microseconds >> 16,
+        .edx = microseconds & 0xFFFF,
+    };
+
+    SERVICE_FUNCTION();
+
+    bios_call(0x15, &regs, &regs);
+}
+
+bool services_run_on_all_cpus(void (*proc)(void *arg, bool on_ap), void *arg)
+{
+    UNUSED(proc);
+    UNUSED(arg);
+
+    // No firmware interface for this, all CPUs but the BSP are in wait-for-SIPI
+    return false;
+}
+
 void bios_entry(void)
 {
     memzero(section_bss_begin, section_bss_end - section_bss_begin);
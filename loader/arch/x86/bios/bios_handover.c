@@ -2,6 +2,7 @@
 #include "handover.h"
 #include "bios_call.h"
 #include "services_impl.h"
+#include "bulk_memory.h"
 
 void handover_prepare_for(struct handover_info *hi)
 {
@@ -32,6 +33,7 @@ void kernel_handover_x86(struct x86_handover_info *info);
 NORETURN
 void kernel_handover(struct handover_info *hi)
 {
+    bulk_memory_restore_cpu_state();
     cr4_prepare(hi);
 
     if (hi->flags & HO_X86_LME) {
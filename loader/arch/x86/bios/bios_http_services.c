@@ -0,0 +1,34 @@
+#include "common/bug.h"
+#include "common/helpers.h"
+#include "http_services.h"
+
+// PXE only gives us UDP, there's no TCP stack to run HTTP on top of
+bool http_services_setup(struct string_view root)
+{
+    UNUSED(root);
+    return false;
+}
+
+bool http_get_file_size(struct string_view path, u64 *out_size)
+{
+    UNUSED(path);
+    UNUSED(out_size);
+    BUG();
+}
+
+bool http_read_file_range(struct string_view path, void *out_buf, u64 offset,
+                          u64 bytes, u64 file_size)
+{
+    UNUSED(path);
+    UNUSED(out_buf);
+    UNUSED(offset);
+    UNUSED(bytes);
+    UNUSED(file_size);
+    BUG();
+}
+
+void http_server_ip_address(struct ip_addr *out)
+{
+    UNUSED(out);
+    BUG();
+}
@@ -5,6 +5,7 @@
 #include "common/log.h"
 #include "common/string.h"
 #include "bios_memory_services.h"
+#include "free_range_index.h"
 #include "memory_services.h"
 #include "services_impl.h"
 #include "bios_call.h"
@@ -128,6 +129,11 @@ static void allocate_out_of(size_t mme_idx, struct memory_map_entry *new_mme)
     BUG_ON(me->physical_address > new_mme->physical_address || me_end < new_end);
     BUG_ON(me->type == new_mme->type);
 
+    if (me->type == MEMORY_TYPE_FREE)
+        free_range_index_remove(new_mme->physical_address, new_end);
+    else if (new_mme->type == MEMORY_TYPE_FREE)
+        free_range_index_insert(new_mme->physical_address, new_end);
+
     if (before_valid) {
         struct memory_map_entry *me_after = NULL;
 
@@ -172,118 +178,54 @@ static void allocate_out_of(size_t mme_idx, struct memory_map_entry *new_mme)
     }
 }
 
-static u64 allocate_top_down(size_t page_count, u64 upper_limit, u32 type)
+static void allocate_range(u64 address, u64 bytes, u32 type)
 {
-    u64 range_end, bytes_to_allocate = page_count * PAGE_SIZE;
-    u64 allocated_end = 0;
-    struct memory_map_entry allocated_mme;
-    size_t i = entry_count;
-
-    if (bytes_to_allocate <= page_count)
-        oops("invalid allocation size of %zu pages\n", page_count);
-
-    while (i-- > 0) {
-        struct memory_map_entry *me = &entries_buffer[i];
-
-        if (me->physical_address >= upper_limit)
-            continue;
-
-        if (me->type != MEMORY_TYPE_FREE)
-            continue;
-
-        range_end = MIN(mme_end(me), upper_limit);
-
-        // Not enough length after cutoff
-        if ((range_end - me->physical_address) < bytes_to_allocate)
-            continue;
-
-        allocated_end = range_end;
-        break;
-    }
-
-    if (!allocated_end)
-        return 0;
-
-    allocated_mme = (struct memory_map_entry) {
-        .physical_address = allocated_end - bytes_to_allocate,
-        .size_in_bytes = bytes_to_allocate,
+    ssize_t mme_idx;
+    struct memory_map_entry allocated_mme = {
+        .physical_address = address,
+        .size_in_bytes = bytes,
         .type = type
     };
-    allocate_out_of(i, &allocated_mme);
 
-    return allocated_mme.physical_address;
+    mme_idx = mm_find_first_that_contains(entries_buffer, entry_count,
+                                          address, false);
+    BUG_ON(mme_idx < 0);
+
+    allocate_out_of(mme_idx, &allocated_mme);
 }
 
-static u64 allocate_within(size_t page_count, u64 lower_limit, u64 upper_limit, u32 type)
+static u64 allocate_top_down(size_t page_count, u64 upper_limit, u32 type)
 {
-    u64 range_begin, bytes_to_allocate = page_count * PAGE_SIZE;
-    ssize_t mme_idx;
-    struct memory_map_entry *picked_mme = NULL;
-    struct memory_map_entry allocated_mme;
+    u64 address, bytes_to_allocate = page_count * PAGE_SIZE;
 
     if (bytes_to_allocate <= page_count)
         oops("invalid allocation size of %zu pages\n", page_count);
 
-    // invalid input
-    if (lower_limit >= upper_limit)
-        goto out_invalid_allocation;
-
-    // search gap is too small
-    if (lower_limit + bytes_to_allocate > upper_limit)
-        goto out_invalid_allocation;
-
-    // overflow
-    if (lower_limit + bytes_to_allocate < lower_limit)
-        goto out_invalid_allocation;
-
-    mme_idx = mm_find_first_that_contains(entries_buffer, entry_count, lower_limit, true);
-    if (mme_idx < 0)
+    if (!free_range_index_find_top_down(bytes_to_allocate, upper_limit,
+                                        &address))
         return 0;
 
-    for (; mme_idx < (ssize_t)entry_count; ++mme_idx) {
-        picked_mme = &entries_buffer[mme_idx];
-        u64 end = mme_end(picked_mme);
-        bool is_bad_range;
-
-        if (picked_mme->physical_address > upper_limit)
-            return 0;
-
-        if (picked_mme->type == MEMORY_TYPE_FREE) {
-            u64 available_gap = MIN(end, upper_limit) - MAX(picked_mme->physical_address, lower_limit);
-            is_bad_range = available_gap < bytes_to_allocate;
-        } else {
-            is_bad_range = true;
-        }
-
-        if (is_bad_range) {
-            if (end >= upper_limit)
-                return 0;
+    allocate_range(address, bytes_to_allocate, type);
+    return address;
+}
 
-            if ((upper_limit - end) < bytes_to_allocate)
-                return 0;
+static u64 allocate_at(u64 address, size_t page_count, u32 type)
+{
+    u64 bytes_to_allocate = page_count * PAGE_SIZE;
 
-            continue;
-        }
+    if (bytes_to_allocate <= page_count)
+        oops("invalid allocation size of %zu pages\n", page_count);
 
-        break;
+    if (address + bytes_to_allocate < address) {
+        oops("invalid allocation of %zu pages at 0x%016llX\n",
+             page_count, address);
     }
 
-    if (mme_idx == (ssize_t)entry_count)
+    if (!free_range_index_contains(address, address + bytes_to_allocate))
         return 0;
 
-    range_begin = MAX(lower_limit, picked_mme->physical_address);
-    allocated_mme = (struct memory_map_entry) {
-        .physical_address = range_begin,
-        .size_in_bytes = bytes_to_allocate,
-        .type = type
-    };
-    allocate_out_of(mme_idx, &allocated_mme);
-
-    return allocated_mme.physical_address;
-
-out_invalid_allocation:
-    oops("invalid allocate_within() call %zu pages within:\n0x%016llX -> 0x%016llX\n",
-         page_count, lower_limit, upper_limit);
+    allocate_range(address, bytes_to_allocate, type);
+    return address;
 }
 
 u64 ms_allocate_pages(size_t count, u64 upper_limit, u32 type)
@@ -299,7 +241,7 @@ u64 ms_allocate_pages_at(u64 address, size_t count, u32 type)
     SERVICE_FUNCTION();
     OOPS_ON(type <= MEMORY_TYPE_MAX);
 
-    return allocate_within(count, address, address + (PAGE_SIZE * count), type);
+    return allocate_at(address, count, type);
 }
 
 void ms_free_pages(u64 address, size_t count)
@@ -340,7 +282,7 @@ size_t services_release_resources(void *buf, size_t capacity, size_t elem_size,
     SERVICE_FUNCTION();
     size_t i;
 
-    entry_count = mm_fixup(buf, entry_count, 0, FIXUP_IF_DIRTY);
+    entry_count = mm_fixup(entries_buffer, entry_count, 0, FIXUP_IF_DIRTY);
     if (capacity < entry_count)
         return entry_count;
 
@@ -350,7 +292,8 @@ size_t services_release_resources(void *buf, size_t capacity, size_t elem_size,
      * transform it into MEMORY_TYPE_FREE safely as services are now
      * disabled.
      */
-    entry_count = mm_fixup(buf, entry_count, 0, FIXUP_NO_PRESERVE_LOADER_RECLAIM);
+    entry_count = mm_fixup(entries_buffer, entry_count, 0,
+                           FIXUP_NO_PRESERVE_LOADER_RECLAIM);
 
     BUG_ON(!entry_convert && (elem_size != sizeof(struct memory_map_entry)));
 
@@ -376,11 +319,19 @@ size_t services_release_resources(void *buf, size_t capacity, size_t elem_size,
 static void initialize_memory_map(void)
 {
     u64 res;
+    size_t i;
 
     load_e820();
     entry_count = mm_fixup(entries_buffer, entry_count, BUFFER_CAPACITY,
                            FIXUP_UNSORTED | FIXUP_OVERLAP_RESOLVE);
 
+    for (i = 0; i < entry_count; ++i) {
+        struct memory_map_entry *me = &entries_buffer[i];
+
+        if (me->type == MEMORY_TYPE_FREE)
+            free_range_index_insert(me->physical_address, mme_end(me));
+    }
+
     // Try to allocate ourselves
     res = ms_allocate_pages_at(STAGE2_BASE_PAGE, (STAGE2_END_PAGE - STAGE2_BASE_PAGE) / PAGE_SIZE,
                                MEMORY_TYPE_LOADER_RECLAIMABLE);
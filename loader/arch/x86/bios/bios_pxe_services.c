@@ -1,14 +1,17 @@
 #define MSG_FMT(msg) "BIOS-PXE: " msg
 
 #include "common/attributes.h"
+#include "common/conversions.h"
+#include "common/format.h"
 #include "common/helpers.h"
 #include "common/log.h"
+#include "common/minmax.h"
 #include "common/string.h"
 #include "common/string_view.h"
 #include "bios_call.h"
 #include "ip.h"
 #include "pxe_services.h"
-#include "scratch_buffer.h"
+#include "services.h"
 #include "services_impl.h"
 
 // INT 1Ah PXE installation check
@@ -16,10 +19,11 @@
 #define PXE_INSTALL_CHECK_OK 0x564E
 
 // PXE API opcodes (PXE spec 2.1)
-#define PXENV_TFTP_OPEN       0x0020
-#define PXENV_TFTP_CLOSE      0x0021
-#define PXENV_TFTP_READ       0x0022
 #define PXENV_TFTP_GET_FSIZE  0x0025
+#define PXENV_UDP_OPEN        0x0030
+#define PXENV_UDP_CLOSE       0x0031
+#define PXENV_UDP_READ        0x0032
+#define PXENV_UDP_WRITE       0x0033
 #define PXENV_GET_CACHED_INFO 0x0071
 
 #define PXENV_EXIT_SUCCESS   0x0000
@@ -30,15 +34,41 @@
 
 #define TFTP_PORT 69
 
+// Local ports are picked from here on, a new one for every transfer
+#define TFTP_LOCAL_PORT_BASE 0xC000
+
+// TFTP opcodes (RFC 1350, RFC 2347)
+#define TFTP_OP_RRQ   1
+#define TFTP_OP_DATA  3
+#define TFTP_OP_ACK   4
+#define TFTP_OP_ERROR 5
+#define TFTP_OP_OACK  6
+
+#define TFTP_HEADER_SIZE 4
+#define TFTP_DEFAULT_BLOCK_SIZE 512
+
+/*
+ * The largest block we are willing to negotiate (RFC 2348): whatever fits a
+ * single Ethernet frame after the IPv4, UDP and TFTP headers. PXE has no way
+ * to query the actual MTU, and the server may hand back a smaller size.
+ */
+#define TFTP_MAX_BLOCK_SIZE (1500 - 20 - 8 - TFTP_HEADER_SIZE)
+
+// Blocks the server may send before waiting for an ACK (RFC 7440)
+#define TFTP_MAX_WINDOW_SIZE 16
+
 /*
- * The largest TFTP packet we are willing to negotiate. Anything bigger doesn't
- * fit a single Ethernet frame, and the server may hand back a smaller size.
+ * Receive timeout: the NIC is polled back to back for a while, which covers
+ * the common case of a packet already being on its way, then once every
+ * TFTP_POLL_INTERVAL_US for about a second.
  */
-#define TFTP_MAX_PACKET_SIZE 1456
-BUILD_BUG_ON(TFTP_MAX_PACKET_SIZE < 512);
-BUILD_BUG_ON(TFTP_MAX_PACKET_SIZE > SCRATCH_BUFFER_SIZE);
+#define TFTP_SPIN_POLLS 256
+#define TFTP_POLL_INTERVAL_US 1000
+#define TFTP_TIMEOUT_POLLS 1000
+#define TFTP_RETRIES 5
 
 #define TFTP_FILENAME_SIZE 128
+#define TFTP_TX_PACKET_SIZE 256
 
 struct PACKED pxenv_plus {
     char signature[6];
@@ -112,44 +142,104 @@ struct PACKED pxenv_get_cached_info {
 };
 BUILD_BUG_ON(sizeof(struct pxenv_get_cached_info) != 0x0C);
 
-struct PACKED pxenv_tftp_open {
+struct PACKED pxenv_tftp_get_fsize {
     u16 status;
     ipv4_addr server_ip;
     ipv4_addr gateway_ip;
     char filename[TFTP_FILENAME_SIZE];
-    u16 tftp_port;
-    u16 packet_size;
+    u32 file_size;
+};
+BUILD_BUG_ON(sizeof(struct pxenv_tftp_get_fsize) != 0x8E);
+
+struct PACKED pxenv_udp_open {
+    u16 status;
+    ipv4_addr src_ip;
 };
-BUILD_BUG_ON(sizeof(struct pxenv_tftp_open) != 0x8E);
+BUILD_BUG_ON(sizeof(struct pxenv_udp_open) != 0x06);
 
-struct PACKED pxenv_tftp_close {
+struct PACKED pxenv_udp_close {
     u16 status;
 };
-BUILD_BUG_ON(sizeof(struct pxenv_tftp_close) != 0x02);
+BUILD_BUG_ON(sizeof(struct pxenv_udp_close) != 0x02);
 
-struct PACKED pxenv_tftp_read {
+struct PACKED pxenv_udp_write {
     u16 status;
-    u16 packet_number;
+    ipv4_addr ip;
+    ipv4_addr gateway_ip;
+    u16 src_port;
+    u16 dst_port;
     u16 buffer_size;
     u16 buffer_offset;
     u16 buffer_segment;
 };
-BUILD_BUG_ON(sizeof(struct pxenv_tftp_read) != 0x0A);
+BUILD_BUG_ON(sizeof(struct pxenv_udp_write) != 0x14);
 
-struct PACKED pxenv_tftp_get_fsize {
+struct PACKED pxenv_udp_read {
     u16 status;
-    ipv4_addr server_ip;
-    ipv4_addr gateway_ip;
-    char filename[TFTP_FILENAME_SIZE];
-    u32 file_size;
+    ipv4_addr src_ip;
+    ipv4_addr dest_ip;
+    u16 src_port;
+    u16 dst_port;
+    u16 buffer_size;
+    u16 buffer_offset;
+    u16 buffer_segment;
 };
-BUILD_BUG_ON(sizeof(struct pxenv_tftp_get_fsize) != 0x8E);
+BUILD_BUG_ON(sizeof(struct pxenv_udp_read) != 0x14);
 
 static ipv4_addr s_server_ip;
 static ipv4_addr s_gateway_ip;
 
 static struct bootp_packet cached_packet;
 
+/*
+ * The transfer reads are currently served from, see pxe_read_file_range().
+ * TFTP is spoken directly over the PXE UDP API, which unlike the PXE TFTP API
+ * lets us negotiate the transfer size, a large block size and a window. The
+ * size comes back with the very first reply, so opening a file and reading it
+ * is a single transaction.
+ */
+struct tftp_stream {
+    bool open;
+    bool eof;
+
+    // Set if the server told us the file size
+    bool size_known;
+
+    // OACK received but not acknowledged yet, the data starts flowing after
+    bool oack_pending;
+
+    // Already asked the server to resend from 'last_block' after a hiccup
+    bool resync_sent;
+
+    u16 block_size;
+    u16 window_size;
+    u16 blocks_since_ack;
+    u16 last_block;
+    u64 file_size;
+
+    // Both in network byte order, 'server_port' is 0 until the server replies
+    u16 local_port;
+    u16 server_port;
+
+    char filename[TFTP_FILENAME_SIZE];
+    size_t filename_len;
+
+    // File offset of 'pending', which points into 'rx_packet'
+    u64 pos;
+    u8 *pending;
+    u16 pending_bytes;
+};
+static struct tftp_stream s_stream;
+static u16 s_next_local_port = TFTP_LOCAL_PORT_BASE;
+
+/*
+ * Staging areas for the packets going in and out. The whole loader image is
+ * real-mode addressable, and unlike the shared scratch buffer nobody else can
+ * evict the leftovers of a block between two reads.
+ */
+static u8 rx_packet[TFTP_HEADER_SIZE + TFTP_MAX_BLOCK_SIZE];
+static u8 tx_packet[TFTP_TX_PACKET_SIZE];
+
 // The DHCP option area is preceded by a 4-byte magic cookie
 #define DHCP_MAGIC_COOKIE_SIZE 4
 
@@ -350,6 +440,398 @@ static bool copy_filename(char *dst, struct string_view path)
     return true;
 }
 
+// Length of a NUL-terminated field that may be cut short by the packet end
+static size_t field_length(const char *str, size_t max_len)
+{
+    size_t len = 0;
+
+    while (len < max_len && str[len])
+        ++len;
+
+    return len;
+}
+
+static u16 get_be16(const u8 *ptr)
+{
+    return (ptr[0] << 8) | ptr[1];
+}
+
+static void put_be16(u8 *ptr, u16 value)
+{
+    ptr[0] = value >> 8;
+    ptr[1] = value & 0xFF;
+}
+
+static bool udp_open(void)
+{
+    // Zero source IP means the one we got from DHCP
+    struct pxenv_udp_open open = { 0 };
+    u16 ret;
+
+    ret = pxe_call(PXENV_UDP_OPEN, &open);
+    if (ret != PXENV_EXIT_SUCCESS || open.status != PXENV_STATUS_SUCCESS) {
+        print_warn("UDP_OPEN failed (ret=%u, status=0x%04X)\n",
+                   ret, open.status);
+        return false;
+    }
+
+    return true;
+}
+
+static void udp_close(void)
+{
+    struct pxenv_udp_close close = { 0 };
+    pxe_call(PXENV_UDP_CLOSE, &close);
+}
+
+static bool tftp_send(u16 dst_port, size_t bytes)
+{
+    struct pxenv_udp_write write = {
+        .ip = s_server_ip,
+        .gateway_ip = s_gateway_ip,
+        .src_port = s_stream.local_port,
+        .dst_port = dst_port,
+        .buffer_size = bytes,
+    };
+    struct real_mode_addr buf_addr;
+    u16 ret;
+
+    as_real_mode_addr((ptr_t)tx_packet, &buf_addr);
+    write.buffer_segment = buf_addr.segment;
+    write.buffer_offset = buf_addr.offset;
+
+    ret = pxe_call(PXENV_UDP_WRITE, &write);
+    return ret == PXENV_EXIT_SUCCESS && write.status == PXENV_STATUS_SUCCESS;
+}
+
+static void tftp_send_ack(u16 block)
+{
+    put_be16(tx_packet, TFTP_OP_ACK);
+    put_be16(tx_packet + 2, block);
+    tftp_send(s_stream.server_port, TFTP_HEADER_SIZE);
+
+    s_stream.blocks_since_ack = 0;
+}
+
+// Error code 0 is "not defined, see error message"
+static void tftp_send_abort(void)
+{
+    put_be16(tx_packet, TFTP_OP_ERROR);
+    put_be16(tx_packet + 2, 0);
+    tx_packet[TFTP_HEADER_SIZE] = '\0';
+    tftp_send(s_stream.server_port, TFTP_HEADER_SIZE + 1);
+}
+
+/*
+ * Waits for the next packet from the server and returns its length, 0 if
+ * nothing arrived in time. Packets from anyone else are dropped, the first
+ * reply to a request determines the server's port for the rest of the
+ * transfer.
+ */
+static u16 tftp_receive(void)
+{
+    struct real_mode_addr buf_addr;
+    size_t polls;
+
+    as_real_mode_addr((ptr_t)rx_packet, &buf_addr);
+
+    for (polls = 0; polls < TFTP_SPIN_POLLS + TFTP_TIMEOUT_POLLS; ++polls) {
+        struct pxenv_udp_read read = {
+            .dst_port = s_stream.local_port,
+            .buffer_size = sizeof(rx_packet),
+            .buffer_offset = buf_addr.offset,
+            .buffer_segment = buf_addr.segment,
+        };
+        u16 ret;
+
+        ret = pxe_call(PXENV_UDP_READ, &read);
+        if (ret != PXENV_EXIT_SUCCESS || read.status != PXENV_STATUS_SUCCESS) {
+            if (polls >= TFTP_SPIN_POLLS)
+                services_stall(TFTP_POLL_INTERVAL_US);
+            continue;
+        }
+
+        if (memcmp(&read.src_ip, &s_server_ip, sizeof(s_server_ip)) != 0)
+            continue;
+        if (s_stream.server_port && read.src_port != s_stream.server_port)
+            continue;
+        if (read.buffer_size < TFTP_HEADER_SIZE)
+            continue;
+
+        s_stream.server_port = read.src_port;
+        return read.buffer_size;
+    }
+
+    return 0;
+}
+
+static void print_tftp_error(u16 len)
+{
+    struct string_view msg = {
+        .text = (char*)rx_packet + TFTP_HEADER_SIZE,
+        .size = field_length((char*)rx_packet + TFTP_HEADER_SIZE,
+                        len - TFTP_HEADER_SIZE),
+    };
+
+    print_warn("TFTP('%s') error %u: %pSV\n", s_stream.filename,
+               get_be16(rx_packet + 2), &msg);
+}
+
+static size_t put_string(size_t off, struct string_view str)
+{
+    memcpy(tx_packet + off, str.text, str.size);
+    tx_packet[off + str.size] = '\0';
+    return off + str.size + 1;
+}
+
+static size_t put_option(size_t off, struct string_view name, u32 value)
+{
+    char buf[11];
+    int len;
+
+    len = snprintf(buf, sizeof(buf), "%u", value);
+    off = put_string(off, name);
+    return put_string(off, (struct string_view) { buf, len });
+}
+
+static size_t build_rrq(void)
+{
+    size_t off = 2;
+
+    put_be16(tx_packet, TFTP_OP_RRQ);
+    off = put_string(off, (struct string_view) {
+        s_stream.filename, s_stream.filename_len
+    });
+    off = put_string(off, SV("octet"));
+    off = put_option(off, SV("tsize"), 0);
+    off = put_option(off, SV("blksize"), TFTP_MAX_BLOCK_SIZE);
+    off = put_option(off, SV("windowsize"), TFTP_MAX_WINDOW_SIZE);
+
+    return off;
+}
+BUILD_BUG_ON(TFTP_TX_PACKET_SIZE < 2 + TFTP_FILENAME_SIZE + 64);
+
+/*
+ * Options we didn't ask for, or values we can't live with, are a protocol
+ * violation (RFC 2347), so the transfer is aborted.
+ */
+static bool parse_oack(u16 len)
+{
+    struct string_view opts = {
+        .text = (char*)rx_packet + 2,
+        .size = len - 2,
+    };
+
+    while (opts.size) {
+        struct string_view name, value;
+        u64 number;
+
+        name.text = opts.text;
+        name.size = field_length(opts.text, opts.size);
+        if (name.size == opts.size)
+            return false;
+        sv_offset_by(&opts, name.size + 1);
+
+        value.text = opts.text;
+        value.size = field_length(opts.text, opts.size);
+        if (value.size == opts.size)
+            return false;
+        sv_offset_by(&opts, value.size + 1);
+
+        if (!str_to_u64_with_base(value, &number, 10))
+            return false;
+
+        if (sv_equals_caseless(name, SV("tsize"))) {
+            s_stream.file_size = number;
+            s_stream.size_known = true;
+        } else if (sv_equals_caseless(name, SV("blksize"))) {
+            if (number < 8 || number > TFTP_MAX_BLOCK_SIZE)
+                return false;
+            s_stream.block_size = number;
+        } else if (sv_equals_caseless(name, SV("windowsize"))) {
+            if (number < 1 || number > TFTP_MAX_WINDOW_SIZE)
+                return false;
+            s_stream.window_size = number;
+        } else {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+// 'len' bytes of the next in-order DATA packet are in 'rx_packet'
+static void accept_block(u16 len)
+{
+    s_stream.last_block = get_be16(rx_packet + 2);
+    s_stream.pending = rx_packet + TFTP_HEADER_SIZE;
+    s_stream.pending_bytes = len - TFTP_HEADER_SIZE;
+    s_stream.eof = s_stream.pending_bytes < s_stream.block_size;
+    s_stream.resync_sent = false;
+
+    // The final ACK tells the server we're done, so don't hold it back
+    if (++s_stream.blocks_since_ack == s_stream.window_size || s_stream.eof)
+        tftp_send_ack(s_stream.last_block);
+}
+
+static void stream_close(void)
+{
+    if (!s_stream.open)
+        return;
+
+    // Otherwise the server keeps retransmitting until it gives up
+    if (!s_stream.eof && s_stream.server_port)
+        tftp_send_abort();
+
+    udp_close();
+    s_stream.open = false;
+}
+
+static bool stream_open(struct string_view path)
+{
+    size_t rrq_size, retry;
+    u16 len = 0;
+
+    stream_close();
+
+    s_stream = (struct tftp_stream) {
+        .block_size = TFTP_DEFAULT_BLOCK_SIZE,
+        .window_size = 1,
+        .local_port = __builtin_bswap16(s_next_local_port++),
+        .filename_len = path.size,
+    };
+
+    if (!copy_filename(s_stream.filename, path))
+        return false;
+    if (!udp_open())
+        return false;
+
+    s_stream.open = true;
+
+    if (s_next_local_port < TFTP_LOCAL_PORT_BASE)
+        s_next_local_port = TFTP_LOCAL_PORT_BASE;
+
+    rrq_size = build_rrq();
+
+    for (retry = 0; retry < TFTP_RETRIES && !len; ++retry) {
+        if (!tftp_send(__builtin_bswap16(TFTP_PORT), rrq_size))
+            break;
+
+        len = tftp_receive();
+    }
+
+    if (!len) {
+        print_warn("TFTP('%pSV') request timed out\n", &path);
+        goto fail;
+    }
+
+    switch (get_be16(rx_packet)) {
+    case TFTP_OP_OACK:
+        if (!parse_oack(len)) {
+            print_warn("TFTP('%pSV') bogus option acknowledgment\n", &path);
+            goto fail;
+        }
+
+        s_stream.oack_pending = true;
+        return true;
+
+    // The server doesn't do options, the transfer has started regardless
+    case TFTP_OP_DATA:
+        if (get_be16(rx_packet + 2) != 1)
+            goto fail;
+
+        accept_block(len);
+        return true;
+
+    case TFTP_OP_ERROR:
+        print_tftp_error(len);
+        s_stream.server_port = 0;
+        goto fail;
+
+    default:
+        print_warn("TFTP('%pSV') unexpected opcode %u\n", &path,
+                   get_be16(rx_packet));
+        goto fail;
+    }
+
+fail:
+    stream_close();
+    return false;
+}
+
+static bool stream_is_for(struct string_view path)
+{
+    struct string_view name = { s_stream.filename, s_stream.filename_len };
+
+    return s_stream.open && sv_equals(name, path);
+}
+
+static bool stream_next_block(void)
+{
+    u16 expected = s_stream.last_block + 1;
+    size_t timeouts = 0;
+    u16 len, block;
+
+    if (s_stream.oack_pending) {
+        tftp_send_ack(0);
+        s_stream.oack_pending = false;
+    }
+
+    for (;;) {
+        len = tftp_receive();
+
+        if (!len) {
+            if (++timeouts == TFTP_RETRIES) {
+                print_warn("TFTP('%s') timed out at block %u\n",
+                           s_stream.filename, expected);
+                return false;
+            }
+
+            // The server resends its window starting right after this one
+            tftp_send_ack(s_stream.last_block);
+            continue;
+        }
+
+        switch (get_be16(rx_packet)) {
+        case TFTP_OP_DATA:
+            break;
+        case TFTP_OP_ERROR:
+            print_tftp_error(len);
+            s_stream.server_port = 0;
+            return false;
+        case TFTP_OP_OACK:
+            // Our ACK of the options got lost
+            if (s_stream.last_block == 0)
+                tftp_send_ack(0);
+            continue;
+        default:
+            continue;
+        }
+
+        block = get_be16(rx_packet + 2);
+        if (block == expected) {
+            accept_block(len);
+            return true;
+        }
+
+        /*
+         * Lost or reordered packet, ask for a resend once, as every ACK makes
+         * the server start a new window.
+         */
+        if (!s_stream.resync_sent) {
+            tftp_send_ack(s_stream.last_block);
+            s_stream.resync_sent = true;
+        }
+    }
+}
+
+static void stream_consume(u16 bytes)
+{
+    s_stream.pending += bytes;
+    s_stream.pending_bytes -= bytes;
+    s_stream.pos += bytes;
+}
+
 bool pxe_get_file_size(struct string_view path, u64 *out_size)
 {
     SERVICE_FUNCTION();
@@ -362,9 +844,21 @@ bool pxe_get_file_size(struct string_view path, u64 *out_size)
 
     *out_size = 0;
 
-    if (!copy_filename(fsize.filename, path))
+    if (!stream_open(path))
         return false;
 
+    if (s_stream.size_known) {
+        *out_size = s_stream.file_size;
+        return true;
+    }
+
+    /*
+     * The server didn't tell us the size, ask the PXE stack in a separate
+     * transaction, which might know a way. The UDP API must be closed for it.
+     */
+    stream_close();
+    sv_terminated_copy(fsize.filename, path);
+
     ret = pxe_call(PXENV_TFTP_GET_FSIZE, &fsize);
     if (ret != PXENV_EXIT_SUCCESS || fsize.status != PXENV_STATUS_SUCCESS) {
         print_warn(
@@ -378,95 +872,84 @@ bool pxe_get_file_size(struct string_view path, u64 *out_size)
     return true;
 }
 
-static void tftp_close(void)
+bool pxe_read_supports_partial(void)
 {
-    struct pxenv_tftp_close close = { 0 };
-    pxe_call(PXENV_TFTP_CLOSE, &close);
+    return true;
 }
 
-bool pxe_read_file(struct string_view path, void *out_buf, u64 expected_size)
+/*
+ * Blocks are copied straight from the staging area into 'out_buf', skipping
+ * whatever comes before 'offset'. A read that doesn't continue where the last
+ * one stopped (going backwards or switching files) restarts the transfer.
+ */
+bool pxe_read_file_range(struct string_view path, void *out_buf, u64 offset,
+                         u64 bytes, u64 file_size)
 {
     SERVICE_FUNCTION();
 
-    struct pxenv_tftp_open open = {
-        .gateway_ip = s_gateway_ip,
-        .server_ip = s_server_ip,
-    };
-    struct real_mode_addr buf_addr;
     u8 *dst = out_buf;
-    u8 *tftp_buffer;
-    u64 total = 0;
-    u16 packet_size, ret;
+    u64 chunk;
 
-    if (!copy_filename(open.filename, path))
-        return false;
-
-    open.tftp_port = __builtin_bswap16(TFTP_PORT);
-    open.packet_size = TFTP_MAX_PACKET_SIZE;
-
-    ret = pxe_call(PXENV_TFTP_OPEN, &open);
-    if (ret != PXENV_EXIT_SUCCESS || open.status != PXENV_STATUS_SUCCESS) {
-        print_warn(
-            "TFTP_OPEN('%pSV') failed (ret=%u, status=0x%04X)\n",
-            &path, ret, open.status
-        );
-        return false;
-    }
-
-    packet_size = open.packet_size;
-    if (packet_size == 0 || packet_size > TFTP_MAX_PACKET_SIZE) {
-        print_warn("server negotiated a bogus packet size (%u)\n", packet_size);
-        tftp_close();
-        return false;
+    if (!stream_is_for(path) || offset < s_stream.pos) {
+        if (!stream_open(path))
+            return false;
     }
 
-    tftp_buffer = scratch_buffer_borrow(TFTP_MAX_PACKET_SIZE, NULL, NULL);
-    as_real_mode_addr((ptr_t)tftp_buffer, &buf_addr);
+    while (bytes) {
+        if (!s_stream.pending_bytes) {
+            if (s_stream.eof) {
+                print_warn(
+                    "'%pSV' size mismatch: expected %llu, got %llu\n",
+                    &path, file_size, s_stream.pos
+                );
+                goto fail;
+            }
+
+            if (!stream_next_block())
+                goto fail;
+
+            if (s_stream.pos + s_stream.pending_bytes > file_size) {
+                print_warn(
+                    "'%pSV' is larger than the expected %llu bytes\n",
+                    &path, file_size
+                );
+                goto fail;
+            }
 
-    for (;;) {
-        struct pxenv_tftp_read read = { 0 };
-
-        read.buffer_segment = buf_addr.segment;
-        read.buffer_offset = buf_addr.offset;
-
-        ret = pxe_call(PXENV_TFTP_READ, &read);
-        if (ret != PXENV_EXIT_SUCCESS || read.status != PXENV_STATUS_SUCCESS) {
-            print_warn(
-                "TFTP_READ('%pSV') failed (ret=%u, status=0x%04X)\n",
-                &path, ret, read.status
-            );
-            tftp_close();
-            return false;
+            continue;
         }
 
-        if (total + read.buffer_size > expected_size) {
-            print_warn(
-                "'%pSV' is larger than the expected %llu bytes\n",
-                &path, expected_size
-            );
-            tftp_close();
-            return false;
+        if (offset > s_stream.pos) {
+            chunk = MIN(offset - s_stream.pos, (u64)s_stream.pending_bytes);
+            stream_consume(chunk);
+            continue;
         }
 
-        memcpy(dst + total, tftp_buffer, read.buffer_size);
-        total += read.buffer_size;
+        chunk = MIN(bytes, (u64)s_stream.pending_bytes);
+        memcpy(dst, s_stream.pending, chunk);
+        stream_consume(chunk);
 
-        if (read.buffer_size < packet_size)
-            break;
+        dst += chunk;
+        offset += chunk;
+        bytes -= chunk;
     }
 
-    tftp_close();
-
-    if (unlikely(total != expected_size)) {
-        print_warn(
-            "'%pSV' size mismatch: expected %llu, got %llu\n",
-            &path, expected_size, total
-        );
-        return false;
-    }
+    // Got the entire file, no need to wait for the final empty packet
+    if (s_stream.pos == file_size)
+        stream_close();
 
     return true;
+
+fail:
+    stream_close();
+    return false;
+}
+
+static void bios_pxe_services_cleanup(void)
+{
+    stream_close();
 }
+DECLARE_CLEANUP_HANDLER(bios_pxe_services_cleanup);
 
 void pxe_server_ip_address(struct ip_addr *out)
 {
@@ -8,6 +8,8 @@
 #include "bios_call.h"
 #include "edid.h"
 
+#define VBE_DEBUG 0
+
 struct PACKED super_vga_info {
     u32 signature; // 'VBE2' request -> 'VESA' response
     u16 vesa_version;
@@ -160,6 +162,13 @@ static void tty_scroll(void)
         vga_memory[(TTY_ROWS - 1) * TTY_COLUMNS + x] = ' ';
 }
 
+// The loader runs in VGA text mode here, there's no framebuffer to render to
+bool vs_use_framebuffer_tty(bool keep_serial)
+{
+    UNUSED(keep_serial);
+    return false;
+}
+
 bool vs_write_tty(const char *text, size_t count, enum color col)
 {
     volatile u16 *vga_memory = (volatile u16*)VGA_ADDRESS;
@@ -339,13 +348,29 @@ static u16 mode_fb_format(
     );
 }
 
-static void fetch_all_video_modes(void)
+/*
+ * VBE mode enumeration is a 4F01h real-mode call per mode, which adds up on
+ * some BIOSes, so it's done lazily, one mode at a time, as the modes are
+ * actually queried. Headless boots never get here at all.
+ */
+enum vbe_state {
+    VBE_STATE_UNKNOWN,
+    VBE_STATE_ENUMERATING,
+    VBE_STATE_DONE,
+};
+
+static enum vbe_state vbe_state;
+
+// Must stay around, the mode list is allowed to live in its reserved area
+static struct super_vga_info vga_info;
+static volatile u16 *video_modes_list;
+
+static void vbe_init(void)
 {
-    struct super_vga_info vga_info = { 0 };
-    struct mode_information info;
     const char *oem_string;
     u8 vesa_minor;
-    volatile u16 *video_modes_list;
+
+    vbe_state = VBE_STATE_DONE;
 
     if (!fetch_vga_info(&vga_info))
         return;
@@ -359,40 +384,123 @@ static void fetch_all_video_modes(void)
 
     video_modes_list = from_real_mode_addr(vga_info.supported_modes_list_segment,
                                            vga_info.supported_modes_list_offset);
+    vbe_state = VBE_STATE_ENUMERATING;
+}
 
-    while (*video_modes_list != 0xFFFF) {
-        u16 mode_id = *video_modes_list++;
-        u16 fb_format;
-        u32 buffer_idx;
+/*
+ * Mode information is fetched a few modes ahead in one real mode transition
+ * instead of a call per mode. The info buffers are addressed via es:di so
+ * they're fine anywhere within the first megabyte.
+ */
+#define MODE_INFO_BATCH_SIZE 8
+
+static struct mode_information mode_info_batch[MODE_INFO_BATCH_SIZE];
+static u16 mode_id_batch[MODE_INFO_BATCH_SIZE];
+static bool mode_info_ok[MODE_INFO_BATCH_SIZE];
+static size_t mode_batch_count, mode_batch_pos;
+
+static void fetch_mode_info_batch(void)
+{
+    struct bios_call_request requests[MODE_INFO_BATCH_SIZE];
+    struct real_mode_addr rm_addr;
+    size_t i, count = 0;
+
+    while (count < MODE_INFO_BATCH_SIZE && *video_modes_list != 0xFFFF) {
+        struct bios_call_request *req = &requests[count];
+
+        mode_id_batch[count] = *video_modes_list++;
+        memzero(&mode_info_batch[count], sizeof(struct mode_information));
+        as_real_mode_addr((u32)&mode_info_batch[count], &rm_addr);
+
+        // https://oldlinux.superglobalmegacorp.com/Linux.old/docs/interrupts/int-html/rb-0274.htm
+        *req = (struct bios_call_request) {
+            .number = 0x10,
+            .regs = {
+                .eax = 0x4F01,
+                .ecx = mode_id_batch[count],
+                .edi = rm_addr.offset,
+                .es = rm_addr.segment,
+            },
+        };
+        count++;
+    }
+
+    if (count)
+        bios_call_batch(requests, count, 0);
+
+    for (i = 0; i < count; ++i)
+        mode_info_ok[i] = check_vbe_call(0x4F01, &requests[i].regs);
+
+    mode_batch_count = count;
+    mode_batch_pos = 0;
+}
 
-        memzero(&info, sizeof(info));
-        if (!fetch_mode_info(mode_id, &info))
+static struct mode_information *next_mode_info(u16 *out_mode_id)
+{
+    for (;;) {
+        size_t idx;
+
+        if (mode_batch_pos == mode_batch_count) {
+            fetch_mode_info_batch();
+            if (!mode_batch_count)
+                return NULL;
+        }
+
+        idx = mode_batch_pos++;
+        if (!mode_info_ok[idx])
             continue;
 
-        fb_format = mode_fb_format(&info, mode_id, vesa_detected_major >= 3);
+        *out_mode_id = mode_id_batch[idx];
+        return &mode_info_batch[idx];
+    }
+}
+
+// Probes the mode list until one more usable mode is found
+static bool fetch_next_video_mode(void)
+{
+    struct mode_information *info;
+    u16 mode_id;
+
+    if (unlikely(vbe_state == VBE_STATE_UNKNOWN))
+        vbe_init();
+    if (vbe_state != VBE_STATE_ENUMERATING)
+        return false;
+
+    while ((info = next_mode_info(&mode_id))) {
+        u16 fb_format;
+        u32 buffer_idx;
+
+        fb_format = mode_fb_format(info, mode_id, vesa_detected_major >= 3);
         if (fb_format == FB_FORMAT_INVALID)
             continue;
 
         if (video_mode_count == MODE_BUFFER_CAPACITY) {
             print_warn("exceeded video mode storage capacity, skipping the rest\n");
-            return;
+            break;
         }
         buffer_idx = video_mode_count++;
 
-        print_info("video-mode[%u] %ux%u fmt: %s\n", buffer_idx, info.width, info.height,
-                   fb_format_as_str(fb_format));
+        print_dbg(VBE_DEBUG, "video-mode[%u] %ux%u fmt: %s\n", buffer_idx,
+                  info->width, info->height, fb_format_as_str(fb_format));
 
         video_modes[buffer_idx] = (struct video_mode) {
-            .width = info.width,
-            .height = info.height,
-            .bpp = info.bits_per_pixel,
+            .width = info->width,
+            .height = info->height,
+            .bpp = info->bits_per_pixel,
             .format = fb_format,
             .id = (mode_id << 16) | buffer_idx
         };
+        return true;
     }
+
+    print_info("%zu usable video mode(s)\n", video_mode_count);
+    vbe_state = VBE_STATE_DONE;
+    return false;
 }
 
-void fetch_native_resolution(void)
+static bool native_resolution_fetched;
+
+static void fetch_native_resolution(void)
 {
     struct edid e = { 0 };
     u8 edid_checksum;
@@ -403,6 +511,8 @@ void fetch_native_resolution(void)
         .ebx = 0x01,
         .edi = (u32)&e
     };
+
+    native_resolution_fetched = true;
     bios_call(0x10, &regs, &regs);
 
     if (!check_vbe_call(0x4F15, &regs)) {
@@ -423,21 +533,31 @@ void fetch_native_resolution(void)
 u32 vs_get_mode_count(void)
 {
     SERVICE_FUNCTION();
+
+    while (fetch_next_video_mode());
     return video_mode_count;
 }
 
-void vs_query_mode(size_t idx, struct video_mode *out_mode)
+bool vs_query_mode(size_t idx, struct video_mode *out_mode)
 {
     SERVICE_FUNCTION();
-    BUG_ON(idx >= video_mode_count);
+
+    while (idx >= video_mode_count) {
+        if (!fetch_next_video_mode())
+            return false;
+    }
 
     *out_mode = video_modes[idx];
+    return true;
 }
 
 bool vs_query_native_resolution(struct resolution *out_resolution)
 {
     SERVICE_FUNCTION();
 
+    if (!native_resolution_fetched)
+        fetch_native_resolution();
+
     if (native_width == 0 || native_height == 0)
         return false;
 
@@ -503,6 +623,4 @@ bool vs_set_mode(u32 id, struct framebuffer *out_framebuffer)
 void bios_video_services_init(void)
 {
     initialize_legacy_tty();
-    fetch_all_video_modes();
-    fetch_native_resolution();
 }
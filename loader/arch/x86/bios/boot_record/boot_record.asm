@@ -35,7 +35,14 @@ STAGE2_BASE_SECTOR:     equ 1
 ; in-memory copy of this sector). Keep in sync with STAGE1_STAGE2_LBA_OFF in
 ; the installer.
 STAGE2_LBA_PATCH_OFF:   equ 0x1B0
+
+; Likewise, the exact number of sectors the (packed) stage2 spans, right below
+; the LBA. Keep in sync with STAGE1_STAGE2_SECTORS_OFF in the installer.
+STAGE2_SECTORS_PATCH_OFF: equ 0x1AE
 BYTES_PER_BATCH:        equ (SECTORS_PER_BATCH * BYTES_PER_SECTOR)
+
+; What gets loaded when the sector count isn't known: by the ISO variants, and
+; by a plain MBR that was never patched. Also the size limit of packed stage2.
 STAGE2_BYTES_TO_LOAD:   equ 131072
 STAGE2_SECTORS_TO_LOAD: equ (STAGE2_BYTES_TO_LOAD / BYTES_PER_SECTOR) ; must be a multiple of SECTORS_PER_BATCH
 
@@ -194,8 +201,10 @@ skip_bpb:
     mov [DAP.sector_begin_low], eax
     mov eax, [stage2_lba + 4]
     mov [DAP.sector_begin_high], eax
-%endif
+    mov cx, [stage2_sectors]
+%else
     mov cx, STAGE2_SECTORS_TO_LOAD
+%endif
 
     ; The load cursor (LBA and destination segment) lives in the DAP itself
     ; and is advanced in place: no extended register survives an INT 13h call
@@ -204,6 +213,15 @@ skip_bpb:
     ; emulation truncated the destination previously kept in ebx to 16 bits,
     ; silently making later batches overwrite earlier ones).
     load_stage2:
+%ifdef HYPER_PLAIN_MBR
+        ; the last batch may be a partial one (the ISO variants always load
+        ; whole batches, and have no room to spare for this anyway)
+        cmp cx, SECTORS_PER_BATCH
+        jae .full_batch
+        mov [DAP.sector_count], cx
+
+    .full_batch:
+%endif
         call read_disk
 
         add [DAP.sector_begin_low], dword SECTORS_PER_BATCH
@@ -214,7 +232,7 @@ skip_bpb:
 %endif
         add [DAP.read_into_segment], word BYTES_PER_BATCH >> 4
         sub cx, SECTORS_PER_BATCH
-        jnz load_stage2
+        ja load_stage2
 %endif
 
 %ifdef HYPER_PXE_BOOT_RECORD
@@ -336,7 +354,9 @@ times BYTES_PER_SECTOR - ($ - $$) db 0
 ; gap), but the installer overwrites it when stage2 lives elsewhere, e.g.
 ; inside a GPT partition where there is no usable gap before the first
 ; partition.
-times STAGE2_LBA_PATCH_OFF - ($ - $$) db 0
+times STAGE2_SECTORS_PATCH_OFF - ($ - $$) db 0
+stage2_sectors: dw STAGE2_SECTORS_TO_LOAD
+
 stage2_lba: dq STAGE2_BASE_SECTOR
 
 ; padding before partition list (0x1B8 is the NT disk signature, keep zero)
@@ -0,0 +1,175 @@
+#!/usr/bin/env python3
+"""Produce the packed stage2 image the BIOS boot records load.
+
+The output is the stage2 stub (stage2_stub.asm) followed by the LZ4-compressed
+stage2 binary. The stub unpacks stage2 to its link address at boot, so the boot
+record only has to read the compressed size off the disk. The compressor is a
+simple greedy one, which is plenty for a ~100K binary and keeps the build free
+of external dependencies.
+"""
+import argparse
+import struct
+
+STAGE2_MAGIC = b"HyperST2"
+STAGE2_LOAD_BASE = 0x7E00
+
+# Offset of the packed size field in the stub header, see stage2_stub.asm
+STUB_PACKED_SIZE_OFF = 12
+
+# Keep in sync with STUB_RELOCATION_BASE in stage2_stub.asm
+STUB_RELOCATION_BASE = 0x60000
+EBDA_BEGIN = 0x80000
+
+# The ISO boot records still read a fixed span (STAGE2_BYTES_TO_LOAD in
+# boot_record.asm), the packed image must fit within it.
+MAX_PACKED_SIZE = min(128 * 1024, EBDA_BEGIN - STUB_RELOCATION_BASE)
+MAX_UNPACKED_SIZE = STUB_RELOCATION_BASE - STAGE2_LOAD_BASE
+
+LZ4_MIN_MATCH = 4
+LZ4_LAST_LITERALS = 5
+LZ4_MF_LIMIT = 12
+LZ4_MAX_OFFSET = 0xFFFF
+
+
+def lz4_write_length(out, length):
+    while length >= 255:
+        out.append(255)
+        length -= 255
+    out.append(length)
+
+
+def lz4_write_sequence(out, literals, offset=0, match_length=0):
+    lit_len = len(literals)
+    token = min(lit_len, 15) << 4
+
+    if offset:
+        token |= min(match_length - LZ4_MIN_MATCH, 15)
+
+    out.append(token)
+    if lit_len >= 15:
+        lz4_write_length(out, lit_len - 15)
+    out += literals
+
+    if offset:
+        out += struct.pack("<H", offset)
+        if match_length - LZ4_MIN_MATCH >= 15:
+            lz4_write_length(out, match_length - LZ4_MIN_MATCH - 15)
+
+
+def lz4_compress(data):
+    out = bytearray()
+    last_seen = {}
+    end = len(data)
+    anchor = pos = 0
+
+    while pos < end - LZ4_MF_LIMIT:
+        key = data[pos:pos + LZ4_MIN_MATCH]
+        candidate = last_seen.get(key)
+        last_seen[key] = pos
+
+        if candidate is None or pos - candidate > LZ4_MAX_OFFSET:
+            pos += 1
+            continue
+
+        length = LZ4_MIN_MATCH
+        max_length = end - LZ4_LAST_LITERALS - pos
+        while length < max_length and \
+                data[candidate + length] == data[pos + length]:
+            length += 1
+
+        lz4_write_sequence(out, data[anchor:pos], pos - candidate, length)
+        pos += length
+        anchor = pos
+
+    lz4_write_sequence(out, data[anchor:])
+    return bytes(out)
+
+
+def lz4_read_length(data, pos, length):
+    if length != 15:
+        return pos, length
+
+    while True:
+        byte = data[pos]
+        pos += 1
+        length += byte
+        if byte != 255:
+            return pos, length
+
+
+# Mirrors the stub's decompressor, used to verify the output at build time
+def lz4_decompress(data):
+    out = bytearray()
+    pos = 0
+
+    while pos < len(data):
+        token = data[pos]
+        pos += 1
+
+        pos, lit_len = lz4_read_length(data, pos, token >> 4)
+        out += data[pos:pos + lit_len]
+        pos += lit_len
+
+        if pos >= len(data):
+            break
+
+        offset = struct.unpack_from("<H", data, pos)[0]
+        pos += 2
+
+        pos, match_length = lz4_read_length(data, pos, token & 0x0F)
+        match_length += LZ4_MIN_MATCH
+
+        for _ in range(match_length):
+            out.append(out[-offset])
+
+    return bytes(out)
+
+
+def read_file(path):
+    with open(path, "rb") as f:
+        data = f.read()
+
+    if not data:
+        raise SystemExit(f"{path} is empty!")
+
+    return data
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__)
+    parser.add_argument("--stub", required=True)
+    parser.add_argument("--stage2", required=True)
+    parser.add_argument("--output", required=True)
+    args = parser.parse_args()
+
+    stub = bytearray(read_file(args.stub))
+    stage2 = read_file(args.stage2)
+
+    for what, data in (("stub", stub), ("stage2", stage2)):
+        if data[:len(STAGE2_MAGIC)] != STAGE2_MAGIC:
+            raise SystemExit(f"{what} is missing the stage2 magic")
+
+    if len(stage2) > MAX_UNPACKED_SIZE:
+        raise SystemExit(f"stage2 is too large to unpack ({len(stage2)} bytes, "
+                         f"max {MAX_UNPACKED_SIZE}), move STUB_RELOCATION_BASE")
+
+    payload = lz4_compress(stage2)
+    if lz4_decompress(payload) != stage2:
+        raise SystemExit("LZ4 round trip mismatch, the compressor is broken")
+
+    packed_size = len(stub) + len(payload)
+    if packed_size > MAX_PACKED_SIZE:
+        raise SystemExit(f"packed stage2 is too large ({packed_size} bytes, "
+                         f"max {MAX_PACKED_SIZE})")
+
+    struct.pack_into("<I", stub, STUB_PACKED_SIZE_OFF, packed_size)
+
+    with open(args.output, "wb") as f:
+        f.write(stub)
+        f.write(payload)
+
+    print(f"stage2: {len(stage2)} -> {packed_size} bytes packed")
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,170 @@
+BITS 16
+
+; Self-extracting prologue of the packed stage2 image (see pack_stage2.py):
+; this stub immediately followed by the LZ4-compressed stage2. The boot record
+; loads and enters it exactly like it would an unpacked stage2, so the header
+; layout below must match the one in bios_entry.asm.
+
+STAGE2_LOAD_BASE:    equ 0x7E00
+STAGE2_LOAD_SEGMENT: equ STAGE2_LOAD_BASE >> 4
+STAGE2_ENTRY_OFF:    equ 16
+STAGE2_BOOT_PARTITION_OFF: equ 8
+
+; stage2 is unpacked to where it's linked, which is right where we're running,
+; so the stub and the payload move out of the way first. Must lie past the end
+; of the unpacked image and leave room for the packed one below the EBDA.
+; Keep in sync with STUB_RELOCATION_BASE in pack_stage2.py and linker.ld.
+STUB_RELOCATION_BASE:    equ 0x60000
+STUB_RELOCATION_SEGMENT: equ STUB_RELOCATION_BASE >> 4
+
+FLAT_DATA_SELECTOR: equ 0x08
+PROTECTED_MODE_BIT: equ 1
+
+LZ4_MIN_MATCH: equ 4
+
+ORG 0
+
+header:
+    .magic: db "HyperST2"
+
+    ; Patched by the installer same as in the unpacked image, forwarded as is
+    .boot_partition: dd 0xFFFFFFFF
+
+    ; Stub + payload size in bytes, filled in by pack_stage2.py
+    .packed_size: dd 0
+
+entry:
+    ; The boot record jumps to 0:STAGE2_LOAD_BASE + 16, make cs match our ORG
+    jmp STAGE2_LOAD_SEGMENT:normalized
+
+normalized:
+    cli
+
+    ; boot drive for stage2
+    push dx
+
+    ; Load 4GiB limits into the ds/es descriptor caches and go right back to
+    ; real mode ("unreal mode"), letting 32-bit addressing reach the entire
+    ; first megabyte without juggling segments.
+    lgdt [cs:gdt_ptr]
+
+    mov eax, cr0
+    or  al, PROTECTED_MODE_BIT
+    mov cr0, eax
+    jmp .protected_mode
+
+.protected_mode:
+    mov bx, FLAT_DATA_SELECTOR
+    mov ds, bx
+    mov es, bx
+
+    and al, ~PROTECTED_MODE_BIT
+    mov cr0, eax
+    jmp .real_mode
+
+.real_mode:
+    xor bx, bx
+    mov ds, bx
+    mov es, bx
+
+    cld
+    mov esi, STAGE2_LOAD_BASE
+    mov edi, STUB_RELOCATION_BASE
+    mov ecx, [cs:header.packed_size]
+    a32 rep movsb
+
+    jmp STUB_RELOCATION_SEGMENT:relocated
+
+relocated:
+    mov esi, STUB_RELOCATION_BASE + payload
+    mov ebp, STUB_RELOCATION_BASE
+    add ebp, [cs:header.packed_size]
+    mov edi, STAGE2_LOAD_BASE
+    call lz4_decompress
+
+    mov eax, [cs:header.boot_partition]
+    mov [STAGE2_LOAD_BASE + STAGE2_BOOT_PARTITION_OFF], eax
+
+    pop dx
+    sti
+
+    jmp 0:STAGE2_LOAD_BASE + STAGE2_ENTRY_OFF
+
+; Decompresses an LZ4 block, see
+; https://github.com/lz4/lz4/blob/dev/doc/lz4_Block_format.md
+; -----------------------------------------------------------------------------
+; void lz4_decompress(esi src, ebp src_end, edi dst)
+; clobbers eax, ebx, ecx, edx, esi, edi
+lz4_decompress:
+.next_sequence:
+    cmp esi, ebp
+    jae .done
+
+    a32 lodsb
+    mov bl, al
+
+    ; literals
+    movzx ecx, al
+    shr ecx, 4
+    call lz4_read_length
+    a32 rep movsb
+
+    ; the last sequence is literals only
+    cmp esi, ebp
+    jae .done
+
+    a32 lodsw
+    movzx edx, ax
+
+    movzx ecx, bl
+    and ecx, 0x0F
+    call lz4_read_length
+    add ecx, LZ4_MIN_MATCH
+
+    ; Matches may overlap the output they produce, which a forward byte copy
+    ; handles correctly
+    push esi
+    mov esi, edi
+    sub esi, edx
+    a32 rep movsb
+    pop esi
+
+    jmp .next_sequence
+
+.done:
+    ret
+
+; ecx = 4-bit length field from the token, extended by the bytes that follow
+; if saturated
+; clobbers eax
+lz4_read_length:
+    cmp ecx, 15
+    jne .done
+
+.next_byte:
+    a32 lodsb
+    movzx eax, al
+    add ecx, eax
+    cmp al, 255
+    je .next_byte
+
+.done:
+    ret
+
+align 8
+gdt:
+    dq 0
+
+    ; flat 4GiB read/write data
+    dw 0xFFFF, 0x0000
+    db 0x00, 0x92, 0xCF, 0x00
+gdt_end:
+
+gdt_ptr:
+    dw gdt_end - gdt - 1
+
+    ; only ever loaded before relocation
+    dd STAGE2_LOAD_BASE + gdt
+
+; The compressed stage2 is appended right here
+payload:
@@ -0,0 +1,272 @@
+#include "common/bug.h"
+#include "common/log.h"
+#include "common/minmax.h"
+#include "memory_services.h"
+#include "free_range_index.h"
+
+/*
+ * The index is a treap, a binary search tree keyed by the range base, which is
+ * also a heap keyed by a random priority, making it balanced on average. This
+ * keeps the implementation tiny as every operation boils down to split/merge.
+ *
+ * There can never be more free ranges than there are memory map entries, so
+ * the nodes come from a static pool of the same capacity as the memory map.
+ * Node 0 is used as the NULL node.
+ */
+#define INDEX_CAPACITY (PAGE_SIZE / sizeof(struct memory_map_entry))
+#define NIL 0
+
+struct free_range {
+    u64 begin, end;
+
+    // Largest range size within the subtree rooted at this node
+    u64 max_size;
+
+    u32 priority;
+    u16 left, right;
+};
+
+static struct free_range nodes[INDEX_CAPACITY + 1];
+static u16 root;
+static u16 free_list;
+static u16 next_unused = 1;
+static u32 rng_state = 0x2545F491;
+
+static u32 next_priority(void)
+{
+    // xorshift32
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 17;
+    rng_state ^= rng_state << 5;
+
+    return rng_state;
+}
+
+static u16 node_alloc(u64 begin, u64 end)
+{
+    struct free_range *fr;
+    u16 idx;
+
+    if (free_list != NIL) {
+        idx = free_list;
+        free_list = nodes[idx].left;
+    } else {
+        if (next_unused > INDEX_CAPACITY)
+            oops("out of free range index capacity\n");
+
+        idx = next_unused++;
+    }
+
+    fr = &nodes[idx];
+    fr->begin = begin;
+    fr->end = end;
+    fr->max_size = end - begin;
+    fr->priority = next_priority();
+    fr->left = fr->right = NIL;
+
+    return idx;
+}
+
+static void node_free(u16 idx)
+{
+    nodes[idx].left = free_list;
+    free_list = idx;
+}
+
+static void node_update(u16 idx)
+{
+    struct free_range *fr = &nodes[idx];
+
+    fr->max_size = fr->end - fr->begin;
+
+    if (fr->left != NIL)
+        fr->max_size = MAX(fr->max_size, nodes[fr->left].max_size);
+    if (fr->right != NIL)
+        fr->max_size = MAX(fr->max_size, nodes[fr->right].max_size);
+}
+
+// Splits 'idx' into ranges with begin < key and begin >= key
+static void split(u16 idx, u64 key, u16 *out_lhs, u16 *out_rhs)
+{
+    if (idx == NIL) {
+        *out_lhs = *out_rhs = NIL;
+        return;
+    }
+
+    if (nodes[idx].begin < key) {
+        split(nodes[idx].right, key, &nodes[idx].right, out_rhs);
+        *out_lhs = idx;
+    } else {
+        split(nodes[idx].left, key, out_lhs, &nodes[idx].left);
+        *out_rhs = idx;
+    }
+
+    node_update(idx);
+}
+
+// Every key in 'lhs' must be lower than every key in 'rhs'
+static u16 merge(u16 lhs, u16 rhs)
+{
+    if (lhs == NIL)
+        return rhs;
+    if (rhs == NIL)
+        return lhs;
+
+    if (nodes[lhs].priority > nodes[rhs].priority) {
+        nodes[lhs].right = merge(nodes[lhs].right, rhs);
+        node_update(lhs);
+        return lhs;
+    }
+
+    nodes[rhs].left = merge(lhs, nodes[rhs].left);
+    node_update(rhs);
+    return rhs;
+}
+
+static void do_insert(u64 begin, u64 end)
+{
+    u16 lhs, rhs;
+
+    split(root, begin, &lhs, &rhs);
+    root = merge(merge(lhs, node_alloc(begin, end)), rhs);
+}
+
+// Removes the range with the exact base of 'begin'
+static void do_remove(u64 begin)
+{
+    u16 lhs, mid, rhs;
+
+    split(root, begin, &lhs, &rhs);
+    split(rhs, begin + 1, &mid, &rhs);
+    BUG_ON(mid == NIL || nodes[mid].left != NIL || nodes[mid].right != NIL);
+
+    node_free(mid);
+    root = merge(lhs, rhs);
+}
+
+// Range with the highest base that is <= 'address'
+static u16 find_floor(u64 address)
+{
+    u16 idx = root, ret = NIL;
+
+    while (idx != NIL) {
+        if (nodes[idx].begin <= address) {
+            ret = idx;
+            idx = nodes[idx].right;
+        } else {
+            idx = nodes[idx].left;
+        }
+    }
+
+    return ret;
+}
+
+// Range with the lowest base that is >= 'address'
+static u16 find_ceiling(u64 address)
+{
+    u16 idx = root, ret = NIL;
+
+    while (idx != NIL) {
+        if (nodes[idx].begin >= address) {
+            ret = idx;
+            idx = nodes[idx].left;
+        } else {
+            idx = nodes[idx].right;
+        }
+    }
+
+    return ret;
+}
+
+void free_range_index_insert(u64 begin, u64 end)
+{
+    u16 idx;
+
+    BUG_ON(begin >= end);
+
+    if (begin) {
+        idx = find_floor(begin - 1);
+
+        if (idx != NIL && nodes[idx].end == begin) {
+            begin = nodes[idx].begin;
+            do_remove(begin);
+        }
+    }
+
+    idx = find_ceiling(end);
+    if (idx != NIL && nodes[idx].begin == end) {
+        end = nodes[idx].end;
+        do_remove(nodes[idx].begin);
+    }
+
+    do_insert(begin, end);
+}
+
+void free_range_index_remove(u64 begin, u64 end)
+{
+    u16 idx = find_floor(begin);
+    u64 range_begin, range_end;
+
+    BUG_ON(idx == NIL || nodes[idx].end < end);
+
+    range_begin = nodes[idx].begin;
+    range_end = nodes[idx].end;
+    do_remove(range_begin);
+
+    if (range_begin < begin)
+        do_insert(range_begin, begin);
+    if (end < range_end)
+        do_insert(end, range_end);
+}
+
+static u16 find_top_down(u16 idx, u64 bytes, u64 limit)
+{
+    struct free_range *fr;
+    u16 ret;
+
+    /*
+     * The recursion only ever descends into both children along the path to
+     * 'limit', all other subtrees are either skipped entirely or are
+     * guaranteed to contain a fitting range, which keeps this O(log n).
+     */
+    while (idx != NIL) {
+        fr = &nodes[idx];
+
+        if (fr->max_size < bytes)
+            return NIL;
+
+        if (fr->begin >= limit) {
+            idx = fr->left;
+            continue;
+        }
+
+        ret = find_top_down(fr->right, bytes, limit);
+        if (ret != NIL)
+            return ret;
+
+        if (MIN(fr->end, limit) - fr->begin >= bytes)
+            return idx;
+
+        idx = fr->left;
+    }
+
+    return NIL;
+}
+
+bool free_range_index_find_top_down(u64 bytes, u64 limit, u64 *out_begin)
+{
+    u16 idx = find_top_down(root, bytes, limit);
+
+    if (idx == NIL)
+        return false;
+
+    *out_begin = MIN(nodes[idx].end, limit) - bytes;
+    return true;
+}
+
+bool free_range_index_contains(u64 begin, u64 end)
+{
+    u16 idx = find_floor(begin);
+
+    return idx != NIL && end <= nodes[idx].end;
+}
@@ -0,0 +1,29 @@
+#pragma once
+
+#include "common/types.h"
+
+/*
+ * An address-ordered index of the free physical ranges of the BIOS memory map,
+ * augmented with the largest range size of every subtree. This allows finding
+ * the highest free range that fits an allocation in logarithmic time instead
+ * of scanning the entire memory map.
+ *
+ * The index has no notion of memory types, it must be kept in sync with the
+ * canonical memory map by the caller: every range that becomes free has to be
+ * inserted, and every range that stops being free has to be removed.
+ */
+
+// Inserts a free range, merging it with the adjacent ones if any
+void free_range_index_insert(u64 begin, u64 end);
+
+// Removes a range, which must be fully contained within a single free range
+void free_range_index_remove(u64 begin, u64 end);
+
+/*
+ * Finds the highest address 'bytes' long range that is free and ends at or
+ * below 'limit'. Returns false if there's none.
+ */
+bool free_range_index_find_top_down(u64 bytes, u64 limit, u64 *out_begin);
+
+// Checks whether [begin, end) is fully contained within a single free range
+bool free_range_index_contains(u64 begin, u64 end);
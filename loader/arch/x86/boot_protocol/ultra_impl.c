@@ -58,6 +58,15 @@ u64 ultra_max_binary_address(u32 flags)
     return (4ull * GB) - I686_DIRECT_MAP_BASE;
 }
 
+u64 ultra_huge_page_size(u32 flags)
+{
+    // PAE and long mode tables have 512 entries, classic 32-bit ones 1024
+    if (flags & (HO_X86_LME | HO_X86_PAE))
+        return 2 * MB;
+
+    return 4 * MB;
+}
+
 u64 ultra_direct_map_max_size(u32 flags)
 {
     // The direct map spans the entire (huge) higher half on amd64
@@ -0,0 +1,367 @@
+#define MSG_FMT(msg) "BULK-MEMORY: " msg
+
+#include "common/constants.h"
+#include "common/string.h"
+#include "common/log.h"
+#include "arch/cpuid.h"
+#include "bulk_memory.h"
+#include "services.h"
+
+/*
+ * Anything below this most likely fits in the cache anyway, so let the
+ * regular rep movsb/stosb handle it.
+ */
+#define STREAMING_THRESHOLD (256 * KB)
+
+// Streaming stores are issued a cache line at a time
+#define STREAMING_BLOCK_SIZE 64
+
+// CPUID.01H:EDX
+#define CPUID_FXSR    (1 << 24)
+#define CPUID_SSE     (1 << 25)
+#define CPUID_SSE2    (1 << 26)
+
+// CPUID.01H:ECX
+#define CPUID_XSAVE   (1 << 26)
+#define CPUID_OSXSAVE (1 << 27)
+#define CPUID_AVX     (1 << 28)
+
+#define CR0_MP         (1 << 1)
+#define CR0_EM         (1 << 2)
+#define CR0_TS         (1 << 3)
+#define CR4_OSFXSR     (1 << 9)
+#define CR4_OSXMMEXCPT (1 << 10)
+#define CR4_OSXSAVE    (1 << 18)
+
+#define XCR0_X87_STATE     0b001
+#define XCR0_SSE_AVX_STATE 0b110
+
+enum bulk_engine {
+    BULK_ENGINE_UNKNOWN,
+
+    // rep movsb/stosb
+    BULK_ENGINE_REP,
+
+    // movnti from general purpose registers, needs no extra CPU state
+    BULK_ENGINE_MOVNTI,
+
+    // movntdq from XMM registers
+    BULK_ENGINE_SSE2,
+
+    // vmovntdq from YMM registers
+    BULK_ENGINE_AVX,
+};
+
+static enum bulk_engine engine;
+
+static const char *const engine_names[] = {
+    [BULK_ENGINE_REP] = "rep",
+    [BULK_ENGINE_MOVNTI] = "movnti",
+    [BULK_ENGINE_SSE2] = "sse2",
+    [BULK_ENGINE_AVX] = "avx",
+};
+
+static ptr_t read_cr0(void)
+{
+    ptr_t ret;
+
+    asm volatile("mov %%cr0, %0" : "=r"(ret));
+    return ret;
+}
+
+static ptr_t read_cr4(void)
+{
+    ptr_t ret;
+
+    asm volatile("mov %%cr4, %0" : "=r"(ret));
+    return ret;
+}
+
+static void write_cr0(ptr_t value)
+{
+    asm volatile("mov %0, %%cr0" :: "r"(value));
+}
+
+static void write_cr4(ptr_t value)
+{
+    asm volatile("mov %0, %%cr4" :: "r"(value));
+}
+
+static u32 read_xcr0(void)
+{
+    u32 lo, hi;
+
+    asm volatile("xgetbv" : "=a"(lo), "=d"(hi) : "c"(0));
+    return lo;
+}
+
+static void write_xcr0(u32 value)
+{
+    asm volatile("xsetbv" :: "a"(value), "d"(0), "c"(0));
+}
+
+static struct {
+    bool saved;
+    ptr_t cr0, cr4;
+    u32 xcr0;
+} original_state;
+
+/*
+ * Only done under BIOS, where the loader owns the CPU in protected mode and
+ * nothing but the loader itself ever runs with this state enabled. UEFI
+ * firmware owns CR0/CR4/XCR0 while boot services are live, and its interrupt,
+ * SMM and AP paths don't expect the state to change under them, so there the
+ * routines only use whatever the firmware has already enabled (x86-64 UEFI
+ * guarantees SSE).
+ */
+void bulk_memory_enable_cpu_state(void)
+{
+    struct cpuid_res id;
+    ptr_t cr4;
+
+    if (services_get_provider() != SERVICE_PROVIDER_BIOS)
+        return;
+
+    cpuid(HIGHEST_FUNCTION_PARAMETER_AND_MANUFACTURER_ID_NUMBER, &id);
+    if (id.a < PROCESSOR_INFO_AND_FEATURE_BITS_FUNCTION_NUMBER)
+        return;
+
+    cpuid(PROCESSOR_INFO_AND_FEATURE_BITS_FUNCTION_NUMBER, &id);
+    if ((id.d & (CPUID_FXSR | CPUID_SSE)) != (CPUID_FXSR | CPUID_SSE))
+        return;
+
+    original_state.cr0 = read_cr0();
+    original_state.cr4 = read_cr4();
+    original_state.xcr0 = (original_state.cr4 & CR4_OSXSAVE) ?
+                          read_xcr0() : XCR0_X87_STATE;
+    original_state.saved = true;
+
+    write_cr0((original_state.cr0 & ~CR0_EM) | CR0_MP);
+
+    cr4 = original_state.cr4 | CR4_OSFXSR | CR4_OSXMMEXCPT;
+    if ((id.c & (CPUID_XSAVE | CPUID_AVX)) != (CPUID_XSAVE | CPUID_AVX)) {
+        write_cr4(cr4);
+        return;
+    }
+
+    write_cr4(cr4 | CR4_OSXSAVE);
+    write_xcr0(original_state.xcr0 | XCR0_X87_STATE | XCR0_SSE_AVX_STATE);
+}
+
+void bulk_memory_restore_cpu_state(void)
+{
+    if (!original_state.saved)
+        return;
+
+    // XSETBV faults with CR4.OSXSAVE clear, so this goes first
+    if (read_cr4() & CR4_OSXSAVE)
+        write_xcr0(original_state.xcr0);
+
+    write_cr4(original_state.cr4);
+    write_cr0(original_state.cr0);
+    original_state.saved = false;
+}
+
+/*
+ * Relies on bulk_memory_enable_cpu_state() having run on the BSP, anything it
+ * wasn't able to enable is treated as unusable.
+ */
+static enum bulk_engine detect_engine(void)
+{
+    struct cpuid_res id;
+    bool sse_enabled;
+
+    cpuid(HIGHEST_FUNCTION_PARAMETER_AND_MANUFACTURER_ID_NUMBER, &id);
+    if (id.a < PROCESSOR_INFO_AND_FEATURE_BITS_FUNCTION_NUMBER)
+        return BULK_ENGINE_REP;
+
+    cpuid(PROCESSOR_INFO_AND_FEATURE_BITS_FUNCTION_NUMBER, &id);
+    if (!(id.d & CPUID_SSE2))
+        return BULK_ENGINE_REP;
+
+    sse_enabled = (read_cr4() & CR4_OSFXSR) &&
+                  !(read_cr0() & (CR0_EM | CR0_TS));
+    if (!sse_enabled)
+        return BULK_ENGINE_MOVNTI;
+
+    if ((id.c & CPUID_OSXSAVE) && (id.c & CPUID_AVX) &&
+        (read_xcr0() & XCR0_SSE_AVX_STATE) == XCR0_SSE_AVX_STATE)
+        return BULK_ENGINE_AVX;
+
+    return BULK_ENGINE_SSE2;
+}
+
+/*
+ * Work is also dispatched to application processors (see parallel.h), which
+ * the firmware isn't required to set up with the BSP's vector state, so
+ * downgrade the engine if it's not usable on the CPU we're running on.
+ */
+static enum bulk_engine engine_for_this_cpu(enum bulk_engine e)
+{
+    ptr_t cr4;
+
+    if (e < BULK_ENGINE_SSE2)
+        return e;
+
+    cr4 = read_cr4();
+    if (!(cr4 & CR4_OSFXSR) || (read_cr0() & (CR0_EM | CR0_TS)))
+        return BULK_ENGINE_MOVNTI;
+
+    if (e == BULK_ENGINE_AVX &&
+        (!(cr4 & CR4_OSXSAVE) ||
+         (read_xcr0() & XCR0_SSE_AVX_STATE) != XCR0_SSE_AVX_STATE))
+        return BULK_ENGINE_SSE2;
+
+    return e;
+}
+
+static enum bulk_engine get_engine(void)
+{
+    if (unlikely(engine == BULK_ENGINE_UNKNOWN)) {
+        engine = detect_engine();
+        print_info("using %s for large copies\n", engine_names[engine]);
+    }
+
+    return engine_for_this_cpu(engine);
+}
+
+/*
+ * NOTE: the loader is built with -mno-sse, so the compiler never allocates
+ * vector registers on its own and they can't be listed as clobbers either.
+ * Each asm block below is self-contained and only uses registers that are
+ * volatile in both the SysV and the Microsoft ABI.
+ */
+
+static void stream_block_copy(enum bulk_engine e, void *dest, const void *src)
+{
+    switch (e) {
+    case BULK_ENGINE_AVX:
+        asm volatile(
+            "vmovdqu   (%1), %%ymm0\n"
+            "vmovdqu 32(%1), %%ymm1\n"
+            "vmovntdq %%ymm0,   (%0)\n"
+            "vmovntdq %%ymm1, 32(%0)\n"
+            :: "r"(dest), "r"(src) : "memory"
+        );
+        break;
+    case BULK_ENGINE_SSE2:
+        asm volatile(
+            "movdqu   (%1), %%xmm0\n"
+            "movdqu 16(%1), %%xmm1\n"
+            "movdqu 32(%1), %%xmm2\n"
+            "movdqu 48(%1), %%xmm3\n"
+            "movntdq %%xmm0,   (%0)\n"
+            "movntdq %%xmm1, 16(%0)\n"
+            "movntdq %%xmm2, 32(%0)\n"
+            "movntdq %%xmm3, 48(%0)\n"
+            :: "r"(dest), "r"(src) : "memory"
+        );
+        break;
+    default: {
+        const size_t *s = src;
+        size_t *d = dest;
+        size_t i;
+
+        for (i = 0; i < STREAMING_BLOCK_SIZE / sizeof(size_t); ++i)
+            asm volatile("movnti %1, %0" : "=m"(d[i]) : "r"(s[i]));
+        break;
+    }
+    }
+}
+
+static void stream_block_zero(enum bulk_engine e, void *dest)
+{
+    switch (e) {
+    case BULK_ENGINE_AVX:
+        asm volatile(
+            "vxorps %%ymm0, %%ymm0, %%ymm0\n"
+            "vmovntps %%ymm0,   (%0)\n"
+            "vmovntps %%ymm0, 32(%0)\n"
+            :: "r"(dest) : "memory"
+        );
+        break;
+    case BULK_ENGINE_SSE2:
+        asm volatile(
+            "pxor %%xmm0, %%xmm0\n"
+            "movntdq %%xmm0,   (%0)\n"
+            "movntdq %%xmm0, 16(%0)\n"
+            "movntdq %%xmm0, 32(%0)\n"
+            "movntdq %%xmm0, 48(%0)\n"
+            :: "r"(dest) : "memory"
+        );
+        break;
+    default: {
+        size_t *d = dest;
+        size_t i;
+
+        for (i = 0; i < STREAMING_BLOCK_SIZE / sizeof(size_t); ++i)
+            asm volatile("movnti %1, %0" : "=m"(d[i]) : "r"((size_t)0));
+        break;
+    }
+    }
+}
+
+static void stream_finish(enum bulk_engine e)
+{
+    // Avoid AVX-SSE transition penalties in whatever runs next
+    if (e == BULK_ENGINE_AVX)
+        asm volatile("vzeroupper");
+
+    // Streaming stores are weakly ordered, make them visible before returning
+    asm volatile("sfence" ::: "memory");
+}
+
+static size_t bytes_to_block_alignment(void *dest)
+{
+    return -(ptr_t)dest & (STREAMING_BLOCK_SIZE - 1);
+}
+
+void bulk_copy(void *dest, const void *src, size_t count)
+{
+    enum bulk_engine e;
+    size_t head;
+
+    if (count < STREAMING_THRESHOLD || (e = get_engine()) == BULK_ENGINE_REP) {
+        memcpy(dest, src, count);
+        return;
+    }
+
+    head = bytes_to_block_alignment(dest);
+    memcpy(dest, src, head);
+    dest += head;
+    src += head;
+    count -= head;
+
+    for (; count >= STREAMING_BLOCK_SIZE; count -= STREAMING_BLOCK_SIZE) {
+        stream_block_copy(e, dest, src);
+        dest += STREAMING_BLOCK_SIZE;
+        src += STREAMING_BLOCK_SIZE;
+    }
+
+    stream_finish(e);
+    memcpy(dest, src, count);
+}
+
+void bulk_zero(void *dest, size_t count)
+{
+    enum bulk_engine e;
+    size_t head;
+
+    if (count < STREAMING_THRESHOLD || (e = get_engine()) == BULK_ENGINE_REP) {
+        memzero(dest, count);
+        return;
+    }
+
+    head = bytes_to_block_alignment(dest);
+    memzero(dest, head);
+    dest += head;
+    count -= head;
+
+    for (; count >= STREAMING_BLOCK_SIZE; count -= STREAMING_BLOCK_SIZE) {
+        stream_block_zero(e, dest);
+        dest += STREAMING_BLOCK_SIZE;
+    }
+
+    stream_finish(e);
+    memzero(dest, count);
+}
@@ -2,13 +2,7 @@
 #include "common/string_view.h"
 
 #include "handover.h"
-
-struct cpuid_res {
-    u32 a;
-    u32 b;
-    u32 c;
-    u32 d;
-};
+#include "arch/cpuid.h"
 
 void cpuid(u32 function, struct cpuid_res *id)
 {
@@ -17,6 +11,22 @@ void cpuid(u32 function, struct cpuid_res *id)
         : "a"(function), "c"(0));
 }
 
+bool cpuid_is_extended_function_supported(u32 function)
+{
+    struct cpuid_res id;
+    u32 highest_number;
+
+    cpuid(HIGHEST_IMPLEMENTED_EXTENDED_FUNCTION_NUMBER, &id);
+    highest_number = id.a;
+
+    // Guard against bogus function numbers if it's not supported
+    if ((highest_number <= HIGHEST_IMPLEMENTED_EXTENDED_FUNCTION_NUMBER) ||
+       ((highest_number - HIGHEST_IMPLEMENTED_EXTENDED_FUNCTION_NUMBER) > 0xFF))
+        return false;
+
+    return function <= highest_number;
+}
+
 
 static u64 get_i686_higher_half_length(u64 direct_map_base)
 {
@@ -69,12 +79,6 @@ struct string_view handover_flags_to_string[32] = {
     [HO_X86_LA57_BIT] = SV("5-Level Paging"),
 };
 
-#define HIGHEST_FUNCTION_PARAMETER_AND_MANUFACTURER_ID_NUMBER 0x00000000
-#define PROCESSOR_INFO_AND_FEATURE_BITS_FUNCTION_NUMBER       0x00000001
-#define EXTENDED_FEATURES_FUNCTION_NUMBER                     0x00000007
-#define HIGHEST_IMPLEMENTED_EXTENDED_FUNCTION_NUMBER          0x80000000
-#define EXTENDED_PROCESSOR_INFO_FUNCTION_NUMBER               0x80000001
-
 #define CPUID_LONG_MODE (1 << 29)
 #define CPUID_PSE       (1 << 3)
 #define CPUID_PAE       (1 << 6)
@@ -99,12 +103,8 @@ void initialize_flags_map(void)
         handover_flags_map[HO_X86_LA57_BIT] = id.c & CPUID_LA57;
     }
 
-    cpuid(HIGHEST_IMPLEMENTED_EXTENDED_FUNCTION_NUMBER, &id);
-    highest_number = id.a;
-
-    // Guard against bogus function numbers if it's not supported
-    if ((highest_number <= HIGHEST_IMPLEMENTED_EXTENDED_FUNCTION_NUMBER) ||
-       ((highest_number - HIGHEST_IMPLEMENTED_EXTENDED_FUNCTION_NUMBER) > 0xFF))
+    if (!cpuid_is_extended_function_supported(
+            EXTENDED_PROCESSOR_INFO_FUNCTION_NUMBER))
         return;
 
     cpuid(EXTENDED_PROCESSOR_INFO_FUNCTION_NUMBER, &id);
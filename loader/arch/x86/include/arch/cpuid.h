@@ -0,0 +1,22 @@
+#pragma once
+
+#include "common/types.h"
+
+struct cpuid_res {
+    u32 a;
+    u32 b;
+    u32 c;
+    u32 d;
+};
+
+#define HIGHEST_FUNCTION_PARAMETER_AND_MANUFACTURER_ID_NUMBER 0x00000000
+#define PROCESSOR_INFO_AND_FEATURE_BITS_FUNCTION_NUMBER       0x00000001
+#define EXTENDED_FEATURES_FUNCTION_NUMBER                     0x00000007
+#define TSC_AND_CRYSTAL_FREQUENCY_FUNCTION_NUMBER             0x00000015
+#define HIGHEST_IMPLEMENTED_EXTENDED_FUNCTION_NUMBER          0x80000000
+#define EXTENDED_PROCESSOR_INFO_FUNCTION_NUMBER               0x80000001
+
+void cpuid(u32 function, struct cpuid_res *id);
+
+// Checks whether an extended (0x8000XXXX) function number is implemented
+bool cpuid_is_extended_function_supported(u32 function);
@@ -0,0 +1,29 @@
+#pragma once
+
+#include "common/types.h"
+#include "arch/cpuid.h"
+
+static inline u64 arch_read_timestamp(void)
+{
+    u32 lo, hi;
+
+    asm volatile("rdtsc" : "=a"(lo), "=d"(hi));
+    return ((u64)hi << 32) | lo;
+}
+
+// Returns the TSC frequency in Hz, or 0 if the CPU doesn't enumerate it
+static inline u64 arch_timestamp_frequency(void)
+{
+    struct cpuid_res id;
+
+    cpuid(HIGHEST_FUNCTION_PARAMETER_AND_MANUFACTURER_ID_NUMBER, &id);
+    if (id.a < TSC_AND_CRYSTAL_FREQUENCY_FUNCTION_NUMBER)
+        return 0;
+
+    // EAX/EBX is the TSC to crystal clock ratio, ECX is the crystal frequency
+    cpuid(TSC_AND_CRYSTAL_FREQUENCY_FUNCTION_NUMBER, &id);
+    if (!id.a || !id.b || !id.c)
+        return 0;
+
+    return ((u64)id.c * id.b) / id.a;
+}
@@ -0,0 +1,137 @@
+#include "common/minmax.h"
+#include "serial.h"
+#include "pio.h"
+
+#define DATA_REGISTER_BAUD_LO 0
+#define INTERRUPT_ENABLE_REGISTER_BAUD_HI 1
+#define FIFO_CONTROL_REGISTER 2
+#define INTERRUPT_IDENTIFICATION_REGISTER 2
+#define LINE_CONTROL_REGISTER 3
+#define MODEM_CONTROL_REGISTER 4
+#define LINE_STATUS_REGISTER 5
+#define SCRATCH_REGISTER 7
+
+#define SET_BAUD_MODE (1 << 7)
+#define DATA_WIDTH_8 (0b11)
+#define STOP_BIT_1 (0b0 << 2)
+#define PARITY_MODE_NONE (0b000 << 3)
+#define INTERRUPT_MODE_NONE (0b0000)
+
+#define FIFO_ENABLE (1 << 0)
+#define FIFO_CLEAR_RX (1 << 1)
+#define FIFO_CLEAR_TX (1 << 2)
+#define FIFO_64_BYTES (1 << 5)
+#define FIFO_TRIGGER_14 (0b11 << 6)
+
+#define IIR_FIFO_ENABLED (0b11 << 6)
+#define IIR_FIFO_64_BYTES (1 << 5)
+
+#define MODEM_DTR (1 << 0)
+#define MODEM_RTS (1 << 1)
+
+#define STATUS_THR_EMPTY (1 << 5)
+
+static u16 serial_port = SERIAL_COM1;
+static size_t fifo_size = 1;
+static bool serial_present;
+
+static void wait_for_thr_empty(u16 port)
+{
+    while ((in8(port + LINE_STATUS_REGISTER) & STATUS_THR_EMPTY) == 0)
+        ;
+}
+
+// Scratch register round trip, an empty port reads back all ones
+static bool uart_present(u16 port)
+{
+    out8(port + SCRATCH_REGISTER, 0x5A);
+    if (in8(port + SCRATCH_REGISTER) != 0x5A)
+        return false;
+
+    out8(port + SCRATCH_REGISTER, 0xA5);
+    return in8(port + SCRATCH_REGISTER) == 0xA5;
+}
+
+/*
+ * The 64-byte mode bit is only writable on a 16750, and only while DLAB is
+ * set, so this must be called during divisor programming. Other UARTs ignore
+ * the bit and take the rest of the FCR with DLAB set just the same.
+ */
+static void enable_fifo(u16 port)
+{
+    out8(port + FIFO_CONTROL_REGISTER, FIFO_ENABLE | FIFO_CLEAR_RX |
+                                       FIFO_CLEAR_TX | FIFO_64_BYTES |
+                                       FIFO_TRIGGER_14);
+}
+
+// Reads back what enable_fifo() managed to turn on, DLAB must be clear
+static size_t detect_fifo_size(u16 port)
+{
+    u8 iir;
+
+    iir = in8(port + INTERRUPT_IDENTIFICATION_REGISTER);
+    if ((iir & IIR_FIFO_ENABLED) != IIR_FIFO_ENABLED)
+        return 1;
+
+    return (iir & IIR_FIFO_64_BYTES) ? 64 : 16;
+}
+
+bool serial_configure(const struct serial_config *config)
+{
+    u32 clock_hz = config->clock_hz ?: SERIAL_DEFAULT_CLOCK_HZ;
+    u16 port = config->port;
+    u32 divisor;
+
+    if (!config->baud_rate)
+        return false;
+
+    divisor = clock_hz / (16 * config->baud_rate);
+    if (!divisor || divisor > 0xFFFF)
+        return false;
+
+    if (!uart_present(port))
+        return false;
+
+    // Let whatever is still in the old FIFO drain at the old rate
+    if (serial_present)
+        wait_for_thr_empty(serial_port);
+
+    out8(port + INTERRUPT_ENABLE_REGISTER_BAUD_HI, INTERRUPT_MODE_NONE);
+
+    out8(port + LINE_CONTROL_REGISTER, SET_BAUD_MODE);
+    out8(port + DATA_REGISTER_BAUD_LO, divisor & 0xFF);
+    out8(port + INTERRUPT_ENABLE_REGISTER_BAUD_HI, divisor >> 8);
+    enable_fifo(port);
+
+    out8(port + LINE_CONTROL_REGISTER, DATA_WIDTH_8 | STOP_BIT_1 | PARITY_MODE_NONE);
+    out8(port + MODEM_CONTROL_REGISTER, MODEM_DTR | MODEM_RTS);
+
+    serial_port = port;
+    fifo_size = detect_fifo_size(port);
+    serial_present = true;
+
+    return true;
+}
+
+void serial_write(const char *msg, size_t len)
+{
+    size_t i, burst;
+
+    if (!serial_present)
+        return;
+
+    /*
+     * THRE means the whole transmit FIFO is empty, so it can take up to
+     * 'fifo_size' bytes back to back without polling in between.
+     */
+    while (len) {
+        wait_for_thr_empty(serial_port);
+
+        burst = MIN(len, fifo_size);
+        for (i = 0; i < burst; ++i)
+            out8(serial_port + DATA_REGISTER_BAUD_LO, msg[i]);
+
+        msg += burst;
+        len -= burst;
+    }
+}
@@ -0,0 +1,409 @@
+#define MSG_FMT(msg) "SMP-X86: " msg
+
+#include "common/align.h"
+#include "common/log.h"
+#include "common/minmax.h"
+#include "common/string.h"
+#include "acpi.h"
+#include "allocator.h"
+#include "handover.h"
+#include "services.h"
+#include "smp.h"
+#include "arch/cpuid.h"
+#include "arch/timestamp.h"
+
+#define IA32_APIC_BASE_MSR       0x1B
+#define IA32_APIC_BASE_X2APIC    (1 << 10)
+#define IA32_APIC_BASE_ADDR_MASK 0xFFFFFF000ull
+
+#define X2APIC_ICR_MSR 0x830
+
+#define XAPIC_ICR_LOW  0x300
+#define XAPIC_ICR_HIGH 0x310
+
+#define ICR_DELIVERY_MODE_INIT    (0b101 << 8)
+#define ICR_DELIVERY_MODE_STARTUP (0b110 << 8)
+#define ICR_DELIVERY_STATUS       (1 << 12)
+#define ICR_LEVEL_ASSERT          (1 << 14)
+
+#define XAPIC_MAX_ID 0xFE
+
+// Intel SDM Vol. 3A 9.4.4.1 Typical BSP Initialization Sequence
+#define INIT_DELAY_US    (10 * 1000)
+#define STARTUP_DELAY_US 200
+
+#define EXTENDED_TOPOLOGY_FUNCTION_NUMBER 0x0000000B
+
+#define GDT_CODE32 0x00CF9A000000FFFFull
+#define GDT_DATA32 0x00CF92000000FFFFull
+#define GDT_CODE64 0x00AF9A000000FFFFull
+
+#define CODE32_SELECTOR 0x08
+#define CODE64_SELECTOR 0x18
+
+// Make sure this is aligned with the struc in smp_trampoline.asm
+struct x86_smp_trampoline_data {
+    u16 reserved0;
+    u16 gdt_limit;
+    u32 gdt_base;
+    u32 pm_entry_offset;
+    u16 pm_entry_selector;
+    u16 reserved1;
+    u32 lm_entry_offset;
+    u16 lm_entry_selector;
+    u16 reserved2;
+    u32 cr3;
+    u32 cr4;
+    u64 direct_map_base;
+    u64 cpus;
+    u64 cpus_pointer_base;
+    u32 cpu_count;
+    u8 is_long_mode;
+    u8 use_x2apic_id;
+    u16 reserved3;
+    u64 gdt[4];
+};
+BUILD_BUG_ON(offsetof(struct x86_smp_trampoline_data, cr3) != 24);
+BUILD_BUG_ON(offsetof(struct x86_smp_trampoline_data, gdt) != 64);
+
+extern char smp_trampoline_begin[];
+extern char smp_trampoline_pm_entry[];
+extern char smp_trampoline_lm_entry[];
+extern char smp_trampoline_data[];
+extern char smp_trampoline_end[];
+
+static bool x2apic_enabled;
+static ptr_t xapic_base;
+
+static u64 rdmsr(u32 msr)
+{
+    u32 lo, hi;
+
+    asm volatile("rdmsr" : "=a"(lo), "=d"(hi) : "c"(msr));
+    return ((u64)hi << 32) | lo;
+}
+
+static void wrmsr(u32 msr, u64 value)
+{
+    asm volatile("wrmsr" :: "c"(msr), "a"((u32)value), "d"((u32)(value >> 32)));
+}
+
+static void detect_apic_mode(void)
+{
+    u64 apic_base = rdmsr(IA32_APIC_BASE_MSR);
+
+    x2apic_enabled = apic_base & IA32_APIC_BASE_X2APIC;
+    xapic_base = apic_base & IA32_APIC_BASE_ADDR_MASK;
+}
+
+static bool has_extended_topology(void)
+{
+    struct cpuid_res id;
+
+    cpuid(HIGHEST_FUNCTION_PARAMETER_AND_MANUFACTURER_ID_NUMBER, &id);
+    return id.a >= EXTENDED_TOPOLOGY_FUNCTION_NUMBER;
+}
+
+/*
+ * Must match what the trampoline does to find its own descriptor. In x2APIC
+ * mode IDs may be wider than 8 bits, in which case only the extended topology
+ * leaf is able to report them.
+ */
+static bool use_x2apic_id(void)
+{
+    return x2apic_enabled && has_extended_topology();
+}
+
+static u32 current_apic_id(void)
+{
+    struct cpuid_res id;
+
+    if (use_x2apic_id()) {
+        cpuid(EXTENDED_TOPOLOGY_FUNCTION_NUMBER, &id);
+        return id.d;
+    }
+
+    cpuid(PROCESSOR_INFO_AND_FEATURE_BITS_FUNCTION_NUMBER, &id);
+    return id.b >> 24;
+}
+
+struct enumerate_ctx {
+    struct smp_cpu *cpus;
+    size_t capacity;
+    size_t count;
+    u32 bsp_id;
+};
+
+static bool is_duplicate(struct enumerate_ctx *ctx, u32 apic_id)
+{
+    size_t i;
+
+    for (i = 0; i < MIN(ctx->count, ctx->capacity); ++i) {
+        if (ctx->cpus[i].hardware_id == apic_id)
+            return true;
+    }
+
+    return false;
+}
+
+static void add_cpu(struct enumerate_ctx *ctx, u32 apic_id, u32 uid, u32 flags)
+{
+    struct smp_cpu *cpu;
+
+    if (!(flags & ACPI_MADT_LAPIC_ENABLED))
+        return;
+
+    if (!x2apic_enabled && apic_id > XAPIC_MAX_ID) {
+        print_warn("skipping CPU %u, not addressable in xAPIC mode\n", apic_id);
+        return;
+    }
+
+    // Firmware is allowed to list the same CPU as both an xAPIC and an x2APIC
+    if (ctx->cpus && is_duplicate(ctx, apic_id))
+        return;
+
+    if (ctx->count++ >= ctx->capacity)
+        return;
+
+    cpu = &ctx->cpus[ctx->count - 1];
+    cpu->hardware_id = apic_id;
+    cpu->acpi_uid = uid;
+
+    if (apic_id == ctx->bsp_id)
+        cpu->flags |= SMP_CPU_BSP;
+}
+
+static bool madt_add_cpu(void *user, const struct acpi_madt_entry_header *entry)
+{
+    struct enumerate_ctx *ctx = user;
+
+    switch (entry->type) {
+    case ACPI_MADT_ENTRY_TYPE_LAPIC: {
+        const struct acpi_madt_lapic *lapic = (const void*)entry;
+
+        if (entry->length < sizeof(*lapic))
+            break;
+
+        add_cpu(ctx, lapic->apic_id, lapic->acpi_processor_uid, lapic->flags);
+        break;
+    }
+    case ACPI_MADT_ENTRY_TYPE_X2APIC: {
+        const struct acpi_madt_x2apic *x2apic = (const void*)entry;
+
+        if (entry->length < sizeof(*x2apic))
+            break;
+
+        add_cpu(ctx, x2apic->x2apic_id, x2apic->acpi_processor_uid,
+                x2apic->flags);
+        break;
+    }
+    default:
+        break;
+    }
+
+    return true;
+}
+
+size_t smp_arch_enumerate(struct smp_cpu *cpus, size_t capacity)
+{
+    const struct acpi_madt *madt;
+    ptr_t rsdp;
+    struct enumerate_ctx ctx = {
+        .cpus = cpus,
+        .capacity = capacity,
+    };
+
+    rsdp = services_find_rsdp();
+    if (!rsdp)
+        return 0;
+
+    madt = (const struct acpi_madt*)acpi_find_table(rsdp, "APIC");
+    if (!madt) {
+        print_warn("no MADT found\n");
+        return 0;
+    }
+
+    detect_apic_mode();
+    ctx.bsp_id = current_apic_id();
+
+    acpi_madt_foreach(madt, madt_add_cpu, &ctx);
+
+    /*
+     * The counting pass can't filter duplicates without somewhere to store
+     * the IDs, so it's merely an upper bound, the filling pass is exact.
+     */
+    return cpus ? MIN(ctx.count, capacity) : ctx.count;
+}
+
+static void send_ipi(u32 apic_id, u32 command)
+{
+    volatile u32 *icr_low, *icr_high;
+
+    if (x2apic_enabled) {
+        wrmsr(X2APIC_ICR_MSR, ((u64)apic_id << 32) | command);
+        return;
+    }
+
+    icr_low = ADDR_TO_PTR(xapic_base + XAPIC_ICR_LOW);
+    icr_high = ADDR_TO_PTR(xapic_base + XAPIC_ICR_HIGH);
+
+    *icr_high = apic_id << 24;
+    *icr_low = command;
+
+    while (*icr_low & ICR_DELIVERY_STATUS)
+        asm volatile("pause");
+}
+
+static void send_to_pending(struct smp_cpu *cpus, size_t count, u32 command)
+{
+    size_t i;
+
+    for (i = 0; i < count; ++i) {
+        volatile u32 *flags = &cpus[i].flags;
+
+        if (*flags & (SMP_CPU_BSP | SMP_CPU_PARKED))
+            continue;
+
+        send_ipi(cpus[i].hardware_id, command);
+    }
+}
+
+static ptr_t trampoline_setup(struct handover_info *hi, struct smp_cpu *cpus,
+                              size_t count, u64 pointer_offset)
+{
+    struct x86_smp_trampoline_data *data;
+    size_t tramp_size = smp_trampoline_end - smp_trampoline_begin;
+    ptr_t tramp;
+    struct allocation_spec as = {
+        // Must be addressable by the STARTUP IPI vector
+        .ceiling = 1 * MB,
+        .pages = 1
+    };
+
+    BUILD_BUG_ON(sizeof(struct smp_cpu) != 64);
+    BUG_ON(tramp_size > PAGE_SIZE);
+
+    tramp = allocate_pages_ex(&as);
+    if (!tramp) {
+        print_warn("failed to allocate a trampoline page below 1MiB\n");
+        return 0;
+    }
+
+    memcpy(ADDR_TO_PTR(tramp), smp_trampoline_begin, tramp_size);
+    data = ADDR_TO_PTR(tramp + (smp_trampoline_data - smp_trampoline_begin));
+
+    data->gdt[1] = GDT_CODE32;
+    data->gdt[2] = GDT_DATA32;
+    data->gdt[3] = GDT_CODE64;
+    data->gdt_limit = sizeof(data->gdt) - 1;
+    data->gdt_base = (ptr_t)data->gdt;
+
+    data->pm_entry_offset = tramp + (smp_trampoline_pm_entry -
+                                     smp_trampoline_begin);
+    data->pm_entry_selector = CODE32_SELECTOR;
+    data->lm_entry_offset = tramp + (smp_trampoline_lm_entry -
+                                     smp_trampoline_begin);
+    data->lm_entry_selector = CODE64_SELECTOR;
+
+    data->cr3 = pt_get_root(&hi->pt);
+    // Exactly what the BSP is handed over with, see kernel_handover()
+    data->cr4 = handover_flags_to_cr4(hi->flags);
+    data->is_long_mode = hi->flags & HO_X86_LME;
+    data->use_x2apic_id = use_x2apic_id();
+
+    data->direct_map_base = hi->direct_map_base;
+    data->cpus = (ptr_t)cpus + hi->direct_map_base;
+    data->cpus_pointer_base = (ptr_t)cpus + pointer_offset;
+    data->cpu_count = count;
+
+    return tramp;
+}
+
+static void send_startup_sequence(struct smp_cpu *cpus, size_t count,
+                                  u8 vector, void (*stall)(u32 us))
+{
+    /*
+     * Every CPU gets its INIT before any of them gets a STARTUP so that the
+     * mandatory delays are only paid once instead of once per CPU.
+     */
+    send_to_pending(cpus, count, ICR_DELIVERY_MODE_INIT | ICR_LEVEL_ASSERT);
+    stall(INIT_DELAY_US);
+
+    send_to_pending(cpus, count, ICR_DELIVERY_MODE_STARTUP | vector);
+    stall(STARTUP_DELAY_US);
+
+    // CPUs that already got going ignore the second STARTUP anyway
+    send_to_pending(cpus, count, ICR_DELIVERY_MODE_STARTUP | vector);
+}
+
+#define TSC_CALIBRATION_US (10 * 1000)
+
+static u8 deferred_vector;
+static u64 tsc_ticks_per_us;
+
+/*
+ * Stall() is gone along with the rest of boot services by the time the
+ * deferred start happens, so the delays are measured with the TSC instead.
+ * Calibrate it against Stall() while that's still around, unless the CPU
+ * enumerates its frequency.
+ */
+static void tsc_calibrate(void)
+{
+    u64 frequency = arch_timestamp_frequency();
+    u64 begin;
+
+    if (frequency) {
+        tsc_ticks_per_us = frequency / (1000 * 1000);
+    } else {
+        begin = arch_read_timestamp();
+        services_stall(TSC_CALIBRATION_US);
+        tsc_ticks_per_us = (arch_read_timestamp() - begin) / TSC_CALIBRATION_US;
+    }
+
+    // Err on the side of waiting too long
+    tsc_ticks_per_us = MAX(tsc_ticks_per_us, 1ull);
+}
+
+void smp_arch_deferred_stall(u32 us)
+{
+    u64 end = arch_read_timestamp() + us * tsc_ticks_per_us;
+
+    while (arch_read_timestamp() < end)
+        asm volatile("pause");
+}
+
+enum smp_start_result smp_arch_start(struct handover_info *hi,
+                                     struct smp_cpu *cpus, size_t count,
+                                     u64 pointer_offset)
+{
+    ptr_t tramp;
+    u8 vector;
+
+    tramp = trampoline_setup(hi, cpus, count, pointer_offset);
+    if (!tramp)
+        return SMP_START_FAILED;
+
+    vector = tramp >> PAGE_SHIFT;
+    print_info("starting APs via INIT-SIPI-SIPI, trampoline at 0x%08X (%s)\n",
+               (u32)tramp, x2apic_enabled ? "x2APIC" : "xAPIC");
+
+    /*
+     * EDK2's MpInitLib re-INITs every AP from its ExitBootServices() callback
+     * and parks it in a loop of its own, so anything started before that is
+     * lost. Wake them up once the firmware is out of the picture instead.
+     */
+    if (services_get_provider() == SERVICE_PROVIDER_UEFI) {
+        tsc_calibrate();
+        deferred_vector = vector;
+        return SMP_START_DEFERRED;
+    }
+
+    send_startup_sequence(cpus, count, vector, services_stall);
+    return SMP_START_SENT;
+}
+
+void smp_arch_start_deferred(struct smp_cpu *cpus, size_t count)
+{
+    send_startup_sequence(cpus, count, deferred_vector,
+                          smp_arch_deferred_stall);
+}
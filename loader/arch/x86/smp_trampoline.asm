@@ -0,0 +1,320 @@
+; Application processor wake-up trampoline.
+;
+; This is never executed in place, smp_arch_start() copies everything between
+; smp_trampoline_begin and smp_trampoline_end to a page below 1MiB and points
+; the STARTUP IPI at it. All of the code below must therefore be position
+; independent: it only ever addresses itself relative to the page base, which
+; is derived from CS in real mode.
+;
+; Every AP goes real mode -> protected mode -> (long mode) with the kernel's
+; page table, then jumps to the direct map copy of the page and parks there,
+; spinning on its own 'struct smp_cpu' until the kernel releases it. Nothing
+; here needs a stack, APs only get one once released.
+
+section .text
+
+CR0_PE:              equ (1 << 0)
+CR0_NW:              equ (1 << 29)
+CR0_CD:              equ (1 << 30)
+CR0_PG:              equ (1 << 31)
+EFER_NUMBER:         equ 0xC0000080
+LONG_MODE_BIT:       equ (1 << 8)
+EFLAGS_RESERVED_BIT: equ (1 << 1)
+
+CODE32_SELECTOR: equ 0x08
+DATA32_SELECTOR: equ 0x10
+CODE64_SELECTOR: equ 0x18
+
+SMP_CPU_PARKED: equ (1 << 1)
+
+; Make sure this is aligned with struct smp_cpu in include/smp.h
+struc smp_cpu
+    .hardware_id: resq 1
+    .entrypoint:  resq 1
+    .stack:       resq 1
+    .argument:    resq 1
+    .acpi_uid:    resd 1
+    .flags:       resd 1
+    .reserved:    resq 3
+endstruc
+
+; Make sure this is aligned with struct x86_smp_trampoline_data in smp.c
+struc x86_smp_trampoline_data
+    .reserved0:           resw 1
+    .gdt_limit:           resw 1
+    .gdt_base:            resd 1
+    .pm_entry_offset:     resd 1
+    .pm_entry_selector:   resw 1
+    .reserved1:           resw 1
+    .lm_entry_offset:     resd 1
+    .lm_entry_selector:   resw 1
+    .reserved2:           resw 1
+    .cr3:                 resd 1
+    .cr4:                 resd 1
+    .direct_map_base:     resq 1
+    .cpus:                resq 1
+    .cpus_pointer_base:   resq 1
+    .cpu_count:           resd 1
+    .is_long_mode:        resb 1
+    .use_x2apic_id:       resb 1
+    .reserved3:           resw 1
+    .gdt:                 resq 4
+endstruc
+
+%define TRAMPOLINE_OFFSET(label) ((label) - smp_trampoline_begin)
+%define DATA_OFFSET TRAMPOLINE_OFFSET(smp_trampoline_data)
+
+BITS 16
+global smp_trampoline_begin
+smp_trampoline_begin:
+    cli
+    cld
+
+    mov ax, cs
+    mov ds, ax
+
+    ; Page base, used for all addressing from now on
+    xor ebx, ebx
+    mov bx, ax
+    shl ebx, 4
+
+    o32 lgdt [DATA_OFFSET + x86_smp_trampoline_data.gdt_limit]
+
+    mov eax, cr0
+    or eax, CR0_PE
+    mov cr0, eax
+
+    jmp far dword [DATA_OFFSET + x86_smp_trampoline_data.pm_entry_offset]
+
+BITS 32
+global smp_trampoline_pm_entry
+smp_trampoline_pm_entry:
+    mov ax, DATA32_SELECTOR
+    mov ds, ax
+    mov es, ax
+    mov fs, ax
+    mov gs, ax
+    mov ss, ax
+
+    lea esi, [ebx + DATA_OFFSET]
+
+    mov eax, [esi + x86_smp_trampoline_data.cr4]
+    mov cr4, eax
+
+    mov eax, [esi + x86_smp_trampoline_data.cr3]
+    mov cr3, eax
+
+    mov al, [esi + x86_smp_trampoline_data.is_long_mode]
+    test al, al
+    jz .enable_paging
+
+    mov ecx, EFER_NUMBER
+    rdmsr
+    or eax, LONG_MODE_BIT
+    wrmsr
+
+.enable_paging:
+    ; INIT leaves the caches disabled, turn them back on as well
+    mov eax, cr0
+    and eax, ~(CR0_CD | CR0_NW)
+    or eax, CR0_PG
+    mov cr0, eax
+
+    mov al, [esi + x86_smp_trampoline_data.is_long_mode]
+    test al, al
+    jz .i386
+
+    jmp far dword [esi + x86_smp_trampoline_data.lm_entry_offset]
+
+.i386:
+    mov eax, [esi + x86_smp_trampoline_data.direct_map_base]
+    lea ecx, [ebx + eax + TRAMPOLINE_OFFSET(park_i386)]
+    add esi, eax
+    jmp ecx
+
+; ============================ i386 parking code =============================
+; esi -> trampoline data (direct map)
+park_i386:
+    mov al, [esi + x86_smp_trampoline_data.use_x2apic_id]
+    test al, al
+    jz .xapic_id
+
+    mov eax, 0x0B
+    xor ecx, ecx
+    cpuid
+    jmp .have_id
+
+.xapic_id:
+    mov eax, 0x01
+    cpuid
+    shr ebx, 24
+    mov edx, ebx
+
+.have_id:
+    mov edi, [esi + x86_smp_trampoline_data.cpus]
+    mov ecx, [esi + x86_smp_trampoline_data.cpu_count]
+
+.next_cpu:
+    test ecx, ecx
+    jz .not_found
+
+    cmp [edi + smp_cpu.hardware_id], edx
+    jne .skip_cpu
+    cmp dword [edi + smp_cpu.hardware_id + 4], 0
+    je .found
+
+.skip_cpu:
+    add edi, smp_cpu_size
+    dec ecx
+    jmp .next_cpu
+
+.not_found:
+    cli
+    hlt
+    jmp .not_found
+
+.found:
+    ; The descriptor pointer as the kernel sees it
+    mov ebp, edi
+    sub ebp, [esi + x86_smp_trampoline_data.cpus]
+    add ebp, [esi + x86_smp_trampoline_data.cpus_pointer_base]
+
+    lock or dword [edi + smp_cpu.flags], SMP_CPU_PARKED
+
+.spin:
+    pause
+    mov eax, [edi + smp_cpu.entrypoint]
+    test eax, eax
+    jz .spin
+
+    ; The lower half might've been unmapped since we loaded CR3
+    mov ecx, cr3
+    mov cr3, ecx
+
+    mov esp, [edi + smp_cpu.stack]
+
+    ; SysV ABI alignment
+    push dword 0x00000000
+    push dword 0x00000000
+
+    push dword [edi + smp_cpu.argument]
+    push ebp
+
+    push dword 0x00000000 ; fake ret address
+    push eax
+
+    xor eax, eax
+    xor ecx, ecx
+    xor edx, edx
+    xor ebx, ebx
+    xor ebp, ebp
+    xor esi, esi
+    xor edi, edi
+
+    push dword 0x00000000 | EFLAGS_RESERVED_BIT
+    popfd
+
+    ret
+
+; ============================ amd64 parking code ============================
+BITS 64
+global smp_trampoline_lm_entry
+smp_trampoline_lm_entry:
+    ; Upper halves are undefined after the mode switch
+    mov ebx, ebx
+    mov esi, esi
+
+    mov rax, [rsi + x86_smp_trampoline_data.direct_map_base]
+    add rsi, rax
+    lea rcx, [rbx + rax + TRAMPOLINE_OFFSET(park_amd64)]
+    jmp rcx
+
+; rsi -> trampoline data (direct map)
+park_amd64:
+    mov al, [rsi + x86_smp_trampoline_data.use_x2apic_id]
+    test al, al
+    jz .xapic_id
+
+    mov eax, 0x0B
+    xor ecx, ecx
+    cpuid
+    jmp .have_id
+
+.xapic_id:
+    mov eax, 0x01
+    cpuid
+    shr ebx, 24
+    mov edx, ebx
+
+.have_id:
+    mov r8d, edx
+    mov rdi, [rsi + x86_smp_trampoline_data.cpus]
+    mov ecx, [rsi + x86_smp_trampoline_data.cpu_count]
+
+.next_cpu:
+    test ecx, ecx
+    jz .not_found
+
+    cmp [rdi + smp_cpu.hardware_id], r8
+    je .found
+
+    add rdi, smp_cpu_size
+    dec ecx
+    jmp .next_cpu
+
+.not_found:
+    cli
+    hlt
+    jmp .not_found
+
+.found:
+    ; The descriptor pointer as the kernel sees it
+    mov r9, rdi
+    sub r9, [rsi + x86_smp_trampoline_data.cpus]
+    add r9, [rsi + x86_smp_trampoline_data.cpus_pointer_base]
+
+    lock or dword [rdi + smp_cpu.flags], SMP_CPU_PARKED
+
+.spin:
+    pause
+    mov rax, [rdi + smp_cpu.entrypoint]
+    test rax, rax
+    jz .spin
+
+    ; The lower half might've been unmapped since we loaded CR3
+    mov rcx, cr3
+    mov cr3, rcx
+
+    mov rsp, [rdi + smp_cpu.stack]
+    mov rsi, [rdi + smp_cpu.argument]
+    mov rdi, r9
+
+    push qword 0x0000000000000000 ; fake ret address
+    push rax
+
+    xor rax, rax
+    xor rcx, rcx
+    xor rdx, rdx
+    xor rbx, rbx
+    xor rbp, rbp
+    xor r8, r8
+    xor r9, r9
+    xor r10, r10
+    xor r11, r11
+    xor r12, r12
+    xor r13, r13
+    xor r14, r14
+    xor r15, r15
+
+    push qword 0x0000000000000000 | EFLAGS_RESERVED_BIT
+    popfq
+
+    ret
+
+align 8
+global smp_trampoline_data
+smp_trampoline_data:
+    times x86_smp_trampoline_data_size db 0
+
+global smp_trampoline_end
+smp_trampoline_end:
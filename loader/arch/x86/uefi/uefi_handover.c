@@ -2,6 +2,7 @@
 #include "common/rw_helpers.h"
 #include "handover.h"
 #include "services_impl.h"
+#include "bulk_memory.h"
 #include "uefi/relocator.h"
 
 extern char gdt_ptr[];
@@ -87,6 +88,8 @@ void kernel_handover_x86(struct x86_handover_info *hi);
 NORETURN
 void kernel_handover(struct handover_info *hi)
 {
+    bulk_memory_restore_cpu_state();
+
     *xhi_relocated = (struct x86_handover_info) {
         .arg0 = hi->arg0,
         .arg1 = hi->arg1,
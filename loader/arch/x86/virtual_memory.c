@@ -1,20 +1,38 @@
 #include "common/bug.h"
 #include "common/string.h"
-#include "common/rw_helpers.h"
 
 #include "virtual_memory.h"
 #include "virtual_memory_impl.h"
+#include "arch/cpuid.h"
+
+#define CPUID_PDPE1GB (1 << 26)
+
+static bool cpu_supports_gigantic_pages(void)
+{
+    struct cpuid_res id;
+
+    if (!cpuid_is_extended_function_supported(
+            EXTENDED_PROCESSOR_INFO_FUNCTION_NUMBER))
+        return false;
+
+    cpuid(EXTENDED_PROCESSOR_INFO_FUNCTION_NUMBER, &id);
+    return id.d & CPUID_PDPE1GB;
+}
 
 void page_table_init(struct page_table *pt, enum pt_type type,
                      u64 max_table_address)
 {
-    ptr_t root_page = pt_get_table_page(max_table_address);
+    ptr_t root_page;
+
+    pt->max_table_address = max_table_address;
+    memzero(&pt->pool, sizeof(pt->pool));
+
+    root_page = pt_get_table_page(pt);
     OOPS_ON(!root_page);
 
     pt->root = ADDR_TO_PTR(root_page);
     pt->levels = pt_depth(type);
     pt->base_shift = PAGE_SHIFT;
-    pt->max_table_address = max_table_address;
 
     // 52 is the maximum supported number of physical bits
     pt->entry_address_mask = ~(BIT_MASK(52, 64) | BIT_MASK(0, PAGE_SHIFT));
@@ -36,13 +54,10 @@ void page_table_init(struct page_table *pt, enum pt_type type,
         BUG();
     }
 
-    if (pt->entry_width == 8) {
-        pt->write_slot = write_u64;
-        pt->read_slot = read_u64;
-    } else {
-        pt->write_slot = write_u32_u64;
-        pt->read_slot = read_u32_zero_extend;
-    }
+    // PAE PDPTEs have no PS bit, 1GiB pages are only available in long mode
+    pt->gigantic_pages = pt->levels >= 4 && cpu_supports_gigantic_pages();
+
+    pt_init_levels(pt);
 
     /*
      * 32-bit PAE paging is a bit strange in that the root table consists of
@@ -63,10 +78,10 @@ void page_table_init(struct page_table *pt, enum pt_type type,
         void *table = pt->root;
 
         for (i = 0; i < 4; ++i) {
-            entry = pt_get_table_page(pt->max_table_address);
+            entry = pt_get_table_page(pt);
             OOPS_ON(!entry);
 
-            pt->write_slot(table, entry | PAGE_PRESENT);
+            pt_write_slot(pt, table, entry | PAGE_PRESENT);
             table += pt->entry_width;
         }
     }
@@ -12,14 +12,19 @@
 #include "boot_protocol.h"
 #include "boot_protocol/ultra_impl.h"
 #include "ultra_protocol/ultra_protocol.h"
+#include "ultra_extensions.h"
 #include "elf.h"
 #include "filesystem/filesystem_table.h"
 #include "allocator.h"
 #include "virtual_memory.h"
 #include "handover.h"
+#include "parallel.h"
 #include "hyper.h"
 #include "services.h"
 #include "video_services.h"
+#include "timeline.h"
+#include "smp.h"
+#include "numa.h"
 
 static void get_binary_options(struct config *cfg, struct loadable_entry *le,
                                struct binary_options *opts)
@@ -59,6 +64,9 @@ static void get_binary_options(struct config *cfg, struct loadable_entry *le,
 struct pending_module {
     struct string_view description;
 
+    // Where the module ended up, see ultra_numa_info_attribute
+    u32 numa_node;
+
     // Keep last: its trailing description[] flexible array stays unused here.
     struct ultra_module_info_attribute attr;
 };
@@ -140,7 +148,7 @@ static u64 module_get_load_address(struct config *cfg,
 
 static void *module_data_alloc(u64 addr, u64 ceiling, size_t size,
                                size_t zero_after_offset,
-                               bool has_load_address)
+                               bool has_load_address, u32 numa_node)
 {
     size_t zeroed_bytes;
     void *ret;
@@ -174,12 +182,17 @@ static void *module_data_alloc(u64 addr, u64 ceiling, size_t size,
         }
     } else {
         as.ceiling = ceiling;
+
+        if (numa_node != NUMA_NODE_ANY) {
+            as.flags |= ALLOCATE_PREFER_NODE;
+            as.node = numa_node;
+        }
     }
 
     addr = allocate_pages_ex(&as);
     ret = ADDR_TO_PTR(addr);
 
-    memzero(ret + zero_after_offset, zeroed_bytes);
+    parallel_bulk_zero(ret + zero_after_offset, zeroed_bytes);
     return ret;
 }
 
@@ -209,14 +222,55 @@ static struct string_view module_get_description(struct config *cfg,
     return (struct string_view) { storage, desc.size };
 }
 
+#define NUMA_NODE_KEY SV("numa-node")
+
+/*
+ * Modules are placed anywhere by default, 'hot' ones on the BSP's node, which
+ * is what the kernel is going to be running on first. An explicit 'numa-node'
+ * wins over either.
+ */
+static u32 module_get_numa_node(struct config *cfg, struct value *module_value,
+                                u32 bsp_node)
+{
+    const uint32_t type_mask = VALUE_STRING | VALUE_UNSIGNED | VALUE_NONE;
+    struct value node_value;
+    bool is_hot = false;
+
+    cfg_get_bool(cfg, module_value, SV("hot"), &is_hot);
+
+    if (!cfg_get_one_of(cfg, module_value, NUMA_NODE_KEY, type_mask,
+                        &node_value) || value_is_null(&node_value))
+        return is_hot ? bsp_node : NUMA_NODE_ANY;
+
+    if (value_is_string(&node_value)) {
+        if (sv_equals(node_value.as_string, SV("bsp")))
+            return bsp_node;
+        if (sv_equals(node_value.as_string, SV("any")))
+            return NUMA_NODE_ANY;
+
+        cfg_oops_invalid_key_value(SV("module/numa-node"),
+                                   node_value.as_string);
+    }
+
+    if (node_value.as_unsigned >= NUMA_NODE_ANY ||
+        !numa_node_exists(node_value.as_unsigned)) {
+        print_warn("no NUMA node %llu, placing module anywhere\n",
+                   node_value.as_unsigned);
+        return NUMA_NODE_ANY;
+    }
+
+    return node_value.as_unsigned;
+}
+
 static void module_load(struct config *cfg, struct value *module_value,
-                        struct pending_module *pm, u64 ceiling)
+                        struct pending_module *pm, u64 ceiling, u32 bsp_node)
 {
     struct ultra_module_info_attribute *attrs = &pm->attr;
     bool has_path, has_load_address = false;
     struct string_view str_path, module_name = { 0 };
     size_t module_size = 0;
     uint32_t module_type = ULTRA_MODULE_TYPE_FILE;
+    u32 numa_node = NUMA_NODE_ANY;
     u64 load_address = 0;
     void *module_data;
 
@@ -231,6 +285,7 @@ static void module_load(struct config *cfg, struct value *module_value,
         load_address = module_get_load_address(cfg, module_value,
                                                &has_load_address);
         pm->description = module_get_description(cfg, module_value);
+        numa_node = module_get_numa_node(cfg, module_value, bsp_node);
     } else {
         str_path = module_value->as_string;
         has_path = true;
@@ -279,29 +334,33 @@ static void module_load(struct config *cfg, struct value *module_value,
         }
 
         module_data = module_data_alloc(load_address, ceiling, module_size,
-                                        bytes_to_read, has_load_address);
+                                        bytes_to_read, has_load_address,
+                                        numa_node);
 
         if (!module_file->fs->read_file(module_file, module_data, 0,
                                         bytes_to_read)) {
             oops("failed to read module file\n");
         }
 
-        fse->fs->close_file(module_file);
+        module_file->fs->close_file(module_file);
     } else { // module_type == ULTRA_MODULE_TYPE_MEMORY
         if (!module_size)
             oops("module size cannot be \"auto\" for type \"memory\"\n");
 
         module_data = module_data_alloc(load_address, ceiling, module_size, 0,
-                                        has_load_address);
+                                        has_load_address, numa_node);
     }
 
     attrs->address = (ptr_t)module_data;
     attrs->type = module_type;
     attrs->size = module_size;
+    pm->numa_node = numa_node_of(attrs->address);
+
+    timeline_mark(TIMELINE_EVENT_MODULE_LOADED, module_idx);
 }
 
 static void load_kernel(struct config *cfg, struct loadable_entry *entry,
-                        struct kernel_info *info)
+                        struct kernel_info *info, u32 numa_node)
 {
     struct binary_options *bo = &info->bin_opts;
     struct handover_info *hi = &info->hi;
@@ -329,16 +388,23 @@ static void load_kernel(struct config *cfg, struct loadable_entry *entry,
     spec.flags |= ELF_USE_VIRTUAL_ADDRESSES;
     if (bo->allocate_anywhere)
         spec.flags |= ELF_ALLOCATE_ANYWHERE;
+    if (numa_node != NUMA_NODE_ANY) {
+        spec.flags |= ELF_PREFER_NUMA_NODE;
+        spec.numa_node = numa_node;
+    }
 
     hi->flags |= ultra_get_flags_for_binary_options(bo, arch);
     handover_ensure_supported_flags(hi->flags);
 
     spec.binary_ceiling = ultra_max_binary_address(hi->flags);
     spec.higher_half_base = ultra_higher_half_base(hi->flags);
+    spec.physical_alignment = ultra_huge_page_size(hi->flags);
 
     if (!elf_load(&spec, &info->bin_info, &err))
         goto elf_error;
 
+    timeline_mark(TIMELINE_EVENT_KERNEL_LOADED, 0);
+
     hi->entrypoint = bi->entrypoint_address;
     hi->kernel_binary_base = bi->physical_base;
     hi->kernel_binary_size = bi->physical_ceiling - bi->physical_base;
@@ -420,6 +486,9 @@ static void video_mode_from_value(struct config *cfg, struct value *val,
 
 #define DEFAULT_BPP 32
 
+// No exposed framebuffer format has more than 8 bits per component
+#define MAX_BPP 32
+
 // Prefer the mode with the largest area, breaking ties by higher bpp.
 static bool vm_is_preferable(const struct video_mode *m,
                              const struct video_mode *best)
@@ -441,14 +510,11 @@ static bool vm_is_preferable(const struct video_mode *m,
 static bool pick_largest_mode(u32 max_width, u32 max_height, u16 want_format,
                               u32 want_bpp, struct video_mode *out)
 {
-    size_t i, count = vs_get_mode_count();
-    struct video_mode best = { 0 };
+    struct video_mode m, best = { 0 };
     bool found = false;
+    size_t i;
 
-    for (i = 0; i < count; ++i) {
-        struct video_mode m;
-        vs_query_mode(i, &m);
-
+    for (i = 0; vs_query_mode(i, &m); ++i) {
         if (want_format != FB_FORMAT_INVALID && m.format != want_format)
             continue;
         if (want_bpp && m.bpp != want_bpp)
@@ -467,22 +533,44 @@ static bool pick_largest_mode(u32 max_width, u32 max_height, u16 want_format,
     return found;
 }
 
+static bool mode_matches(const struct requested_video_mode *rm,
+                         const struct video_mode *m)
+{
+    if (m->width != rm->width || m->height != rm->height)
+        return false;
+    if (rm->format != FB_FORMAT_INVALID && m->format != rm->format)
+        return false;
+
+    return !rm->has_bpp || m->bpp == rm->bpp;
+}
+
+/*
+ * A match nothing else could beat, either because the bpp was pinned or
+ * because there's no deeper mode, means the rest of the modes don't have to
+ * be probed.
+ */
+static bool is_final_match(const struct requested_video_mode *rm,
+                           const struct video_mode *m)
+{
+    return rm->has_bpp || m->bpp == MAX_BPP;
+}
+
 static bool pick_exact_mode(const struct requested_video_mode *rm,
                             struct video_mode *out)
 {
-    size_t i, count = vs_get_mode_count();
-    struct video_mode best = { 0 };
+    struct video_mode m, best = { 0 };
     bool found = false;
+    size_t i;
 
-    for (i = 0; i < count; ++i) {
-        struct video_mode m;
-        vs_query_mode(i, &m);
+    // The firmware might already be displaying it (e.g. UEFI GOP)
+    if (vs_get_current_mode(&m) && mode_matches(rm, &m) &&
+        is_final_match(rm, &m)) {
+        *out = m;
+        return true;
+    }
 
-        if (m.width != rm->width || m.height != rm->height)
-            continue;
-        if (rm->format != FB_FORMAT_INVALID && m.format != rm->format)
-            continue;
-        if (rm->has_bpp && m.bpp != rm->bpp)
+    for (i = 0; vs_query_mode(i, &m); ++i) {
+        if (!mode_matches(rm, &m))
             continue;
 
         // Among modes of the requested resolution prefer the highest bpp
@@ -491,6 +579,9 @@ static bool pick_exact_mode(const struct requested_video_mode *rm,
 
         best = m;
         found = true;
+
+        if (is_final_match(rm, &m))
+            break;
     }
 
     *out = best;
@@ -500,7 +591,7 @@ static bool pick_exact_mode(const struct requested_video_mode *rm,
 /*
  * Auto mode policy, used when the config doesn't pin an exact resolution:
  *   - if the display's native resolution is known (EDID), use the largest mode
- *     that fits within it;
+ *     that fits within it, or the current mode as is if it's already native;
  *   - otherwise, if the firmware already has an active framebuffer (e.g. the
  *     UEFI GOP, usually already at native), keep it as is;
  *   - otherwise (e.g. BIOS, which boots in text mode), pick the largest mode.
@@ -510,11 +601,24 @@ static bool pick_auto_mode(const struct requested_video_mode *rm,
 {
     u32 want_bpp = rm->has_bpp ? rm->bpp : 0;
     struct resolution native;
+    bool has_native;
 
-    if (vs_query_native_resolution(&native) &&
-        pick_largest_mode(native.width, native.height, rm->format, want_bpp,
-                          out))
-        return true;
+    has_native = vs_query_native_resolution(&native);
+
+    if (has_native) {
+        struct requested_video_mode native_rm = *rm;
+
+        // Already at native, nothing could fit better
+        native_rm.width = native.width;
+        native_rm.height = native.height;
+        if (vs_get_current_mode(out) && mode_matches(&native_rm, out) &&
+            is_final_match(&native_rm, out))
+            return true;
+
+        if (pick_largest_mode(native.width, native.height, rm->format,
+                              want_bpp, out))
+            return true;
+    }
 
     if (!rm->has_bpp && rm->format == FB_FORMAT_INVALID &&
         vs_get_current_mode(out))
@@ -558,6 +662,9 @@ static bool set_video_mode(struct config *cfg, struct loadable_entry *entry,
     print_info("picked video mode %ux%u @ %u bpp\n",
                picked.width, picked.height, picked.bpp);
 
+    // Whatever is still pending would never make it to the tty otherwise
+    logger_flush();
+
     if (!vs_set_mode(picked.id, &fb))
         oops("failed to set picked video mode\n");
 
@@ -584,6 +691,19 @@ static bool apm_setup(struct config *cfg, struct loadable_entry *le,
     return services_setup_apm(out_info);
 }
 
+static bool timeline_setup(struct config *cfg, struct loadable_entry *le)
+{
+    bool wants_timeline = false, wants_print = false;
+
+    cfg_get_bool(cfg, le, SV("boot-timeline"), &wants_timeline);
+    cfg_get_bool(cfg, le, SV("print-boot-timeline"), &wants_print);
+
+    if (wants_print)
+        timeline_print();
+
+    return wants_timeline;
+}
+
 static bool uefi_info_setup(struct config *cfg, struct loadable_entry *le,
                             struct uefi_handoff_info *out_info)
 {
@@ -607,8 +727,20 @@ struct attribute_array_spec {
     bool cmdline_present;
     bool apm_info_present;
     bool uefi_info_present;
+    bool timeline_present;
+    bool smp_present;
+    bool free_page_bitmap_present;
+    bool numa_info_present;
+    bool loader_log_present;
     uint8_t page_table_depth;
 
+    // Node the kernel, its stack & page tables go on, or NUMA_NODE_ANY
+    u32 numa_node;
+
+    // Only valid if numa_info_present
+    u32 bsp_node;
+    u32 kernel_node;
+
     struct ultra_framebuffer fb;
 
     struct string_view cmdline;
@@ -618,12 +750,111 @@ struct attribute_array_spec {
 
     struct apm_info apm_info;
     struct uefi_handoff_info uefi_info;
+    struct smp_info smp_info;
+
+    // Allocated & zeroed up front, filled in from the final memory map
+    u64 *free_page_bitmap;
+    u64 free_page_count;
 
     ptr_t acpi_rsdp_address;
     ptr_t dtb_address;
     ptr_t smbios_address;
 };
 
+static bool smp_setup(struct config *cfg, struct loadable_entry *le,
+                      struct attribute_array_spec *spec)
+{
+    struct handover_info *hi = &spec->kern_info.hi;
+    bool wants_smp = false;
+    u64 pointer_offset = 0;
+
+    cfg_get_bool(cfg, le, SV("smp"), &wants_smp);
+    if (!wants_smp)
+        return false;
+
+    if (spec->higher_half_pointers)
+        pointer_offset = hi->direct_map_base;
+
+    return smp_start_aps(hi, pointer_offset, &spec->smp_info);
+}
+
+static bool find_free_end(void *user, const struct memory_map_entry *me)
+{
+    u64 *free_end = user;
+
+    if (me->type == MEMORY_TYPE_FREE)
+        *free_end = MAX(*free_end, me->physical_address + me->size_in_bytes);
+
+    return true;
+}
+
+/*
+ * The bitmap is sized from the current memory map. Allocations can only ever
+ * turn free memory into something else, so the highest free address can't
+ * grow past this point, even after the bitmap & attribute array are allocated.
+ */
+static bool free_page_bitmap_setup(struct config *cfg, struct loadable_entry *le,
+                                   struct attribute_array_spec *spec)
+{
+    struct handover_info *hi = &spec->kern_info.hi;
+    bool wants_bitmap = false;
+    u64 free_end = 0;
+    size_t bytes;
+    struct allocation_spec as = {
+        .ceiling = handover_get_max_pt_address(hi->direct_map_base, hi->flags),
+        .flags = ALLOCATE_CRITICAL
+    };
+
+    cfg_get_bool(cfg, le, SV("free-page-bitmap"), &wants_bitmap);
+    if (!wants_bitmap)
+        return false;
+
+    mm_foreach_entry(find_free_end, &free_end);
+    if (!free_end) {
+        print_warn("no free memory, not building a free page bitmap\n");
+        return false;
+    }
+    spec->free_page_count = free_end >> PAGE_SHIFT;
+
+    bytes = ALIGN_UP(CEILING_DIVIDE(spec->free_page_count, 8), sizeof(u64));
+    as.pages = PAGE_ROUND_UP(bytes) >> PAGE_SHIFT;
+    spec->free_page_bitmap = ADDR_TO_PTR(allocate_pages_ex(&as));
+    parallel_bulk_zero(spec->free_page_bitmap, bytes);
+
+    print_info("free page bitmap: %zu bytes covering %llu pages\n",
+               bytes, spec->free_page_count);
+    return true;
+}
+
+/*
+ * Whatever the kernel touches first thing goes on the BSP's node, unless the
+ * platform isn't NUMA in the first place, or placement is turned off.
+ */
+static u32 numa_placement_setup(struct config *cfg, struct loadable_entry *le)
+{
+    bool wants_placement = true;
+
+    cfg_get_bool(cfg, le, SV("numa-placement"), &wants_placement);
+    if (!wants_placement)
+        return NUMA_NODE_ANY;
+
+    return numa_bsp_node();
+}
+
+static bool numa_info_setup(struct config *cfg, struct loadable_entry *le,
+                            struct attribute_array_spec *spec)
+{
+    bool wants_numa_info = false;
+
+    cfg_get_bool(cfg, le, SV("numa-info"), &wants_numa_info);
+    if (!wants_numa_info)
+        return false;
+
+    spec->bsp_node = numa_bsp_node();
+    spec->kernel_node = numa_node_of(spec->kern_info.hi.kernel_binary_base);
+    return true;
+}
+
 static void ultra_memory_map_entry_convert(struct memory_map_entry *entry,
                                            void *buf)
 {
@@ -721,7 +952,12 @@ write_kernel_info_attribute(struct ultra_kernel_info_attribute *attr,
         memcpy(&attr->partition_guid, &loc->partition_guid,
                sizeof(attr->partition_guid));
         break;
+    /*
+     * The protocol has no notion of HTTP, as far as the kernel is concerned
+     * it's just another network boot off the same server.
+     */
     case FSE_TYPE_PXE:
+    case FSE_TYPE_HTTP:
         if (loc->ip.type == IP_TYPE_V4) {
             memcpy(&attr->pxe_v4, &loc->ip.v4, IPV4_ADDR_LEN);
             attr->partition_type = ULTRA_PARTITION_TYPE_PXE_V4;
@@ -804,6 +1040,160 @@ static void *write_uefi_info(void *attr_ptr,
     return attr_ptr + size;
 }
 
+static void *write_smp_info(void *attr_ptr,
+                            const struct attribute_array_spec *spec)
+{
+    struct ultra_smp_info_attribute *si = attr_ptr;
+    u64 cpus_address = (ptr_t)spec->smp_info.cpus;
+
+    BUILD_BUG_ON(sizeof(struct ultra_smp_cpu) != sizeof(struct smp_cpu));
+    BUILD_BUG_ON(offsetof(struct ultra_smp_cpu, entrypoint) !=
+                 offsetof(struct smp_cpu, entrypoint));
+    BUILD_BUG_ON(offsetof(struct ultra_smp_cpu, flags) !=
+                 offsetof(struct smp_cpu, flags));
+    BUILD_BUG_ON(ULTRA_SMP_CPU_BSP != SMP_CPU_BSP);
+    BUILD_BUG_ON(ULTRA_SMP_CPU_PARKED != SMP_CPU_PARKED);
+
+    if (spec->higher_half_pointers)
+        cpus_address += spec->kern_info.hi.direct_map_base;
+
+    si->header.type = ULTRA_ATTRIBUTE_SMP_INFO;
+    si->header.size = sizeof(struct ultra_smp_info_attribute);
+    si->cpu_count = spec->smp_info.cpu_count;
+    si->bsp_index = spec->smp_info.bsp_index;
+    si->cpus_address = cpus_address;
+
+    return ++si;
+}
+
+static void bitmap_set_range(u64 *bitmap, u64 first, u64 count)
+{
+    u64 head_bits, tail_bits;
+
+    // Unaligned head up to the next byte, whole bytes, then the tail
+    head_bits = MIN((8 - (first & 7)) & 7, count);
+    for (; head_bits; --head_bits, ++first, --count)
+        bitmap[first / 64] |= 1ull << (first % 64);
+
+    memset((u8*)bitmap + first / 8, 0xFF, count / 8);
+    first += ALIGN_DOWN(count, 8);
+
+    for (tail_bits = count & 7; tail_bits; --tail_bits, ++first)
+        bitmap[first / 64] |= 1ull << (first % 64);
+}
+
+/*
+ * Has to be written after the memory map, as that's the first point where it
+ * is final. Bytes map onto the 64-bit words LSB-first only on little-endian
+ * machines, which all supported architectures are.
+ */
+static void *write_free_page_bitmap(void *attr_ptr,
+                                    const struct attribute_array_spec *spec,
+                                    const struct ultra_memory_map_attribute *mm)
+{
+    struct ultra_free_page_bitmap_attribute *fpb = attr_ptr;
+    size_t i, entry_count = ULTRA_MEMORY_MAP_ENTRY_COUNT(mm->header);
+    u64 bitmap_address = (ptr_t)spec->free_page_bitmap;
+
+    for (i = 0; i < entry_count; ++i) {
+        const struct ultra_memory_map_entry *me = &mm->entries[i];
+        u64 first, end;
+
+        if (me->type != ULTRA_MEMORY_TYPE_FREE)
+            continue;
+
+        first = PAGE_ROUND_UP(me->physical_address) >> PAGE_SHIFT;
+        end = PAGE_ROUND_DOWN(me->physical_address + me->size) >> PAGE_SHIFT;
+        end = MIN(end, spec->free_page_count);
+        if (first >= end)
+            continue;
+
+        bitmap_set_range(spec->free_page_bitmap, first, end - first);
+    }
+
+    if (spec->higher_half_pointers)
+        bitmap_address += spec->kern_info.hi.direct_map_base;
+
+    fpb->header.type = ULTRA_ATTRIBUTE_FREE_PAGE_BITMAP;
+    fpb->header.size = sizeof(struct ultra_free_page_bitmap_attribute);
+    fpb->page_count = spec->free_page_count;
+    fpb->bitmap_address = bitmap_address;
+    fpb->bitmap_size = ALIGN_UP(CEILING_DIVIDE(spec->free_page_count, 8),
+                                sizeof(u64));
+
+    return ++fpb;
+}
+
+static size_t boot_timeline_size(void)
+{
+    size_t count;
+
+    timeline_get_entries(&count);
+
+    // Leave room for the handover, which is recorded while writing
+    return sizeof(struct ultra_boot_timeline_attribute) +
+           (count + 1) * sizeof(struct ultra_boot_timeline_entry);
+}
+
+static void *write_boot_timeline(void *attr_ptr)
+{
+    struct ultra_boot_timeline_attribute *bt = attr_ptr;
+    const struct timeline_entry *entries;
+    size_t i, count, max_count;
+
+    BUILD_BUG_ON(TIMELINE_EVENT_LOADER_ENTRY !=
+                 ULTRA_BOOT_TIMELINE_LOADER_ENTRY);
+    BUILD_BUG_ON(TIMELINE_EVENT_HANDOVER != ULTRA_BOOT_TIMELINE_HANDOVER);
+
+    max_count = (boot_timeline_size() - sizeof(*bt)) /
+                sizeof(struct ultra_boot_timeline_entry);
+
+    timeline_mark(TIMELINE_EVENT_HANDOVER, 0);
+    entries = timeline_get_entries(&count);
+    count = MIN(count, max_count);
+
+    bt->header.type = ULTRA_ATTRIBUTE_BOOT_TIMELINE;
+    bt->header.size = sizeof(*bt) +
+                      count * sizeof(struct ultra_boot_timeline_entry);
+    bt->frequency = timeline_get_frequency();
+
+    for (i = 0; i < count; ++i) {
+        bt->entries[i] = (struct ultra_boot_timeline_entry) {
+            .event = entries[i].event,
+            .argument = entries[i].argument,
+            .timestamp = entries[i].timestamp,
+        };
+    }
+
+    return attr_ptr + bt->header.size;
+}
+
+/*
+ * Room for whatever gets logged while the attribute array is being built, on
+ * top of what's already there when it's sized.
+ */
+#define LOADER_LOG_SLACK 1024
+
+static size_t loader_log_size(size_t capacity)
+{
+    return ALIGN_UP(sizeof(struct ultra_loader_log_attribute) + capacity + 1, 8);
+}
+
+static void *write_loader_log(void *attr_ptr, size_t capacity)
+{
+    struct ultra_loader_log_attribute *ll = attr_ptr;
+    size_t size = loader_log_size(capacity);
+
+    ll->header.type = ULTRA_ATTRIBUTE_LOADER_LOG;
+    ll->header.size = size;
+    ll->total_bytes = logger_total_bytes();
+
+    // The array is pre-zeroed, so the text is always NUL-terminated
+    logger_copy_buffer(ll->text, capacity);
+
+    return attr_ptr + size;
+}
+
 static void *write_command_line_attribute(void *attr_ptr,
                                           struct string_view cmdline,
                                           size_t aligned_len)
@@ -854,11 +1244,39 @@ static void *write_module_info(void *attr_ptr, const struct pending_module *pm)
     return attr_ptr + size;
 }
 
+static size_t numa_info_size(const struct attribute_array_spec *spec)
+{
+    return ALIGN_UP(sizeof(struct ultra_numa_info_attribute) +
+                    spec->module_buf.size * sizeof(uint32_t), 8);
+}
+
+static void *write_numa_info(void *attr_ptr,
+                             const struct attribute_array_spec *spec)
+{
+    struct ultra_numa_info_attribute *ni = attr_ptr;
+    size_t i, size = numa_info_size(spec);
+
+    BUILD_BUG_ON(ULTRA_NUMA_NODE_UNKNOWN != NUMA_NODE_ANY);
+
+    ni->header.type = ULTRA_ATTRIBUTE_NUMA_INFO;
+    ni->header.size = size;
+    ni->bsp_node = spec->bsp_node;
+    ni->kernel_node = spec->kernel_node;
+    ni->module_count = spec->module_buf.size;
+
+    for (i = 0; i < spec->module_buf.size; ++i)
+        ni->module_nodes[i] = module_at(spec, i)->numa_node;
+
+    return attr_ptr + size;
+}
+
 static ptr_t build_attribute_array(const struct attribute_array_spec *spec,
                                    u64 array_ceiling)
 {
     u32 cmdline_aligned_length = 0;
+    size_t loader_log_capacity = 0;
     size_t i, mm_entry_count, pages_needed, bytes_needed = 0;
+    struct ultra_memory_map_attribute *mm;
     void *attr_ptr;
     uint32_t *attr_count;
     ptr_t ret;
@@ -882,6 +1300,18 @@ static ptr_t build_attribute_array(const struct attribute_array_spec *spec,
     if (spec->uefi_info_present)
         bytes_needed += ALIGN_UP(sizeof(struct ultra_uefi_info_attribute)
                                  + spec->uefi_info.memory_map_capacity, 8);
+    if (spec->timeline_present)
+        bytes_needed += boot_timeline_size();
+    bytes_needed += spec->smp_present *
+                    sizeof(struct ultra_smp_info_attribute);
+    bytes_needed += spec->free_page_bitmap_present *
+                    sizeof(struct ultra_free_page_bitmap_attribute);
+    if (spec->numa_info_present)
+        bytes_needed += numa_info_size(spec);
+    if (spec->loader_log_present) {
+        loader_log_capacity = logger_buffered_bytes() + LOADER_LOG_SLACK;
+        bytes_needed += loader_log_size(loader_log_capacity);
+    }
     bytes_needed += sizeof(struct ultra_memory_map_attribute);
 
     // Add 2 to give some leeway for memory map growth after the next allocation
@@ -958,6 +1388,16 @@ static ptr_t build_attribute_array(const struct attribute_array_spec *spec,
         *attr_count += 1;
     }
 
+    if (spec->smp_present) {
+        attr_ptr = write_smp_info(attr_ptr, spec);
+        *attr_count += 1;
+    }
+
+    if (spec->numa_info_present) {
+        attr_ptr = write_numa_info(attr_ptr, spec);
+        *attr_count += 1;
+    }
+
     /*
      * The memory map is acquired here, which also exits boot services and
      * captures the raw EFI memory map if a capture buffer was reserved (see
@@ -965,14 +1405,31 @@ static ptr_t build_attribute_array(const struct attribute_array_spec *spec,
      * so its variable size (which is only known once the map is captured)
      * doesn't shift any attribute after it.
      */
+    mm = attr_ptr;
     attr_ptr = write_memory_map(attr_ptr, mm_entry_count);
     *attr_count += 1;
 
+    if (spec->free_page_bitmap_present) {
+        attr_ptr = write_free_page_bitmap(attr_ptr, spec, mm);
+        *attr_count += 1;
+    }
+
     if (spec->uefi_info_present) {
         attr_ptr = write_uefi_info(attr_ptr, &spec->uefi_info);
         *attr_count += 1;
     }
 
+    if (spec->loader_log_present) {
+        attr_ptr = write_loader_log(attr_ptr, loader_log_capacity);
+        *attr_count += 1;
+    }
+
+    // Last, so that the handover timestamp is as late as possible
+    if (spec->timeline_present) {
+        attr_ptr = write_boot_timeline(attr_ptr);
+        *attr_count += 1;
+    }
+
     return ret;
 }
 
@@ -980,7 +1437,7 @@ static ptr_t build_attribute_array(const struct attribute_array_spec *spec,
 #define STACK_KEY SV("stack")
 
 static void allocate_stack(struct config *cfg, struct loadable_entry *le,
-                           struct handover_info *hi)
+                           struct handover_info *hi, u32 numa_node)
 {
     struct value val;
     size_t size = 16 * KB;
@@ -1031,6 +1488,11 @@ static void allocate_stack(struct config *cfg, struct loadable_entry *le,
             cfg_oops_invalid_key_value(STACK_KEY, val.as_string);
     }
 
+    if (numa_node != NUMA_NODE_ANY) {
+        as.flags |= ALLOCATE_PREFER_NODE;
+        as.node = numa_node;
+    }
+
     as.pages = size >> PAGE_SHIFT;
     hi->stack = allocate_pages_ex(&as);
 }
@@ -1068,7 +1530,7 @@ static void load_kernel_as_module(struct config *cfg, struct loadable_entry *le,
 
     size = binary->size;
     data = module_data_alloc(0, ultra_max_binary_address(hi->flags),
-                             size, size, false);
+                             size, size, false, spec->numa_node);
 
     if (!binary->fs->read_file(binary, data, 0, size))
         oops("failed to read kernel binary\n");
@@ -1077,6 +1539,7 @@ static void load_kernel_as_module(struct config *cfg, struct loadable_entry *le,
     mi->attr.type = ULTRA_MODULE_TYPE_FILE;
     mi->attr.address = (ptr_t)data;
     mi->attr.size = size;
+    mi->numa_node = numa_node_of((ptr_t)data);
     sv_terminated_copy(mi->attr.name, SV("__KERNEL__"));
 
     if (spec->higher_half_pointers)
@@ -1101,7 +1564,8 @@ static void load_all_modules(struct config *cfg, struct loadable_entry *le,
         struct pending_module *mi;
 
         mi = module_alloc(&spec->module_buf);
-        module_load(cfg, &module_value, mi, ultra_max_binary_address(hi->flags));
+        module_load(cfg, &module_value, mi, ultra_max_binary_address(hi->flags),
+                    spec->numa_node);
 
         if (spec->higher_half_pointers)
             mi->attr.address += hi->direct_map_base;
@@ -1181,6 +1645,13 @@ struct direct_map_ctx {
      */
     u64 higher_half_limit;
     u64 lower_half_limit;
+
+    /*
+     * Identity mappings below this address are not built on their own, they
+     * share the page table subtrees of the direct map instead, see
+     * share_identity_map(). Zero if there's no identity map.
+     */
+    u64 shared_limit;
 };
 
 /*
@@ -1191,20 +1662,24 @@ static void direct_map_one_range(struct direct_map_ctx *ctx, u64 begin,
                                  u64 end, enum page_type type)
 {
     struct page_mapping_spec *spec = ctx->spec;
-    u8 shift = type == PAGE_TYPE_HUGE ? huge_page_shift(spec->pt) : PAGE_SHIFT;
+    u8 shift = page_type_shift(spec->pt, type);
 
     if (end <= begin)
         return;
 
     spec->type = type;
-    spec->physical_base = begin;
 
-    if (begin < ctx->lower_half_limit) {
-        spec->virtual_base = begin;
-        spec->count = (MIN(end, ctx->lower_half_limit) - begin) >> shift;
+    if (begin < ctx->lower_half_limit && end > ctx->shared_limit) {
+        u64 identity_begin = MAX(begin, ctx->shared_limit);
+
+        spec->physical_base = identity_begin;
+        spec->virtual_base = identity_begin;
+        spec->count = (MIN(end, ctx->lower_half_limit) - identity_begin) >> shift;
         map_pages(spec);
     }
 
+    spec->physical_base = begin;
+
     if (begin < ctx->higher_half_limit) {
         spec->virtual_base = ctx->direct_map_base + begin;
         spec->count = (MIN(end, ctx->higher_half_limit) - begin) >> shift;
@@ -1217,13 +1692,14 @@ static void direct_map_one_range(struct direct_map_ctx *ctx, u64 begin,
  * if a lower-half limit is set). Huge pages only cover the aligned interior;
  * the unaligned edges fall back to small pages so the mapping never rounds
  * out over adjacent non-RAM memory, which may be device memory or not backed
- * at all. The first huge page is mapped separately with small pages, so
- * ranges are clipped to start above it here.
+ * at all. Likewise, 1GiB pages (if supported) only cover the 1GiB-aligned part
+ * of the huge page interior. The first huge page is mapped separately with
+ * small pages, so ranges are clipped to start above it here.
  */
 static void direct_map_ram_range(struct direct_map_ctx *ctx, u64 begin, u64 end)
 {
     struct page_table *pt = ctx->spec->pt;
-    u64 huge_begin, huge_end;
+    u64 huge_begin, huge_end, gigantic_begin, gigantic_end;
 
     begin = MAX(begin, huge_page_size(pt));
     begin = PAGE_ROUND_DOWN(begin);
@@ -1234,8 +1710,18 @@ static void direct_map_ram_range(struct direct_map_ctx *ctx, u64 begin, u64 end)
     huge_begin = MIN(HUGE_PAGE_ROUND_UP(pt, begin), end);
     huge_end = MAX(HUGE_PAGE_ROUND_DOWN(pt, end), huge_begin);
 
+    gigantic_begin = gigantic_end = huge_end;
+    if (pt->gigantic_pages) {
+        gigantic_begin = MIN(ALIGN_UP(huge_begin, gigantic_page_size(pt)),
+                             huge_end);
+        gigantic_end = MAX(ALIGN_DOWN(huge_end, gigantic_page_size(pt)),
+                           gigantic_begin);
+    }
+
     direct_map_one_range(ctx, begin, huge_begin, PAGE_TYPE_NORMAL);
-    direct_map_one_range(ctx, huge_begin, huge_end, PAGE_TYPE_HUGE);
+    direct_map_one_range(ctx, huge_begin, gigantic_begin, PAGE_TYPE_HUGE);
+    direct_map_one_range(ctx, gigantic_begin, gigantic_end, PAGE_TYPE_GIGANTIC);
+    direct_map_one_range(ctx, gigantic_end, huge_end, PAGE_TYPE_HUGE);
     direct_map_one_range(ctx, huge_end, end, PAGE_TYPE_NORMAL);
 }
 
@@ -1265,6 +1751,28 @@ static bool direct_map_ram_entry(void *opaque, const struct memory_map_entry *me
     return true;
 }
 
+/*
+ * The identity map is the same as the direct map up to the shared limit, except
+ * for the first huge page, which might have a NULL guard and is mapped
+ * separately by map_low_small_pages(). Instead of building the same set of
+ * tables twice, alias the direct map subtrees wherever the two are equally
+ * aligned, which is everywhere but the root table in practice. This roughly
+ * halves the page table memory & build time with an identity map.
+ */
+static void share_identity_map(struct direct_map_ctx *ctx)
+{
+    struct page_table *pt = ctx->spec->pt;
+    u64 begin = huge_page_size(pt);
+    u64 end = MIN(ctx->shared_limit, PAGE_ROUND_UP(ctx->ram_end));
+
+    if (end <= begin)
+        return;
+
+    if (!map_share_range(pt, ctx->direct_map_base + begin, begin, end - begin))
+        panic("Out of memory while sharing the direct map at 0x%016llX\n",
+              ctx->direct_map_base);
+}
+
 /*
  * The first huge page worth of physical memory is always mapped with small
  * pages: both to keep the NULL guard page small (so the kernel keeps access to
@@ -1339,44 +1847,146 @@ static void map_lower_huge_page(struct page_mapping_spec *spec, bool null_guard)
     spec->count = old_count - 1;
 }
 
-static void do_build_page_table(struct kernel_info *ki, enum pt_type type,
-                                bool higher_half_exclusive, bool null_guard) {
+/*
+ * Map a virtually & physically contiguous range with the largest pages that
+ * both bases are congruent for, falling back to smaller pages at the edges that
+ * aren't aligned to them.
+ */
+static void map_range_largest_pages(struct page_mapping_spec *spec,
+                                    u64 virtual_base, u64 physical_base,
+                                    u64 bytes)
+{
+    struct page_table *pt = spec->pt;
+    enum page_type type, max_type;
+
+    max_type = pt->gigantic_pages ? PAGE_TYPE_GIGANTIC : PAGE_TYPE_HUGE;
+    while (max_type != PAGE_TYPE_NORMAL &&
+           !IS_ALIGNED(virtual_base - physical_base,
+                       1ull << page_type_shift(pt, max_type)))
+        max_type--;
+
+    spec->virtual_base = virtual_base;
+    spec->physical_base = physical_base;
+
+    while (bytes) {
+        u64 page_bytes, run_bytes;
+
+        for (type = max_type; type != PAGE_TYPE_NORMAL; type--) {
+            page_bytes = 1ull << page_type_shift(pt, type);
+
+            if (IS_ALIGNED(spec->virtual_base, page_bytes) &&
+                bytes >= page_bytes)
+                break;
+        }
+
+        page_bytes = 1ull << page_type_shift(pt, type);
+        run_bytes = ALIGN_DOWN(bytes, page_bytes);
+
+        // Stop at the next boundary where a larger page would fit
+        if (type != max_type) {
+            u64 next_bytes = 1ull << page_type_shift(pt, type + 1);
+            u64 dist = ALIGN_UP(spec->virtual_base, next_bytes) -
+                       spec->virtual_base;
+
+            if (dist)
+                run_bytes = MIN(run_bytes, dist);
+        }
+
+        spec->type = type;
+        spec->count = run_bytes >> page_type_shift(pt, type);
+        map_pages(spec);
+
+        spec->virtual_base += run_bytes;
+        spec->physical_base += run_bytes;
+        bytes -= run_bytes;
+    }
+}
+
+static void map_kernel_address_space(struct kernel_info *ki,
+                                     struct page_mapping_spec *spec,
+                                     bool higher_half_exclusive,
+                                     bool null_guard)
+{
     struct handover_info *hi = &ki->hi;
     struct elf_binary_info *bi = &ki->bin_info;
-    u64 hh_base;
+    u64 hh_base = ultra_higher_half_base(hi->flags);
 
-    struct page_mapping_spec spec = {
-        .pt = &hi->pt,
-        .critical = true,
-    };
     struct direct_map_ctx ctx = {
-        .spec = &spec,
+        .spec = spec,
         .direct_map_base = hi->direct_map_base,
         .higher_half_limit = ultra_direct_map_max_size(hi->flags),
         .lower_half_limit = higher_half_exclusive ?
                                 0 : ultra_identity_map_max_size(hi->flags),
     };
-
-    hh_base = ultra_higher_half_base(hi->flags);
-    page_table_init(
-        spec.pt, type,
-        handover_get_max_pt_address(ctx.direct_map_base, hi->flags)
-    );
+    ctx.shared_limit = MIN(ctx.lower_half_limit, ctx.higher_half_limit);
 
     /*
      * Map only the RAM regions from the memory map into the direct map (and,
      * unless higher-half-exclusive, the identity map), so reserved and device
      * memory never ends up writeback-cached in the direct map.
      */
-    map_low_small_pages(&spec, ctx.direct_map_base, !higher_half_exclusive,
+    map_low_small_pages(spec, ctx.direct_map_base, !higher_half_exclusive,
                         null_guard);
     mm_foreach_entry(direct_map_ram_entry, &ctx);
     direct_map_ram_range(&ctx, ctx.ram_begin, ctx.ram_end);
+    share_identity_map(&ctx);
+
+    /*
+     * If kernel had allocate-anywhere set to on, map virtual base to physical
+     * base, otherwise simply direct map fist N gigabytes of physical. The
+     * allocate-anywhere physical base is picked to be congruent with the
+     * virtual one modulo the huge page size, see data_alloc().
+     */
+    if (ki->bin_opts.allocate_anywhere) {
+        map_range_largest_pages(
+            spec, bi->virtual_base, bi->physical_base,
+            PAGE_ROUND_UP(bi->physical_ceiling - bi->physical_base)
+        );
+    } else if (hh_base != ctx.direct_map_base) {
+        spec->virtual_base = hh_base;
+        spec->count = ultra_higher_half_size(hi->flags);
+        spec->count >>= huge_page_shift(spec->pt);
+
+        map_lower_huge_page(spec, false);
+        map_pages(spec);
+    }
+}
+
+static void do_build_page_table(struct kernel_info *ki, enum pt_type type,
+                                bool higher_half_exclusive, bool null_guard,
+                                u32 numa_node) {
+    struct handover_info *hi = &ki->hi;
+
+    struct page_mapping_spec spec = {
+        .pt = &hi->pt,
+        .critical = true,
+    };
+
+    spec.pt->prefer_numa_node = numa_node != NUMA_NODE_ANY;
+    spec.pt->numa_node = numa_node;
+
+    page_table_init(
+        spec.pt, type,
+        handover_get_max_pt_address(hi->direct_map_base, hi->flags)
+    );
+
+    /*
+     * Go over the entire address space twice: first to size the table page
+     * pool, then to actually map it with table pages carved out of the pool.
+     * Allocating the pool only turns free RAM into loader RAM, so the RAM
+     * ranges seen by both passes are identical.
+     */
+    pt_pool_begin_sizing(spec.pt);
+    map_kernel_address_space(ki, &spec, higher_half_exclusive, null_guard);
+    pt_pool_end_sizing(spec.pt);
+
+    map_kernel_address_space(ki, &spec, higher_half_exclusive, null_guard);
+    pt_pool_release(spec.pt);
 
     if (higher_half_exclusive) {
         u64 root_cov = pt_level_entry_virtual_coverage(spec.pt,
                                                        spec.pt->levels - 1);
-        u64 off, tramp_len = handover_get_minimum_map_length(ctx.direct_map_base,
+        u64 off, tramp_len = handover_get_minimum_map_length(hi->direct_map_base,
                                                              hi->flags);
 
         /*
@@ -1385,32 +1995,10 @@ static void do_build_page_table(struct kernel_info *ki, enum pt_type type,
          * cover it. These are unmapped again right after control is handed off.
          */
         for (off = 0; off < tramp_len; off += root_cov) {
-            map_copy_root_entry(spec.pt, ctx.direct_map_base + off,
+            map_copy_root_entry(spec.pt, hi->direct_map_base + off,
                                          0x0000000000000000  + off);
         }
     }
-
-    /*
-     * If kernel had allocate-anywhere set to on, map virtual base to physical
-     * base, otherwise simply direct map fist N gigabytes of physical.
-     */
-    if (ki->bin_opts.allocate_anywhere) {
-        spec.physical_base = bi->physical_base;
-        spec.virtual_base = bi->virtual_base;
-
-        spec.count = PAGE_ROUND_UP(bi->physical_ceiling - bi->physical_base);
-        spec.count >>= PAGE_SHIFT;
-
-        spec.type = PAGE_TYPE_NORMAL;
-        map_pages(&spec);
-    } else if (hh_base != ctx.direct_map_base) {
-        spec.virtual_base = hh_base;
-        spec.count = ultra_higher_half_size(hi->flags);
-        spec.count >>= huge_page_shift(spec.pt);
-
-        map_lower_huge_page(&spec, false);
-        map_pages(&spec);
-    }
 }
 
 static void build_page_table(struct config *cfg, struct loadable_entry *le,
@@ -1425,6 +2013,8 @@ static void build_page_table(struct config *cfg, struct loadable_entry *le,
     enum pt_type type;
     struct value pt_val;
 
+    timeline_mark(TIMELINE_EVENT_PAGE_TABLE_BUILD, 0);
+
     cfg_get_bool(cfg, le, SV("higher-half-exclusive"),
                  &is_higher_half_exclusive);
 
@@ -1463,7 +2053,8 @@ static void build_page_table(struct config *cfg, struct loadable_entry *le,
     }
 
     hi->direct_map_base = ultra_direct_map_base(hi->flags);
-    do_build_page_table(ki, type, is_higher_half_exclusive, null_guard);
+    do_build_page_table(ki, type, is_higher_half_exclusive, null_guard,
+                        spec->numa_node);
 
     return;
 
@@ -1483,20 +2074,31 @@ static void ultra_protocol_boot(struct config *cfg, struct loadable_entry *le)
     dynamic_buffer_init(&spec.module_buf,
                         sizeof(struct pending_module), true);
 
-    load_kernel(cfg, le, ki);
+    spec.numa_node = numa_placement_setup(cfg, le);
+
+    load_kernel(cfg, le, ki, spec.numa_node);
     build_page_table(cfg, le, &spec);
 
     spec.cmdline_present = get_cmdline(cfg, le, &spec.cmdline);
 
     load_kernel_as_module(cfg, le, &spec);
     load_all_modules(cfg, le, &spec);
-    allocate_stack(cfg, le, hi);
+    allocate_stack(cfg, le, hi, spec.numa_node);
     spec.acpi_rsdp_address = services_find_rsdp();
     spec.dtb_address = services_find_dtb();
     spec.smbios_address = services_find_smbios();
 
     spec.apm_info_present = apm_setup(cfg, le, &spec.apm_info);
     spec.uefi_info_present = uefi_info_setup(cfg, le, &spec.uefi_info);
+    spec.timeline_present = timeline_setup(cfg, le);
+    spec.numa_info_present = numa_info_setup(cfg, le, &spec);
+    cfg_get_bool(cfg, le, SV("pass-loader-log"), &spec.loader_log_present);
+
+    /*
+     * Started CPUs run on the final page table and rely on services being
+     * online while we wait for them, so this has to happen here.
+     */
+    spec.smp_present = smp_setup(cfg, le, &spec);
 
    /*
     * Attempt to set video mode last, as we're not going to be able to use
@@ -1504,6 +2106,9 @@ static void ultra_protocol_boot(struct config *cfg, struct loadable_entry *le)
     */
     spec.fb_present = set_video_mode(cfg, le, &spec.fb);
 
+    // As late as possible, see free_page_bitmap_setup()
+    spec.free_page_bitmap_present = free_page_bitmap_setup(cfg, le, &spec);
+
     // NOTE: no services must be used after this aside from memory allocation
     cfg_release(cfg);
     services_cleanup();
@@ -1517,6 +2122,9 @@ static void ultra_protocol_boot(struct config *cfg, struct loadable_entry *le)
     attr_arr_addr = build_attribute_array(&spec,
                                           ultra_max_binary_address(hi->flags));
 
+    // Only now that the firmware is gone, if it would've stolen them before
+    smp_start_deferred_aps();
+
     if (ki->is_higher_half) {
         hi->stack += hi->direct_map_base;
         attr_arr_addr += hi->direct_map_base;
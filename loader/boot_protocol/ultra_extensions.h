@@ -0,0 +1,141 @@
+#pragma once
+
+/*
+ * Hyper-specific extensions to the Ultra boot protocol.
+ *
+ * These live in a vendor range of attribute types so that they can never
+ * collide with attributes added to the protocol itself. Every extension is
+ * opt-in via the loader configuration, so kernels that are not aware of them
+ * never see one.
+ *
+ * Expects ultra_protocol.h to be included beforehand.
+ */
+
+#define ULTRA_ATTRIBUTE_HYPER_BASE 0x48590000 // 'HY'
+
+#define ULTRA_ATTRIBUTE_BOOT_TIMELINE (ULTRA_ATTRIBUTE_HYPER_BASE + 1)
+
+#define ULTRA_ATTRIBUTE_SMP_INFO      (ULTRA_ATTRIBUTE_HYPER_BASE + 2)
+#define ULTRA_ATTRIBUTE_FREE_PAGE_BITMAP (ULTRA_ATTRIBUTE_HYPER_BASE + 3)
+#define ULTRA_ATTRIBUTE_NUMA_INFO     (ULTRA_ATTRIBUTE_HYPER_BASE + 4)
+#define ULTRA_ATTRIBUTE_LOADER_LOG    (ULTRA_ATTRIBUTE_HYPER_BASE + 5)
+
+#define ULTRA_BOOT_TIMELINE_LOADER_ENTRY      1
+#define ULTRA_BOOT_TIMELINE_DISKS_INITIALIZED 2
+#define ULTRA_BOOT_TIMELINE_CONFIG_LOADED     3
+#define ULTRA_BOOT_TIMELINE_MODULE_LOADED     4 // argument is the module index
+#define ULTRA_BOOT_TIMELINE_KERNEL_LOADED     5
+#define ULTRA_BOOT_TIMELINE_PAGE_TABLE_BUILD  6
+#define ULTRA_BOOT_TIMELINE_HANDOVER          7
+
+struct ultra_boot_timeline_entry {
+    uint32_t event;
+    uint32_t argument;
+
+    // Raw cycle counter value: TSC on x86, CNTVCT_EL0 on aarch64
+    uint64_t timestamp;
+};
+
+struct ultra_boot_timeline_attribute {
+    struct ultra_attribute_header header;
+
+    // Cycle counter frequency in Hz, 0 if the loader wasn't able to tell
+    uint64_t frequency;
+
+    struct ultra_boot_timeline_entry entries[];
+};
+
+#define ULTRA_BOOT_TIMELINE_ENTRY_COUNT(attr)                              \
+    (((attr).header.size - sizeof(struct ultra_boot_timeline_attribute)) / \
+     sizeof(struct ultra_boot_timeline_entry))
+
+/*
+ * Application processors started by the loader are parked on their own
+ * descriptor, spinning until 'entrypoint' becomes non-zero. To release one,
+ * write 'stack' & 'argument' first, then 'entrypoint' with a release store.
+ * The CPU then jumps to 'entrypoint' with the stack set to 'stack', using the
+ * same register state and calling convention as the BSP handover, where arg0
+ * is a pointer to its own descriptor and arg1 is 'argument'.
+ *
+ * Only CPUs with ULTRA_SMP_CPU_PARKED set are waiting to be released, the
+ * rest failed to start and must be brought up by the kernel itself, if at all.
+ *
+ * The descriptors as well as the code parked CPUs are running live in
+ * loader-reclaimable memory, which must not be reclaimed until every parked
+ * CPU has been released.
+ */
+struct ultra_smp_cpu {
+    // x86: local APIC ID, aarch64: MPIDR_EL1 affinity fields
+    uint64_t hardware_id;
+
+    uint64_t entrypoint;
+    uint64_t stack;
+    uint64_t argument;
+
+    uint32_t acpi_uid;
+
+#define ULTRA_SMP_CPU_BSP    (1 << 0)
+#define ULTRA_SMP_CPU_PARKED (1 << 1)
+    uint32_t flags;
+
+    uint64_t reserved[3];
+};
+
+struct ultra_smp_info_attribute {
+    struct ultra_attribute_header header;
+    uint32_t cpu_count;
+    uint32_t bsp_index;
+
+    // Array of cpu_count descriptors, offset the same way as module addresses
+    uint64_t cpus_address;
+};
+
+/*
+ * One bit per 4K physical page starting at address 0, set if the page is
+ * entirely within a ULTRA_MEMORY_TYPE_FREE range of the memory map. Bits are
+ * stored in 64-bit words, least significant bit first, so page N is described
+ * by bit (N % 64) of word (N / 64). Pages past 'page_count' are never free.
+ *
+ * This matches the memory map exactly, so a kernel is free to use it as the
+ * initial state of its physical allocator instead of walking the map.
+ * The bitmap itself lives in loader-reclaimable memory.
+ */
+struct ultra_free_page_bitmap_attribute {
+    struct ultra_attribute_header header;
+    uint64_t page_count;
+
+    // Offset the same way as module addresses, size is in bytes
+    uint64_t bitmap_address;
+    uint64_t bitmap_size;
+};
+
+/*
+ * NUMA placement of what the loader put in memory. Nodes are ACPI SRAT
+ * proximity domains, ULTRA_NUMA_NODE_UNKNOWN is reported for everything if the
+ * platform isn't NUMA, as well as for memory the SRAT doesn't describe.
+ *
+ * 'module_nodes' has an entry per module attribute, in the same order, each
+ * being the node the first byte of that module ended up on.
+ */
+#define ULTRA_NUMA_NODE_UNKNOWN 0xFFFFFFFF
+
+struct ultra_numa_info_attribute {
+    struct ultra_attribute_header header;
+    uint32_t bsp_node;
+    uint32_t kernel_node;
+    uint32_t module_count;
+    uint32_t module_nodes[];
+};
+
+/*
+ * The loader's own log as of handover, regardless of how much of it made it to
+ * the console. Only the newest part is kept if the log outgrew the loader's
+ * buffer, in which case 'total_bytes' is larger than the length of 'text'.
+ */
+struct ultra_loader_log_attribute {
+    struct ultra_attribute_header header;
+    uint64_t total_bytes;
+
+    // NUL-terminated, oldest message first
+    char text[];
+};
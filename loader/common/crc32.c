@@ -0,0 +1,37 @@
+#include "common/helpers.h"
+#include "common/crc32.h"
+
+#define CRC32_POLYNOMIAL 0xEDB88320
+
+static u32 crc32_table[256];
+static bool table_ready;
+
+static void build_table(void)
+{
+    u32 i, j, crc;
+
+    for (i = 0; i < 256; ++i) {
+        crc = i;
+
+        for (j = 0; j < 8; ++j)
+            crc = (crc >> 1) ^ ((crc & 1) ? CRC32_POLYNOMIAL : 0);
+
+        crc32_table[i] = crc;
+    }
+
+    table_ready = true;
+}
+
+u32 crc32(const void *data, size_t size)
+{
+    const u8 *bytes = data;
+    u32 crc = 0xFFFFFFFF;
+
+    if (unlikely(!table_ready))
+        build_table();
+
+    while (size--)
+        crc = crc32_table[(crc ^ *bytes++) & 0xFF] ^ (crc >> 8);
+
+    return ~crc;
+}
@@ -1,7 +1,7 @@
-#include "fb_font.h"
+#include "common/fb_font.h"
 
-// UltraOS TTY font
-u8 fb_font[256][16] = {
+// UltraOS TTY font, ASCII only. Bit N of every row is the Nth pixel from the left
+const u8 fb_font[FB_FONT_GLYPH_COUNT][FB_FONT_HEIGHT] = {
     { 0 }, // Null (0)
     { 0 }, // Start of Heading (1)
     { 0 }, // Start of Text (2)
@@ -1,14 +1,31 @@
 #include "common/log.h"
 #include "common/format.h"
+#include "common/constants.h"
+#include "common/minmax.h"
+#include "common/string.h"
 
-// TODO: remove this hack
-#if __i386__
-#include "pio.h"
-#endif
-
+#include "serial.h"
 #include "video_services.h"
 
 static enum log_level current_level = LOG_LEVEL_INFO;
+static enum log_flush_mode flush_mode = LOG_FLUSH_IMMEDIATE;
+
+/*
+ * Every message lands in the ring first, from where it's flushed to the slow
+ * sinks (serial & tty) according to the flush mode, and eventually handed
+ * over to the kernel. The E9 port costs next to nothing and stays synchronous.
+ *
+ * Both positions are running byte counts, the ring only ever holds the last
+ * LOG_RING_SIZE bytes of the log.
+ */
+#define LOG_RING_SIZE (32 * KB)
+
+// Pending bytes at which batched mode flushes, well below the ring size
+#define LOG_BATCH_SIZE (4 * KB)
+
+static char log_ring[LOG_RING_SIZE];
+static u64 ring_head;
+static u64 ring_flushed;
 
 enum log_level logger_set_level(enum log_level level)
 {
@@ -18,41 +35,20 @@ enum log_level logger_set_level(enum log_level level)
 }
 
 #ifdef HYPER_SERIAL_LOG
+static void serial_init(void)
+{
+    struct serial_config config = {
+        .port = SERIAL_COM1,
+        .baud_rate = HYPER_SERIAL_BAUD_RATE,
+    };
 
-#define SERIAL_COM1 0x3F8
-
-#define INTERRUPT_ENABLE_REGISTER 1
-#define LINE_CONTROL_REGISTER 3
-#define DATA_REGISTER_BAUD_LO 0
-#define DATA_REGISTER_BAUD_HI 1
-#define LINE_STATUS_REGISTER 5
-
-#define SET_BAUD_MODE (1 << 7)
-#define DATA_WIDTH_8 (0b11)
-#define STOP_BIT_1 (0b0 << 2)
-#define PARITY_MODE_NONE (0b000 << 3)
-#define INTERRUPT_MODE_NONE (0b0000)
-
-#define STATUS_BUSY (1 << 5)
-
-static void serial_init(void) {
-    const uint16_t baud_divisor = 115200 / HYPER_SERIAL_BAUD_RATE;
-    out8(SERIAL_COM1 + LINE_CONTROL_REGISTER, SET_BAUD_MODE);
-    out8(SERIAL_COM1 + DATA_REGISTER_BAUD_LO, (baud_divisor << 8) >> 8);
-    out8(SERIAL_COM1 + DATA_REGISTER_BAUD_HI, baud_divisor >> 8);
-
-    out8(SERIAL_COM1 + LINE_CONTROL_REGISTER, DATA_WIDTH_8 | STOP_BIT_1 | PARITY_MODE_NONE);
-
-    out8(SERIAL_COM1 + INTERRUPT_ENABLE_REGISTER, INTERRUPT_MODE_NONE);
+    // Until the config file says otherwise, see configure_logger()
+    serial_configure(&config);
 }
 
-static void write_serial(const char* msg, size_t len) {
-    while (len--) {
-        while ((in8(SERIAL_COM1 + LINE_STATUS_REGISTER) & STATUS_BUSY) == 0)
-            ;
-
-        out8(SERIAL_COM1, *msg++);
-    }
+static void write_serial(const char *msg, size_t len)
+{
+    serial_write(msg, len);
 }
 #else
 static void serial_init(void) {}
@@ -108,6 +104,82 @@ static void write_0xe9(const char *msg, size_t len)
 #endif
 }
 
+static void ring_write(const char *msg, size_t len)
+{
+    size_t off = ring_head % LOG_RING_SIZE;
+    size_t first = MIN(len, LOG_RING_SIZE - off);
+
+    memcpy(&log_ring[off], msg, first);
+    memcpy(log_ring, msg + first, len - first);
+    ring_head += len;
+}
+
+static void write_slow_sinks(const char *msg, size_t len, enum color col)
+{
+    write_serial(msg, len);
+    vs_write_tty(msg, len, col);
+}
+
+// Writes everything up to 'end' that hasn't reached the slow sinks yet
+static void flush_to(u64 end, enum color col)
+{
+    size_t off, len, first;
+
+    // Whatever got overwritten before we got to it is gone
+    if (end - ring_flushed > LOG_RING_SIZE)
+        ring_flushed = end - LOG_RING_SIZE;
+
+    while (ring_flushed < end) {
+        off = ring_flushed % LOG_RING_SIZE;
+        len = end - ring_flushed;
+        first = MIN(len, LOG_RING_SIZE - off);
+
+        ring_flushed += first;
+        write_slow_sinks(&log_ring[off], first, col);
+    }
+}
+
+void logger_flush(void)
+{
+    // Info messages never reach the slow sinks in this mode, only the kernel
+    if (flush_mode == LOG_FLUSH_ERRORS_ONLY) {
+        ring_flushed = ring_head;
+        return;
+    }
+
+    flush_to(ring_head, COLOR_GRAY);
+}
+
+enum log_flush_mode logger_set_flush_mode(enum log_flush_mode mode)
+{
+    enum log_flush_mode prev = flush_mode;
+
+    logger_flush();
+    flush_mode = mode;
+    return prev;
+}
+
+size_t logger_buffered_bytes(void)
+{
+    return MIN(ring_head, (u64)LOG_RING_SIZE);
+}
+
+u64 logger_total_bytes(void)
+{
+    return ring_head;
+}
+
+size_t logger_copy_buffer(char *buf, size_t capacity)
+{
+    size_t len = MIN(capacity, logger_buffered_bytes());
+    size_t off = (ring_head - len) % LOG_RING_SIZE;
+    size_t first = MIN(len, LOG_RING_SIZE - off);
+
+    memcpy(buf, &log_ring[off], first);
+    memcpy(buf + first, log_ring, len - first);
+    return len;
+}
+
 void vprintlvl(enum log_level level, const char *msg, va_list vlist)
 {
     static char log_buf[256];
@@ -124,8 +196,28 @@ void vprintlvl(enum log_level level, const char *msg, va_list vlist)
 
     chars = vscnprintf(log_buf, sizeof(log_buf), msg, vlist);
     write_0xe9(log_buf, chars);
-    write_serial(log_buf, chars);
-    vs_write_tty(log_buf, chars, col);
+    ring_write(log_buf, chars);
+
+    switch (flush_mode) {
+    case LOG_FLUSH_IMMEDIATE:
+        flush_to(ring_head, col);
+        break;
+    case LOG_FLUSH_BATCHED:
+        if (level > LOG_LEVEL_INFO) {
+            // Keep the backlog in order, but only color this message
+            flush_to(ring_head - chars, COLOR_GRAY);
+            flush_to(ring_head, col);
+        } else if (ring_head - ring_flushed >= LOG_BATCH_SIZE) {
+            flush_to(ring_head, COLOR_GRAY);
+        }
+        break;
+    case LOG_FLUSH_ERRORS_ONLY:
+        if (level > LOG_LEVEL_INFO) {
+            ring_flushed = ring_head - chars;
+            flush_to(ring_head, col);
+        }
+        break;
+    }
 }
 
 void vprint(const char *msg, va_list vlist)
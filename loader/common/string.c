@@ -123,7 +123,7 @@ int memcmp(const void *lhs, const void *rhs, size_t count)
     return (int)l[-1] - (int)r[-1];
 }
 
-#else // Portable word-at-a-time implementation (e.g. aarch64).
+#elif !defined(__aarch64__) // Portable word-at-a-time implementation.
 
 static ALWAYS_INLINE void *forward_copy(
     void *dest, const void *src, size_t count
@@ -244,6 +244,8 @@ out_by_byte:
 
 #endif
 
+// aarch64 has its own versions of all of the above in arch/aarch64/string.asm
+#ifndef __aarch64__
 size_t strlen(const char *str)
 {
     const char *s = str;
@@ -264,3 +266,4 @@ size_t strlen(const char *str)
 
     return s - str;
 }
+#endif
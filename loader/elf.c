@@ -7,6 +7,7 @@
 #include "filesystem/filesystem.h"
 #include "allocator.h"
 #include "elf.h"
+#include "parallel.h"
 #include "elf/structures.h"
 #include "elf/context.h"
 #include "elf/machine.h"
@@ -82,6 +83,58 @@ static bool is_valid_file_size(u32 size)
     return size > sizeof(struct Elf64_Ehdr);
 }
 
+static void data_alloc_set_node(struct allocation_spec *as,
+                                const struct elf_load_spec *spec)
+{
+    if (!(spec->flags & ELF_PREFER_NUMA_NODE))
+        return;
+
+    as->flags |= ALLOCATE_PREFER_NODE;
+    as->node = spec->numa_node;
+}
+
+/*
+ * Over-allocate by one alignment unit, then give back the head and tail that
+ * aren't needed to make the physical base congruent with the virtual one.
+ * Returns 0 if there's no contiguous range big enough, in which case the
+ * caller falls back to a regular allocation.
+ */
+static u64 data_alloc_congruent(u64 virtual_base, size_t pages,
+                                const struct elf_load_spec *spec)
+{
+    u64 align = spec->physical_alignment;
+    size_t extra_pages = (align >> PAGE_SHIFT) - 1;
+    size_t head_pages;
+    u64 base, physical_base;
+    struct allocation_spec as = {
+        .ceiling = spec->binary_ceiling,
+        .pages = pages + extra_pages,
+        .type = spec->memory_type,
+    };
+
+    data_alloc_set_node(&as, spec);
+    base = allocate_pages_ex(&as);
+    if (!base)
+        return 0;
+
+    physical_base = base + ((virtual_base - base) & (align - 1));
+    head_pages = (physical_base - base) >> PAGE_SHIFT;
+
+    if (head_pages)
+        free_pages(ADDR_TO_PTR(base), head_pages);
+    if (extra_pages - head_pages) {
+        free_pages(ADDR_TO_PTR(physical_base + ((u64)pages << PAGE_SHIFT)),
+                   extra_pages - head_pages);
+    }
+
+    return physical_base;
+}
+
+/*
+ * 'address' is either the exact physical address to allocate at, or the
+ * virtual base that the physical one should be congruent with if
+ * alloc_anywhere is set.
+ */
 static u64 data_alloc(u64 address, size_t pages,
                       const struct elf_load_spec *spec,
                       bool alloc_anywhere)
@@ -93,9 +146,20 @@ static u64 data_alloc(u64 address, size_t pages,
         .type = spec->memory_type,
     };
 
+    data_alloc_set_node(&as, spec);
+
     if (!alloc_anywhere) {
         as.addr = address;
         as.flags |= ALLOCATE_PRECISE;
+    } else if (spec->physical_alignment > PAGE_SIZE &&
+               ((u64)pages << PAGE_SHIFT) >= spec->physical_alignment) {
+        /*
+         * Not worth it for binaries smaller than one alignment unit, they
+         * wouldn't be able to use a single huge page anyway.
+         */
+        u64 ret = data_alloc_congruent(address, pages, spec);
+        if (ret)
+            return ret;
     }
 
     return allocate_pages_ex(&as);
@@ -221,8 +285,9 @@ static bool elf_do_load(struct elf_load_ctx *ctx)
                                                       spec->binary_ceiling);
     }
 
-    bi->physical_base = data_alloc(bi->physical_base, pages, spec,
-                                   ctx->alloc_anywhere);
+    bi->physical_base = data_alloc(ctx->alloc_anywhere ? bi->virtual_base :
+                                                         bi->physical_base,
+                                   pages, spec, ctx->alloc_anywhere);
     if (ctx->alloc_anywhere) {
         bi->physical_ceiling = bi->physical_base;
         bi->physical_ceiling += pages * PAGE_SIZE;
@@ -281,7 +346,7 @@ static bool elf_do_load(struct elf_load_ctx *ctx)
 
         bytes_to_zero = hdr.memsz - hdr.filesz;
         if (bytes_to_zero)
-            memzero((void*)((ptr_t)load_base), bytes_to_zero);
+            parallel_bulk_zero((void*)((ptr_t)load_base), bytes_to_zero);
     }
 
     return true;
@@ -0,0 +1,460 @@
+#define MSG_FMT(msg) "BLOCKLIST: " msg
+
+#include "common/align.h"
+#include "common/crc32.h"
+#include "common/helpers.h"
+#include "common/log.h"
+#include "common/minmax.h"
+#include "common/string.h"
+#include "allocator.h"
+#include "disk_services.h"
+#include "services.h"
+#include "filesystem/blocklist.h"
+#include "filesystem/bulk_read.h"
+#include "filesystem/filesystem_table.h"
+#include "filesystem/path.h"
+#include "fat/structures.h"
+
+#define BLOCKLIST_DEBUG 0
+
+/*
+ * hyper_install --blocklist resolves the kernel & modules of the default entry
+ * at install time and writes down where they live, in a record placed right
+ * after stage2. For those files, opening costs a single directory entry read
+ * instead of a directory walk and a FAT chain build.
+ *
+ * The record is only ever a hint. A file is used if its directory entry still
+ * has the recorded name, first cluster, size & mtime, and whole-file reads are
+ * additionally checked against the recorded CRC32. Anything that doesn't add
+ * up falls back to regular path resolution.
+ *
+ * NOTE: ELF kernels are read piecewise, one segment at a time, so their reads
+ * are never CRC checked and rely on the directory entry check alone. A kernel
+ * rewritten in place without its directory entry changing goes unnoticed.
+ *
+ * The layout must be kept in sync with the installer.
+ */
+#define BLOCKLIST_MAGIC "HyperBL1"
+#define BLOCKLIST_MAGIC_LEN 8
+#define BLOCKLIST_MAX_SIZE (16 * 512)
+#define BLOCKLIST_PATH_ALIGN 8
+
+// Extents are in 512-byte blocks, same as the BIOS boot chain
+#define BLOCKLIST_BLOCK_SHIFT 9
+
+// Fields of our boot record that locate stage2, see boot_record.asm
+#define MBR_STAGE2_SECTORS_OFF 0x1AE
+#define MBR_STAGE2_LBA_OFF     0x1B0
+#define MBR_SIGNATURE_OFF      0x1FE
+#define MBR_SIGNATURE          0xAA55
+
+struct PACKED blocklist_header {
+    char magic[BLOCKLIST_MAGIC_LEN];
+
+    // Of the entire record, header included
+    u32 size;
+
+    // Of the entire record, with this field zeroed
+    u32 crc32;
+
+    u32 file_count;
+    u8 reserved[12];
+};
+BUILD_BUG_ON(sizeof(struct blocklist_header) != 32);
+
+/*
+ * Followed by the path (path_len bytes, not NUL-terminated, padded to
+ * BLOCKLIST_PATH_ALIGN) and then extent_count extents.
+ */
+struct PACKED blocklist_entry {
+    // First LBA of the partition the file lives on
+    u64 partition_lba;
+    u64 size;
+
+    // Disk LBA of the sector holding the file's FAT directory entry
+    u64 dirent_lba;
+    u16 dirent_offset;
+
+    u16 path_len;
+    u32 extent_count;
+    u32 crc32;
+
+    // Copies of the directory entry fields the record was generated from
+    u32 first_cluster;
+    u16 last_modified_time;
+    u16 last_modified_date;
+    char short_name[FAT_FULL_SHORT_NAME_LENGTH];
+
+    u8 reserved[9];
+};
+BUILD_BUG_ON(sizeof(struct blocklist_entry) != 64);
+
+struct PACKED blocklist_extent {
+    // Partition-relative
+    u64 first_block;
+    u64 block_count;
+};
+BUILD_BUG_ON(sizeof(struct blocklist_extent) != 16);
+
+struct blocklist_file {
+    struct file f;
+
+    /*
+     * Reads bypass the filesystem driver entirely, 'fs' is just enough of a
+     * filesystem for bulk_read_file() to address the partition.
+     */
+    struct filesystem fs;
+    struct filesystem *origin_fs;
+    const struct blocklist_entry *entry;
+
+    // Set once the extents turned out to be stale
+    struct file *fallback;
+};
+
+enum blocklist_state {
+    BLOCKLIST_STATE_UNKNOWN,
+    BLOCKLIST_STATE_ABSENT,
+    BLOCKLIST_STATE_PRESENT,
+};
+
+static enum blocklist_state state;
+static struct disk boot_disk;
+static u8 *record;
+static u32 record_size;
+
+static struct string_view entry_path(const struct blocklist_entry *be)
+{
+    return (struct string_view) { (const char*)(be + 1), be->path_len };
+}
+
+static const struct blocklist_extent *entry_extents(
+    const struct blocklist_entry *be
+)
+{
+    const u8 *path = (const u8*)(be + 1);
+
+    return (const void*)(path + ALIGN_UP(be->path_len, BLOCKLIST_PATH_ALIGN));
+}
+
+// Advances 'offset' past the entry, NULL if it doesn't fit in the record
+static const struct blocklist_entry *next_entry(u32 *offset)
+{
+    const struct blocklist_entry *be;
+    u64 bytes;
+
+    if (record_size - *offset < sizeof(*be))
+        return NULL;
+
+    be = (const void*)(record + *offset);
+    bytes = sizeof(*be);
+    bytes += ALIGN_UP(be->path_len, BLOCKLIST_PATH_ALIGN);
+    bytes += (u64)be->extent_count * sizeof(struct blocklist_extent);
+
+    if (bytes > record_size - *offset)
+        return NULL;
+
+    *offset += bytes;
+    return be;
+}
+
+static bool find_boot_disk(struct disk *out)
+{
+    const struct boot_device_info *bdi = fst_boot_device_info();
+    size_t i, count;
+
+    if (!bdi || bdi->type != BOOT_DEVICE_TYPE_DISK)
+        return false;
+
+    count = ds_get_disk_count();
+
+    for (i = 0; i < count; ++i) {
+        ds_query_disk(i, out);
+
+        if (out->id == bdi->disk_id && out->kind == bdi->disk_kind)
+            return true;
+    }
+
+    return false;
+}
+
+// The record sits right after stage2, which our MBR knows the location of
+static bool blocklist_lba(u8 *mbr, u64 *out_lba)
+{
+    u16 signature, stage2_sectors;
+    u64 stage2_lba;
+
+    memcpy(&signature, mbr + MBR_SIGNATURE_OFF, sizeof(signature));
+    memcpy(&stage2_sectors, mbr + MBR_STAGE2_SECTORS_OFF, sizeof(stage2_sectors));
+    memcpy(&stage2_lba, mbr + MBR_STAGE2_LBA_OFF, sizeof(stage2_lba));
+
+    if (signature != MBR_SIGNATURE || !stage2_sectors)
+        return false;
+    if (stage2_lba >= boot_disk.sectors ||
+        (boot_disk.sectors - stage2_lba) <= stage2_sectors)
+        return false;
+
+    *out_lba = stage2_lba + stage2_sectors;
+    return true;
+}
+
+static bool blocklist_load(void)
+{
+    struct blocklist_header *hdr;
+    u32 crc, blocks;
+    u64 lba;
+
+    // Only the BIOS installer knows how to write one
+    if (services_get_provider() != SERVICE_PROVIDER_BIOS)
+        return false;
+
+    if (!find_boot_disk(&boot_disk) ||
+        boot_disk.block_shift != BLOCKLIST_BLOCK_SHIFT)
+        return false;
+
+    record = allocate_bytes(BLOCKLIST_MAX_SIZE);
+    if (!record)
+        return false;
+
+    if (!ds_read_blocks(boot_disk.handle, record, 0, 1) ||
+        !blocklist_lba(record, &lba))
+        goto out_no_record;
+
+    if (!ds_read_blocks(boot_disk.handle, record, lba, 1))
+        goto out_no_record;
+
+    hdr = (struct blocklist_header*)record;
+    if (memcmp(hdr->magic, BLOCKLIST_MAGIC, BLOCKLIST_MAGIC_LEN) != 0) {
+        print_dbg(BLOCKLIST_DEBUG, "no record at LBA %llu\n", lba);
+        goto out_no_record;
+    }
+
+    record_size = hdr->size;
+    if (record_size < sizeof(*hdr) || record_size > BLOCKLIST_MAX_SIZE) {
+        print_warn("invalid record size %u, ignoring it\n", record_size);
+        goto out_no_record;
+    }
+
+    blocks = CEILING_DIVIDE(record_size, 1u << BLOCKLIST_BLOCK_SHIFT);
+    if ((boot_disk.sectors - lba) < blocks)
+        goto out_no_record;
+
+    if (blocks > 1 &&
+        !ds_read_blocks(boot_disk.handle, record + (1 << BLOCKLIST_BLOCK_SHIFT),
+                        lba + 1, blocks - 1))
+        goto out_no_record;
+
+    crc = hdr->crc32;
+    hdr->crc32 = 0;
+
+    if (crc32(record, record_size) != crc) {
+        print_warn("record checksum mismatch, ignoring it\n");
+        goto out_no_record;
+    }
+
+    print_info("%u file(s) recorded at LBA %llu\n", hdr->file_count, lba);
+    return true;
+
+out_no_record:
+    free_bytes(record, BLOCKLIST_MAX_SIZE);
+    record = NULL;
+    record_size = 0;
+    return false;
+}
+
+static bool extents_valid(struct filesystem *fs,
+                          const struct blocklist_entry *be)
+{
+    const struct blocklist_extent *ext = entry_extents(be);
+    u64 part_blocks, total_blocks = 0;
+    u32 i;
+
+    part_blocks = range_length(&fs->lba_range);
+    part_blocks <<= fs->d.block_shift;
+    part_blocks >>= BLOCKLIST_BLOCK_SHIFT;
+
+    for (i = 0; i < be->extent_count; ++i, ++ext) {
+        if (!ext->block_count || ext->first_block >= part_blocks ||
+            (part_blocks - ext->first_block) < ext->block_count)
+            return false;
+
+        total_blocks += ext->block_count;
+    }
+
+    return total_blocks >= CEILING_DIVIDE(be->size, 1ull << BLOCKLIST_BLOCK_SHIFT);
+}
+
+/*
+ * Anything that rewrites or moves the file updates its directory entry, so
+ * that's all we look at before trusting the extents.
+ */
+static bool dirent_matches(const struct blocklist_entry *be)
+{
+    struct fat_directory_entry de;
+    u64 off;
+    u32 first_cluster;
+
+    off = (be->dirent_lba << BLOCKLIST_BLOCK_SHIFT) + be->dirent_offset;
+    if (!ds_read(boot_disk.handle, &de, off, sizeof(de)))
+        return false;
+
+    first_cluster = ((u32)de.cluster_high << 16) | de.cluster_low;
+
+    return memcmp(de.filename, be->short_name, FAT_SHORT_NAME_LENGTH) == 0 &&
+           memcmp(de.extension, be->short_name + FAT_SHORT_NAME_LENGTH,
+                  FAT_SHORT_EXTENSION_LENGTH) == 0 &&
+           !(de.attributes & (SUBDIR_ATTRIBUTE | VOLUME_LABEL_ATTRIBUTE)) &&
+           de.size == be->size &&
+           first_cluster == be->first_cluster &&
+           de.last_modified_time == be->last_modified_time &&
+           de.last_modified_date == be->last_modified_date;
+}
+
+static bool blocklist_get_range(struct file *base_file, u64 file_block_off,
+                                size_t want_blocks, struct block_range *out)
+{
+    struct blocklist_file *bf = container_of(base_file, struct blocklist_file, f);
+    const struct blocklist_extent *ext = entry_extents(bf->entry);
+    u32 i;
+
+    for (i = 0; i < bf->entry->extent_count; ++i, ++ext) {
+        if (file_block_off >= ext->block_count) {
+            file_block_off -= ext->block_count;
+            continue;
+        }
+
+        out->part_byte_off = ext->first_block + file_block_off;
+        out->part_byte_off <<= BLOCKLIST_BLOCK_SHIFT;
+        out->blocks = MIN((u64)want_blocks, ext->block_count - file_block_off);
+        return true;
+    }
+
+    return false;
+}
+
+static bool open_fallback(struct blocklist_file *bf)
+{
+    struct string_view path = entry_path(bf->entry);
+
+    bf->fallback = path_walk_open(bf->origin_fs, path);
+    if (!bf->fallback) {
+        print_warn("%pSV is gone\n", &path);
+        return false;
+    }
+
+    if (bf->fallback->size != bf->f.size) {
+        print_warn("%pSV changed size (%llu vs %llu)\n",
+                   &path, bf->fallback->size, bf->f.size);
+        return false;
+    }
+
+    return true;
+}
+
+static bool blocklist_read_file(struct file *f, void *buf, u64 off, u32 bytes)
+{
+    struct blocklist_file *bf = container_of(f, struct blocklist_file, f);
+    struct string_view path;
+
+    if (bf->fallback)
+        return bf->fallback->fs->read_file(bf->fallback, buf, off, bytes);
+
+    if (!bulk_read_file(f, buf, off, bytes, blocklist_get_range))
+        return false;
+
+    /*
+     * Modules are read in one go, the kernel in pieces as the ELF dictates.
+     * Partial reads can't be checked, see the note at the top.
+     */
+    if (off != 0 || bytes != f->size || crc32(buf, bytes) == bf->entry->crc32)
+        return true;
+
+    path = entry_path(bf->entry);
+    print_warn("checksum mismatch for %pSV, re-reading via the filesystem\n",
+               &path);
+
+    if (!open_fallback(bf))
+        return false;
+
+    return bf->fallback->fs->read_file(bf->fallback, buf, off, bytes);
+}
+
+static void blocklist_close_file(struct file *f)
+{
+    struct blocklist_file *bf = container_of(f, struct blocklist_file, f);
+
+    if (bf->fallback)
+        bf->fallback->fs->close_file(bf->fallback);
+
+    free_bytes(bf, sizeof(*bf));
+}
+
+static struct file *open_entry(struct filesystem *fs,
+                               const struct blocklist_entry *be)
+{
+    struct blocklist_file *bf;
+    struct string_view path = entry_path(be);
+
+    if (!extents_valid(fs, be)) {
+        print_warn("invalid extents for %pSV\n", &path);
+        return NULL;
+    }
+
+    if (!dirent_matches(be)) {
+        print_info("%pSV changed since install, not using its extents\n",
+                   &path);
+        return NULL;
+    }
+
+    bf = allocate_bytes(sizeof(*bf));
+    if (!bf)
+        return NULL;
+
+    *bf = (struct blocklist_file) {
+        .f = {
+            .fs = &bf->fs,
+            .size = be->size,
+        },
+        .fs = {
+            .d = fs->d,
+            .lba_range = fs->lba_range,
+            .block_shift = BLOCKLIST_BLOCK_SHIFT,
+            .close_file = blocklist_close_file,
+            .read_file = blocklist_read_file,
+        },
+        .origin_fs = fs,
+        .entry = be,
+    };
+
+    print_info("opened %pSV from %u extent(s)\n", &path, be->extent_count);
+    return &bf->f;
+}
+
+struct file *blocklist_open(struct filesystem *fs, struct string_view path)
+{
+    const struct blocklist_header *hdr;
+    const struct blocklist_entry *be;
+    u32 i, offset = sizeof(*hdr);
+
+    if (unlikely(state == BLOCKLIST_STATE_UNKNOWN))
+        state = blocklist_load() ? BLOCKLIST_STATE_PRESENT :
+                                   BLOCKLIST_STATE_ABSENT;
+
+    if (state != BLOCKLIST_STATE_PRESENT || fs->d.handle != boot_disk.handle)
+        return NULL;
+
+    hdr = (const struct blocklist_header*)record;
+
+    for (i = 0; i < hdr->file_count; ++i) {
+        be = next_entry(&offset);
+        if (!be)
+            break;
+
+        if (be->partition_lba != fs->lba_range.begin ||
+            !sv_equals(entry_path(be), path))
+            continue;
+
+        return open_entry(fs, be);
+    }
+
+    return NULL;
+}
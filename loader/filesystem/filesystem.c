@@ -7,8 +7,10 @@
 #include "filesystem/filesystem_table.h"
 #include "filesystem/mbr.h"
 #include "filesystem/gpt.h"
+#include "filesystem/http.h"
 #include "filesystem/pxe.h"
 
+#include "http_services.h"
 #include "pxe_services.h"
 
 CTOR_SECTION_DEFINE_ITERATOR(filesystem_type_entry, filesystems);
@@ -109,3 +111,14 @@ void fs_detect_pxe(void)
     pxe_server_ip_address(&addr);
     fst_add_pxe_fs_entry(&g_pxe_fs, &addr);
 }
+
+void fs_detect_http(struct string_view root)
+{
+    ip_addr addr;
+
+    if (!http_services_setup(root))
+        return;
+
+    http_server_ip_address(&addr);
+    fst_add_http_fs_entry(&g_http_fs, &addr);
+}
@@ -10,6 +10,7 @@ static bool has_boot_dev;
 static struct boot_device_info boot_dev;
 static struct fs_entry *boot_entry;
 static struct fs_entry *pxe_entry;
+static struct fs_entry *http_entry;
 
 void fst_init(void)
 {
@@ -34,23 +35,36 @@ static void fst_fini(void)
 }
 DECLARE_CLEANUP_HANDLER(fst_fini);
 
-void fst_add_pxe_fs_entry(struct filesystem *fs, ip_addr *ip)
+static struct fs_entry *add_network_fs_entry(struct filesystem *fs,
+                                             ip_addr *ip, u16 type)
 {
     struct fs_entry *fse = dynamic_buffer_slot_alloc(&entry_buf);
     if (unlikely(!fse))
-        return;
-
-    // At this moment, we only expect one single PXE server per boot
-    BUG_ON(pxe_entry);
-    pxe_entry = fse;
+        return NULL;
 
     *fse = (struct fs_entry) {
         .loc = {
-            .entry_type = FSE_TYPE_PXE,
+            .entry_type = type,
             .ip = *ip,
         },
         .fs = fs,
     };
+
+    return fse;
+}
+
+void fst_add_pxe_fs_entry(struct filesystem *fs, ip_addr *ip)
+{
+    // At this moment, we only expect one single PXE server per boot
+    BUG_ON(pxe_entry);
+    pxe_entry = add_network_fs_entry(fs, ip, FSE_TYPE_PXE);
+}
+
+void fst_add_http_fs_entry(struct filesystem *fs, ip_addr *ip)
+{
+    // Same for HTTP, there's only one root URL
+    BUG_ON(http_entry);
+    http_entry = add_network_fs_entry(fs, ip, FSE_TYPE_HTTP);
 }
 
 void fst_add_raw_fs_entry(const struct disk *d, struct filesystem *fs)
@@ -125,6 +139,8 @@ const struct fs_entry *fst_fs_by_full_path(const struct full_path *path)
 
     if (path->disk_id_type == DISK_IDENTIFIER_PXE)
         return pxe_entry;
+    if (path->disk_id_type == DISK_IDENTIFIER_HTTP)
+        return http_entry;
 
     if (path->disk_id_type == DISK_IDENTIFIER_ORIGIN) {
         const struct fs_entry *origin = fst_get_origin();
@@ -157,7 +173,7 @@ const struct fs_entry *fst_fs_by_full_path(const struct full_path *path)
     for (i = 0; i < entry_buf.size; ++i) {
         struct fs_entry *entry = dynamic_buffer_get_slot(&entry_buf, i);
 
-        if (entry->loc.entry_type == FSE_TYPE_PXE)
+        if (fse_is_network(entry))
             continue;
 
         if (by_disk_index) {
@@ -225,6 +241,10 @@ void fst_resolve_boot_entry(void)
         boot_entry = pxe_entry;
         return;
     }
+    if (boot_dev.type == BOOT_DEVICE_TYPE_HTTP) {
+        boot_entry = http_entry;
+        return;
+    }
 
     if (boot_dev.partition_id == BOOT_PARTITION_ID_TYPE_NONE)
         return;
@@ -232,7 +252,7 @@ void fst_resolve_boot_entry(void)
     for (i = 0; i < entry_buf.size; ++i) {
         struct fs_entry *e = dynamic_buffer_get_slot(&entry_buf, i);
 
-        if (e->loc.entry_type == FSE_TYPE_PXE)
+        if (fse_is_network(e))
             continue;
         if (e->loc.disk_id != boot_dev.disk_id ||
             e->loc.disk_kind != boot_dev.disk_kind)
@@ -277,6 +297,8 @@ bool fst_entry_on_boot_device(const struct fs_entry *entry)
 
     if (entry->loc.entry_type == FSE_TYPE_PXE)
         return boot_dev.type == BOOT_DEVICE_TYPE_PXE;
+    if (entry->loc.entry_type == FSE_TYPE_HTTP)
+        return boot_dev.type == BOOT_DEVICE_TYPE_HTTP;
     if (boot_dev.type != BOOT_DEVICE_TYPE_DISK)
         return false;
 
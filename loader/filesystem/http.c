@@ -0,0 +1,67 @@
+#include "filesystem/http.h"
+#include "common/helpers.h"
+#include "filesystem/filesystem.h"
+#include "filesystem/path.h"
+#include "http_services.h"
+#include "allocator.h"
+
+/*
+ * Files are opened by asking the server for their size, every read after that
+ * is a range request for exactly the bytes that were asked for.
+ */
+struct http_file {
+    struct file base_file;
+
+    size_t path_len;
+    char path[MAX_PATH_SIZE];
+};
+
+static struct file *http_open_file(struct filesystem *fs,
+                                   struct string_view path)
+{
+    struct http_file *out_file;
+    u64 file_size;
+
+    if (path.size > MAX_PATH_SIZE)
+        return NULL;
+
+    if (!http_get_file_size(path, &file_size))
+        return NULL;
+
+    out_file = allocate_bytes(sizeof(*out_file));
+    if (!out_file)
+        return NULL;
+
+    *out_file = (struct http_file) {
+        .base_file = {
+            .fs = fs,
+            .size = file_size,
+        },
+        .path_len = path.size,
+    };
+    memcpy(out_file->path, path.text, path.size);
+
+    return &out_file->base_file;
+}
+
+static void http_close_file(struct file *file)
+{
+    struct http_file *hfile = container_of(file, struct http_file, base_file);
+
+    free_bytes(hfile, sizeof(*hfile));
+}
+
+static bool http_read(struct file *file, void *buffer, u64 offset, u32 bytes)
+{
+    struct http_file *hfile = container_of(file, struct http_file, base_file);
+    struct string_view path = { hfile->path, hfile->path_len };
+
+    return http_read_file_range(path, buffer, offset, bytes, file->size);
+}
+
+struct filesystem g_http_fs = {
+    .open_file_direct = http_open_file,
+    .close_file = http_close_file,
+    .read_file = http_read,
+    .block_shift = 9,
+};
@@ -1,6 +1,7 @@
 #include "common/ctype.h"
 #include "common/conversions.h"
 
+#include "filesystem/blocklist.h"
 #include "filesystem/path.h"
 
 bool next_path_node(struct string_view *path, struct string_view *node)
@@ -179,27 +180,36 @@ static bool path_consume_partition_identifier(struct string_view *path, struct f
     return false;
 }
 
-#define PXE_STR  SV("PXE")
-#define TFTP_STR SV("TFTP")
+static const struct {
+    struct string_view prefix;
+    enum disk_identifier id;
+} network_prefixes[] = {
+    { SV_CONSTEXPR("PXE"), DISK_IDENTIFIER_PXE },
+    { SV_CONSTEXPR("TFTP"), DISK_IDENTIFIER_PXE },
+    { SV_CONSTEXPR("HTTP"), DISK_IDENTIFIER_HTTP },
+};
 
 /*
- * Network (PXE) media has no disk/partition concept, so it's addressed by a
+ * Network media has no disk/partition concept, so it's addressed by a
  * dedicated "PXE::/" (or "TFTP::/") prefix that refers to the server the loader
- * booted from.
+ * booted from, or "HTTP::/" that refers to the HTTP root URL.
  */
-static bool path_consume_pxe_identifier(struct string_view *path,
-                                        struct full_path *out_path)
+static bool path_consume_network_identifier(struct string_view *path,
+                                            struct full_path *out_path)
 {
     struct string_view p = *path;
+    enum disk_identifier id = DISK_IDENTIFIER_INVALID;
+    size_t i;
 
-    if (sv_starts_with_caseless(p, PXE_STR))
-        sv_offset_by(&p, PXE_STR.size);
-    else if (sv_starts_with_caseless(p, TFTP_STR))
-        sv_offset_by(&p, TFTP_STR.size);
-    else
-        return false;
+    for (i = 0; i < ARRAY_SIZE(network_prefixes); ++i) {
+        if (sv_starts_with_caseless(p, network_prefixes[i].prefix)) {
+            sv_offset_by(&p, network_prefixes[i].prefix.size);
+            id = network_prefixes[i].id;
+            break;
+        }
+    }
 
-    if (!sv_starts_with(p, SV("::/")))
+    if (id == DISK_IDENTIFIER_INVALID || !sv_starts_with(p, SV("::/")))
         return false;
 
     // Skip "::", keeping the leading '/' as part of the path
@@ -209,7 +219,7 @@ static bool path_consume_pxe_identifier(struct string_view *path,
              &p, p.size, MAX_PATH_SIZE);
     }
 
-    out_path->disk_id_type = DISK_IDENTIFIER_PXE;
+    out_path->disk_id_type = id;
     out_path->partition_id_type = PARTITION_IDENTIFIER_RAW;
     out_path->path_within_partition = p;
     return true;
@@ -236,7 +246,7 @@ bool path_parse(struct string_view path, struct full_path *out_path)
         return true;
     }
 
-    if (path_consume_pxe_identifier(&path, out_path))
+    if (path_consume_network_identifier(&path, out_path))
         return true;
 
     /*
@@ -278,20 +288,13 @@ bool path_parse(struct string_view path, struct full_path *out_path)
     return true;
 }
 
- struct file *path_open(struct filesystem *fs, struct string_view path)
+struct file *path_walk_open(struct filesystem *fs, struct string_view path)
 {
     struct dir_iter_ctx ctx;
     struct dir_rec rec;
     struct string_view node;
     bool node_found = false, is_dir = true;
 
-    /*
-     * Filesystems without an iterator API (e.g. PXE) can only resolve a
-     * full path in one shot, so hand the whole thing over verbatim.
-     */
-    if (fs->open_file_direct)
-        return fs->open_file_direct(fs, path);
-
     fs->iter_ctx_init(fs, &ctx, NULL);
 
     while (next_path_node(&path, &node)) {
@@ -324,3 +327,21 @@ bool path_parse(struct string_view path, struct full_path *out_path)
 
     return fs->open_file(fs, &rec);
 }
+
+struct file *path_open(struct filesystem *fs, struct string_view path)
+{
+    struct file *f;
+
+    /*
+     * Filesystems without an iterator API (e.g. PXE) can only resolve a
+     * full path in one shot, so hand the whole thing over verbatim.
+     */
+    if (fs->open_file_direct)
+        return fs->open_file_direct(fs, path);
+
+    f = blocklist_open(fs, path);
+    if (f)
+        return f;
+
+    return path_walk_open(fs, path);
+}
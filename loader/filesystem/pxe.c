@@ -1,38 +1,47 @@
 #include "filesystem/pxe.h"
 #include "common/helpers.h"
 #include "filesystem/filesystem.h"
+#include "filesystem/path.h"
 #include "pxe_services.h"
 #include "allocator.h"
+#include "bulk_memory.h"
 
+/*
+ * Files are opened lazily, nothing is downloaded until the first read, which
+ * then lands directly in the caller's buffer. Only platforms that can't serve
+ * partial reads fall back to keeping a full copy in 'data' for those.
+ */
 struct pxe_file {
     struct file base_file;
-    u8 data[];
-};
+    u8 *data;
 
-static size_t pxe_file_struct_size(struct pxe_file *file)
-{
-    return sizeof(*file) + file->base_file.size;
-}
+    size_t path_len;
+    char path[MAX_PATH_SIZE];
+};
 
 static struct file *pxe_open_file(struct filesystem *fs, struct string_view path)
 {
     struct pxe_file *out_file;
     u64 file_size;
 
+    if (path.size > MAX_PATH_SIZE)
+        return NULL;
+
     if (!pxe_get_file_size(path, &file_size))
         return NULL;
 
-    out_file = allocate_bytes(sizeof(*out_file) + file_size);
+    out_file = allocate_bytes(sizeof(*out_file));
     if (!out_file)
         return NULL;
 
-    out_file->base_file.fs = fs;
-    out_file->base_file.size = file_size;
-
-    if (!pxe_read_file(path, out_file->data, file_size)) {
-        free_bytes(out_file, pxe_file_struct_size(out_file));
-        return NULL;
-    }
+    *out_file = (struct pxe_file) {
+        .base_file = {
+            .fs = fs,
+            .size = file_size,
+        },
+        .path_len = path.size,
+    };
+    memcpy(out_file->path, path.text, path.size);
 
     return &out_file->base_file;
 }
@@ -42,16 +51,38 @@ static void pxe_close_file(struct file *file)
     struct pxe_file *pfile;
 
     pfile = container_of(file, struct pxe_file, base_file);
-    free_bytes(pfile, pxe_file_struct_size(pfile));
+
+    if (pfile->data)
+        free_bytes(pfile->data, file->size);
+
+    free_bytes(pfile, sizeof(*pfile));
 }
 
 static bool pxe_read(struct file *file, void *buffer, u64 offset, u32 bytes)
 {
     struct pxe_file *pfile;
+    struct string_view path;
+    u64 size = file->size;
 
     pfile = container_of(file, struct pxe_file, base_file);
-    memcpy(buffer, pfile->data + offset, bytes);
+    path = (struct string_view) { pfile->path, pfile->path_len };
+
+    if (!pfile->data) {
+        if (pxe_read_supports_partial() || (offset == 0 && bytes == size))
+            return pxe_read_file_range(path, buffer, offset, bytes, size);
+
+        pfile->data = allocate_bytes(size);
+        if (!pfile->data)
+            return false;
+
+        if (!pxe_read_file_range(path, pfile->data, 0, size, size)) {
+            free_bytes(pfile->data, size);
+            pfile->data = NULL;
+            return false;
+        }
+    }
 
+    bulk_copy(buffer, pfile->data + offset, bytes);
     return true;
 }
 
@@ -0,0 +1,233 @@
+#pragma once
+
+#include "common/types.h"
+#include "common/attributes.h"
+
+#define ACPI_SIGNATURE_LEN 4
+
+struct acpi_rsdp {
+    char signature[8];
+    u8 checksum;
+    char oem_id[6];
+    u8 revision;
+    u32 rsdt_address;
+
+    // Only valid if revision >= 2
+    u32 length;
+    u64 xsdt_address;
+    u8 extended_checksum;
+    u8 reserved[3];
+} PACKED;
+
+struct acpi_sdt_header {
+    char signature[ACPI_SIGNATURE_LEN];
+    u32 length;
+    u8 revision;
+    u8 checksum;
+    char oem_id[6];
+    char oem_table_id[8];
+    u32 oem_revision;
+    u32 creator_id;
+    u32 creator_revision;
+} PACKED;
+
+// Multiple APIC Description Table, signature "APIC"
+struct acpi_madt {
+    struct acpi_sdt_header header;
+    u32 local_apic_address;
+    u32 flags;
+    u8 entries[];
+} PACKED;
+
+struct acpi_madt_entry_header {
+    u8 type;
+    u8 length;
+} PACKED;
+
+#define ACPI_MADT_ENTRY_TYPE_LAPIC  0x00
+#define ACPI_MADT_ENTRY_TYPE_X2APIC 0x09
+#define ACPI_MADT_ENTRY_TYPE_GICC   0x0B
+
+#define ACPI_MADT_LAPIC_ENABLED        (1 << 0)
+#define ACPI_MADT_LAPIC_ONLINE_CAPABLE (1 << 1)
+
+struct acpi_madt_lapic {
+    struct acpi_madt_entry_header header;
+    u8 acpi_processor_uid;
+    u8 apic_id;
+    u32 flags;
+} PACKED;
+
+struct acpi_madt_x2apic {
+    struct acpi_madt_entry_header header;
+    u16 reserved;
+    u32 x2apic_id;
+    u32 flags;
+    u32 acpi_processor_uid;
+} PACKED;
+
+#define ACPI_MADT_GICC_ENABLED        (1 << 0)
+#define ACPI_MADT_GICC_ONLINE_CAPABLE (1 << 3)
+
+struct acpi_madt_gicc {
+    struct acpi_madt_entry_header header;
+    u16 reserved;
+    u32 cpu_interface_number;
+    u32 acpi_processor_uid;
+    u32 flags;
+    u32 parking_protocol_version;
+    u32 performance_interrupt_gsiv;
+    u64 parked_address;
+    u64 physical_base_address;
+    u64 gicv;
+    u64 gich;
+    u32 vgic_maintenance_interrupt;
+    u64 gicr_base_address;
+    u64 mpidr;
+} PACKED;
+
+// System Resource Affinity Table, signature "SRAT"
+struct acpi_srat {
+    struct acpi_sdt_header header;
+    u32 reserved0;
+    u64 reserved1;
+    u8 entries[];
+} PACKED;
+
+struct acpi_srat_entry_header {
+    u8 type;
+    u8 length;
+} PACKED;
+
+#define ACPI_SRAT_ENTRY_TYPE_LAPIC_AFFINITY  0x00
+#define ACPI_SRAT_ENTRY_TYPE_MEMORY_AFFINITY 0x01
+#define ACPI_SRAT_ENTRY_TYPE_X2APIC_AFFINITY 0x02
+#define ACPI_SRAT_ENTRY_TYPE_GICC_AFFINITY   0x03
+
+// Same bit for every entry type
+#define ACPI_SRAT_ENABLED (1 << 0)
+
+#define ACPI_SRAT_MEMORY_HOT_PLUGGABLE (1 << 1)
+#define ACPI_SRAT_MEMORY_NON_VOLATILE  (1 << 2)
+
+struct acpi_srat_lapic_affinity {
+    struct acpi_srat_entry_header header;
+    u8 proximity_domain_low;
+    u8 apic_id;
+    u32 flags;
+    u8 local_sapic_eid;
+    u8 proximity_domain_high[3];
+    u32 clock_domain;
+} PACKED;
+
+struct acpi_srat_memory_affinity {
+    struct acpi_srat_entry_header header;
+    u32 proximity_domain;
+    u16 reserved0;
+    u64 base_address;
+    u64 length;
+    u32 reserved1;
+    u32 flags;
+    u64 reserved2;
+} PACKED;
+
+struct acpi_srat_x2apic_affinity {
+    struct acpi_srat_entry_header header;
+    u16 reserved0;
+    u32 proximity_domain;
+    u32 x2apic_id;
+    u32 flags;
+    u32 clock_domain;
+    u32 reserved1;
+} PACKED;
+
+struct acpi_srat_gicc_affinity {
+    struct acpi_srat_entry_header header;
+    u32 proximity_domain;
+    u32 acpi_processor_uid;
+    u32 flags;
+    u32 clock_domain;
+} PACKED;
+
+// Generic Address Structure
+struct acpi_gas {
+    u8 address_space_id;
+    u8 register_bit_width;
+    u8 register_bit_offset;
+    u8 access_size;
+    u64 address;
+} PACKED;
+
+#define ACPI_GAS_SPACE_SYSTEM_MEMORY 0x00
+#define ACPI_GAS_SPACE_SYSTEM_IO     0x01
+
+// Serial Port Console Redirection Table, signature "SPCR"
+struct acpi_spcr {
+    struct acpi_sdt_header header;
+    u8 interface_type;
+    u8 reserved0[3];
+    struct acpi_gas base_address;
+    u8 interrupt_type;
+    u8 irq;
+    u32 gsi;
+    u8 configured_baud_rate;
+    u8 parity;
+    u8 stop_bits;
+    u8 flow_control;
+    u8 terminal_type;
+    u8 language;
+    u16 pci_device_id;
+    u16 pci_vendor_id;
+    u8 pci_bus;
+    u8 pci_device;
+    u8 pci_function;
+    u32 pci_flags;
+    u8 pci_segment;
+
+    // Only valid if revision >= 3
+    u32 uart_clock_frequency;
+
+    // Only valid if revision >= 4
+    u32 precise_baud_rate;
+} PACKED;
+
+#define ACPI_SPCR_INTERFACE_16550     0x00
+#define ACPI_SPCR_INTERFACE_16450     0x01
+#define ACPI_SPCR_INTERFACE_16550_GAS 0x12
+
+// Encodings of configured_baud_rate, 0 means "as already configured"
+#define ACPI_SPCR_BAUD_RATE_9600   3
+#define ACPI_SPCR_BAUD_RATE_19200  4
+#define ACPI_SPCR_BAUD_RATE_57600  6
+#define ACPI_SPCR_BAUD_RATE_115200 7
+
+// Fixed ACPI Description Table, signature "FACP"
+#define ACPI_FADT_ARM_BOOT_ARCH_OFFSET 129
+
+#define ACPI_ARM_BOOT_ARCH_PSCI_COMPLIANT (1 << 0)
+#define ACPI_ARM_BOOT_ARCH_PSCI_USE_HVC   (1 << 1)
+
+/*
+ * Looks up the first table with the given signature via the XSDT (or the RSDT
+ * if the former is not available) pointed to by 'rsdp'. The table checksum is
+ * verified, a table that fails verification is skipped with a warning.
+ * Returns a pointer to the table header or NULL if no valid table was found.
+ */
+const struct acpi_sdt_header *acpi_find_table(ptr_t rsdp, const char *signature);
+
+/*
+ * Calls 'cb' for every entry of the MADT, stopping early if it returns false.
+ * Malformed entries (zero or out-of-bounds length) terminate the iteration.
+ */
+typedef bool (*acpi_madt_foreach_t)(void *user,
+                                    const struct acpi_madt_entry_header *entry);
+void acpi_madt_foreach(const struct acpi_madt *madt, acpi_madt_foreach_t cb,
+                       void *user);
+
+/*
+ * Same as acpi_madt_foreach(), but for the entries of the SRAT.
+ */
+typedef bool (*acpi_srat_foreach_t)(void *user,
+                                    const struct acpi_srat_entry_header *entry);
+void acpi_srat_foreach(const struct acpi_srat *srat, acpi_srat_foreach_t cb,
+                       void *user);
@@ -15,6 +15,12 @@
 #define ALLOCATE_CRITICAL (1 << 1)
 #define ALLOCATE_STACK    (1 << 2)
 
+/*
+ * Ignored with ALLOCATE_PRECISE: try to place the allocation on NUMA node
+ * 'node' first, falling back to any node if that doesn't work out.
+ */
+#define ALLOCATE_PREFER_NODE (1 << 3)
+
 struct allocation_spec {
     union {
         u64 addr;
@@ -25,6 +31,7 @@ struct allocation_spec {
 
     u32 flags;
     u32 type;
+    u32 node;
 };
 
 u64 allocate_pages_ex(const struct allocation_spec*);
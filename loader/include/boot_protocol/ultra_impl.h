@@ -42,6 +42,12 @@ u64 ultra_higher_half_size(u32 flags);
 u64 ultra_direct_map_base(u32 flags);
 u64 ultra_max_binary_address(u32 flags);
 
+/*
+ * Huge page size of the page table that is going to be built for the given
+ * flags, known before the exact page table type is picked.
+ */
+u64 ultra_huge_page_size(u32 flags);
+
 /*
  * 1 + the highest physical address the direct map (higher half) and identity
  * map (lower half) respectively are able to cover. Unbounded on 64-bit, but the
@@ -0,0 +1,25 @@
+#pragma once
+
+#include "common/types.h"
+
+/*
+ * Copy & zero routines meant for large buffers that are handed over to the
+ * kernel and are unlikely to be touched by the loader again: module contents,
+ * BSS, page table pools etc. Past an architecture specific size threshold
+ * these avoid dragging the destination through the cache where possible, below
+ * it they behave exactly like memcpy() & memzero().
+ *
+ * The ranges must not overlap.
+ */
+void bulk_copy(void *dest, const void *src, size_t count);
+void bulk_zero(void *dest, size_t count);
+
+/*
+ * Some architectures need extra CPU state enabled (e.g. SSE/AVX on x86) before
+ * the routines above can use anything but the general purpose registers.
+ * Enable it on the boot CPU as early as possible, and put it back the way it
+ * was found right before handing over to the kernel, after the last call to
+ * either routine. This is a no-op wherever the firmware owns that state.
+ */
+void bulk_memory_enable_cpu_state(void);
+void bulk_memory_restore_cpu_state(void);
@@ -0,0 +1,8 @@
+#pragma once
+#include "types.h"
+
+/*
+ * The standard (IEEE 802.3) CRC-32, i.e. the one zlib and Python's
+ * zlib.crc32() compute.
+ */
+u32 crc32(const void *data, size_t size);
@@ -0,0 +1,13 @@
+#pragma once
+
+#include "common/types.h"
+
+/*
+ * 8x16 bitmap font used by the framebuffer console, also shared with the test
+ * kernel. Only covers ASCII, anything past it must be substituted by the user.
+ */
+#define FB_FONT_WIDTH 8
+#define FB_FONT_HEIGHT 16
+#define FB_FONT_GLYPH_COUNT 128
+
+extern const u8 fb_font[FB_FONT_GLYPH_COUNT][FB_FONT_HEIGHT];
@@ -2,6 +2,7 @@
 
 #include <stdarg.h>
 #include "attributes.h"
+#include "types.h"
 
 // Inspired by linux kern_levels
 #define LOG_LEVEL_PREFIX "\x1"
@@ -17,8 +18,40 @@ enum log_level {
 
 enum log_level logger_set_level(enum log_level level);
 
+/*
+ * How messages reach the slow sinks (serial & tty). Every message is always
+ * kept in the in-memory log, see logger_copy_buffer().
+ */
+enum log_flush_mode {
+    // Every message as soon as it's printed
+    LOG_FLUSH_IMMEDIATE,
+
+    // Info messages in batches, warnings & errors flush everything right away
+    LOG_FLUSH_BATCHED,
+
+    // Only warnings & errors, info messages stay in memory
+    LOG_FLUSH_ERRORS_ONLY,
+};
+
+// Flushes whatever is pending before switching modes
+enum log_flush_mode logger_set_flush_mode(enum log_flush_mode mode);
+
+void logger_flush(void);
+
 void logger_init(void);
 
+// Number of bytes currently held by the in-memory log
+size_t logger_buffered_bytes(void);
+
+// Number of bytes ever logged, including the ones that no longer fit
+u64 logger_total_bytes(void);
+
+/*
+ * Copies the newest 'capacity' bytes of the in-memory log (or all of it if
+ * there's less) into 'buf', oldest first. Returns the number of bytes copied.
+ */
+size_t logger_copy_buffer(char *buf, size_t capacity);
+
 void vprintlvl(enum log_level, const char *msg, va_list vlist);
 void vprint(const char *msg, va_list vlist);
 
@@ -158,8 +158,8 @@ bool cfg_get_next_one_of(struct config *cfg, enum value_type mask, struct value
 #define cfg_get_first_one_of(cfg, obj, key, type_mask, out_ptr) _cfg_get_one_of(cfg, (obj)->cfg_off, false, key, (type_mask), out_ptr)
 
 #define cfg_get_global_bool(cfg, key, out_ptr) _cfg_get_bool(cfg, -1, true, key, out_ptr)
-#define cfg_get_global_signed(cfg, key, out_ptr) _cfg_get_unsigned(cfg, -1, true, key, out_ptr)
-#define cfg_get_global_unsigned(cfg, key, out_ptr) _cfg_get_signed(cfg, -1, true, key, out_ptr)
+#define cfg_get_global_signed(cfg, key, out_ptr) _cfg_get_signed(cfg, -1, true, key, out_ptr)
+#define cfg_get_global_unsigned(cfg, key, out_ptr) _cfg_get_unsigned(cfg, -1, true, key, out_ptr)
 #define cfg_get_global_string(cfg, key, out_ptr) _cfg_get_string(cfg, -1, true, key, out_ptr)
 #define cfg_get_global_object(cfg, key, out_ptr) _cfg_get_object(cfg, -1, true, key, out_ptr)
 
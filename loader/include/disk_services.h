@@ -31,6 +31,8 @@ enum boot_device_type {
     BOOT_DEVICE_TYPE_DISK,
     // Booted over the network (PXE)
     BOOT_DEVICE_TYPE_PXE,
+    // Booted over the network from an HTTP(S) URL
+    BOOT_DEVICE_TYPE_HTTP,
 };
 
 enum boot_partition_id_type {
@@ -7,6 +7,7 @@ struct file;
 
 #define ELF_ALLOCATE_ANYWHERE     (1 << 0)
 #define ELF_USE_VIRTUAL_ADDRESSES (1 << 1)
+#define ELF_PREFER_NUMA_NODE      (1 << 2)
 
 struct elf_io {
     struct file *binary;
@@ -21,6 +22,16 @@ struct elf_load_spec {
     u32 memory_type;
     u64 binary_ceiling;
     u64 higher_half_base;
+
+    /*
+     * ELF_ALLOCATE_ANYWHERE only, optional: try to pick a physical base that
+     * is congruent with the virtual base modulo this (power of two) value, so
+     * that the binary can be mapped with huge pages.
+     */
+    u64 physical_alignment;
+
+    // ELF_PREFER_NUMA_NODE only, see ALLOCATE_PREFER_NODE
+    u32 numa_node;
 };
 
 enum elf_arch {
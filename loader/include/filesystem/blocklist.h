@@ -0,0 +1,13 @@
+#pragma once
+
+#include "filesystem.h"
+
+/*
+ * Opens 'path' on 'fs' straight from the extents the installer recorded for it
+ * (hyper_install --blocklist), skipping the directory walk. Returns NULL if
+ * there's no record for the file, or the record no longer matches what's on
+ * disk, in which case the caller should resolve the path normally.
+ * The returned file carries its own filesystem, so it must be closed via
+ * file->fs->close_file.
+ */
+struct file *blocklist_open(struct filesystem *fs, struct string_view path);
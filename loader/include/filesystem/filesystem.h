@@ -98,5 +98,12 @@ void fs_check_read(struct file *f, u64 offset, u32 size);
 void fs_detect_all(struct disk *d, struct block_cache *bc);
 void fs_detect_pxe(void);
 
+/*
+ * Makes the files under the 'root' URL available as "HTTP::/". An empty
+ * 'root' only does anything if the loader was booted over HTTP, in which case
+ * the root is where the loader itself came from.
+ */
+void fs_detect_http(struct string_view root);
+
 struct filesystem *fs_try_detect(const struct disk *d, struct range lba_range,
                                  struct block_cache *bc);
@@ -10,6 +10,7 @@ enum fse_type {
     FSE_TYPE_MBR,
     FSE_TYPE_GPT,
     FSE_TYPE_PXE,
+    FSE_TYPE_HTTP,
 };
 
 struct fs_location {
@@ -32,9 +33,17 @@ struct fs_entry {
     struct filesystem *fs;
 };
 
+// Network filesystems have no disk behind them
+static inline bool fse_is_network(const struct fs_entry *entry)
+{
+    return entry->loc.entry_type == FSE_TYPE_PXE ||
+           entry->loc.entry_type == FSE_TYPE_HTTP;
+}
+
 void fst_init(void);
 
 void fst_add_pxe_fs_entry(struct filesystem*, ip_addr *ip);
+void fst_add_http_fs_entry(struct filesystem*, ip_addr *ip);
 
 void fst_add_raw_fs_entry(const struct disk *d, struct filesystem*);
 
@@ -64,7 +73,7 @@ const struct boot_device_info *fst_boot_device_info(void);
 
 /*
  * The filesystem the loader was booted from: the exact boot partition, or the
- * network filesystem for a PXE boot. NULL when it couldn't be pinned down
+ * network filesystem for a PXE/HTTP boot. NULL when it couldn't be pinned down
  * (partition unknown, or no recognized filesystem there). This is what '/'
  * should resolve to when it carries a config.
  */
@@ -72,7 +81,8 @@ struct fs_entry *fst_boot_entry(void);
 
 /*
  * Whether 'entry' lives on the device the loader was booted from: any partition
- * of the boot disk, or the network filesystem for a PXE boot. Used to prefer
- * the boot disk when the exact boot partition isn't known or has no config.
+ * of the boot disk, or the network filesystem for a PXE/HTTP boot. Used to
+ * prefer the boot disk when the exact boot partition isn't known or has no
+ * config.
  */
 bool fst_entry_on_boot_device(const struct fs_entry *entry);
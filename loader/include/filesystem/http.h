@@ -0,0 +1,3 @@
+#include "filesystem.h"
+
+extern struct filesystem g_http_fs;
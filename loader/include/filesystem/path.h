@@ -12,7 +12,8 @@ enum disk_identifier {
     DISK_IDENTIFIER_UUID,
     DISK_IDENTIFIER_ANY,
     DISK_IDENTIFIER_ORIGIN,
-    DISK_IDENTIFIER_PXE
+    DISK_IDENTIFIER_PXE,
+    DISK_IDENTIFIER_HTTP
 };
 
 enum partition_identifier {
@@ -44,3 +45,9 @@ struct full_path {
 
 bool path_parse(struct string_view path, struct full_path *out_path);
 struct file *path_open(struct filesystem *fs, struct string_view path);
+
+/*
+ * Same as path_open, but always walks the directories, ignoring the installer
+ * blocklist. 'fs' must have the iterator API.
+ */
+struct file *path_walk_open(struct filesystem *fs, struct string_view path);
@@ -0,0 +1,37 @@
+#pragma once
+
+#include "common/types.h"
+#include "common/string_view.h"
+#include "ip.h"
+
+/*
+ * Sets up HTTP services on the current platform. All paths are resolved
+ * relative to 'root', a "http://" or "https://" URL. An empty 'root' means
+ * the URL the loader itself was booted from, if it was booted over HTTP.
+ * A return value of 'true' indicates the server is reachable and usable.
+ */
+bool http_services_setup(struct string_view root);
+
+/*
+ * Retrieves the size of a file pointed to by 'path', as reported by the
+ * server. The beginning of the file is fetched along with it, so that a
+ * subsequent read of the headers doesn't cost another round trip.
+ * Returns 'true' if the result was retrieved successfully, 'false' otherwise.
+ */
+bool http_get_file_size(struct string_view path, u64 *out_size);
+
+/*
+ * Reads 'bytes' bytes at 'offset' of the file pointed to by 'path', which is
+ * expected to be exactly 'file_size' bytes long, directly into 'out_buf'.
+ * Only the requested range is transferred. Returns 'true' iff the entire
+ * range was received successfully.
+ */
+bool http_read_file_range(struct string_view path, void *out_buf, u64 offset,
+                          u64 bytes, u64 file_size);
+
+/*
+ * Retrieves the address of the HTTP server, left as an unset IPv4 address if
+ * the server is named by a host name rather than an address. Expected to be
+ * always successful after a (successful) call to http_services_setup().
+ */
+void http_server_ip_address(struct ip_addr *out);
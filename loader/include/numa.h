@@ -0,0 +1,27 @@
+#pragma once
+
+#include "common/types.h"
+
+/*
+ * Node-aware view of physical memory, built from the ACPI SRAT on first use.
+ * Nodes are SRAT proximity domains. Platforms without an SRAT, or with one
+ * that only describes a single node, are treated as non-NUMA, in which case
+ * every query below reports NUMA_NODE_ANY.
+ * Must only be used while services are still online.
+ */
+#define NUMA_NODE_ANY 0xFFFFFFFF
+
+// Node of the CPU we're running on, NUMA_NODE_ANY if unknown
+u32 numa_bsp_node(void);
+
+// Node 'address' belongs to, NUMA_NODE_ANY if it's not covered by the SRAT
+u32 numa_node_of(u64 address);
+
+bool numa_node_exists(u32 node);
+
+/*
+ * Finds the highest free range of 'pages' pages that lies entirely within
+ * 'node' and below 'ceiling'. Doesn't allocate anything.
+ * Returns the address of the first byte of the range, 0 if there isn't one.
+ */
+u64 numa_find_free_pages(u32 node, size_t pages, u64 ceiling);
@@ -0,0 +1,29 @@
+#pragma once
+
+#include "common/types.h"
+
+/*
+ * A minimal work dispatcher for spreading independent jobs over every CPU the
+ * firmware lets us use, falling back to running them serially on the calling
+ * CPU wherever that's not possible.
+ *
+ * Jobs may run on any CPU and in any order, so they must not depend on each
+ * other, use any services (memory allocation and logging included) or touch
+ * any global state that isn't safe to access concurrently. Job 0 is always
+ * run on the calling CPU before anything is dispatched, so a job may rely on
+ * one-time lazy initialization happening there.
+ */
+typedef void (*parallel_job_t)(void *ctx, size_t index);
+
+void parallel_for(size_t count, parallel_job_t job, void *ctx);
+
+/*
+ * Stops dispatching jobs to other CPUs from this point on, must be called
+ * before the loader takes over any application processor on its own.
+ */
+void parallel_disable(void);
+
+/*
+ * bulk_zero() split into chunks that are zeroed in parallel if worthwhile.
+ */
+void parallel_bulk_zero(void *dest, size_t count);
@@ -17,12 +17,21 @@ bool pxe_services_setup(void);
 bool pxe_get_file_size(struct string_view path, u64 *out_size);
 
 /*
- * Reads a file pointed to by 'path' into 'out_buf'. 'expected_size' specifies
- * the size of 'out_buf', as well as the expected amount of bytes the TFTP
- * server is supposed to transfer. Returns 'true' iff the transfer was
- * successful and the number of bytes transferred is exactly 'expected_size'.
+ * Whether pxe_read_file_range() accepts reads that don't cover the entire
+ * file. If it doesn't, such reads have to be served from a full copy.
  */
-bool pxe_read_file(struct string_view path, void *out_buf, u64 expected_size);
+bool pxe_read_supports_partial(void);
+
+/*
+ * Reads 'bytes' bytes at 'offset' of the file pointed to by 'path', which is
+ * expected to be exactly 'file_size' bytes long, directly into 'out_buf'.
+ * Consecutive reads that move forward through the same file are streamed from
+ * a single transfer, anything else restarts it. Returns 'true' iff the
+ * transfer was successful and the file turned out to be of the expected size
+ * as far as it was read.
+ */
+bool pxe_read_file_range(struct string_view path, void *out_buf, u64 offset,
+                         u64 bytes, u64 file_size);
 
 /*
  * Retrieves the address of the PXE server that is currently detected.
@@ -0,0 +1,31 @@
+#pragma once
+
+#include "common/types.h"
+
+/*
+ * Polled 16550-compatible UART used as a log sink, only available on x86 with
+ * HYPER_SERIAL_LOG enabled. The transmit FIFO is used whenever the UART has
+ * one, in which case every THRE wait is followed by a burst of up to a whole
+ * FIFO worth of bytes instead of a single one.
+ */
+#define SERIAL_COM1 0x3F8
+
+// Input clock of a PC UART, making 115200 the highest attainable baud rate
+#define SERIAL_DEFAULT_CLOCK_HZ 1843200
+
+struct serial_config {
+    u16 port;
+    u32 baud_rate;
+
+    // Frequency of the UART input clock, 0 means SERIAL_DEFAULT_CLOCK_HZ
+    u32 clock_hz;
+};
+
+/*
+ * (Re)programs the UART at config->port, after which all output goes there.
+ * Returns false and leaves the current configuration intact if there's no
+ * UART at that port or the baud rate can't be derived from the input clock.
+ */
+bool serial_configure(const struct serial_config *config);
+
+void serial_write(const char *msg, size_t len);
@@ -35,6 +35,21 @@ ptr_t services_find_smbios(void);
  */
 bool services_setup_apm(struct apm_info *out_info);
 
+/*
+ * Busy-waits for at least 'microseconds' using a firmware-provided timer.
+ */
+void services_stall(u32 microseconds);
+
+/*
+ * Runs 'proc(arg, on_ap)' on every available application processor and on the
+ * calling CPU at the same time, returning once it has returned everywhere.
+ * 'on_ap' is false for the calling CPU's invocation only. 'proc' must not use
+ * any services, including memory allocation and logging.
+ * Returns false without running 'proc' anywhere if the platform offers no way
+ * to dispatch work to other CPUs, or if there are none.
+ */
+bool services_run_on_all_cpus(void (*proc)(void *arg, bool on_ap), void *arg);
+
 /*
  * Aborts the loader execution in a platform-specific manner.
  * Must be used for unrecoverable errors.
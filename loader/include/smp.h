@@ -0,0 +1,108 @@
+#pragma once
+
+#include "common/types.h"
+#include "handover.h"
+
+/*
+ * Descriptor of a single CPU started by the loader, consumed by the kernel.
+ *
+ * Every application processor spins on its own descriptor until 'entrypoint'
+ * becomes non-zero, at which point it loads 'stack' and jumps there with a
+ * pointer to the descriptor as the first argument and 'argument' as the
+ * second one. The kernel must write 'stack' & 'argument' before 'entrypoint'.
+ *
+ * Each descriptor occupies a cache line of its own so that parked CPUs don't
+ * contend with each other or with the rest of the array. Protocols that
+ * export this must keep their own definition layout-compatible.
+ */
+struct smp_cpu {
+    // x86: local APIC ID, aarch64: MPIDR_EL1 affinity fields
+    u64 hardware_id;
+
+    u64 entrypoint;
+    u64 stack;
+    u64 argument;
+
+    u32 acpi_uid;
+
+#define SMP_CPU_BSP    (1 << 0)
+#define SMP_CPU_PARKED (1 << 1)
+    u32 flags;
+
+    u64 reserved[3];
+};
+
+struct smp_info {
+    // Physical address of the descriptor array, one entry per CPU
+    struct smp_cpu *cpus;
+    size_t cpu_count;
+    size_t bsp_index;
+};
+
+/*
+ * Enumerates all CPUs present in the system, starts every application
+ * processor and parks it in a loop waiting to be released by the kernel.
+ * hi -> handover info with a fully built page table, which is also what the
+ *       parked CPUs end up running on.
+ * pointer_offset -> offset added to the physical address of a descriptor when
+ *                   it's handed to the CPU it describes on release.
+ * Returns false if the platform offers no way to enumerate or start CPUs, in
+ * which case nothing was started. CPUs that failed to check in within a
+ * reasonable amount of time are left without SMP_CPU_PARKED.
+ * Must be called while services are still online. On some platforms the CPUs
+ * can only be woken up once the firmware is gone, smp_start_deferred_aps()
+ * must be called for those to be started at all.
+ */
+bool smp_start_aps(struct handover_info *hi, u64 pointer_offset,
+                   struct smp_info *out);
+
+/*
+ * Wakes up the CPUs whose start smp_start_aps() had to defer, and waits for
+ * them to check in. Must be called after services are gone for good (i.e.
+ * after the memory map is released), right before handing over to the kernel.
+ * Doesn't log anything. No-op if nothing was deferred.
+ */
+void smp_start_deferred_aps(void);
+
+/*
+ * Arch-specific, fills up to 'capacity' descriptors with the hardware IDs of
+ * enabled CPUs, marking the one we're running on with SMP_CPU_BSP.
+ * Returns the total number of enabled CPUs, 0 if they couldn't be enumerated.
+ */
+size_t smp_arch_enumerate(struct smp_cpu *cpus, size_t capacity);
+
+enum smp_start_result {
+    // No CPU could be started at all
+    SMP_START_FAILED,
+
+    // The wake-up sequence was sent, CPUs are on their way to check in
+    SMP_START_SENT,
+
+    /*
+     * Everything is prepared, but the firmware would take the CPUs back if
+     * they were woken up now. smp_arch_start_deferred() does that later.
+     */
+    SMP_START_DEFERRED,
+};
+
+/*
+ * Arch-specific, sends the wake-up sequence to every CPU in 'cpus' that isn't
+ * the BSP, or prepares to do so later. Doesn't wait for the CPUs to check in
+ * past what the wake-up protocol itself requires.
+ */
+enum smp_start_result smp_arch_start(struct handover_info *hi,
+                                     struct smp_cpu *cpus, size_t count,
+                                     u64 pointer_offset);
+
+/*
+ * Arch-specific, only called after smp_arch_start() returned
+ * SMP_START_DEFERRED, once services are gone. Sends the prepared wake-up
+ * sequence to the same CPUs.
+ */
+void smp_arch_start_deferred(struct smp_cpu *cpus, size_t count);
+
+/*
+ * Arch-specific, busy-waits for at least 'us' microseconds without using any
+ * services. Same constraints as smp_arch_start_deferred().
+ */
+void smp_arch_deferred_stall(u32 us);
@@ -0,0 +1,39 @@
+#pragma once
+
+#include "common/types.h"
+
+/*
+ * A coarse timeline of the boot process, recorded with the architectural
+ * cycle counter (TSC on x86, CNTVCT_EL0 on aarch64) at fixed points.
+ */
+enum timeline_event {
+    TIMELINE_EVENT_LOADER_ENTRY = 1,
+    TIMELINE_EVENT_DISKS_INITIALIZED,
+    TIMELINE_EVENT_CONFIG_LOADED,
+
+    // Argument is the index of the module
+    TIMELINE_EVENT_MODULE_LOADED,
+
+    TIMELINE_EVENT_KERNEL_LOADED,
+    TIMELINE_EVENT_PAGE_TABLE_BUILD,
+    TIMELINE_EVENT_HANDOVER,
+};
+
+struct timeline_entry {
+    u32 event;
+    u32 argument;
+    u64 timestamp;
+};
+
+void timeline_mark(enum timeline_event event, u32 argument);
+
+/*
+ * Returns all entries recorded so far. There is always room for the handover
+ * event, which is expected to be the last one.
+ */
+const struct timeline_entry *timeline_get_entries(size_t *out_count);
+
+// Cycle counter frequency in Hz, 0 if unknown
+u64 timeline_get_frequency(void);
+
+void timeline_print(void);
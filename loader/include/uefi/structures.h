@@ -61,6 +61,9 @@ typedef struct {
 #define EFI_DISK_IO_PROTOCOL_GUID \
     { 0xCE345171, 0xBA0B, 0x11D2, { 0x8E, 0x4F, 0x00, 0xA0, 0xC9, 0x69, 0x72, 0x3B } }
 
+#define EFI_SIMPLE_TEXT_OUTPUT_PROTOCOL_GUID \
+    { 0x387477C2, 0x69C7, 0x11D2, { 0x8E, 0x39, 0x00, 0xA0, 0xC9, 0x69, 0x72, 0x3B } }
+
 #define EFI_SUCCESS               0
 
 #define EFI_WARN_UNKNOWN_GLYPH    1
@@ -547,6 +550,8 @@ typedef struct {
 #define EFI_DEVICE_PATH_SUBTYPE_MAC        0x0B
 #define EFI_DEVICE_PATH_SUBTYPE_IPV4       0x0C
 #define EFI_DEVICE_PATH_SUBTYPE_IPV6       0x0D
+#define EFI_DEVICE_PATH_SUBTYPE_UART       0x0E
+#define EFI_DEVICE_PATH_SUBTYPE_URI        0x18
 #define EFI_DEVICE_PATH_SUBTYPE_HARD_DRIVE 0x01
 #define EFI_DEVICE_PATH_SUBTYPE_CDROM      0x02
 
@@ -561,6 +566,12 @@ typedef struct PACKED {
     UINT8 SignatureType;
 } EFI_HARD_DRIVE_DEVICE_PATH;
 
+// A MESSAGING/URI node, the URI isn't NUL-terminated and fills the rest of it
+typedef struct PACKED {
+    EFI_DEVICE_PATH_PROTOCOL Header;
+    CHAR8 Uri[];
+} EFI_URI_DEVICE_PATH;
+
 #define EFI_LOADED_IMAGE_PROTOCOL_GUID \
     { 0x5B1B31A1, 0x9562, 0x11d2, \
       { 0x8E, 0x3F, 0x00, 0xA0, 0xC9, 0x69, 0x72, 0x3B } }
@@ -1292,3 +1303,368 @@ typedef struct _EFI_PXE_BASE_CODE_PROTOCOL {
     VOID *SetPackets;
     EFI_PXE_BASE_CODE_MODE *Mode;
 } EFI_PXE_BASE_CODE_PROTOCOL;
+
+#define EFI_SIMPLE_NETWORK_PROTOCOL_GUID \
+    { 0xA19832B9, 0xAC25, 0x11D3, { 0x9A, 0x2D, 0x00, 0x90, 0x27, 0x3F, 0xC1, 0x4D } }
+
+// Only the leading fields we care about, the rest is never accessed
+typedef struct {
+    UINT32 State;
+    UINT32 HwAddressSize;
+    UINT32 MediaHeaderSize;
+    UINT32 MaxPacketSize;
+} EFI_SIMPLE_NETWORK_MODE;
+
+typedef struct _EFI_SIMPLE_NETWORK_PROTOCOL {
+    UINT64 Revision;
+    VOID *Start;
+    VOID *Stop;
+    VOID *Initialize;
+    VOID *Reset;
+    VOID *Shutdown;
+    VOID *ReceiveFilters;
+    VOID *StationAddress;
+    VOID *Statistics;
+    VOID *MCastIpToMac;
+    VOID *NvData;
+    VOID *GetStatus;
+    VOID *Transmit;
+    VOID *Receive;
+    EFI_EVENT WaitForPacket;
+    EFI_SIMPLE_NETWORK_MODE *Mode;
+} EFI_SIMPLE_NETWORK_PROTOCOL;
+
+typedef struct _EFI_SERVICE_BINDING_PROTOCOL EFI_SERVICE_BINDING_PROTOCOL;
+
+typedef
+EFI_STATUS
+(EFIAPI *EFI_SERVICE_BINDING_CREATE_CHILD) (
+    IN EFI_SERVICE_BINDING_PROTOCOL *This,
+    IN OUT EFI_HANDLE *ChildHandle
+);
+
+typedef
+EFI_STATUS
+(EFIAPI *EFI_SERVICE_BINDING_DESTROY_CHILD) (
+    IN EFI_SERVICE_BINDING_PROTOCOL *This,
+    IN EFI_HANDLE ChildHandle
+);
+
+typedef struct _EFI_SERVICE_BINDING_PROTOCOL {
+    EFI_SERVICE_BINDING_CREATE_CHILD CreateChild;
+    EFI_SERVICE_BINDING_DESTROY_CHILD DestroyChild;
+} EFI_SERVICE_BINDING_PROTOCOL;
+
+#define EFI_IP4_CONFIG2_PROTOCOL_GUID \
+    { 0x5B446ED1, 0xE30B, 0x4FAA, { 0x87, 0x1A, 0x36, 0x54, 0xEC, 0xA3, 0x60, 0x80 } }
+
+typedef struct _EFI_IP4_CONFIG2_PROTOCOL EFI_IP4_CONFIG2_PROTOCOL;
+
+typedef enum {
+    Ip4Config2DataTypeInterfaceInfo,
+    Ip4Config2DataTypePolicy,
+    Ip4Config2DataTypeManualAddress,
+    Ip4Config2DataTypeGateway,
+    Ip4Config2DataTypeDnsServer,
+    Ip4Config2DataTypeMaximum
+} EFI_IP4_CONFIG2_DATA_TYPE;
+
+typedef enum {
+    Ip4Config2PolicyStatic,
+    Ip4Config2PolicyDhcp,
+    Ip4Config2PolicyMax
+} EFI_IP4_CONFIG2_POLICY;
+
+typedef
+EFI_STATUS
+(EFIAPI *EFI_IP4_CONFIG2_SET_DATA) (
+    IN EFI_IP4_CONFIG2_PROTOCOL *This,
+    IN EFI_IP4_CONFIG2_DATA_TYPE DataType,
+    IN UINTN DataSize,
+    IN VOID *Data
+);
+
+typedef
+EFI_STATUS
+(EFIAPI *EFI_IP4_CONFIG2_GET_DATA) (
+    IN EFI_IP4_CONFIG2_PROTOCOL *This,
+    IN EFI_IP4_CONFIG2_DATA_TYPE DataType,
+    IN OUT UINTN *DataSize,
+    IN OPTIONAL VOID *Data
+);
+
+typedef struct _EFI_IP4_CONFIG2_PROTOCOL {
+    EFI_IP4_CONFIG2_SET_DATA SetData;
+    EFI_IP4_CONFIG2_GET_DATA GetData;
+    VOID *RegisterDataNotify;
+    VOID *UnregisterDataNotify;
+} EFI_IP4_CONFIG2_PROTOCOL;
+
+#define EFI_HTTP_SERVICE_BINDING_PROTOCOL_GUID \
+    { 0xBDC8E6AF, 0xD9BC, 0x4379, { 0xA7, 0x2A, 0xE0, 0xC4, 0xE7, 0x5D, 0xAE, 0x1C } }
+
+#define EFI_HTTP_PROTOCOL_GUID \
+    { 0x7A59B29B, 0x910B, 0x4171, { 0x82, 0x42, 0xA8, 0x5A, 0x0D, 0xF2, 0x5B, 0x5B } }
+
+typedef struct _EFI_HTTP_PROTOCOL EFI_HTTP_PROTOCOL;
+
+typedef enum {
+    HttpVersion10,
+    HttpVersion11,
+    HttpVersionUnsupported
+} EFI_HTTP_VERSION;
+
+typedef struct {
+    BOOLEAN UseDefaultAddress;
+    EFI_IPv4_ADDRESS LocalAddress;
+    EFI_IPv4_ADDRESS LocalSubnet;
+    UINT16 LocalPort;
+} EFI_HTTPv4_ACCESS_POINT;
+
+typedef struct {
+    EFI_IPv6_ADDRESS LocalAddress;
+    UINT16 LocalPort;
+} EFI_HTTPv6_ACCESS_POINT;
+
+typedef struct {
+    EFI_HTTP_VERSION HttpVersion;
+    UINT32 TimeOutMillisec;
+    BOOLEAN LocalAddressIsIPv6;
+    union {
+        EFI_HTTPv4_ACCESS_POINT *IPv4Node;
+        EFI_HTTPv6_ACCESS_POINT *IPv6Node;
+    } AccessPoint;
+} EFI_HTTP_CONFIG_DATA;
+
+typedef enum {
+    HttpMethodGet,
+    HttpMethodPost,
+    HttpMethodPatch,
+    HttpMethodOptions,
+    HttpMethodConnect,
+    HttpMethodHead,
+    HttpMethodPut,
+    HttpMethodDelete,
+    HttpMethodTrace,
+    HttpMethodMax
+} EFI_HTTP_METHOD;
+
+typedef struct {
+    EFI_HTTP_METHOD Method;
+    CHAR16 *Url;
+} EFI_HTTP_REQUEST_DATA;
+
+typedef enum {
+    HTTP_STATUS_UNSUPPORTED_STATUS = 0,
+    HTTP_STATUS_100_CONTINUE,
+    HTTP_STATUS_101_SWITCHING_PROTOCOLS,
+    HTTP_STATUS_200_OK,
+    HTTP_STATUS_201_CREATED,
+    HTTP_STATUS_202_ACCEPTED,
+    HTTP_STATUS_203_NON_AUTHORITATIVE_INFORMATION,
+    HTTP_STATUS_204_NO_CONTENT,
+    HTTP_STATUS_205_RESET_CONTENT,
+    HTTP_STATUS_206_PARTIAL_CONTENT,
+    HTTP_STATUS_300_MULTIPLE_CHOICES,
+    HTTP_STATUS_301_MOVED_PERMANENTLY,
+    HTTP_STATUS_302_FOUND,
+    HTTP_STATUS_303_SEE_OTHER,
+    HTTP_STATUS_304_NOT_MODIFIED,
+    HTTP_STATUS_305_USE_PROXY,
+    HTTP_STATUS_307_TEMPORARY_REDIRECT,
+    HTTP_STATUS_400_BAD_REQUEST,
+    HTTP_STATUS_401_UNAUTHORIZED,
+    HTTP_STATUS_402_PAYMENT_REQUIRED,
+    HTTP_STATUS_403_FORBIDDEN,
+    HTTP_STATUS_404_NOT_FOUND,
+    HTTP_STATUS_405_METHOD_NOT_ALLOWED,
+    HTTP_STATUS_406_NOT_ACCEPTABLE,
+    HTTP_STATUS_407_PROXY_AUTHENTICATION_REQUIRED,
+    HTTP_STATUS_408_REQUEST_TIME_OUT,
+    HTTP_STATUS_409_CONFLICT,
+    HTTP_STATUS_410_GONE,
+    HTTP_STATUS_411_LENGTH_REQUIRED,
+    HTTP_STATUS_412_PRECONDITION_FAILED,
+    HTTP_STATUS_413_REQUEST_ENTITY_TOO_LARGE,
+    HTTP_STATUS_414_REQUEST_URI_TOO_LARGE,
+    HTTP_STATUS_415_UNSUPPORTED_MEDIA_TYPE,
+    HTTP_STATUS_416_REQUESTED_RANGE_NOT_SATISFIED,
+    HTTP_STATUS_417_EXPECTATION_FAILED,
+    HTTP_STATUS_500_INTERNAL_SERVER_ERROR,
+    HTTP_STATUS_501_NOT_IMPLEMENTED,
+    HTTP_STATUS_502_BAD_GATEWAY,
+    HTTP_STATUS_503_SERVICE_UNAVAILABLE,
+    HTTP_STATUS_504_GATEWAY_TIME_OUT,
+    HTTP_STATUS_505_HTTP_VERSION_NOT_SUPPORTED,
+    HTTP_STATUS_308_PERMANENT_REDIRECT
+} EFI_HTTP_STATUS_CODE;
+
+typedef struct {
+    EFI_HTTP_STATUS_CODE StatusCode;
+} EFI_HTTP_RESPONSE_DATA;
+
+typedef struct {
+    CHAR8 *FieldName;
+    CHAR8 *FieldValue;
+} EFI_HTTP_HEADER;
+
+typedef struct {
+    union {
+        EFI_HTTP_REQUEST_DATA *Request;
+        EFI_HTTP_RESPONSE_DATA *Response;
+    } Data;
+    UINTN HeaderCount;
+    EFI_HTTP_HEADER *Headers;
+    UINTN BodyLength;
+    VOID *Body;
+} EFI_HTTP_MESSAGE;
+
+typedef struct {
+    EFI_EVENT Event;
+    EFI_STATUS Status;
+    EFI_HTTP_MESSAGE *Message;
+} EFI_HTTP_TOKEN;
+
+typedef
+EFI_STATUS
+(EFIAPI *EFI_HTTP_CONFIGURE) (
+    IN EFI_HTTP_PROTOCOL *This,
+    IN OPTIONAL EFI_HTTP_CONFIG_DATA *HttpConfigData
+);
+
+typedef
+EFI_STATUS
+(EFIAPI *EFI_HTTP_REQUEST) (
+    IN EFI_HTTP_PROTOCOL *This,
+    IN EFI_HTTP_TOKEN *Token
+);
+
+typedef
+EFI_STATUS
+(EFIAPI *EFI_HTTP_CANCEL) (
+    IN EFI_HTTP_PROTOCOL *This,
+    IN OPTIONAL EFI_HTTP_TOKEN *Token
+);
+
+typedef
+EFI_STATUS
+(EFIAPI *EFI_HTTP_RESPONSE) (
+    IN EFI_HTTP_PROTOCOL *This,
+    IN EFI_HTTP_TOKEN *Token
+);
+
+typedef
+EFI_STATUS
+(EFIAPI *EFI_HTTP_POLL) (
+    IN EFI_HTTP_PROTOCOL *This
+);
+
+typedef struct _EFI_HTTP_PROTOCOL {
+    VOID *GetModeData;
+    EFI_HTTP_CONFIGURE Configure;
+    EFI_HTTP_REQUEST Request;
+    EFI_HTTP_CANCEL Cancel;
+    EFI_HTTP_RESPONSE Response;
+    EFI_HTTP_POLL Poll;
+} EFI_HTTP_PROTOCOL;
+
+#define EFI_MP_SERVICES_PROTOCOL_GUID \
+    { 0x3FDDA605, 0xA76E, 0x4F46, { 0xAD, 0x29, 0x12, 0xF4, 0x53, 0x1B, 0x3D, 0x08 } }
+
+typedef struct _EFI_MP_SERVICES_PROTOCOL EFI_MP_SERVICES_PROTOCOL;
+
+#define PROCESSOR_AS_BSP_BIT        0x00000001
+#define PROCESSOR_ENABLED_BIT       0x00000002
+#define PROCESSOR_HEALTH_STATUS_BIT 0x00000004
+
+typedef struct {
+    UINT32 Package;
+    UINT32 Core;
+    UINT32 Thread;
+} EFI_CPU_PHYSICAL_LOCATION;
+
+typedef struct {
+    UINT64 ProcessorId;
+    UINT32 StatusFlag;
+    EFI_CPU_PHYSICAL_LOCATION Location;
+} EFI_PROCESSOR_INFORMATION;
+
+typedef
+VOID
+(EFIAPI *EFI_AP_PROCEDURE) (
+    IN OUT VOID *ProcedureArgument
+);
+
+typedef
+EFI_STATUS
+(EFIAPI *EFI_MP_SERVICES_GET_NUMBER_OF_PROCESSORS) (
+    IN EFI_MP_SERVICES_PROTOCOL *This,
+    OUT UINTN *NumberOfProcessors,
+    OUT UINTN *NumberOfEnabledProcessors
+);
+
+typedef
+EFI_STATUS
+(EFIAPI *EFI_MP_SERVICES_GET_PROCESSOR_INFO) (
+    IN EFI_MP_SERVICES_PROTOCOL *This,
+    IN UINTN ProcessorNumber,
+    OUT EFI_PROCESSOR_INFORMATION *ProcessorInfoBuffer
+);
+
+typedef
+EFI_STATUS
+(EFIAPI *EFI_MP_SERVICES_STARTUP_ALL_APS) (
+    IN EFI_MP_SERVICES_PROTOCOL *This,
+    IN EFI_AP_PROCEDURE Procedure,
+    IN BOOLEAN SingleThread,
+    IN OPTIONAL EFI_EVENT WaitEvent,
+    IN UINTN TimeoutInMicroSeconds,
+    IN OPTIONAL VOID *ProcedureArgument,
+    OUT OPTIONAL UINTN **FailedCpuList
+);
+
+typedef
+EFI_STATUS
+(EFIAPI *EFI_MP_SERVICES_STARTUP_THIS_AP) (
+    IN EFI_MP_SERVICES_PROTOCOL *This,
+    IN EFI_AP_PROCEDURE Procedure,
+    IN UINTN ProcessorNumber,
+    IN OPTIONAL EFI_EVENT WaitEvent,
+    IN UINTN TimeoutInMicroseconds,
+    IN OPTIONAL VOID *ProcedureArgument,
+    OUT OPTIONAL BOOLEAN *Finished
+);
+
+typedef
+EFI_STATUS
+(EFIAPI *EFI_MP_SERVICES_SWITCH_BSP) (
+    IN EFI_MP_SERVICES_PROTOCOL *This,
+    IN UINTN ProcessorNumber,
+    IN BOOLEAN EnableOldBSP
+);
+
+typedef
+EFI_STATUS
+(EFIAPI *EFI_MP_SERVICES_ENABLEDISABLEAP) (
+    IN EFI_MP_SERVICES_PROTOCOL *This,
+    IN UINTN ProcessorNumber,
+    IN BOOLEAN EnableAP,
+    IN OPTIONAL UINT32 *HealthFlag
+);
+
+typedef
+EFI_STATUS
+(EFIAPI *EFI_MP_SERVICES_WHOAMI) (
+    IN EFI_MP_SERVICES_PROTOCOL *This,
+    OUT UINTN *ProcessorNumber
+);
+
+struct _EFI_MP_SERVICES_PROTOCOL {
+    EFI_MP_SERVICES_GET_NUMBER_OF_PROCESSORS GetNumberOfProcessors;
+    EFI_MP_SERVICES_GET_PROCESSOR_INFO GetProcessorInfo;
+    EFI_MP_SERVICES_STARTUP_ALL_APS StartupAllAPs;
+    EFI_MP_SERVICES_STARTUP_THIS_AP StartupThisAP;
+    EFI_MP_SERVICES_SWITCH_BSP SwitchBSP;
+    EFI_MP_SERVICES_ENABLEDISABLEAP EnableDisableAP;
+    EFI_MP_SERVICES_WHOAMI WhoAmI;
+};
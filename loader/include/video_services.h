@@ -75,15 +75,19 @@ struct framebuffer {
 
 /*
  * Number of video modes that can be queried.
+ * Modes are enumerated lazily, so this has to probe every mode the firmware
+ * knows about, prefer iterating with vs_query_mode() where possible.
  */
 u32 vs_get_mode_count(void);
 
 /*
- * Retrieves information about a video mode at idx.
+ * Retrieves information about a video mode at idx, only probing the firmware
+ * for modes up to idx.
  * idx -> video mode to retrieve.
  * out_mode -> pointer to data that receives video mode information.
+ * Returns false if there's no mode at idx, i.e. all modes have been iterated.
  */
-void vs_query_mode(size_t idx, struct video_mode *out_mode);
+bool vs_query_mode(size_t idx, struct video_mode *out_mode);
 
 /*
  * Attempts to query native screen resolution.
@@ -109,6 +113,16 @@ bool vs_get_current_mode(struct video_mode *out_mode);
  */
 bool vs_set_mode(u32 id, struct framebuffer *out_framebuffer);
 
+/*
+ * Switches tty output from the firmware console to a console rendered
+ * directly into the current framebuffer.
+ * keep_serial -> keep mirroring output to the firmware's serial console, if
+ *                there is one.
+ * Returns true on success, false if the platform or the current video mode
+ * doesn't support it, in which case the tty is left as is.
+ */
+bool vs_use_framebuffer_tty(bool keep_serial);
+
 /*
 * Writes string to the output device with the given color.
 * text -> ascii string to output to the device.
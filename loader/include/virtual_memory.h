@@ -4,16 +4,55 @@
 #include "common/align.h"
 #include "arch/virtual_memory.h"
 
+// Deepest supported page table, see get_pte()
+#define PT_MAX_LEVELS 6
+
+/*
+ * Table pages are carved out of a single physically contiguous pool instead of
+ * being allocated one at a time, which would otherwise cost a memory map
+ * mutation (BIOS) or a firmware call (UEFI) per table page. The pool is sized
+ * by a dry run of all the mappings, see pt_pool_begin_sizing().
+ */
+struct pt_page_pool {
+    ptr_t base;
+    size_t capacity;
+    size_t used;
+
+    bool sizing;
+    size_t pages_needed;
+
+    /*
+     * Last table accounted at every level for each half of the address space,
+     * so that consecutive mappings sharing their edge tables aren't counted
+     * twice. Identity and direct map requests are interleaved, hence two.
+     */
+    u64 last_table[PT_MAX_LEVELS][2];
+};
+
 struct page_table {
     void *root;
-    void (*write_slot)(void*, u64);
-    u64 (*read_slot)(void*);
     u64 max_table_address;
     u64 entry_address_mask;
     u8 table_width_shift;
     u8 levels;
     u8 entry_width;
     u8 base_shift;
+
+    // Whether the table supports 1GiB leaf entries, see PAGE_TYPE_GIGANTIC
+    bool gigantic_pages;
+
+    // Per-level index geometry, precomputed by pt_init_levels()
+    u8 level_shift[PT_MAX_LEVELS];
+    u16 level_mask[PT_MAX_LEVELS];
+
+    struct pt_page_pool pool;
+
+    /*
+     * Set before page_table_init() to make table pages preferably come from a
+     * specific NUMA node, see ALLOCATE_PREFER_NODE.
+     */
+    bool prefer_numa_node;
+    u32 numa_node;
 };
 
 static inline ptr_t pt_get_root(struct page_table *pt)
@@ -41,6 +80,16 @@ static inline size_t page_size(struct page_table *pt)
     return 1ul << pt->base_shift;
 }
 
+static inline size_t gigantic_page_shift(struct page_table *pt)
+{
+    return huge_page_shift(pt) + pt->table_width_shift;
+}
+
+static inline u64 gigantic_page_size(struct page_table *pt)
+{
+    return 1ull << gigantic_page_shift(pt);
+}
+
 #define HUGE_PAGE_ROUND_UP(pt, size)   ALIGN_UP(size, huge_page_size(pt))
 #define HUGE_PAGE_ROUND_DOWN(pt, size) ALIGN_DOWN(size, huge_page_size(pt))
 
@@ -59,8 +108,17 @@ enum page_type {
 
     // 2/4M pages
     PAGE_TYPE_HUGE = 1,
+
+    // 1G pages, only valid if pt->gigantic_pages is set
+    PAGE_TYPE_GIGANTIC = 2,
 };
 
+static inline size_t page_type_shift(struct page_table *pt,
+                                     enum page_type type)
+{
+    return page_shift(pt) + pt->table_width_shift * type;
+}
+
 struct page_mapping_spec {
     struct page_table *pt;
 
@@ -74,8 +132,33 @@ struct page_mapping_spec {
 
 bool map_pages(const struct page_mapping_spec*);
 
+/*
+ * Makes [dst_virtual_base, dst_virtual_base + length) map the same physical
+ * memory as the already mapped [src_virtual_base, ...) by pointing the entries
+ * at the highest possible level to the same subtrees, wherever both ranges are
+ * aligned to the entry coverage. Anything below an entry that is already
+ * present in the destination is assumed to be identical and left alone.
+ * Note that modifications through one of the ranges are then visible in both.
+ */
+bool map_share_range(struct page_table *pt, u64 src_virtual_base,
+                     u64 dst_virtual_base, u64 length);
+
 // Copy a root table entry at src to dest table entry
 void map_copy_root_entry(struct page_table*, u64 src_virtual_address,
                          u64 dest_virtual_address);
 
 u64 pt_get_root_pte_at(struct page_table *pt, u64 virtual_address);
+
+/*
+ * Page table pool sizing protocol:
+ * pt_pool_begin_sizing() -> every map_pages() call only accounts the table
+ *                           pages it would need, nothing gets mapped.
+ * pt_pool_end_sizing()   -> reserves the pool for the accounted pages. Failing
+ *                           to do so is not fatal, table pages are then
+ *                           allocated one by one as before.
+ * pt_pool_release()      -> returns the unused part of the pool, must be called
+ *                           once all the real map_pages() calls are done.
+ */
+void pt_pool_begin_sizing(struct page_table *pt);
+void pt_pool_end_sizing(struct page_table *pt);
+void pt_pool_release(struct page_table *pt);
@@ -2,6 +2,63 @@
 
 #include "virtual_memory.h"
 
-ptr_t pt_get_table_page(u64 max_address);
+// Expects pt->max_table_address to be initialized
+ptr_t pt_get_table_page(struct page_table *pt);
 
 u8 pt_table_width_shift_for_level(struct page_table *pt, size_t idx);
+
+// Must be called by page_table_init() once the table geometry is set
+void pt_init_levels(struct page_table *pt);
+
+/*
+ * Entry accessors specialised for every supported entry width, generated from
+ * the same template. Callers dispatch on pt->entry_width once per table run
+ * instead of making an indirect call per entry, which leaves the compiler with
+ * plain store loops to unroll.
+ */
+#define DEFINE_PT_ENTRY_OPS(type)                                              \
+    static inline u64 pt_read_##type(void *slot)                               \
+    {                                                                          \
+        return *(type*)slot;                                                   \
+    }                                                                          \
+                                                                               \
+    static inline void pt_write_run_##type(void *slot, u64 entry, u64 step,    \
+                                           size_t count)                       \
+    {                                                                          \
+        type *cur = slot;                                                      \
+        size_t i;                                                              \
+                                                                               \
+        for (i = 0; i < count; ++i)                                            \
+            cur[i] = (type)(entry + i * step);                                 \
+    }
+
+DEFINE_PT_ENTRY_OPS(u32)
+DEFINE_PT_ENTRY_OPS(u64)
+
+#undef DEFINE_PT_ENTRY_OPS
+
+static inline u64 pt_read_slot(struct page_table *pt, void *slot)
+{
+    if (pt->entry_width == 8)
+        return pt_read_u64(slot);
+
+    return pt_read_u32(slot);
+}
+
+/*
+ * Writes 'count' consecutive entries starting at 'slot', each one 'step'
+ * bytes of physical memory past the previous one.
+ */
+static inline void pt_write_run(struct page_table *pt, void *slot, u64 entry,
+                                u64 step, size_t count)
+{
+    if (pt->entry_width == 8)
+        pt_write_run_u64(slot, entry, step, count);
+    else
+        pt_write_run_u32(slot, entry, step, count);
+}
+
+static inline void pt_write_slot(struct page_table *pt, void *slot, u64 entry)
+{
+    pt_write_run(pt, slot, entry, 0, 1);
+}
@@ -7,9 +7,16 @@
 #include "filesystem/filesystem_table.h"
 #include "config.h"
 #include "boot_protocol.h"
+#include "timeline.h"
+#include "acpi.h"
+#include "serial.h"
+#include "video_services.h"
+#include "bulk_memory.h"
 
 void init_all_disks(void);
 void init_config(struct config *out_cfg);
+void configure_logger(struct config *cfg);
+void configure_network(struct config *cfg);
 
 struct file *find_config_file(struct fs_entry **fe);
 void pick_loadable_entry(struct config *cfg, struct loadable_entry *le);
@@ -19,12 +26,19 @@ void loader_entry(void)
     struct config cfg = { 0 };
     struct loadable_entry le;
 
+    bulk_memory_enable_cpu_state();
+    timeline_mark(TIMELINE_EVENT_LOADER_ENTRY, 0);
     logger_init();
 
     fst_init();
 
     init_all_disks();
+    timeline_mark(TIMELINE_EVENT_DISKS_INITIALIZED, 0);
+
     init_config(&cfg);
+    timeline_mark(TIMELINE_EVENT_CONFIG_LOADED, 0);
+    configure_logger(&cfg);
+    configure_network(&cfg);
 
     pick_loadable_entry(&cfg, &le);
     boot(&cfg, &le);
@@ -61,6 +75,213 @@ void init_config(struct config *out_cfg)
     }
 }
 
+#ifdef HYPER_SERIAL_LOG
+
+#define SERIAL_PORT_KEY SV("serial-port")
+#define SERIAL_BAUD_RATE_KEY SV("serial-baud-rate")
+
+static u32 spcr_baud_rate(const struct acpi_spcr *spcr)
+{
+    if (spcr->header.revision >= 4 &&
+        spcr->header.length >= offsetof(struct acpi_spcr, precise_baud_rate) +
+                               sizeof(spcr->precise_baud_rate) &&
+        spcr->precise_baud_rate)
+        return spcr->precise_baud_rate;
+
+    switch (spcr->configured_baud_rate) {
+    case ACPI_SPCR_BAUD_RATE_9600:
+        return 9600;
+    case ACPI_SPCR_BAUD_RATE_19200:
+        return 19200;
+    case ACPI_SPCR_BAUD_RATE_57600:
+        return 57600;
+    case ACPI_SPCR_BAUD_RATE_115200:
+        return 115200;
+    default:
+        return 0;
+    }
+}
+
+/*
+ * Picks up the console the firmware redirects to, if it's a port I/O 16550.
+ * Memory-mapped UARTs aren't supported by the serial driver.
+ */
+static bool serial_config_from_spcr(struct serial_config *sc)
+{
+    const struct acpi_spcr *spcr;
+    u32 baud_rate;
+    ptr_t rsdp;
+
+    rsdp = services_find_rsdp();
+    if (!rsdp)
+        return false;
+
+    spcr = (const struct acpi_spcr*)acpi_find_table(rsdp, "SPCR");
+    if (!spcr || spcr->header.length < offsetof(struct acpi_spcr,
+                                                uart_clock_frequency))
+        return false;
+
+    switch (spcr->interface_type) {
+    case ACPI_SPCR_INTERFACE_16550:
+    case ACPI_SPCR_INTERFACE_16450:
+    case ACPI_SPCR_INTERFACE_16550_GAS:
+        break;
+    default:
+        return false;
+    }
+
+    if (spcr->base_address.address_space_id != ACPI_GAS_SPACE_SYSTEM_IO ||
+        !spcr->base_address.address || spcr->base_address.address > 0xFFFF)
+        return false;
+
+    sc->port = spcr->base_address.address;
+
+    // 0 means "as configured", which we have no way of knowing, keep ours
+    baud_rate = spcr_baud_rate(spcr);
+    if (baud_rate)
+        sc->baud_rate = baud_rate;
+
+    if (spcr->header.revision >= 3 &&
+        spcr->header.length >= offsetof(struct acpi_spcr, precise_baud_rate))
+        sc->clock_hz = spcr->uart_clock_frequency;
+
+    return true;
+}
+
+/*
+ * hyper.cfg takes priority over the SPCR, either key on its own overrides the
+ * corresponding compile-time default.
+ */
+static void configure_serial(struct config *cfg)
+{
+    struct serial_config sc = {
+        .port = SERIAL_COM1,
+        .baud_rate = HYPER_SERIAL_BAUD_RATE,
+    };
+    bool has_port, has_baud_rate;
+    u64 port, baud_rate;
+
+    has_port = cfg_get_global_unsigned(cfg, SERIAL_PORT_KEY, &port);
+    has_baud_rate = cfg_get_global_unsigned(cfg, SERIAL_BAUD_RATE_KEY,
+                                            &baud_rate);
+
+    if (!has_port && !has_baud_rate) {
+        if (!serial_config_from_spcr(&sc))
+            return;
+    }
+
+    if (has_port) {
+        if (!port || port > 0xFFFF)
+            oops("invalid serial port 0x%llX\n", port);
+
+        sc.port = port;
+    }
+
+    if (has_baud_rate) {
+        if (!baud_rate || baud_rate > 0xFFFFFFFF)
+            oops("invalid serial baud rate %llu\n", baud_rate);
+
+        sc.baud_rate = baud_rate;
+    }
+
+    // Anything still pending goes out at the old settings
+    logger_flush();
+
+    if (!serial_configure(&sc)) {
+        print_warn("unable to use serial port 0x%04X @ %u baud, keeping the "
+                   "previous configuration\n", sc.port, sc.baud_rate);
+        return;
+    }
+
+    print_info("logging to serial port 0x%04X @ %u baud\n", sc.port,
+               sc.baud_rate);
+}
+#else
+static void configure_serial(struct config *cfg)
+{
+    UNUSED(cfg);
+}
+#endif
+
+#define LOADER_CONSOLE_KEY SV("loader-console")
+
+/*
+ * "firmware" (default) keeps logging through the firmware console,
+ * "framebuffer" renders into the framebuffer directly, "framebuffer+serial"
+ * does the same but still mirrors to the firmware's serial console.
+ */
+static void configure_console(struct config *cfg)
+{
+    struct string_view console_str;
+    bool keep_serial;
+
+    if (!cfg_get_global_string(cfg, LOADER_CONSOLE_KEY, &console_str))
+        return;
+
+    if (sv_equals(console_str, SV("firmware")))
+        return;
+    else if (sv_equals(console_str, SV("framebuffer")))
+        keep_serial = false;
+    else if (sv_equals(console_str, SV("framebuffer+serial")))
+        keep_serial = true;
+    else
+        cfg_oops_invalid_key_value(LOADER_CONSOLE_KEY, console_str);
+
+    // Whatever is pending belongs to the old console
+    logger_flush();
+
+    if (!vs_use_framebuffer_tty(keep_serial))
+        print_warn("framebuffer console unavailable, using the firmware one\n");
+}
+
+#define LOG_FLUSH_KEY SV("log-flush")
+
+void configure_logger(struct config *cfg)
+{
+    struct string_view mode_str;
+    enum log_flush_mode mode;
+
+    configure_serial(cfg);
+    configure_console(cfg);
+
+    if (!cfg_get_global_string(cfg, LOG_FLUSH_KEY, &mode_str))
+        return;
+
+    if (sv_equals(mode_str, SV("immediate")))
+        mode = LOG_FLUSH_IMMEDIATE;
+    else if (sv_equals(mode_str, SV("batched")))
+        mode = LOG_FLUSH_BATCHED;
+    else if (sv_equals(mode_str, SV("errors-only")))
+        mode = LOG_FLUSH_ERRORS_ONLY;
+    else
+        cfg_oops_invalid_key_value(LOG_FLUSH_KEY, mode_str);
+
+    logger_set_flush_mode(mode);
+}
+
+#define HTTP_ROOT_KEY SV("http-root")
+
+// Files can be fetched over HTTP even if the loader wasn't booted that way
+void configure_network(struct config *cfg)
+{
+    const struct boot_device_info *bdi = fst_boot_device_info();
+    struct string_view root;
+
+    if (!cfg_get_global_string(cfg, HTTP_ROOT_KEY, &root))
+        return;
+
+    // The root is already where we were booted from
+    if (bdi && bdi->type == BOOT_DEVICE_TYPE_HTTP) {
+        print_warn("booted over HTTP, ignoring http-root\n");
+        return;
+    }
+
+    if (sv_empty(root))
+        cfg_oops_invalid_key_value(HTTP_ROOT_KEY, root);
+
+    fs_detect_http(root);
+}
+
 void init_all_disks(void)
 {
     size_t disk_index;
@@ -87,6 +308,7 @@ void init_all_disks(void)
     free_pages(buf, 1);
 
     fs_detect_pxe();
+    fs_detect_http(SV(""));
 
     /*
      * Now that all existing filesystems are detected, attempt to find our boot
@@ -129,6 +351,10 @@ static void print_boot_device(const struct boot_device_info *bd,
         print_info("Booted via network (PXE)\n");
         return;
     }
+    if (bd->type == BOOT_DEVICE_TYPE_HTTP) {
+        print_info("Booted via network (HTTP)\n");
+        return;
+    }
 
     kind = bd->disk_kind == DISK_KIND_CD ? "cd" : "hd";
     if (boot_entry == NULL || boot_entry->loc.entry_type == FSE_TYPE_RAW) {
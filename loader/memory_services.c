@@ -88,13 +88,11 @@ static u64 mme_resolve_type(struct memory_map_entry *entry)
  * ---------------------------------------
  * If a free range ends up being under a page in size after overlap resolution,
  * it gets removed from the memory map entirely.
+ *
+ * Parts "after" the winner are not final as they can overlap ranges further
+ * down the map, so they're fed back into the walk instead of being emitted.
  */
 
-struct overlap_resolution {
-    struct memory_map_entry entries[3];
-    u8 entry_count;
-};
-
 bool mme_is_valid(struct memory_map_entry *me)
 {
     if (!me->size_in_bytes)
@@ -125,75 +123,6 @@ void mme_align_if_needed(struct memory_map_entry *me)
     me->size_in_bytes = aligned_size;
 }
 
-static void do_resolve_rhs_win(struct memory_map_entry *lhs, struct memory_map_entry *rhs,
-                               struct overlap_resolution *res)
-{
-    u64 lhs_end = mme_end(lhs);
-    u64 rhs_end = mme_end(rhs);
-
-    res->entries[0] = (struct memory_map_entry) {
-        .physical_address = lhs->physical_address,
-        .size_in_bytes = rhs->physical_address - lhs->physical_address,
-        .type = lhs->type
-    };
-
-    res->entries[2] = (struct memory_map_entry) {
-        .physical_address = rhs_end,
-        .size_in_bytes = (lhs_end > rhs_end) ? lhs_end - rhs_end : 0,
-        .type = lhs->type
-    };
-
-    mme_align_if_needed(&res->entries[0]);
-    mme_align_if_needed(&res->entries[2]);
-
-    res->entry_count = 3;
-
-    if (!mme_is_valid(&res->entries[0])) {
-        res->entries[0] = *rhs;
-        res->entry_count--;
-    } else {
-        res->entries[1] = *rhs;
-    }
-
-    if (!mme_is_valid(&res->entries[2])) {
-        res->entry_count--;
-    } else if (res->entry_count != 3) {
-        res->entries[res->entry_count - 1] = res->entries[2];
-    }
-}
-
-static void do_resolve_lhs_win(struct memory_map_entry *lhs, struct memory_map_entry *rhs,
-                               struct overlap_resolution *res)
-{
-    u64 lhs_end = mme_end(lhs);
-    u64 rhs_end = mme_end(rhs);
-
-    res->entries[0] = (struct memory_map_entry) {
-        .physical_address = lhs->physical_address,
-        .size_in_bytes = lhs->size_in_bytes,
-        .type = lhs->type
-    };
-
-    res->entries[1] = (struct memory_map_entry) {
-        .physical_address = lhs_end,
-        .size_in_bytes = (lhs_end < rhs_end) ? rhs_end - lhs_end : 0,
-        .type = rhs->type
-    };
-    mme_align_if_needed(&res->entries[1]);
-
-    res->entry_count = 2;
-
-    if (!mme_is_valid(&res->entries[1]))
-        res->entry_count--;
-}
-
-static void do_resolve_overlap(struct memory_map_entry *lhs, struct memory_map_entry *rhs,
-                               struct overlap_resolution *res)
-{
-    return (rhs->type < lhs->type) ? do_resolve_lhs_win(lhs, rhs, res) :
-                                     do_resolve_rhs_win(lhs, rhs, res);
-}
-
 void mme_insert(struct memory_map_entry *buf, struct memory_map_entry *me,
                 size_t idx, size_t count)
 {
@@ -210,11 +139,6 @@ range_place:
     buf[idx] = *me;
 }
 
-struct fixup_result {
-    bool lhs_type_changed;
-    size_t new_count;
-};
-
 ssize_t mm_find_first_that_contains(struct memory_map_entry *buf, u64 count,
                                     u64 value, bool allow_one_above)
 {
@@ -249,183 +173,223 @@ ssize_t mm_find_first_that_contains(struct memory_map_entry *buf, u64 count,
     return allow_one_above ? left : -1;
 }
 
-// returns the number of new ranges inserted
-static int mme_insert_try_merge(struct memory_map_entry *buf, struct memory_map_entry *me,
-                                size_t count, size_t cap)
+/*
+ * Ranges starting at the same address are ordered by descending type so that
+ * the winner of a potential overlap is always seen first.
+ */
+static bool mme_less(const struct memory_map_entry *lhs,
+                     const struct memory_map_entry *rhs)
+{
+    if (lhs->physical_address != rhs->physical_address)
+        return lhs->physical_address < rhs->physical_address;
+
+    return lhs->type > rhs->type;
+}
+
+/*
+ * Pieces of ranges that lost an overlap resolution and extend past the winning
+ * range. They are merged back into the sorted input as the map is walked, and
+ * only live until the walk reaches their base, so this only ever has to hold
+ * as many pieces as there are nested overlaps at a given address.
+ */
+#define MAX_DEFERRED_PIECES 32
+
+struct fixup_ctx {
+    struct memory_map_entry *out;
+    size_t out_count;
+
+    struct memory_map_entry *in;
+    size_t in_count, in_idx;
+
+    // Sorted in reverse, the next piece is always the last one
+    struct memory_map_entry deferred[MAX_DEFERRED_PIECES];
+    size_t deferred_count;
+
+    u8 flags;
+};
+
+static bool fixup_take_next(struct fixup_ctx *ctx, struct memory_map_entry *out)
 {
-    ssize_t res = mm_find_first_that_contains(buf, count, me->physical_address, true);
-    struct memory_map_entry *target_me;
-    u64 this_end = mme_end(me);
-    u64 target_end;
-
-    if (res < 0) {
-        res = count;
-        goto out_no_merge;
+    struct memory_map_entry *next_deferred = NULL;
+    bool have_input = ctx->in_idx < ctx->in_count;
+
+    if (ctx->deferred_count)
+        next_deferred = &ctx->deferred[ctx->deferred_count - 1];
+
+    if (next_deferred &&
+        (!have_input || mme_less(next_deferred, &ctx->in[ctx->in_idx]))) {
+        *out = *next_deferred;
+        ctx->deferred_count--;
+        return true;
     }
 
-    target_me = &buf[res];
-    target_end = mme_end(target_me);
+    if (!have_input)
+        return false;
 
-    /*
-     * There's a small chance that we might be able to merge the entry
-     * with target, thus avoiding memmove and entry count increase.
-     */
-    if (me->physical_address < target_me->physical_address) {
-        // This range overlaps target
-        if (target_me->physical_address <= this_end && target_me->type == me->type) {
-            target_me->physical_address = me->physical_address;
-            target_me->size_in_bytes = MAX(this_end, target_end) - target_me->physical_address;
-            return 0;
-        }
+    *out = ctx->in[ctx->in_idx++];
+    return true;
+}
+
+static void fixup_defer(struct fixup_ctx *ctx, struct memory_map_entry *me)
+{
+    size_t i;
 
-        if (res == 0)
-            goto out_no_merge;
+    mme_align_if_needed(me);
+    if (!mme_is_valid(me))
+        return;
 
-        // previous range might overlap this range
-        target_me = &buf[--res];
-        target_end = mme_end(target_me);
+    if (ctx->deferred_count == MAX_DEFERRED_PIECES)
+        oops("too many nested memory map overlaps\n");
 
-        if (me->physical_address <= target_end && me->type == target_me->type) {
-            target_me->size_in_bytes = MAX(this_end, target_end) - target_me->physical_address;
-            return 0;
-        }
+    for (i = ctx->deferred_count++; i; --i) {
+        if (mme_less(me, &ctx->deferred[i - 1]))
+            break;
 
-        // Nothing to merge, insert this range at lower bound.
-        ++res;
-    } else if (target_me->type == me->type) {
-        target_me->size_in_bytes = MAX(this_end, target_end) - target_me->physical_address;
-        return 0;
+        ctx->deferred[i] = ctx->deferred[i - 1];
     }
 
-// Slow path, nothing to merge. Insert the extra range & increase count.
-out_no_merge:
-    OOPS_ON(count >= cap);
-    mme_insert(buf, me, res, count);
-    return 1;
+    ctx->deferred[i] = *me;
 }
 
-static void mm_overlap_fixup(
-    struct memory_map_entry *buf, size_t lhs_idx, size_t rhs_idx,
-    size_t count, size_t cap, struct fixup_result *res,
-    bool intentional_overlap
-)
+static void fixup_emit(struct fixup_ctx *ctx, struct memory_map_entry *me)
+{
+    struct memory_map_entry *slot = &ctx->out[ctx->out_count];
+
+    /*
+     * Overlap resolution can split one entry into two, make sure the output
+     * never catches up with the input that hasn't been consumed yet.
+     */
+    if (ctx->in_idx < ctx->in_count && slot >= &ctx->in[ctx->in_idx])
+        oops("out of memory map capacity during fixup\n");
+
+    *slot = *me;
+    ctx->out_count++;
+}
+
+static void fixup_resolve_overlap(struct fixup_ctx *ctx,
+                                  struct memory_map_entry *cur,
+                                  struct memory_map_entry *next)
 {
-    struct memory_map_entry *lhs = &buf[lhs_idx];
-    struct memory_map_entry *rhs = &buf[rhs_idx];
-    struct overlap_resolution or;
+    u64 cur_end = mme_end(cur);
+    u64 next_end = mme_end(next);
+    struct memory_map_entry piece;
+
+    if (!(ctx->flags & FIXUP_OVERLAP_INTENTIONAL)) {
+        print_warn(
+            "detected overlapping physical ranges:\n"
+            MM_ENT_FMT"\n"MM_ENT_FMT"\n",
+            MM_ENT_PRT(cur), MM_ENT_PRT(next)
+        );
 
-    if (!intentional_overlap) {
         /*
          * Overlaps between loader/protocol allocated memory are a fatal error.
          * This basically implies a bug in firmware allocator or some memory
          * corruption.
          */
-        BUG_ON(lhs->type > MEMORY_TYPE_MAX || rhs->type > MEMORY_TYPE_MAX);
+        BUG_ON(cur->type > MEMORY_TYPE_MAX || next->type > MEMORY_TYPE_MAX);
     }
+    DIE_ON(!(ctx->flags & FIXUP_OVERLAP_RESOLVE));
 
-    do_resolve_overlap(lhs, rhs, &or);
-
-    if (MC_DEBUG) {
-        int i;
-        print_info("resolved overlap with %d range(s):\n", or.entry_count);
-
-        for (i = 0; i < or.entry_count; ++i) {
-            print_info("entry[%d]: " MM_ENT_FMT "\n", i,
-                       MM_ENT_PRT(&or.entries[i]));
-        }
-
-        print_info("\n");
+    if (cur->type == next->type) {
+        cur->size_in_bytes = MAX(cur_end, next_end) - cur->physical_address;
+        return;
     }
 
-    res->new_count = count - 1;
+    // LHS wins, RHS gets a part after LHS, if any
+    if (next->type < cur->type) {
+        piece = (struct memory_map_entry) {
+            .physical_address = cur_end,
+            .size_in_bytes = next_end > cur_end ? next_end - cur_end : 0,
+            .type = next->type
+        };
+        fixup_defer(ctx, &piece);
+        return;
+    }
 
-    if (or.entries[0].type != lhs->type)
-        res->lhs_type_changed = true;
+    // RHS wins, LHS gets a part before RHS & a part after RHS, if any
+    piece = (struct memory_map_entry) {
+        .physical_address = cur->physical_address,
+        .size_in_bytes = next->physical_address - cur->physical_address,
+        .type = cur->type
+    };
+    mme_align_if_needed(&piece);
 
-    *lhs = or.entries[0];
+    /*
+     * Nothing that comes after can overlap this piece as the input is sorted,
+     * so it's final.
+     */
+    if (mme_is_valid(&piece))
+        fixup_emit(ctx, &piece);
 
-    if (or.entry_count >= 2) {
-        *rhs = or.entries[1];
-        res->new_count++;
-    }
+    piece = (struct memory_map_entry) {
+        .physical_address = next_end,
+        .size_in_bytes = cur_end > next_end ? cur_end - next_end : 0,
+        .type = cur->type
+    };
+    fixup_defer(ctx, &piece);
 
-    if (or.entry_count == 3) {
-        res->new_count += mme_insert_try_merge(buf + rhs_idx, &or.entries[2],
-                                               count - rhs_idx, cap - rhs_idx);
-    }
+    *cur = *next;
 }
 
+/*
+ * A single walk over the sorted map that resolves overlaps and merges adjacent
+ * ranges of the same type. The current range is kept aside until the next one
+ * is known not to overlap or extend it.
+ */
 static size_t mm_do_fixup(
     struct memory_map_entry *buf, size_t count, size_t buf_cap,
     u8 flags
 )
 {
-    size_t i, j;
-    struct memory_map_entry *this, *next;
-    u64 this_end;
-
-    j = 0;
-    i = 1;
-
-    while (i < count) {
-        this = &buf[j];
-        next = &buf[i];
-        this_end = mme_end(this);
-
-        if (this_end > next->physical_address) {
-            struct fixup_result fr;
-            bool is_intentional = flags & FIXUP_OVERLAP_INTENTIONAL;
-
-            if (!is_intentional) {
-                print_warn(
-                    "detected overlapping physical ranges:\n"
-                    MM_ENT_FMT"\n"MM_ENT_FMT"\n",
-                    MM_ENT_PRT(this), MM_ENT_PRT(next)
-                );
-            }
-            DIE_ON(!(flags & FIXUP_OVERLAP_RESOLVE));
-
-            mm_overlap_fixup(buf, j, i, count, buf_cap, &fr, is_intentional);
-
-            // Both ranges collapsed into one, skip rhs
-            if (fr.new_count < count)
-                ++i;
-
-            count = fr.new_count;
-            if (fr.lhs_type_changed && j != 0) {
-                --j;
-                --i;
-                buf[i] = buf[j + 1];
-            }
+    struct memory_map_entry cur, next;
+    struct fixup_ctx ctx = {
+        .out = buf,
+        .in = buf,
+        .in_count = count,
+        .flags = flags,
+    };
 
-            continue;
-        }
+    /*
+     * Resolving an overlap might produce more entries than it consumes, move
+     * the input to the end of the buffer to give the output some headroom.
+     */
+    if ((flags & FIXUP_OVERLAP_RESOLVE) && buf_cap > count) {
+        ctx.in = buf + (buf_cap - count);
+        memmove(ctx.in, buf, count * sizeof(*buf));
+    }
 
-        this->type = mme_resolve_type(this);
-        next->type = mme_resolve_type(next);
-        ++i;
+    fixup_take_next(&ctx, &cur);
 
-        if (this->type != next->type || this_end != next->physical_address) {
-            ++j;
+    while (fixup_take_next(&ctx, &next)) {
+        u64 cur_end = mme_end(&cur);
 
-            // This range is just after
-            if (j == i - 1)
-                continue;
+        if (cur_end > next.physical_address) {
+            fixup_resolve_overlap(&ctx, &cur, &next);
+            continue;
+        }
+
+        cur.type = mme_resolve_type(&cur);
+        next.type = mme_resolve_type(&next);
 
-            buf[j] = *next;
+        if (cur.type != next.type || cur_end != next.physical_address) {
+            fixup_emit(&ctx, &cur);
+            cur = next;
             continue;
         }
 
         print_dbg(MC_DEBUG, "merging ranges:\n"MM_ENT_FMT"\n"MM_ENT_FMT"\n",
-                  MM_ENT_PRT(this), MM_ENT_PRT(next));
+                  MM_ENT_PRT(&cur), MM_ENT_PRT(&next));
 
-        this->size_in_bytes += next->size_in_bytes;
+        cur.size_in_bytes += next.size_in_bytes;
 
         print_dbg(MC_DEBUG, "merged as: "MM_ENT_FMT"\n\n",
-                  MM_ENT_PRT(this));
+                  MM_ENT_PRT(&cur));
     }
 
-    return j + 1;
+    cur.type = mme_resolve_type(&cur);
+    fixup_emit(&ctx, &cur);
+
+    return ctx.out_count;
 }
 
 size_t mm_fixup(struct memory_map_entry *buf, size_t count, size_t cap, u8 flags)
@@ -456,25 +420,54 @@ size_t mm_fixup(struct memory_map_entry *buf, size_t count, size_t cap, u8 flags
     return ret;
 }
 
+static void mme_sift_down(struct memory_map_entry *buf, size_t idx,
+                          size_t count)
+{
+    for (;;) {
+        size_t child = idx * 2 + 1;
+        struct memory_map_entry tmp;
+
+        if (child >= count)
+            return;
+
+        if (child + 1 < count && mme_less(&buf[child], &buf[child + 1]))
+            child++;
+
+        if (!mme_less(&buf[idx], &buf[child]))
+            return;
+
+        tmp = buf[idx];
+        buf[idx] = buf[child];
+        buf[child] = tmp;
+        idx = child;
+    }
+}
+
+/*
+ * Firmware maps are almost always sorted already and the same map is often
+ * sorted more than once, so check for that first. Otherwise, heapsort: it's
+ * O(n log n) in the worst case, in-place and doesn't recurse.
+ */
 void mm_sort(struct memory_map_entry *buf, size_t count)
 {
-    size_t i, j;
+    size_t i;
 
-    for (i = 0; i < count; ++i) {
-        j = i;
+    for (i = 1; i < count; ++i) {
+        if (mme_less(&buf[i], &buf[i - 1]))
+            break;
+    }
+    if (i >= count)
+        return;
 
-        while (j) {
-            struct memory_map_entry *rhs = &buf[j];
-            struct memory_map_entry *lhs = &buf[j - 1];
+    for (i = count / 2; i-- > 0;)
+        mme_sift_down(buf, i, count);
 
-            if (lhs->physical_address <= rhs->physical_address)
-                break;
+    for (i = count - 1; i > 0; --i) {
+        struct memory_map_entry tmp = buf[0];
 
-            struct memory_map_entry tmp = *rhs;
-            *rhs = *lhs;
-            *lhs = tmp;
-            --j;
-        }
+        buf[0] = buf[i];
+        buf[i] = tmp;
+        mme_sift_down(buf, 0, i);
     }
 }
 
@@ -0,0 +1,300 @@
+#define MSG_FMT(msg) "NUMA: " msg
+
+#include "common/align.h"
+#include "common/log.h"
+#include "common/minmax.h"
+#include "common/string.h"
+#include "acpi.h"
+#include "allocator.h"
+#include "memory_services.h"
+#include "numa.h"
+#include "services.h"
+#include "smp.h"
+
+/*
+ * Firmware tends to describe each node with a handful of ranges at most, so a
+ * fixed table is plenty. Ranges past the limit are dropped with a warning,
+ * which only makes the affected memory look node-less.
+ */
+#define NUMA_MAX_RANGES 64
+
+struct numa_range {
+    u64 begin, end;
+    u32 node;
+};
+
+static struct numa_range ranges[NUMA_MAX_RANGES];
+static size_t range_count;
+static u32 bsp_node = NUMA_NODE_ANY;
+static bool initialized;
+
+struct srat_ctx {
+    struct smp_cpu bsp;
+    bool bsp_known;
+    bool overflowed;
+};
+
+static void add_range(struct srat_ctx *ctx,
+                      const struct acpi_srat_memory_affinity *ma)
+{
+    struct numa_range *range;
+
+    if (!(ma->flags & ACPI_SRAT_ENABLED) || !ma->length)
+        return;
+
+    // Memory that isn't there yet is of no use to the loader
+    if (ma->flags & ACPI_SRAT_MEMORY_HOT_PLUGGABLE)
+        return;
+
+    if (range_count == NUMA_MAX_RANGES) {
+        ctx->overflowed = true;
+        return;
+    }
+
+    range = &ranges[range_count++];
+    range->begin = ma->base_address;
+    range->end = ma->base_address + ma->length;
+    range->node = ma->proximity_domain;
+
+    // Wrapped around, clamp to the end of the address space
+    if (range->end < range->begin)
+        range->end = ~0ull;
+}
+
+static void match_bsp(struct srat_ctx *ctx, u8 type, u32 id, u32 node,
+                      u32 flags)
+{
+    u32 bsp_id;
+
+    if (!ctx->bsp_known || !(flags & ACPI_SRAT_ENABLED))
+        return;
+
+    // GICC affinity entries identify CPUs by their ACPI UID
+    bsp_id = type == ACPI_SRAT_ENTRY_TYPE_GICC_AFFINITY ? ctx->bsp.acpi_uid :
+                                                          ctx->bsp.hardware_id;
+    if (id == bsp_id)
+        bsp_node = node;
+}
+
+static bool srat_entry(void *user, const struct acpi_srat_entry_header *entry)
+{
+    struct srat_ctx *ctx = user;
+
+    switch (entry->type) {
+    case ACPI_SRAT_ENTRY_TYPE_MEMORY_AFFINITY: {
+        const struct acpi_srat_memory_affinity *ma = (const void*)entry;
+
+        if (entry->length >= sizeof(*ma))
+            add_range(ctx, ma);
+        break;
+    }
+    case ACPI_SRAT_ENTRY_TYPE_LAPIC_AFFINITY: {
+        const struct acpi_srat_lapic_affinity *la = (const void*)entry;
+        u32 node;
+
+        if (entry->length < sizeof(*la))
+            break;
+
+        node = la->proximity_domain_low;
+        node |= la->proximity_domain_high[0] << 8;
+        node |= la->proximity_domain_high[1] << 16;
+        node |= (u32)la->proximity_domain_high[2] << 24;
+
+        match_bsp(ctx, entry->type, la->apic_id, node, la->flags);
+        break;
+    }
+    case ACPI_SRAT_ENTRY_TYPE_X2APIC_AFFINITY: {
+        const struct acpi_srat_x2apic_affinity *xa = (const void*)entry;
+
+        if (entry->length >= sizeof(*xa)) {
+            match_bsp(ctx, entry->type, xa->x2apic_id, xa->proximity_domain,
+                      xa->flags);
+        }
+        break;
+    }
+    case ACPI_SRAT_ENTRY_TYPE_GICC_AFFINITY: {
+        const struct acpi_srat_gicc_affinity *ga = (const void*)entry;
+
+        if (entry->length >= sizeof(*ga)) {
+            match_bsp(ctx, entry->type, ga->acpi_processor_uid,
+                      ga->proximity_domain, ga->flags);
+        }
+        break;
+    }
+    default:
+        break;
+    }
+
+    return true;
+}
+
+// The SRAT refers to CPUs by their hardware IDs, the MADT tells us ours
+static bool find_bsp(struct smp_cpu *out)
+{
+    struct smp_cpu *cpus;
+    size_t i, count, bytes;
+    bool found = false;
+
+    count = smp_arch_enumerate(NULL, 0);
+    if (!count)
+        return false;
+
+    bytes = count * sizeof(struct smp_cpu);
+    cpus = allocate_critical_bytes(bytes);
+    memzero(cpus, bytes);
+
+    count = smp_arch_enumerate(cpus, count);
+    for (i = 0; i < count; ++i) {
+        if (cpus[i].flags & SMP_CPU_BSP) {
+            *out = cpus[i];
+            found = true;
+            break;
+        }
+    }
+
+    free_bytes(cpus, bytes);
+    return found;
+}
+
+static bool is_multi_node(void)
+{
+    size_t i;
+
+    for (i = 1; i < range_count; ++i) {
+        if (ranges[i].node != ranges[0].node)
+            return true;
+    }
+
+    return false;
+}
+
+static void numa_init(void)
+{
+    const struct acpi_srat *srat;
+    struct srat_ctx ctx = { 0 };
+    ptr_t rsdp;
+
+    initialized = true;
+
+    rsdp = services_find_rsdp();
+    if (!rsdp)
+        return;
+
+    srat = (const struct acpi_srat*)acpi_find_table(rsdp, "SRAT");
+    if (!srat)
+        return;
+
+    ctx.bsp_known = find_bsp(&ctx.bsp);
+    acpi_srat_foreach(srat, srat_entry, &ctx);
+
+    if (ctx.overflowed) {
+        print_warn("too many SRAT memory ranges, only using the first %d\n",
+                   NUMA_MAX_RANGES);
+    }
+
+    if (!is_multi_node()) {
+        range_count = 0;
+        bsp_node = NUMA_NODE_ANY;
+        return;
+    }
+
+    if (bsp_node == NUMA_NODE_ANY)
+        print_warn("unable to tell which node the BSP belongs to\n");
+
+    print_info("%zu memory range(s), BSP on node %u\n", range_count, bsp_node);
+}
+
+static void ensure_initialized(void)
+{
+    if (unlikely(!initialized))
+        numa_init();
+}
+
+u32 numa_bsp_node(void)
+{
+    ensure_initialized();
+    return bsp_node;
+}
+
+u32 numa_node_of(u64 address)
+{
+    size_t i;
+
+    ensure_initialized();
+
+    for (i = 0; i < range_count; ++i) {
+        if (address >= ranges[i].begin && address < ranges[i].end)
+            return ranges[i].node;
+    }
+
+    return NUMA_NODE_ANY;
+}
+
+bool numa_node_exists(u32 node)
+{
+    size_t i;
+
+    ensure_initialized();
+
+    for (i = 0; i < range_count; ++i) {
+        if (ranges[i].node == node)
+            return true;
+    }
+
+    return false;
+}
+
+struct find_ctx {
+    u32 node;
+    u64 bytes;
+    u64 ceiling;
+    u64 result;
+};
+
+static bool find_in_entry(void *user, const struct memory_map_entry *me)
+{
+    struct find_ctx *ctx = user;
+    u64 me_end = me->physical_address + me->size_in_bytes;
+    size_t i;
+
+    if (me->type != MEMORY_TYPE_FREE)
+        return true;
+
+    for (i = 0; i < range_count; ++i) {
+        const struct numa_range *range = &ranges[i];
+        u64 begin, end, candidate;
+
+        if (range->node != ctx->node)
+            continue;
+
+        // Never hand out the first page, 0 means failure to the allocator
+        begin = MAX(MAX(range->begin, me->physical_address), (u64)PAGE_SIZE);
+        begin = PAGE_ROUND_UP(begin);
+        end = MIN(MIN(range->end, me_end), ctx->ceiling);
+        end = PAGE_ROUND_DOWN(end);
+
+        if (begin >= end || (end - begin) < ctx->bytes)
+            continue;
+
+        // Top-down, same as the regular allocator
+        candidate = end - ctx->bytes;
+        ctx->result = MAX(ctx->result, candidate);
+    }
+
+    return true;
+}
+
+u64 numa_find_free_pages(u32 node, size_t pages, u64 ceiling)
+{
+    struct find_ctx ctx = {
+        .node = node,
+        .bytes = (u64)pages << PAGE_SHIFT,
+        .ceiling = ceiling,
+    };
+
+    if (!numa_node_exists(node))
+        return 0;
+
+    mm_foreach_entry(find_in_entry, &ctx);
+    return ctx.result;
+}
@@ -0,0 +1,101 @@
+#define MSG_FMT(msg) "PARALLEL: " msg
+
+#include "common/constants.h"
+#include "common/helpers.h"
+#include "common/log.h"
+#include "common/minmax.h"
+#include "bulk_memory.h"
+#include "parallel.h"
+#include "services.h"
+
+// Large enough for the dispatch overhead to be negligible
+#define ZERO_CHUNK_SIZE (2 * MB)
+#define ZERO_PARALLEL_THRESHOLD (2 * ZERO_CHUNK_SIZE)
+
+static bool parallel_disabled;
+
+struct parallel_dispatch {
+    parallel_job_t job;
+    void *ctx;
+    size_t count;
+    size_t next;
+
+    // Jobs that ended up on a CPU other than the caller's
+    size_t remote_count;
+};
+
+static void worker(void *arg, bool on_ap)
+{
+    struct parallel_dispatch *pd = arg;
+    size_t idx, done = 0;
+
+    for (;;) {
+        idx = __atomic_fetch_add(&pd->next, 1, __ATOMIC_RELAXED);
+        if (idx >= pd->count)
+            break;
+
+        pd->job(pd->ctx, idx);
+        done++;
+    }
+
+    if (on_ap)
+        __atomic_fetch_add(&pd->remote_count, done, __ATOMIC_RELAXED);
+}
+
+void parallel_for(size_t count, parallel_job_t job, void *ctx)
+{
+    struct parallel_dispatch pd = {
+        .job = job,
+        .ctx = ctx,
+        .count = count,
+        .next = 1,
+    };
+
+    if (!count)
+        return;
+
+    job(ctx, 0);
+    if (count == 1)
+        return;
+
+    if (parallel_disabled || !services_run_on_all_cpus(worker, &pd)) {
+        worker(&pd, false);
+        return;
+    }
+
+    print_info("%zu out of %zu job(s) ran on other CPUs\n", pd.remote_count,
+               count);
+}
+
+void parallel_disable(void)
+{
+    parallel_disabled = true;
+}
+
+struct zero_ctx {
+    u8 *dest;
+    size_t count;
+};
+
+static void zero_chunk(void *ctx, size_t index)
+{
+    struct zero_ctx *zc = ctx;
+    size_t offset = index * ZERO_CHUNK_SIZE;
+
+    bulk_zero(zc->dest + offset, MIN(zc->count - offset, ZERO_CHUNK_SIZE));
+}
+
+void parallel_bulk_zero(void *dest, size_t count)
+{
+    struct zero_ctx zc = {
+        .dest = dest,
+        .count = count,
+    };
+
+    if (count < ZERO_PARALLEL_THRESHOLD) {
+        bulk_zero(dest, count);
+        return;
+    }
+
+    parallel_for(CEILING_DIVIDE(count, ZERO_CHUNK_SIZE), zero_chunk, &zc);
+}
@@ -1,3 +1,4 @@
+#include "common/log.h"
 #include "common/panic.h"
 
 #include "services.h"
@@ -18,6 +19,9 @@ void services_cleanup(void)
 {
     cleanup_handler *handler;
 
+    // The slow log sinks may rely on services that are about to go away
+    logger_flush();
+
     for (handler = cleanup_handlers_begin;
          handler < cleanup_handlers_end;
          ++handler)
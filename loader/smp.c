@@ -0,0 +1,141 @@
+#define MSG_FMT(msg) "SMP: " msg
+
+#include "common/log.h"
+#include "common/string.h"
+#include "allocator.h"
+#include "parallel.h"
+#include "services.h"
+#include "smp.h"
+
+// How long to wait for all started CPUs to check in before giving up on them
+#define SMP_PARK_TIMEOUT_US (1000 * 1000)
+#define SMP_PARK_POLL_US    100
+
+static struct smp_cpu *deferred_cpus;
+static size_t deferred_count;
+
+static size_t count_parked(struct smp_cpu *cpus, size_t count)
+{
+    size_t i, parked = 0;
+
+    for (i = 0; i < count; ++i) {
+        volatile u32 *flags = &cpus[i].flags;
+
+        parked += (*flags & SMP_CPU_PARKED) != 0;
+    }
+
+    return parked;
+}
+
+static void wait_for_parked(struct smp_cpu *cpus, size_t count)
+{
+    size_t i, parked = 0;
+    u32 waited;
+
+    // The BSP is always considered parked, see smp_start_aps()
+    for (waited = 0; waited < SMP_PARK_TIMEOUT_US; waited += SMP_PARK_POLL_US) {
+        parked = count_parked(cpus, count);
+        if (parked == count)
+            break;
+
+        services_stall(SMP_PARK_POLL_US);
+    }
+
+    print_info("%zu out of %zu application processors parked in %u us\n",
+               parked - 1, count - 1, waited);
+    if (parked == count)
+        return;
+
+    for (i = 0; i < count; ++i) {
+        if (cpus[i].flags & SMP_CPU_PARKED)
+            continue;
+
+        print_warn("CPU %llu didn't check in, leaving it offline\n",
+                   cpus[i].hardware_id);
+    }
+}
+
+bool smp_start_aps(struct handover_info *hi, u64 pointer_offset,
+                   struct smp_info *out)
+{
+    struct smp_cpu *cpus;
+    size_t i, count, bytes;
+    struct allocation_spec as = {
+        .ceiling = handover_get_max_pt_address(hi->direct_map_base, hi->flags),
+        .flags = ALLOCATE_CRITICAL
+    };
+
+    count = smp_arch_enumerate(NULL, 0);
+    if (!count) {
+        print_warn("unable to enumerate CPUs, not starting any\n");
+        return false;
+    }
+
+    /*
+     * The array has to be reachable via the direct map as that's where the
+     * parked CPUs look at it from, hence the ceiling above.
+     */
+    bytes = count * sizeof(struct smp_cpu);
+    as.pages = PAGE_ROUND_UP(bytes) >> PAGE_SHIFT;
+    cpus = ADDR_TO_PTR(allocate_pages_ex(&as));
+    memzero(cpus, bytes);
+
+    count = smp_arch_enumerate(cpus, count);
+    *out = (struct smp_info) {
+        .cpus = cpus,
+        .cpu_count = count,
+    };
+
+    for (i = 0; i < count; ++i) {
+        if (cpus[i].flags & SMP_CPU_BSP) {
+            // The BSP is going to be running the kernel, it's never released
+            cpus[i].flags |= SMP_CPU_PARKED;
+            out->bsp_index = i;
+            break;
+        }
+    }
+    BUG_ON(i == count);
+
+    print_info("found %zu CPU(s), BSP is %llu\n", count,
+               cpus[out->bsp_index].hardware_id);
+    if (count == 1)
+        return true;
+
+    // The firmware's view of the APs is about to become stale
+    parallel_disable();
+
+    switch (smp_arch_start(hi, cpus, count, pointer_offset)) {
+    case SMP_START_SENT:
+        wait_for_parked(cpus, count);
+        break;
+    case SMP_START_DEFERRED:
+        print_info("deferring AP start until the firmware is gone\n");
+        deferred_cpus = cpus;
+        deferred_count = count;
+        break;
+    default:
+        break;
+    }
+
+    return true;
+}
+
+void smp_start_deferred_aps(void)
+{
+    u32 waited;
+
+    if (!deferred_cpus)
+        return;
+
+    smp_arch_start_deferred(deferred_cpus, deferred_count);
+
+    // Nothing to report to, CPUs that don't make it stay without the flag
+    for (waited = 0; waited < SMP_PARK_TIMEOUT_US; waited += SMP_PARK_POLL_US) {
+        if (count_parked(deferred_cpus, deferred_count) == deferred_count)
+            break;
+
+        smp_arch_deferred_stall(SMP_PARK_POLL_US);
+    }
+
+    deferred_cpus = NULL;
+}
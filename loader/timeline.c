@@ -0,0 +1,98 @@
+#define MSG_FMT(msg) "TIMELINE: " msg
+
+#include "common/log.h"
+#include "timeline.h"
+#include "arch/timestamp.h"
+
+/*
+ * One entry per module plus a handful of fixed points, anything past this is
+ * dropped. The last slot is kept for the handover.
+ */
+#define TIMELINE_CAPACITY 128
+
+static struct timeline_entry entries[TIMELINE_CAPACITY];
+static size_t entry_count;
+static size_t entries_dropped;
+
+void timeline_mark(enum timeline_event event, u32 argument)
+{
+    size_t capacity = TIMELINE_CAPACITY;
+
+    if (event != TIMELINE_EVENT_HANDOVER)
+        capacity--;
+
+    if (unlikely(entry_count >= capacity)) {
+        entries_dropped++;
+        return;
+    }
+
+    entries[entry_count++] = (struct timeline_entry) {
+        .event = event,
+        .argument = argument,
+        .timestamp = arch_read_timestamp(),
+    };
+}
+
+const struct timeline_entry *timeline_get_entries(size_t *out_count)
+{
+    *out_count = entry_count;
+    return entries;
+}
+
+u64 timeline_get_frequency(void)
+{
+    static u64 frequency = -1ull;
+
+    if (frequency == -1ull)
+        frequency = arch_timestamp_frequency();
+
+    return frequency;
+}
+
+static const char *event_to_str(u32 event)
+{
+    switch (event) {
+    case TIMELINE_EVENT_LOADER_ENTRY:
+        return "loader entry";
+    case TIMELINE_EVENT_DISKS_INITIALIZED:
+        return "disks initialized";
+    case TIMELINE_EVENT_CONFIG_LOADED:
+        return "config loaded";
+    case TIMELINE_EVENT_MODULE_LOADED:
+        return "module loaded";
+    case TIMELINE_EVENT_KERNEL_LOADED:
+        return "kernel loaded";
+    case TIMELINE_EVENT_PAGE_TABLE_BUILD:
+        return "page table build";
+    case TIMELINE_EVENT_HANDOVER:
+        return "handover";
+    default:
+        return "<invalid>";
+    }
+}
+
+void timeline_print(void)
+{
+    u64 frequency = timeline_get_frequency();
+    size_t i;
+
+    if (!entry_count)
+        return;
+
+    for (i = 0; i < entry_count; ++i) {
+        const struct timeline_entry *te = &entries[i];
+        u64 delta = te->timestamp - entries[0].timestamp;
+
+        if (frequency) {
+            print_info("+%llu us: %s (%u)\n",
+                       (delta * 1000000) / frequency,
+                       event_to_str(te->event), te->argument);
+        } else {
+            print_info("+%llu cycles: %s (%u)\n", delta,
+                       event_to_str(te->event), te->argument);
+        }
+    }
+
+    if (entries_dropped)
+        print_warn("%zu entries were dropped\n", entries_dropped);
+}
@@ -77,6 +77,25 @@ static bool dp_is_network(EFI_DEVICE_PATH_PROTOCOL *dp)
     return false;
 }
 
+// An HTTP boot device path additionally carries the boot URI
+static bool dp_is_http(EFI_DEVICE_PATH_PROTOCOL *dp)
+{
+    while (dp->Type != EFI_DEVICE_PATH_TYPE_END) {
+        UINTN len = dp_node_length(dp);
+
+        if (len < sizeof(*dp))
+            break;
+
+        if (dp->Type == EFI_DEVICE_PATH_TYPE_MESSAGING &&
+            dp->SubType == EFI_DEVICE_PATH_SUBTYPE_URI)
+            return true;
+
+        dp = (EFI_DEVICE_PATH_PROTOCOL*)((u8*)dp + len);
+    }
+
+    return false;
+}
+
 static EFI_DEVICE_PATH_PROTOCOL *handle_device_path(EFI_HANDLE handle)
 {
     EFI_GUID dp_guid = EFI_DEVICE_PATH_PROTOCOL_GUID;
@@ -280,7 +299,8 @@ bool ds_query_boot_device(struct boot_device_info *out_info)
      */
     if (dp_is_network(boot_dp)) {
         *out_info = (struct boot_device_info) {
-            .type = BOOT_DEVICE_TYPE_PXE,
+            .type = dp_is_http(boot_dp) ? BOOT_DEVICE_TYPE_HTTP :
+                                          BOOT_DEVICE_TYPE_PXE,
             .partition_id = BOOT_PARTITION_ID_TYPE_NONE,
         };
 
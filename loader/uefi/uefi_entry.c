@@ -1,5 +1,6 @@
 #include "common/log.h"
 #include "services.h"
+#include "services_impl.h"
 #include "uefi/structures.h"
 #include "uefi_video_services.h"
 #include "uefi_disk_services.h"
@@ -12,6 +13,12 @@ enum service_provider services_get_provider(void)
     return SERVICE_PROVIDER_UEFI;
 }
 
+void services_stall(u32 microseconds)
+{
+    SERVICE_FUNCTION();
+    g_st->BootServices->Stall(microseconds);
+}
+
 void loader_abort(void)
 {
     UINTN idx;
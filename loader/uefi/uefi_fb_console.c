@@ -0,0 +1,210 @@
+#define MSG_FMT(msg) "UEFI-FBCON: " msg
+
+#include "common/align.h"
+#include "common/log.h"
+#include "common/string.h"
+#include "uefi_fb_console.h"
+
+static u8 *fb;
+static size_t fb_pitch;
+static size_t rows, columns;
+
+// Cursor position in cells, 'y' may be one past the last row, see fbcon_write
+static size_t tty_x, tty_y;
+
+static u8 r_shift, g_shift, b_shift;
+
+/*
+ * Two adjacent pixels for every combination of two glyph bits, so that a glyph
+ * row is written with four 64-bit stores instead of eight 32-bit ones. Only
+ * used if every glyph row is 8-byte aligned, which depends on the pitch.
+ */
+static u64 pixel_pairs[4];
+static bool wide_stores;
+
+bool fb_console_active(void)
+{
+    return fb != NULL;
+}
+
+static bool pixel_format_shifts(EFI_GRAPHICS_OUTPUT_MODE_INFORMATION *mi)
+{
+    switch (mi->PixelFormat) {
+    case PixelRedGreenBlueReserved8BitPerColor:
+        r_shift = 0;
+        g_shift = 8;
+        b_shift = 16;
+        return true;
+    case PixelBlueGreenRedReserved8BitPerColor:
+        r_shift = 16;
+        g_shift = 8;
+        b_shift = 0;
+        return true;
+    case PixelBitMask: {
+        EFI_PIXEL_BITMASK *pb = &mi->PixelInformation;
+        u32 all = pb->RedMask | pb->GreenMask | pb->BlueMask | pb->ReservedMask;
+
+        if (__builtin_popcount(pb->RedMask) != 8 ||
+            __builtin_popcount(pb->GreenMask) != 8 ||
+            __builtin_popcount(pb->BlueMask) != 8 ||
+            __builtin_popcount(all) <= 24)
+            return false;
+
+        r_shift = __builtin_ctz(pb->RedMask);
+        g_shift = __builtin_ctz(pb->GreenMask);
+        b_shift = __builtin_ctz(pb->BlueMask);
+        return true;
+    }
+    default:
+        return false;
+    }
+}
+
+bool fb_console_init(EFI_GRAPHICS_OUTPUT_PROTOCOL *gop)
+{
+    EFI_GRAPHICS_OUTPUT_MODE_INFORMATION *mi;
+
+    fb = NULL;
+
+    if (!gop || !gop->Mode || !gop->Mode->Info || !gop->Mode->FrameBufferBase)
+        return false;
+
+    mi = gop->Mode->Info;
+    if (!pixel_format_shifts(mi))
+        return false;
+
+    fb_pitch = (size_t)mi->PixelsPerScanLine * 4;
+    columns = mi->HorizontalResolution / FB_FONT_WIDTH;
+    rows = mi->VerticalResolution / FB_FONT_HEIGHT;
+    if (!rows || !columns)
+        return false;
+
+    fb = (u8*)(ptr_t)gop->Mode->FrameBufferBase;
+    wide_stores = IS_ALIGNED((ptr_t)fb, 8) && IS_ALIGNED(fb_pitch, 8);
+    tty_x = tty_y = 0;
+
+    memzero(fb, rows * FB_FONT_HEIGHT * fb_pitch);
+
+    print_info("%zu cols x %zu rows @ 0x%016llX\n", columns, rows,
+               gop->Mode->FrameBufferBase);
+    return true;
+}
+
+static u32 rgb(u8 r, u8 g, u8 b)
+{
+    return ((u32)r << r_shift) | ((u32)g << g_shift) | ((u32)b << b_shift);
+}
+
+static u32 as_pixel(enum color c)
+{
+    switch (c) {
+    default:
+    case COLOR_WHITE:
+        return rgb(0xFF, 0xFF, 0xFF);
+    case COLOR_GRAY:
+        return rgb(0xAA, 0xAA, 0xAA);
+    case COLOR_YELLOW:
+        return rgb(0xFF, 0xFF, 0x55);
+    case COLOR_RED:
+        return rgb(0xFF, 0x55, 0x55);
+    case COLOR_BLUE:
+        return rgb(0x55, 0x55, 0xFF);
+    case COLOR_GREEN:
+        return rgb(0x55, 0xFF, 0x55);
+    }
+}
+
+static void set_color(enum color c)
+{
+    u64 fg = as_pixel(c);
+
+    // Background is always black
+    pixel_pairs[0] = 0;
+    pixel_pairs[1] = fg;
+    pixel_pairs[2] = fg << 32;
+    pixel_pairs[3] = fg | (fg << 32);
+}
+
+static void draw_glyph(size_t x, size_t y, char c)
+{
+    const u8 *glyph = fb_font[(u8)c < FB_FONT_GLYPH_COUNT ? (u8)c : '?'];
+    u8 *row = fb + (y * FB_FONT_HEIGHT * fb_pitch) + (x * FB_FONT_WIDTH * 4);
+    size_t i, j;
+
+    for (i = 0; i < FB_FONT_HEIGHT; ++i, row += fb_pitch) {
+        u8 bits = glyph[i];
+
+        if (wide_stores) {
+            volatile u64 *dst = (volatile u64*)row;
+
+            dst[0] = pixel_pairs[bits & 3];
+            dst[1] = pixel_pairs[(bits >> 2) & 3];
+            dst[2] = pixel_pairs[(bits >> 4) & 3];
+            dst[3] = pixel_pairs[bits >> 6];
+            continue;
+        }
+
+        for (j = 0; j < FB_FONT_WIDTH; ++j, bits >>= 1)
+            ((volatile u32*)row)[j] = (u32)pixel_pairs[bits & 1];
+    }
+}
+
+static void advance(char c, size_t *x, size_t *y)
+{
+    if (c == '\n' || ++*x == columns) {
+        *x = 0;
+        ++*y;
+    }
+}
+
+// Moves everything up by 'lines' text rows with a single block move
+static void scroll(size_t lines)
+{
+    size_t line_bytes = FB_FONT_HEIGHT * fb_pitch;
+
+    if (lines < rows)
+        memmove(fb, fb + lines * line_bytes, (rows - lines) * line_bytes);
+    else
+        lines = rows;
+
+    memzero(fb + (rows - lines) * line_bytes, lines * line_bytes);
+}
+
+/*
+ * The whole batch is laid out up front, so the screen is scrolled at most once
+ * per write by however many lines it takes to fit the output. Text that would
+ * scroll off before it's ever seen is never drawn.
+ */
+void fb_console_write(const char *text, size_t count, enum color col)
+{
+    size_t i, x = tty_x, y = tty_y, last_row, overflow = 0;
+
+    if (unlikely(!fb))
+        return;
+
+    for (i = 0; i < count; ++i)
+        advance(text[i], &x, &y);
+
+    // Parked right after a newline, that row doesn't need to exist just yet
+    last_row = x ? y : y - 1;
+    if (y && last_row >= rows) {
+        overflow = last_row - rows + 1;
+        scroll(overflow);
+    }
+
+    set_color(col);
+    x = tty_x;
+    y = tty_y;
+
+    for (i = 0; i < count; ++i) {
+        char c = text[i];
+
+        if (c != '\n' && y >= overflow)
+            draw_glyph(x, y - overflow, c);
+
+        advance(c, &x, &y);
+    }
+
+    tty_x = x;
+    tty_y = y - overflow;
+}
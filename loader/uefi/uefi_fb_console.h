@@ -0,0 +1,20 @@
+#pragma once
+
+#include "common/types.h"
+#include "common/fb_font.h"
+#include "uefi/structures.h"
+#include "video_services.h"
+
+/*
+ * Text console rendered straight into the GOP framebuffer, as opposed to going
+ * through ConOut. Only 32 bpp direct color modes are supported.
+ *
+ * (Re)initializes the console for the mode 'gop' is currently in and clears
+ * the screen. Returns false and deactivates the console if the mode is
+ * unusable.
+ */
+bool fb_console_init(EFI_GRAPHICS_OUTPUT_PROTOCOL *gop);
+
+bool fb_console_active(void);
+
+void fb_console_write(const char *text, size_t count, enum color col);
@@ -0,0 +1,1028 @@
+#define MSG_FMT(msg) "UEFI-HTTP: " msg
+
+#include "common/conversions.h"
+#include "common/ctype.h"
+#include "common/format.h"
+#include "common/helpers.h"
+#include "common/log.h"
+#include "common/minmax.h"
+#include "common/string.h"
+#include "common/string_view.h"
+#include "filesystem/path.h"
+#include "http_services.h"
+#include "ip.h"
+#include "services.h"
+#include "services_impl.h"
+#include "uefi/globals.h"
+#include "uefi/helpers.h"
+#include "uefi/structures.h"
+
+#define HTTP_MAX_ROOT_SIZE 256
+// Root, separator, a fully percent-encoded path and the terminator
+#define HTTP_MAX_URL_SIZE (HTTP_MAX_ROOT_SIZE + 1 + MAX_PATH_SIZE * 3 + 1)
+
+/*
+ * Large reads are split into ranges of HTTP_CHUNK_SIZE, which are spread over
+ * up to HTTP_MAX_CONNECTIONS connections. Each connection asks for its next
+ * range as soon as the previous one is received, so there's always a request
+ * in flight and the round trips of the individual requests overlap.
+ */
+#define HTTP_MAX_CONNECTIONS 4
+#define HTTP_CHUNK_SIZE (1024 * 1024)
+
+/*
+ * Sizing a file fetches this much of its beginning along the way, which is
+ * where all the headers (ELF, multiboot, etc.) live.
+ */
+#define HTTP_PREFETCH_SIZE 4096
+
+// Give up on a transfer after this long without any progress
+#define HTTP_TIMEOUT_US (10 * 1000 * 1000)
+#define HTTP_POLL_INTERVAL_US 50
+
+// How long to wait for DHCP in case the NIC has no address yet
+#define HTTP_ADDRESS_TIMEOUT_US (10 * 1000 * 1000)
+#define HTTP_ADDRESS_POLL_INTERVAL_US (100 * 1000)
+
+enum conn_state {
+    CONN_STATE_IDLE,
+    CONN_STATE_REQUEST,
+    CONN_STATE_HEADERS,
+    CONN_STATE_BODY,
+};
+
+enum conn_header {
+    CONN_HEADER_HOST,
+    CONN_HEADER_RANGE,
+    CONN_HEADER_USER_AGENT,
+    CONN_HEADER_COUNT,
+};
+
+struct http_connection {
+    EFI_HANDLE child;
+    EFI_HTTP_PROTOCOL *http;
+    EFI_EVENT event;
+
+    EFI_HTTP_TOKEN token;
+    EFI_HTTP_MESSAGE message;
+    EFI_HTTP_REQUEST_DATA request;
+    EFI_HTTP_RESPONSE_DATA response;
+    EFI_HTTP_HEADER headers[CONN_HEADER_COUNT];
+    char range[48];
+
+    enum conn_state state;
+
+    // The range being fetched, 'dst' receives 'bytes' bytes at 'offset'
+    u64 offset;
+    u64 bytes;
+    u8 *dst;
+
+    /*
+     * Body bytes to throw away before 'dst' and after it, only non-zero if
+     * the server sent more than we asked for.
+     */
+    u64 skip;
+    u64 excess;
+
+    // The full size of the file, as reported by the response
+    u64 file_size;
+
+    // What the file size is supposed to be, 0 if not known yet
+    u64 expected_size;
+};
+
+static EFI_HANDLE s_nic;
+static EFI_SERVICE_BINDING_PROTOCOL *s_binding;
+static struct http_connection s_connections[HTTP_MAX_CONNECTIONS];
+static size_t s_connection_count;
+
+static char s_root[HTTP_MAX_ROOT_SIZE];
+static size_t s_root_len;
+static char s_host[HTTP_MAX_ROOT_SIZE];
+static ipv4_addr s_server_ip;
+
+// Set once the server has ignored a Range header
+static bool s_no_ranges;
+
+// Set if the IPv4 policy of the NIC was changed, to be put back on cleanup
+static EFI_IP4_CONFIG2_PROTOCOL *s_cfg2;
+static EFI_IP4_CONFIG2_POLICY s_original_policy;
+
+static CHAR16 s_url[HTTP_MAX_URL_SIZE];
+
+static u8 s_discard[4096];
+
+static struct {
+    char path[MAX_PATH_SIZE];
+    size_t path_len;
+    u8 data[HTTP_PREFETCH_SIZE];
+    size_t size;
+} s_prefetch;
+
+static EFI_HTTPv4_ACCESS_POINT s_access_point = {
+    .UseDefaultAddress = TRUE,
+};
+
+static EFI_HTTP_CONFIG_DATA s_config = {
+    .HttpVersion = HttpVersion11,
+    .TimeOutMillisec = HTTP_TIMEOUT_US / 1000,
+    .LocalAddressIsIPv6 = FALSE,
+    .AccessPoint.IPv4Node = &s_access_point,
+};
+
+static void print_efi_error(const char *what, EFI_STATUS ret)
+{
+    struct string_view err_msg = uefi_status_to_string(ret);
+    print_warn("%s error: %pSV\n", what, &err_msg);
+}
+
+/*
+ * The root URL of an HTTP boot is the one the loader itself came from, minus
+ * the file name. It's in the URI node of the boot device path.
+ */
+static bool boot_uri_root(struct string_view *out)
+{
+    EFI_GUID li_guid = EFI_LOADED_IMAGE_PROTOCOL_GUID;
+    EFI_GUID dp_guid = EFI_DEVICE_PATH_PROTOCOL_GUID;
+    EFI_LOADED_IMAGE_PROTOCOL *li = NULL;
+    EFI_DEVICE_PATH_PROTOCOL *dp = NULL;
+    EFI_BOOT_SERVICES *bs = g_st->BootServices;
+    EFI_STATUS ret;
+
+    ret = bs->HandleProtocol(g_img, &li_guid, (void**)&li);
+    if (unlikely_efi_error(ret) || !li->DeviceHandle)
+        return false;
+
+    ret = bs->HandleProtocol(li->DeviceHandle, &dp_guid, (void**)&dp);
+    if (unlikely_efi_error(ret))
+        return false;
+
+    while (dp->Type != EFI_DEVICE_PATH_TYPE_END) {
+        UINTN len = dp->Length[0] | ((UINTN)dp->Length[1] << 8);
+
+        if (len < sizeof(*dp))
+            break;
+
+        if (dp->Type == EFI_DEVICE_PATH_TYPE_MESSAGING &&
+            dp->SubType == EFI_DEVICE_PATH_SUBTYPE_URI &&
+            len > sizeof(*dp)) {
+            EFI_URI_DEVICE_PATH *uri = (EFI_URI_DEVICE_PATH*)dp;
+            struct string_view root = { uri->Uri, len - sizeof(*dp) };
+
+            while (root.size && root.text[root.size - 1] != '/')
+                root.size--;
+
+            *out = root;
+            return !sv_empty(root);
+        }
+
+        dp = (EFI_DEVICE_PATH_PROTOCOL*)((u8*)dp + len);
+    }
+
+    return false;
+}
+
+static bool set_root(struct string_view root)
+{
+    struct string_view authority;
+    ssize_t slash, colon;
+
+    if (sv_starts_with_caseless(root, SV("http://"))) {
+        authority = root;
+        sv_offset_by(&authority, 7);
+    } else if (sv_starts_with_caseless(root, SV("https://"))) {
+        authority = root;
+        sv_offset_by(&authority, 8);
+    } else {
+        print_warn("unsupported URL \"%pSV\"\n", &root);
+        return false;
+    }
+
+    // Paths always come with a leading slash
+    while (root.size && root.text[root.size - 1] == '/')
+        root.size--;
+
+    if (root.size >= sizeof(s_root)) {
+        print_warn("root URL \"%pSV\" is too long\n", &root);
+        return false;
+    }
+
+    slash = sv_find(authority, SV("/"), 0);
+    if (slash >= 0)
+        authority.size = slash;
+    if (sv_empty(authority))
+        return false;
+
+    sv_terminated_copy(s_root, root);
+    s_root_len = root.size;
+    sv_terminated_copy(s_host, authority);
+
+    colon = sv_find(authority, SV(":"), 0);
+    if (colon >= 0)
+        authority.size = colon;
+
+    if (!ipv4_parse((const u8*)authority.text, authority.size, &s_server_ip))
+        memzero(&s_server_ip, sizeof(s_server_ip));
+
+    return true;
+}
+
+/*
+ * Prefer the NIC we were booted from, that's the one that's most likely
+ * to have an address already.
+ */
+static bool pick_nic(void)
+{
+    EFI_GUID sb_guid = EFI_HTTP_SERVICE_BINDING_PROTOCOL_GUID;
+    EFI_GUID li_guid = EFI_LOADED_IMAGE_PROTOCOL_GUID;
+    EFI_GUID dp_guid = EFI_DEVICE_PATH_PROTOCOL_GUID;
+    EFI_BOOT_SERVICES *bs = g_st->BootServices;
+    EFI_LOADED_IMAGE_PROTOCOL *li = NULL;
+    EFI_DEVICE_PATH_PROTOCOL *dp = NULL;
+    EFI_HANDLE *handles;
+    UINTN handle_count;
+    EFI_STATUS ret;
+
+    s_nic = NULL;
+
+    ret = bs->HandleProtocol(g_img, &li_guid, (void**)&li);
+    if (!EFI_ERROR(ret) && li->DeviceHandle) {
+        ret = bs->HandleProtocol(li->DeviceHandle, &dp_guid, (void**)&dp);
+        if (!EFI_ERROR(ret))
+            bs->LocateDevicePath(&sb_guid, &dp, &s_nic);
+    }
+
+    if (!s_nic) {
+        if (!uefi_get_protocol_handles_nowarn(&sb_guid, &handles,
+                                              &handle_count))
+            return false;
+
+        s_nic = handles[0];
+        bs->FreePool(handles);
+    }
+
+    ret = bs->HandleProtocol(s_nic, &sb_guid, (void**)&s_binding);
+    if (unlikely_efi_error(ret)) {
+        print_efi_error("HandleProtocol(HTTP service binding)", ret);
+        return false;
+    }
+
+    return true;
+}
+
+static void conn_destroy(struct http_connection *c)
+{
+    EFI_BOOT_SERVICES *bs = g_st->BootServices;
+
+    if (c->state != CONN_STATE_IDLE)
+        c->http->Cancel(c->http, NULL);
+
+    c->http->Configure(c->http, NULL);
+    bs->CloseEvent(c->event);
+    s_binding->DestroyChild(s_binding, c->child);
+
+    *c = (struct http_connection) { 0 };
+}
+
+static bool conn_create(struct http_connection *c)
+{
+    EFI_GUID http_guid = EFI_HTTP_PROTOCOL_GUID;
+    EFI_BOOT_SERVICES *bs = g_st->BootServices;
+    EFI_STATUS ret;
+
+    *c = (struct http_connection) { 0 };
+
+    ret = s_binding->CreateChild(s_binding, &c->child);
+    if (unlikely_efi_error(ret)) {
+        print_efi_error("CreateChild()", ret);
+        return false;
+    }
+
+    ret = bs->HandleProtocol(c->child, &http_guid, (void**)&c->http);
+    if (unlikely_efi_error(ret)) {
+        print_efi_error("HandleProtocol(HTTP)", ret);
+        goto out_destroy_child;
+    }
+
+    ret = c->http->Configure(c->http, &s_config);
+    if (unlikely_efi_error(ret)) {
+        print_efi_error("Configure()", ret);
+        goto out_destroy_child;
+    }
+
+    ret = bs->CreateEvent(0, 0, NULL, NULL, &c->event);
+    if (unlikely_efi_error(ret)) {
+        c->http->Configure(c->http, NULL);
+        goto out_destroy_child;
+    }
+
+    c->headers[CONN_HEADER_HOST] = (EFI_HTTP_HEADER) {
+        (CHAR8*)"Host", (CHAR8*)s_host
+    };
+    c->headers[CONN_HEADER_RANGE] = (EFI_HTTP_HEADER) {
+        (CHAR8*)"Range", (CHAR8*)c->range
+    };
+    c->headers[CONN_HEADER_USER_AGENT] = (EFI_HTTP_HEADER) {
+        (CHAR8*)"User-Agent", (CHAR8*)"Hyper"
+    };
+
+    return true;
+
+out_destroy_child:
+    s_binding->DestroyChild(s_binding, c->child);
+    return false;
+}
+
+/*
+ * Drops whatever is left of the current exchange along with the TCP
+ * connection, which is the only way to get rid of an unread response body.
+ */
+static void conn_reset(struct http_connection *c)
+{
+    if (c->state != CONN_STATE_IDLE)
+        c->http->Cancel(c->http, NULL);
+
+    c->http->Configure(c->http, NULL);
+    c->http->Configure(c->http, &s_config);
+    c->state = CONN_STATE_IDLE;
+}
+
+// Get at least 'count' connections going, fewer if the firmware can't
+static size_t ensure_connections(size_t count)
+{
+    count = MIN(count, (size_t)HTTP_MAX_CONNECTIONS);
+
+    while (s_connection_count < count) {
+        if (!conn_create(&s_connections[s_connection_count]))
+            break;
+
+        s_connection_count++;
+    }
+
+    return s_connection_count;
+}
+
+static bool is_url_safe(char c)
+{
+    return isalnum(c) || c == '/' || c == '-' || c == '.' || c == '_' ||
+           c == '~' || c == '%';
+}
+
+static void build_url(struct string_view path)
+{
+    static const char hex[] = "0123456789ABCDEF";
+    size_t i, j = 0;
+
+    for (i = 0; i < s_root_len; ++i)
+        s_url[j++] = s_root[i];
+
+    if (!sv_starts_with(path, SV("/")))
+        s_url[j++] = '/';
+
+    for (i = 0; i < path.size; ++i) {
+        u8 c = path.text[i];
+
+        if (is_url_safe(c)) {
+            s_url[j++] = c;
+            continue;
+        }
+
+        s_url[j++] = '%';
+        s_url[j++] = hex[c >> 4];
+        s_url[j++] = hex[c & 0xF];
+    }
+
+    s_url[j] = 0;
+}
+
+/*
+ * The firmware only brings up the IP configuration of a NIC once something
+ * asks for it, which doesn't happen unless we were booted over the network.
+ * The policy is persisted by the firmware, so it's only switched to DHCP if
+ * that doesn't throw away a static address, and is put back on cleanup.
+ */
+static bool wait_for_address(void)
+{
+    EFI_GUID ip4_config2_guid = EFI_IP4_CONFIG2_PROTOCOL_GUID;
+    EFI_IP4_CONFIG2_POLICY policy = Ip4Config2PolicyDhcp;
+    EFI_BOOT_SERVICES *bs = g_st->BootServices;
+    EFI_IP4_CONFIG2_PROTOCOL *cfg2 = NULL;
+    UINTN size = sizeof(policy);
+    static bool attempted;
+    EFI_STATUS ret;
+
+    if (attempted)
+        return false;
+    attempted = true;
+
+    ret = bs->HandleProtocol(s_nic, &ip4_config2_guid, (void**)&cfg2);
+    if (unlikely_efi_error(ret)) {
+        print_warn("no IPv4 address and no way to configure one\n");
+        return false;
+    }
+
+    ret = cfg2->GetData(cfg2, Ip4Config2DataTypePolicy, &size, &s_original_policy);
+    if (unlikely_efi_error(ret)) {
+        print_efi_error("GetData(policy)", ret);
+        return false;
+    }
+
+    // DHCP is already in charge, the address might just not be there yet
+    if (s_original_policy == Ip4Config2PolicyDhcp)
+        return true;
+
+    size = 0;
+    ret = cfg2->GetData(cfg2, Ip4Config2DataTypeManualAddress, &size, NULL);
+    if (ret != EFI_NOT_FOUND) {
+        print_warn("no IPv4 address, not overriding the static configuration "
+                   "of the NIC\n");
+        return false;
+    }
+
+    print_info("no IPv4 address, requesting one via DHCP\n");
+
+    ret = cfg2->SetData(cfg2, Ip4Config2DataTypePolicy, sizeof(policy), &policy);
+    if (unlikely_efi_error(ret)) {
+        print_efi_error("SetData(policy)", ret);
+        return false;
+    }
+
+    s_cfg2 = cfg2;
+    return true;
+}
+
+static void restore_address_policy(void)
+{
+    EFI_STATUS ret;
+
+    if (!s_cfg2)
+        return;
+
+    ret = s_cfg2->SetData(s_cfg2, Ip4Config2DataTypePolicy,
+                          sizeof(s_original_policy), &s_original_policy);
+    if (unlikely_efi_error(ret))
+        print_efi_error("SetData(original policy)", ret);
+
+    s_cfg2 = NULL;
+}
+
+static EFI_STATUS conn_send_request(struct http_connection *c)
+{
+    EFI_BOOT_SERVICES *bs = g_st->BootServices;
+    u64 waited = 0;
+    EFI_STATUS ret;
+
+    for (;;) {
+        ret = c->http->Request(c->http, &c->token);
+        if (ret != EFI_NO_MAPPING)
+            return ret;
+
+        if (waited == 0 && !wait_for_address())
+            return ret;
+        if (waited >= HTTP_ADDRESS_TIMEOUT_US)
+            return ret;
+
+        bs->Stall(HTTP_ADDRESS_POLL_INTERVAL_US);
+        waited += HTTP_ADDRESS_POLL_INTERVAL_US;
+    }
+}
+
+// Expects the URL of the file to be in 's_url'
+static bool conn_start(struct http_connection *c, u64 offset, u64 bytes,
+                       void *dst, u64 expected_size)
+{
+    EFI_STATUS ret;
+
+    BUG_ON(bytes == 0 || c->state != CONN_STATE_IDLE);
+
+    c->offset = offset;
+    c->bytes = bytes;
+    c->dst = dst;
+    c->skip = 0;
+    c->excess = 0;
+    c->file_size = 0;
+    c->expected_size = expected_size;
+
+    snprintf(c->range, sizeof(c->range), "bytes=%llu-%llu",
+             offset, offset + bytes - 1);
+
+    c->request = (EFI_HTTP_REQUEST_DATA) {
+        .Method = HttpMethodGet,
+        .Url = s_url,
+    };
+    c->message = (EFI_HTTP_MESSAGE) {
+        .Data.Request = &c->request,
+        .HeaderCount = CONN_HEADER_COUNT,
+        .Headers = c->headers,
+    };
+    c->token = (EFI_HTTP_TOKEN) {
+        .Event = c->event,
+        .Status = EFI_SUCCESS,
+        .Message = &c->message,
+    };
+
+    ret = conn_send_request(c);
+    if (unlikely_efi_error(ret)) {
+        print_efi_error("Request()", ret);
+        return false;
+    }
+
+    c->state = CONN_STATE_REQUEST;
+    return true;
+}
+
+static bool conn_receive(struct http_connection *c, bool headers)
+{
+    u64 bytes;
+    void *buf;
+    EFI_STATUS ret;
+
+    if (headers) {
+        c->message = (EFI_HTTP_MESSAGE) {
+            .Data.Response = &c->response,
+        };
+        c->state = CONN_STATE_HEADERS;
+    } else {
+        if (c->skip) {
+            buf = s_discard;
+            bytes = MIN(c->skip, (u64)sizeof(s_discard));
+        } else {
+            buf = c->dst;
+            bytes = MIN(c->bytes, (u64)HTTP_CHUNK_SIZE);
+        }
+
+        c->message = (EFI_HTTP_MESSAGE) {
+            .Body = buf,
+            .BodyLength = bytes,
+        };
+        c->state = CONN_STATE_BODY;
+    }
+
+    c->token.Status = EFI_SUCCESS;
+    c->token.Message = &c->message;
+
+    ret = c->http->Response(c->http, &c->token);
+    if (unlikely_efi_error(ret)) {
+        print_efi_error("Response()", ret);
+        conn_reset(c);
+        return false;
+    }
+
+    return true;
+}
+
+static struct string_view find_header(const EFI_HTTP_MESSAGE *msg,
+                                      struct string_view name)
+{
+    size_t i;
+
+    for (i = 0; i < msg->HeaderCount; ++i) {
+        const EFI_HTTP_HEADER *hdr = &msg->Headers[i];
+        struct string_view hdr_name = {
+            (char*)hdr->FieldName, strlen((char*)hdr->FieldName)
+        };
+
+        if (sv_equals_caseless(hdr_name, name)) {
+            return (struct string_view) {
+                (char*)hdr->FieldValue, strlen((char*)hdr->FieldValue)
+            };
+        }
+    }
+
+    return (struct string_view) { 0 };
+}
+
+static void free_headers(EFI_HTTP_MESSAGE *msg)
+{
+    EFI_BOOT_SERVICES *bs = g_st->BootServices;
+    size_t i;
+
+    if (!msg->Headers)
+        return;
+
+    for (i = 0; i < msg->HeaderCount; ++i) {
+        bs->FreePool(msg->Headers[i].FieldName);
+        bs->FreePool(msg->Headers[i].FieldValue);
+    }
+
+    bs->FreePool(msg->Headers);
+    msg->Headers = NULL;
+    msg->HeaderCount = 0;
+}
+
+static void trim_spaces(struct string_view *str)
+{
+    while (str->size && str->text[0] == ' ')
+        sv_offset_by(str, 1);
+    while (str->size && str->text[str->size - 1] == ' ')
+        str->size--;
+}
+
+/*
+ * Content-Range is "bytes <first>-<last>/<total>" for partial responses,
+ * and "bytes * /<total>" (without the space) for unsatisfiable ranges.
+ */
+static bool parse_content_range(struct string_view value, u64 *first,
+                                u64 *last, u64 *total)
+{
+    struct string_view part;
+    ssize_t slash, dash;
+
+    trim_spaces(&value);
+    if (!sv_starts_with_caseless(value, SV("bytes ")))
+        return false;
+    sv_offset_by(&value, 6);
+
+    slash = sv_find(value, SV("/"), 0);
+    if (slash < 0)
+        return false;
+
+    part = (struct string_view) { value.text + slash + 1,
+                                  value.size - slash - 1 };
+    trim_spaces(&part);
+    if (!str_to_u64_with_base(part, total, 10))
+        return false;
+
+    value.size = slash;
+    if (sv_equals(value, SV("*"))) {
+        *first = *last = *total;
+        return true;
+    }
+
+    dash = sv_find(value, SV("-"), 0);
+    if (dash < 0)
+        return false;
+
+    part = (struct string_view) { value.text + dash + 1,
+                                  value.size - dash - 1 };
+    value.size = dash;
+
+    return str_to_u64_with_base(value, first, 10) &&
+           str_to_u64_with_base(part, last, 10) &&
+           *first <= *last;
+}
+
+static bool parse_response_headers(struct http_connection *c)
+{
+    EFI_HTTP_MESSAGE *msg = &c->message;
+    struct string_view value;
+    u64 first, last, total, end;
+
+    switch (c->response.StatusCode) {
+    case HTTP_STATUS_206_PARTIAL_CONTENT:
+        value = find_header(msg, SV("Content-Range"));
+        if (!parse_content_range(value, &first, &last, &total))
+            goto bad_range;
+
+        // Only allowed to be cut short by the end of the file
+        end = MIN(c->offset + c->bytes, total);
+        if (first != c->offset || last + 1 != end)
+            goto bad_range;
+
+        c->file_size = total;
+        c->bytes = end - c->offset;
+        break;
+
+    case HTTP_STATUS_200_OK:
+        // The server ignored the range, the entire file follows
+        value = find_header(msg, SV("Content-Length"));
+        trim_spaces(&value);
+        if (!str_to_u64_with_base(value, &total, 10)) {
+            print_warn("no Content-Length in response\n");
+            return false;
+        }
+
+        if (!s_no_ranges) {
+            print_info("server doesn't support range requests\n");
+            s_no_ranges = true;
+        }
+
+        if (c->offset > total)
+            return false;
+
+        c->file_size = total;
+        c->skip = c->offset;
+        c->bytes = MIN(c->bytes, total - c->offset);
+        c->excess = total - c->offset - c->bytes;
+        break;
+
+    case HTTP_STATUS_416_REQUESTED_RANGE_NOT_SATISFIED:
+        // Ranges can't be satisfied for an empty file, it has no bytes
+        value = find_header(msg, SV("Content-Range"));
+        if (!parse_content_range(value, &first, &last, &total) ||
+            c->offset < total)
+            goto bad_range;
+
+        c->file_size = total;
+        c->bytes = 0;
+
+        // Might come with an error page
+        c->excess = ~0ull;
+        break;
+
+    case HTTP_STATUS_404_NOT_FOUND:
+        return false;
+
+    default:
+        print_warn("unexpected HTTP status %d\n", c->response.StatusCode);
+        return false;
+    }
+
+    if (c->expected_size && c->file_size != c->expected_size) {
+        print_warn("file size changed from %llu to %llu bytes\n",
+                   c->expected_size, c->file_size);
+        return false;
+    }
+
+    return true;
+
+bad_range:
+    print_warn("bad Content-Range \"%pSV\"\n", &value);
+    return false;
+}
+
+/*
+ * Moves the exchange on 'c' along after its token completed. Returns false
+ * on failure, the exchange is over once 'c' is back to idle.
+ */
+static bool conn_advance(struct http_connection *c)
+{
+    EFI_STATUS status = c->token.Status;
+    u64 got;
+    bool ok;
+
+    if (unlikely_efi_error(status)) {
+        print_efi_error("HTTP transfer", status);
+        conn_reset(c);
+        return false;
+    }
+
+    switch (c->state) {
+    case CONN_STATE_REQUEST:
+        return conn_receive(c, true);
+
+    case CONN_STATE_HEADERS:
+        ok = parse_response_headers(c);
+        free_headers(&c->message);
+
+        if (!ok) {
+            conn_reset(c);
+            return false;
+        }
+        break;
+
+    case CONN_STATE_BODY:
+        got = c->message.BodyLength;
+
+        if (c->skip) {
+            c->skip -= MIN(got, c->skip);
+        } else {
+            got = MIN(got, c->bytes);
+            c->dst += got;
+            c->bytes -= got;
+        }
+        break;
+
+    default:
+        BUG();
+    }
+
+    if (c->skip || c->bytes)
+        return conn_receive(c, false);
+
+    // Anything left unread would be mistaken for the next response
+    if (c->excess)
+        conn_reset(c);
+
+    c->state = CONN_STATE_IDLE;
+    return true;
+}
+
+// Drops every exchange still in flight, so nothing writes to its 'dst' anymore
+static void abort_connections(void)
+{
+    size_t i;
+
+    for (i = 0; i < s_connection_count; ++i) {
+        if (s_connections[i].state != CONN_STATE_IDLE)
+            conn_reset(&s_connections[i]);
+    }
+}
+
+/*
+ * Drives all busy connections until every one of them is idle, or just until
+ * the first one is if 'any' is set. Returns false if a transfer failed or
+ * timed out, in which case all of them are aborted.
+ */
+static bool poll_connections(bool any)
+{
+    EFI_BOOT_SERVICES *bs = g_st->BootServices;
+    u64 idle_us = 0;
+    bool ok = true, done = false;
+    size_t i;
+
+    while (ok && !done) {
+        bool busy = false, progress = false;
+
+        for (i = 0; i < s_connection_count; ++i) {
+            struct http_connection *c = &s_connections[i];
+
+            if (c->state == CONN_STATE_IDLE)
+                continue;
+
+            c->http->Poll(c->http);
+
+            if (bs->CheckEvent(c->event) == EFI_SUCCESS) {
+                progress = true;
+                ok &= conn_advance(c);
+            }
+
+            if (c->state == CONN_STATE_IDLE)
+                done |= any;
+            else
+                busy = true;
+        }
+
+        if (!busy)
+            break;
+
+        if (progress) {
+            idle_us = 0;
+            continue;
+        }
+
+        if (idle_us >= HTTP_TIMEOUT_US) {
+            print_warn("transfer timed out\n");
+            ok = false;
+            break;
+        }
+
+        bs->Stall(HTTP_POLL_INTERVAL_US);
+        idle_us += HTTP_POLL_INTERVAL_US;
+    }
+
+    if (!ok)
+        abort_connections();
+
+    return ok;
+}
+
+static bool fetch_single(u64 offset, u64 bytes, void *dst, u64 expected_size)
+{
+    if (!conn_start(&s_connections[0], offset, bytes, dst, expected_size))
+        return false;
+
+    return poll_connections(false);
+}
+
+bool http_services_setup(struct string_view root)
+{
+    if (s_binding)
+        return false;
+
+    if (sv_empty(root) && !boot_uri_root(&root))
+        return false;
+
+    if (!set_root(root))
+        return false;
+
+    if (!pick_nic()) {
+        print_warn("no HTTP capable network interface found\n");
+        return false;
+    }
+
+    if (!ensure_connections(1)) {
+        s_binding = NULL;
+        return false;
+    }
+
+    print_info("using %s/\n", s_root);
+    return true;
+}
+
+bool http_get_file_size(struct string_view path, u64 *out_size)
+{
+    SERVICE_FUNCTION();
+
+    struct http_connection *c = &s_connections[0];
+
+    BUG_ON(!s_connection_count);
+    *out_size = 0;
+
+    if (path.size > MAX_PATH_SIZE)
+        return false;
+
+    s_prefetch.path_len = 0;
+    build_url(path);
+
+    if (!fetch_single(0, HTTP_PREFETCH_SIZE, s_prefetch.data, 0))
+        return false;
+
+    s_prefetch.size = MIN(c->file_size, (u64)HTTP_PREFETCH_SIZE);
+    memcpy(s_prefetch.path, path.text, path.size);
+    s_prefetch.path_len = path.size;
+
+    *out_size = c->file_size;
+    return true;
+}
+
+static bool is_prefetched(struct string_view path)
+{
+    struct string_view prefetched = { s_prefetch.path, s_prefetch.path_len };
+
+    return s_prefetch.path_len && sv_equals(prefetched, path);
+}
+
+bool http_read_file_range(struct string_view path, void *out_buf, u64 offset,
+                          u64 bytes, u64 file_size)
+{
+    SERVICE_FUNCTION();
+
+    u8 *dst = out_buf;
+    u64 chunk;
+    size_t i, conns;
+    bool ok = true;
+
+    BUG_ON(!s_connection_count);
+
+    if (offset + bytes > file_size)
+        return false;
+
+    if (offset < s_prefetch.size && is_prefetched(path)) {
+        chunk = MIN(bytes, s_prefetch.size - offset);
+        memcpy(dst, s_prefetch.data + offset, chunk);
+
+        dst += chunk;
+        offset += chunk;
+        bytes -= chunk;
+    }
+
+    if (!bytes)
+        return true;
+
+    build_url(path);
+
+    /*
+     * Without range support every request costs a full download, so make
+     * sure there's only one.
+     */
+    if (s_no_ranges)
+        return fetch_single(offset, bytes, dst, file_size);
+
+    conns = ensure_connections((bytes + HTTP_CHUNK_SIZE - 1) / HTTP_CHUNK_SIZE);
+
+    // Hand out the next range whenever a connection frees up
+    while (bytes && ok) {
+        for (i = 0; i < conns && bytes; ++i) {
+            struct http_connection *c = &s_connections[i];
+
+            if (c->state != CONN_STATE_IDLE)
+                continue;
+
+            chunk = MIN(bytes, (u64)HTTP_CHUNK_SIZE);
+            if (!conn_start(c, offset, chunk, dst, file_size)) {
+                ok = false;
+                break;
+            }
+
+            dst += chunk;
+            offset += chunk;
+            bytes -= chunk;
+        }
+
+        if (ok && bytes)
+            ok = poll_connections(true);
+    }
+
+    if (ok && poll_connections(false))
+        return true;
+
+    /*
+     * A failed read must not leave the ranges that are still in flight
+     * writing into 'out_buf' behind the caller's back, or keep the
+     * connections busy for the next one.
+     */
+    abort_connections();
+    print_warn("failed to read \"%pSV\"\n", &path);
+    return false;
+}
+
+void http_server_ip_address(struct ip_addr *out)
+{
+    SERVICE_FUNCTION();
+
+    out->type = IP_TYPE_V4;
+    memcpy(&out->v4, &s_server_ip, IPV4_ADDR_LEN);
+}
+
+static void uefi_http_services_cleanup(void)
+{
+    size_t i;
+
+    for (i = 0; i < s_connection_count; ++i)
+        conn_destroy(&s_connections[i]);
+
+    s_connection_count = 0;
+    restore_address_policy();
+}
+DECLARE_CLEANUP_HANDLER(uefi_http_services_cleanup);
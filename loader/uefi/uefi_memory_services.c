@@ -3,6 +3,7 @@
 #include "common/attributes.h"
 #include "common/align.h"
 #include "common/log.h"
+#include "common/minmax.h"
 #include "uefi/globals.h"
 #include "uefi/helpers.h"
 #include "memory_services.h"
@@ -45,7 +46,34 @@ static struct memory_map_entry *protocol_allocations = NULL;
 static size_t protocol_allocations_count = 0;
 static size_t protocol_allocations_capacity = 0;
 
-#define PROTOCOL_ALLOCATIONS_BUFFER_INCREMENT 64
+#define PROTOCOL_ALLOCATIONS_INITIAL_CAPACITY 64
+
+/*
+ * Non-precise allocations are carved out of large chunks reserved from the
+ * firmware up front, one set of chunks per memory type. Every AllocatePages()
+ * call potentially splits a firmware descriptor, so this keeps both the number
+ * of firmware calls and the size of the final memory map down.
+ *
+ * Chunks are bump allocated bottom-up, freeing the topmost allocation rolls it
+ * back, anything else is returned to the firmware directly. The bump pointer
+ * never goes back past such a hole as those pages are no longer ours. The unused tails
+ * of all chunks are given back on the first services_release_resources() call,
+ * all allocations after that go straight to the firmware.
+ */
+#define SUBALLOC_CHUNK_PAGES 256
+#define SUBALLOC_MAX_PAGES (SUBALLOC_CHUNK_PAGES / 4)
+#define SUBALLOC_MAX_CHUNKS 32
+
+struct suballoc_chunk {
+    u64 base;
+    size_t used_pages;
+    size_t floor_pages;
+    u32 type;
+};
+
+static struct suballoc_chunk suballoc_chunks[SUBALLOC_MAX_CHUNKS];
+static size_t suballoc_chunk_count = 0;
+static bool suballoc_sealed = false;
 
 static u32 efi_md_to_native_type(EFI_MEMORY_DESCRIPTOR *md)
 {
@@ -92,13 +120,26 @@ static inline void account_allocation(u64 address, size_t count, u32 type)
     if (type < MEMORY_TYPE_PROTO_SPECIFIC_BASE)
         return;
 
+    // Consecutive sub-allocations of the same type are usually contiguous
+    if (protocol_allocations_count) {
+        entry = &protocol_allocations[protocol_allocations_count - 1];
+
+        if (entry->type == type && mme_end(entry) == address) {
+            entry->size_in_bytes += count << PAGE_SHIFT;
+            return;
+        }
+    }
+
     if (protocol_allocations_count == protocol_allocations_capacity) {
+        size_t new_capacity = protocol_allocations_capacity * 2;
         void *new_buf;
 
+        if (!new_capacity)
+            new_capacity = PROTOCOL_ALLOCATIONS_INITIAL_CAPACITY;
+
         OOPS_ON(!uefi_pool_alloc(
             EfiLoaderData, sizeof(struct memory_map_entry),
-            protocol_allocations_capacity + PROTOCOL_ALLOCATIONS_BUFFER_INCREMENT,
-            &new_buf
+            new_capacity, &new_buf
         ));
 
         if (protocol_allocations != NULL) {
@@ -109,7 +150,7 @@ static inline void account_allocation(u64 address, size_t count, u32 type)
             g_st->BootServices->FreePool(protocol_allocations);
         }
 
-        protocol_allocations_capacity += PROTOCOL_ALLOCATIONS_BUFFER_INCREMENT;
+        protocol_allocations_capacity = new_capacity;
         protocol_allocations = new_buf;
     }
 
@@ -120,6 +161,135 @@ static inline void account_allocation(u64 address, size_t count, u32 type)
     entry->type = type;
 }
 
+static u64 firmware_allocate_pages(size_t count, u64 upper_limit)
+{
+    EFI_STATUS ret;
+    u64 address = upper_limit;
+
+    ret = g_st->BootServices->AllocatePages(AllocateMaxAddress, EfiLoaderData, count, &address);
+    if (unlikely_efi_error(ret)) {
+        struct string_view err_msg = uefi_status_to_string(ret);
+        print_warn("AllocatePages(AllocateMaxAddress, %zu, 0x%016llX) failed: %pSV\n", count, address, &err_msg);
+        return 0;
+    }
+
+    return address;
+}
+
+static void firmware_free_pages(u64 address, size_t count)
+{
+    EFI_STATUS ret = g_st->BootServices->FreePages(address, count);
+    if (unlikely_efi_error(ret)) {
+        struct string_view err_msg = uefi_status_to_string(ret);
+        panic("FreePages(0x%016llX, %zu) failed: %pSV\n", address, count, &err_msg);
+    }
+}
+
+static inline u64 suballoc_chunk_top(struct suballoc_chunk *chunk)
+{
+    return chunk->base + ((u64)chunk->used_pages << PAGE_SHIFT);
+}
+
+static u64 suballoc_try_chunk(struct suballoc_chunk *chunk, size_t count,
+                              u64 upper_limit)
+{
+    u64 address = suballoc_chunk_top(chunk);
+
+    if ((chunk->used_pages + count) > SUBALLOC_CHUNK_PAGES)
+        return 0;
+    if ((address + ((u64)count << PAGE_SHIFT)) > upper_limit)
+        return 0;
+
+    chunk->used_pages += count;
+    return address;
+}
+
+static u64 suballoc_allocate(size_t count, u64 upper_limit, u32 type)
+{
+    struct suballoc_chunk *chunk;
+    u64 address;
+    size_t i;
+
+    if (suballoc_sealed || count > SUBALLOC_MAX_PAGES)
+        return 0;
+
+    for (i = 0; i < suballoc_chunk_count; ++i) {
+        chunk = &suballoc_chunks[i];
+
+        if (chunk->type != type)
+            continue;
+
+        address = suballoc_try_chunk(chunk, count, upper_limit);
+        if (address)
+            return address;
+    }
+
+    if (suballoc_chunk_count == SUBALLOC_MAX_CHUNKS)
+        return 0;
+
+    address = firmware_allocate_pages(SUBALLOC_CHUNK_PAGES, upper_limit);
+    if (!address)
+        return 0;
+
+    chunk = &suballoc_chunks[suballoc_chunk_count++];
+    chunk->base = address;
+    chunk->used_pages = count;
+    chunk->floor_pages = 0;
+    chunk->type = type;
+
+    return address;
+}
+
+static bool suballoc_free(u64 address, size_t count)
+{
+    struct suballoc_chunk *chunk;
+    u64 end = address + ((u64)count << PAGE_SHIFT);
+    size_t i;
+
+    for (i = 0; i < suballoc_chunk_count; ++i) {
+        chunk = &suballoc_chunks[i];
+
+        if (address < chunk->base || end > suballoc_chunk_top(chunk))
+            continue;
+
+        if (end == suballoc_chunk_top(chunk) &&
+            (chunk->used_pages - count) >= chunk->floor_pages) {
+            chunk->used_pages -= count;
+            return true;
+        }
+
+        // Not the topmost allocation, give it back to the firmware instead
+        chunk->floor_pages = MAX(chunk->floor_pages,
+                                 (size_t)((end - chunk->base) >> PAGE_SHIFT));
+        return false;
+    }
+
+    return false;
+}
+
+static void suballoc_release_tails(void)
+{
+    size_t i, pages_released = 0;
+
+    if (suballoc_sealed)
+        return;
+
+    for (i = 0; i < suballoc_chunk_count; ++i) {
+        struct suballoc_chunk *chunk = &suballoc_chunks[i];
+        size_t tail_pages = SUBALLOC_CHUNK_PAGES - chunk->used_pages;
+
+        if (!tail_pages)
+            continue;
+
+        firmware_free_pages(suballoc_chunk_top(chunk), tail_pages);
+        pages_released += tail_pages;
+    }
+
+    print_dbg(UEFI_MS_DEBUG, "released %zu unused pages out of %zu chunks\n",
+              pages_released, suballoc_chunk_count);
+    suballoc_sealed = true;
+}
+
 u64 ms_allocate_pages_at(u64 address, size_t count, u32 type)
 {
     SERVICE_FUNCTION();
@@ -141,15 +311,13 @@ u64 ms_allocate_pages(size_t count, u64 upper_limit, u32 type)
 {
     SERVICE_FUNCTION();
 
-    EFI_STATUS ret;
-    u64 address = upper_limit;
+    u64 address;
 
-    ret = g_st->BootServices->AllocatePages(AllocateMaxAddress, EfiLoaderData, count, &address);
-    if (unlikely_efi_error(ret)) {
-        struct string_view err_msg = uefi_status_to_string(ret);
-        print_warn("AllocatePages(AllocateMaxAddress, %zu, 0x%016llX) failed: %pSV\n", count, address, &err_msg);
+    address = suballoc_allocate(count, upper_limit, type);
+    if (!address)
+        address = firmware_allocate_pages(count, upper_limit);
+    if (!address)
         return 0;
-    }
 
     account_allocation(address, count, type);
     return address;
@@ -159,11 +327,10 @@ void ms_free_pages(u64 address, size_t count)
 {
     SERVICE_FUNCTION();
 
-    EFI_STATUS ret = g_st->BootServices->FreePages(address, count);
-    if (unlikely_efi_error(ret)) {
-        struct string_view err_msg = uefi_status_to_string(ret);
-        panic("FreePages(0x%016llX, %zu) failed: %pSV\n", address, count, &err_msg);
-    }
+    if (suballoc_free(address, count))
+        return;
+
+    firmware_free_pages(address, count);
 }
 
 static void page_buf_ensure_capacity(void **buf, size_t *byte_capacity,
@@ -177,7 +344,7 @@ static void page_buf_ensure_capacity(void **buf, size_t *byte_capacity,
     if (rounded_up_bytes <= *byte_capacity)
         return;
     if (*buf)
-        ms_free_pages((u64)*buf, *byte_capacity / PAGE_SIZE);
+        firmware_free_pages((u64)*buf, *byte_capacity / PAGE_SIZE);
 
     ret = g_st->BootServices->AllocatePages(AllocateAnyPages, EfiLoaderData, page_count, &addr);
     if (unlikely_efi_error(ret)) {
@@ -350,6 +517,9 @@ size_t services_release_resources(void *buf, size_t capacity, size_t elem_size,
     EFI_STATUS ret;
     size_t i;
 
+    // Must happen before the map is acquired as this frees memory
+    suballoc_release_tails();
+
     /*
      * Only log errors after first call to GetMemoryMap,
      * as WriteString() is allowed to allocate.
@@ -405,8 +575,11 @@ void mm_foreach_entry(mme_foreach_t func, void *user)
     SERVICE_FUNCTION();
     size_t i;
 
-    if (!buf_entry_count)
-        fill_internal_memory_map_buffer();
+    /*
+     * Always refetch, as the firmware map changes with every allocation and
+     * callers rely on seeing what's actually free right now.
+     */
+    fill_internal_memory_map_buffer();
 
     for (i = 0; i < buf_entry_count; i++) {
         if (!func(user, mm_entry_at(i)))
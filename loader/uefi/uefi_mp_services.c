@@ -0,0 +1,201 @@
+#define MSG_FMT(msg) "UEFI-MP: " msg
+
+#include "common/log.h"
+#include "services.h"
+#include "services_impl.h"
+#include "uefi/globals.h"
+#include "uefi/helpers.h"
+#include "uefi/structures.h"
+
+/*
+ * How long the BSP waits for another AP to finish when it can't rely on the
+ * completion event, in case the firmware never dispatched to some of them.
+ */
+#define AP_WAIT_TIMEOUT_US (10 * 1000 * 1000)
+#define AP_WAIT_POLL_US 100
+
+enum mp_state {
+    MP_STATE_UNKNOWN,
+    MP_STATE_AVAILABLE,
+    MP_STATE_UNAVAILABLE,
+};
+
+static enum mp_state s_state;
+static EFI_MP_SERVICES_PROTOCOL *s_mp;
+static bool s_blocking_only;
+static size_t s_ap_count;
+
+static void mp_services_init(void)
+{
+    EFI_GUID mp_guid = EFI_MP_SERVICES_PROTOCOL_GUID;
+    UINTN cpus, enabled_cpus;
+    EFI_STATUS ret;
+
+    s_state = MP_STATE_UNAVAILABLE;
+
+    ret = g_st->BootServices->LocateProtocol(&mp_guid, NULL, (void**)&s_mp);
+    if (unlikely_efi_error(ret) || !s_mp) {
+        print_info("no MP services, running serially\n");
+        return;
+    }
+
+    ret = s_mp->GetNumberOfProcessors(s_mp, &cpus, &enabled_cpus);
+    if (unlikely_efi_error(ret)) {
+        struct string_view err_msg = uefi_status_to_string(ret);
+        print_warn("GetNumberOfProcessors() error: %pSV\n", &err_msg);
+        return;
+    }
+
+    print_info("%zu out of %zu CPU(s) enabled\n", enabled_cpus, cpus);
+    if (enabled_cpus < 2)
+        return;
+
+    // The BSP is one of the enabled CPUs, StartupAllAPs() never runs on it
+    s_ap_count = enabled_cpus - 1;
+    s_state = MP_STATE_AVAILABLE;
+}
+
+struct ap_dispatch {
+    void (*proc)(void *arg, bool on_ap);
+    void *arg;
+
+    // Number of APs that returned from 'proc'
+    size_t finished;
+};
+
+static void ap_entry(void *ctx)
+{
+    struct ap_dispatch *ad = ctx;
+
+    ad->proc(ad->arg, true);
+    __atomic_fetch_add(&ad->finished, 1, __ATOMIC_RELEASE);
+}
+
+static EFI_STATUS startup_all_aps(struct ap_dispatch *ad, EFI_EVENT event)
+{
+    // SingleThread = FALSE, no timeout, don't care about the failed CPU list
+    return s_mp->StartupAllAPs(s_mp, ap_entry, FALSE, event, 0, ad, NULL);
+}
+
+static void wait_for_all_aps(struct ap_dispatch *ad)
+{
+    size_t finished, last_finished = 0;
+    u32 waited = 0;
+
+    for (;;) {
+        finished = __atomic_load_n(&ad->finished, __ATOMIC_ACQUIRE);
+        if (finished == s_ap_count)
+            return;
+
+        if (finished != last_finished) {
+            last_finished = finished;
+            waited = 0;
+        }
+
+        /*
+         * The APs that did start might still be running with pointers to the
+         * caller's stack, so there's no way to back out of this gracefully.
+         */
+        if (waited >= AP_WAIT_TIMEOUT_US) {
+            oops("only %zu out of %zu AP(s) finished, giving up\n",
+                 finished, s_ap_count);
+        }
+
+        services_stall(AP_WAIT_POLL_US);
+        waited += AP_WAIT_POLL_US;
+    }
+}
+
+/*
+ * Blocking StartupAllAPs() leaves the BSP idle until every AP is done, so use
+ * the non-blocking mode where the BSP is free to run 'proc' alongside them,
+ * and only fall back to blocking if the firmware doesn't implement it.
+ */
+static bool run_non_blocking(struct ap_dispatch *ad)
+{
+    EFI_BOOT_SERVICES *bs = g_st->BootServices;
+    EFI_EVENT event;
+    EFI_STATUS ret;
+    UINTN idx;
+
+    ret = bs->CreateEvent(0, 0, NULL, NULL, &event);
+    if (unlikely_efi_error(ret))
+        return false;
+
+    ret = startup_all_aps(ad, event);
+    if (unlikely_efi_error(ret)) {
+        bs->CloseEvent(event);
+        return false;
+    }
+
+    ad->proc(ad->arg, false);
+
+    ret = bs->WaitForEvent(1, &event, &idx);
+    if (unlikely_efi_error(ret)) {
+        struct string_view err_msg = uefi_status_to_string(ret);
+
+        /*
+         * The APs might still be running with pointers to the caller's stack,
+         * so returning early isn't an option. Don't rely on the event again.
+         */
+        wait_for_all_aps(ad);
+        s_blocking_only = true;
+
+        print_warn("WaitForEvent() error: %pSV, switching to blocking mode\n",
+                   &err_msg);
+    }
+
+    bs->CloseEvent(event);
+    return true;
+}
+
+bool services_run_on_all_cpus(void (*proc)(void *arg, bool on_ap), void *arg)
+{
+    struct ap_dispatch ad = {
+        .proc = proc,
+        .arg = arg,
+    };
+    EFI_STATUS ret;
+
+    /*
+     * Allowed to be called after exit, where it simply reports that there's
+     * nothing to dispatch to.
+     */
+    if (services_offline)
+        return false;
+
+    if (unlikely(s_state == MP_STATE_UNKNOWN))
+        mp_services_init();
+    if (s_state != MP_STATE_AVAILABLE)
+        return false;
+
+    if (!s_blocking_only) {
+        if (run_non_blocking(&ad))
+            goto out;
+
+        s_blocking_only = true;
+    }
+
+    ret = startup_all_aps(&ad, NULL);
+    if (unlikely_efi_error(ret)) {
+        struct string_view err_msg = uefi_status_to_string(ret);
+
+        print_warn("StartupAllAPs() error: %pSV, running serially\n", &err_msg);
+        s_state = MP_STATE_UNAVAILABLE;
+        return false;
+    }
+
+    // Whatever the APs didn't get to
+    proc(arg, false);
+
+out:
+    // APs' writes must be visible to whoever consumes the results
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    return true;
+}
+
+static void uefi_mp_services_cleanup(void)
+{
+    s_state = MP_STATE_UNAVAILABLE;
+}
+DECLARE_CLEANUP_HANDLER(uefi_mp_services_cleanup);
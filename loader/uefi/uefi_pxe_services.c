@@ -2,6 +2,7 @@
 
 #include "common/helpers.h"
 #include "common/log.h"
+#include "common/minmax.h"
 #include "common/string.h"
 #include "common/string_view.h"
 #include "filesystem/path.h"
@@ -15,6 +16,19 @@
 static EFI_PXE_BASE_CODE_PROTOCOL *s_pxe;
 static EFI_IP_ADDRESS s_server_ip;
 
+/*
+ * TFTP block size (RFC 2348) to ask for, 0 leaves it up to the firmware,
+ * which usually means the default 512 bytes and twice as many round trips
+ * as needed for every 1K. Bounds per RFC 2348.
+ */
+#define TFTP_MIN_BLOCK_SIZE 512
+#define TFTP_MAX_BLOCK_SIZE 65464u
+
+// IPv4 + UDP + TFTP headers
+#define TFTP_BLOCK_OVERHEAD (20 + 8 + 4)
+
+static UINTN s_block_size;
+
 /*
  * Locate the variable-length DHCP option area within a packet. It begins right
  * after the fixed BOOTP header and 4-byte magic cookie and may run all the way
@@ -28,6 +42,30 @@ static const u8 *dhcp_options(EFI_PXE_BASE_CODE_PACKET *pkt, UINTN *out_size)
     return pkt->Raw + offset;
 }
 
+/*
+ * Pick the largest block that fits a single frame of the underlying NIC, so
+ * that every block is a single packet without IP fragmentation.
+ */
+static void pick_block_size(EFI_HANDLE handle)
+{
+    EFI_GUID snp_guid = EFI_SIMPLE_NETWORK_PROTOCOL_GUID;
+    EFI_SIMPLE_NETWORK_PROTOCOL *snp = NULL;
+    EFI_STATUS ret;
+    UINT32 mtu;
+
+    ret = g_st->BootServices->HandleProtocol(
+        handle, &snp_guid, (void**)&snp
+    );
+    if (unlikely_efi_error(ret) || !snp || !snp->Mode)
+        return;
+
+    mtu = snp->Mode->MaxPacketSize;
+    if (mtu <= TFTP_MIN_BLOCK_SIZE + TFTP_BLOCK_OVERHEAD)
+        return;
+
+    s_block_size = MIN(mtu - TFTP_BLOCK_OVERHEAD, TFTP_MAX_BLOCK_SIZE);
+}
+
 static bool resolve_server_ip(
     EFI_PXE_BASE_CODE_PACKET *pkt, EFI_IPv4_ADDRESS *out
 )
@@ -81,6 +119,7 @@ bool pxe_services_setup(void)
             continue;
 
         s_pxe = pxe;
+        pick_block_size(handles[i]);
         break;
     }
 
@@ -105,7 +144,8 @@ bool pxe_services_setup(void)
         return false;
     }
 
-    print_info("detected PXE: server %pIP4\n", &s_server_ip.v4);
+    print_info("detected PXE: server %pIP4, block size %zu\n",
+               &s_server_ip.v4, s_block_size ?: TFTP_MIN_BLOCK_SIZE);
 
     return true;
 }
@@ -124,7 +164,8 @@ static bool pxe_do_tftp(EFI_PXE_BASE_CODE_TFTP_OPCODE op,
     sv_terminated_copy(terminated_buf, path);
 
     ret = s_pxe->Mtftp(
-        s_pxe, op, buffer, FALSE, buffer_size, NULL, &s_server_ip,
+        s_pxe, op, buffer, FALSE, buffer_size,
+        s_block_size ? &s_block_size : NULL, &s_server_ip,
         (UINT8*)terminated_buf, NULL, dont_use_buffer
     );
     if (unlikely_efi_error(ret)) {
@@ -154,20 +195,29 @@ bool pxe_get_file_size(struct string_view path, u64 *out_size)
     );
 }
 
-bool pxe_read_file(struct string_view path, void *out_buf, u64 expected_size)
+bool pxe_read_supports_partial(void)
+{
+    return false;
+}
+
+bool pxe_read_file_range(struct string_view path, void *out_buf, u64 offset,
+                         u64 bytes, u64 file_size)
 {
     SERVICE_FUNCTION();
 
-    u64 buffer_size = expected_size;
+    u64 buffer_size = file_size;
+
+    // Mtftp() can only fetch whole files
+    BUG_ON(offset != 0 || bytes != file_size);
 
     if (!pxe_do_tftp(EFI_PXE_BASE_CODE_TFTP_READ_FILE, path, out_buf,
                      &buffer_size, FALSE))
         return false;
 
-    if (unlikely(buffer_size != expected_size)) {
+    if (unlikely(buffer_size != file_size)) {
         print_warn(
             "'%pSV' size mismatch: expected %llu, got %llu\n",
-            &path, expected_size, buffer_size
+            &path, file_size, buffer_size
         );
         return false;
     }
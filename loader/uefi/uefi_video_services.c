@@ -7,6 +7,9 @@
 #include "video_services.h"
 #include "services_impl.h"
 #include "edid.h"
+#include "uefi_fb_console.h"
+
+#define GOP_DEBUG 0
 
 static EFI_SIMPLE_TEXT_OUTPUT_PROTOCOL *conout = NULL;
 static EFI_GRAPHICS_OUTPUT_PROTOCOL *gfx = NULL;
@@ -14,100 +17,15 @@ static size_t native_width = 0;
 static size_t native_height = 0;
 static struct video_mode *video_modes = NULL;
 static size_t mode_count = 0;
-static bool tty_available = false;
-
-u32 vs_get_mode_count(void)
-{
-    return (u32)mode_count;
-}
-
-void vs_query_mode(size_t idx, struct video_mode *out_mode)
-{
-    SERVICE_FUNCTION();
-    BUG_ON(idx >= mode_count);
-
-    *out_mode = video_modes[idx];
-}
-
-bool vs_query_native_resolution(struct resolution *out_resolution)
-{
-    SERVICE_FUNCTION();
-
-    if (!native_height || !native_width)
-        return false;
-
-    out_resolution->width = native_width;
-    out_resolution->height = native_height;
-    return true;
-}
-
-bool vs_get_current_mode(struct video_mode *out_mode)
-{
-    SERVICE_FUNCTION();
-
-    size_t i;
-
-    if (!gfx || !gfx->Mode)
-        return false;
-
-    // Return the entry for the mode the firmware is currently displaying
-    for (i = 0; i < mode_count; ++i) {
-        if (video_modes[i].id == gfx->Mode->Mode) {
-            *out_mode = video_modes[i];
-            return true;
-        }
-    }
-
-    return false;
-}
-
-bool vs_set_mode(u32 id, struct framebuffer *out_framebuffer)
-{
-    SERVICE_FUNCTION();
-
-    EFI_STATUS ret;
-    EFI_GRAPHICS_OUTPUT_MODE_INFORMATION *mode_info;
-    struct video_mode *vm;
-
-    BUG_ON(!gfx);
-    BUG_ON(id >= mode_count);
-
-    vm = &video_modes[id];
-    print_info("setting video mode %u...\n", id);
-
-    ret = gfx->SetMode(gfx, id);
-    if (unlikely_efi_error(ret)) {
-        struct string_view err_msg = uefi_status_to_string(ret);
-        print_warn("failed to set video mode %u: %pSV\n", id, &err_msg);
-        return false;
-    }
-
-    if (unlikely(!gfx->Mode)) {
-        print_warn("mode set successfully but EFI_GRAPHICS_OUTPUT_PROTOCOL::Mode is null?\n");
-        return false;
-    }
 
-    mode_info = gfx->Mode->Info;
-    if (unlikely(!mode_info)) {
-        print_warn("mode set successfully but no mode information available?\n");
-        return false;
-    }
-    if (unlikely(gfx->Mode->SizeOfInfo != sizeof(*mode_info))) {
-        print_warn("unexpected mode info: expected %zu got %zu\n",
-                   sizeof(*mode_info), gfx->Mode->SizeOfInfo);
-        return false;
-    }
+// Next GOP mode number to query, modes are enumerated lazily as they're needed
+static u32 next_gop_mode = 0;
+static EFI_HANDLE gop_handle = NULL;
+static bool edid_fetched = false;
+static bool tty_available = false;
 
-    *out_framebuffer = (struct framebuffer) {
-        .width = mode_info->HorizontalResolution,
-        .height = mode_info->VerticalResolution,
-        .physical_address = gfx->Mode->FrameBufferBase,
-        .pitch = mode_info->PixelsPerScanLine * (vm->bpp / 8),
-        .bpp = vm->bpp,
-        .format = vm->format,
-    };
-    return true;
-}
+// Firmware console to mirror to while the framebuffer console is in use
+static EFI_SIMPLE_TEXT_OUTPUT_PROTOCOL *serial_conout = NULL;
 
 static UINTN as_efi_color(enum color c)
 {
@@ -129,25 +47,22 @@ static UINTN as_efi_color(enum color c)
 }
 
 #define MAX_CHARS_PER_WRITE 255
-#define TTY_FLUSH_BUF()                                                      \
-    do {                                                                     \
-        wide_buf[w_off] = 0;                                                 \
-        if (unlikely(conout->OutputString(conout, wide_buf) != EFI_SUCCESS)) \
-            return false;                                                    \
-        w_off = 0;                                                           \
+#define TTY_FLUSH_BUF()                                                \
+    do {                                                               \
+        wide_buf[w_off] = 0;                                           \
+        if (unlikely(out->OutputString(out, wide_buf) != EFI_SUCCESS)) \
+            return false;                                              \
+        w_off = 0;                                                     \
     } while (0)
 
-bool vs_write_tty(const char *text, size_t count, enum color col)
+static bool conout_write(EFI_SIMPLE_TEXT_OUTPUT_PROTOCOL *out, const char *text,
+                         size_t count, enum color col)
 {
     static CHAR16 wide_buf[MAX_CHARS_PER_WRITE + 1];
     UINTN color = as_efi_color(col);
     size_t c_off, w_off = 0;
 
-    if (unlikely(!tty_available))
-        return false;
-    if (unlikely(!count))
-        return true;
-    if (unlikely(conout->SetAttribute(conout, color) != EFI_SUCCESS))
+    if (unlikely(out->SetAttribute(out, color) != EFI_SUCCESS))
         return false;
 
     for (c_off = 0; c_off < count; ++c_off) {
@@ -166,7 +81,96 @@ bool vs_write_tty(const char *text, size_t count, enum color col)
     if (w_off)
         TTY_FLUSH_BUF();
 
-    return conout->SetAttribute(conout, EFI_LIGHTGRAY) == EFI_SUCCESS;
+    return out->SetAttribute(out, EFI_LIGHTGRAY) == EFI_SUCCESS;
+}
+
+bool vs_write_tty(const char *text, size_t count, enum color col)
+{
+    if (unlikely(!count))
+        return true;
+
+    if (fb_console_active()) {
+        fb_console_write(text, count, col);
+
+        if (serial_conout)
+            conout_write(serial_conout, text, count, col);
+
+        return true;
+    }
+
+    if (unlikely(!tty_available))
+        return false;
+
+    return conout_write(conout, text, count, col);
+}
+
+static bool dp_has_uart(EFI_DEVICE_PATH_PROTOCOL *dp)
+{
+    while (dp->Type != EFI_DEVICE_PATH_TYPE_END) {
+        UINTN len = dp->Length[0] | ((UINTN)dp->Length[1] << 8);
+
+        if (len < sizeof(*dp))
+            break;
+
+        if (dp->Type == EFI_DEVICE_PATH_TYPE_MESSAGING &&
+            dp->SubType == EFI_DEVICE_PATH_SUBTYPE_UART)
+            return true;
+
+        dp = (EFI_DEVICE_PATH_PROTOCOL*)((u8*)dp + len);
+    }
+
+    return false;
+}
+
+/*
+ * ConOut is usually a splitter over every console the firmware knows about,
+ * including the graphical one we're replacing. Look for the text output
+ * instance sitting on top of a UART instead, which is what carries serial
+ * (e.g. BMC) redirection.
+ */
+static EFI_SIMPLE_TEXT_OUTPUT_PROTOCOL *find_serial_conout(void)
+{
+    EFI_GUID text_out_guid = EFI_SIMPLE_TEXT_OUTPUT_PROTOCOL_GUID;
+    EFI_GUID dp_guid = EFI_DEVICE_PATH_PROTOCOL_GUID;
+    EFI_SIMPLE_TEXT_OUTPUT_PROTOCOL *out = NULL;
+    EFI_BOOT_SERVICES *bs = g_st->BootServices;
+    EFI_HANDLE *handles;
+    UINTN i, count;
+
+    if (!uefi_get_protocol_handles_nowarn(&text_out_guid, &handles, &count))
+        return NULL;
+
+    for (i = 0; i < count; ++i) {
+        EFI_DEVICE_PATH_PROTOCOL *dp;
+        EFI_STATUS ret;
+
+        ret = bs->HandleProtocol(handles[i], &dp_guid, (void**)&dp);
+        if (EFI_ERROR(ret) || !dp_has_uart(dp))
+            continue;
+
+        ret = bs->HandleProtocol(handles[i], &text_out_guid, (void**)&out);
+        if (!EFI_ERROR(ret))
+            break;
+
+        out = NULL;
+    }
+
+    bs->FreePool(handles);
+    return out;
+}
+
+bool vs_use_framebuffer_tty(bool keep_serial)
+{
+    SERVICE_FUNCTION();
+
+    if (!fb_console_init(gfx))
+        return false;
+
+    serial_conout = keep_serial ? find_serial_conout() : NULL;
+    if (keep_serial && !serial_conout)
+        print_warn("no serial console found, output is framebuffer-only\n");
+
+    return true;
 }
 
 static void tty_init(void)
@@ -249,21 +253,83 @@ static EFI_HANDLE choose_gop_handle(EFI_HANDLE *handles, UINTN handle_count)
     return handles[0];
 }
 
-static void gfx_modes_init(void)
+// Returns false for modes with a pixel format we can't expose
+static bool mode_from_info(EFI_GRAPHICS_OUTPUT_MODE_INFORMATION *mode_info,
+                           u32 id, struct video_mode *out)
+{
+    u16 fb_format, bpp;
+
+    if (mode_info->PixelFormat == PixelBitMask) {
+        EFI_PIXEL_BITMASK *pb = &mode_info->PixelInformation;
+        u8 r_shift, g_shift, b_shift, x_shift;
+
+        if (__builtin_popcount(pb->RedMask) != 8)
+            return false;
+        if (__builtin_popcount(pb->GreenMask) != 8)
+            return false;
+        if (__builtin_popcount(pb->BlueMask) != 8)
+            return false;
+        if (pb->ReservedMask) {
+            if (__builtin_popcount(pb->ReservedMask) != 8)
+                return false;
+            bpp = 32;
+        } else {
+            bpp = 24;
+        }
+
+        r_shift = __builtin_ctz(pb->RedMask);
+        g_shift = __builtin_ctz(pb->GreenMask);
+        b_shift = __builtin_ctz(pb->BlueMask);
+        x_shift = pb->ReservedMask ? __builtin_ctz(pb->ReservedMask) : 0;
+
+        fb_format = fb_format_from_mask_shifts_8888(r_shift, g_shift, b_shift, x_shift, bpp);
+        if (fb_format == FB_FORMAT_INVALID)
+            return false;
+    } else if (mode_info->PixelFormat == PixelBlueGreenRedReserved8BitPerColor) {
+        fb_format = FB_FORMAT_XRGB8888;
+        bpp = 32;
+    } else {
+        return false;
+    }
+
+    *out = (struct video_mode) {
+        .width = mode_info->HorizontalResolution,
+        .height = mode_info->VerticalResolution,
+        .bpp = bpp,
+        .format = fb_format,
+        .id = id
+    };
+    return true;
+}
+
+/*
+ * Modes are queried one at a time as they're asked for instead of all at
+ * once during init, headless boots never get here at all.
+ */
+static bool fetch_next_video_mode(void)
 {
     EFI_GRAPHICS_OUTPUT_MODE_INFORMATION *mode_info;
-    size_t i, mode_size;
+    UINTN mode_size;
 
-    if (!uefi_pool_alloc(EfiLoaderData, sizeof(struct video_mode), gfx->Mode->MaxMode, (void**)&video_modes))
-        return;
+    if (!gfx || !gfx->Mode)
+        return false;
 
-    for (i = 0; i < gfx->Mode->MaxMode; ++i) {
-        u16 fb_format, bpp;
+    if (unlikely(!video_modes)) {
+        if (!uefi_pool_alloc(EfiLoaderData, sizeof(struct video_mode),
+                             gfx->Mode->MaxMode, (void**)&video_modes)) {
+            next_gop_mode = gfx->Mode->MaxMode;
+            return false;
+        }
+    }
+
+    while (next_gop_mode < gfx->Mode->MaxMode) {
+        u32 i = next_gop_mode++;
+        struct video_mode *vm = &video_modes[mode_count];
         EFI_STATUS ret = gfx->QueryMode(gfx, i, &mode_size, &mode_info);
 
         if (EFI_ERROR(ret)) {
             struct string_view err_msg = uefi_status_to_string(ret);
-            print_warn("QueryMode(%zu) failed: %pSV\n", i, &err_msg);
+            print_warn("QueryMode(%u) failed: %pSV\n", i, &err_msg);
             continue;
         }
 
@@ -273,89 +339,54 @@ static void gfx_modes_init(void)
             continue;
         }
 
-        if (mode_info->PixelFormat == PixelBitMask) {
-            EFI_PIXEL_BITMASK *pb = &mode_info->PixelInformation;
-            u8 r_shift, g_shift, b_shift, x_shift;
-
-            if (__builtin_popcount(pb->RedMask) != 8)
-                continue;
-            if (__builtin_popcount(pb->GreenMask) != 8)
-                continue;
-            if (__builtin_popcount(pb->BlueMask) != 8)
-                continue;
-            if (pb->ReservedMask) {
-                if (__builtin_popcount(pb->ReservedMask) != 8)
-                    continue;
-                bpp = 32;
-            } else {
-                bpp = 24;
-            }
-
-            r_shift = __builtin_ctz(pb->RedMask);
-            g_shift = __builtin_ctz(pb->GreenMask);
-            b_shift = __builtin_ctz(pb->BlueMask);
-            x_shift = pb->ReservedMask ? __builtin_ctz(pb->ReservedMask) : 0;
-
-            fb_format = fb_format_from_mask_shifts_8888(r_shift, g_shift, b_shift, x_shift, bpp);
-            if (fb_format == FB_FORMAT_INVALID)
-                continue;
-        } else if (mode_info->PixelFormat == PixelBlueGreenRedReserved8BitPerColor) {
-            fb_format = FB_FORMAT_XRGB8888;
-            bpp = 32;
-        } else {
+        if (!mode_from_info(mode_info, i, vm))
             continue;
-        }
 
-        print_info("video-mode[%zu] %ux%u fmt: %s\n", i, mode_info->HorizontalResolution,
-                   mode_info->VerticalResolution, fb_format_as_str(fb_format));
+        print_dbg(GOP_DEBUG, "video-mode[%u] %ux%u fmt: %s\n", i, vm->width,
+                  vm->height, fb_format_as_str(vm->format));
 
-        video_modes[mode_count++] = (struct video_mode) {
-            .width = mode_info->HorizontalResolution,
-            .height = mode_info->VerticalResolution,
-            .bpp = bpp,
-            .format = fb_format,
-            .id = i
-        };
+        mode_count++;
+        return true;
     }
+
+    return false;
 }
 
-static void uefi_video_services_cleanup(void)
+u32 vs_get_mode_count(void)
 {
-    g_st->BootServices->FreePool(video_modes);
-    mode_count = 0;
+    SERVICE_FUNCTION();
+
+    while (fetch_next_video_mode());
+    return (u32)mode_count;
 }
-DECLARE_CLEANUP_HANDLER(uefi_video_services_cleanup);
 
-static void gop_init(void)
+bool vs_query_mode(size_t idx, struct video_mode *out_mode)
+{
+    SERVICE_FUNCTION();
+
+    while (idx >= mode_count) {
+        if (!fetch_next_video_mode())
+            return false;
+    }
+
+    *out_mode = video_modes[idx];
+    return true;
+}
+
+static void fetch_edid(void)
 {
-    EFI_GUID gop_guid = EFI_GRAPHICS_OUTPUT_PROTOCOL_GUID;
     EFI_GUID active_edid_guid = EFI_EDID_ACTIVE_PROTOCOL_GUID;
     EFI_GUID discovered_edid_guid = EFI_EDID_DISCOVERED_PROTOCOL_GUID;
     EFI_EDID_ACTIVE_PROTOCOL *edid_blob;
-    EFI_HANDLE *gop_handles, picked_handle = NULL;
     EFI_STATUS ret;
-    UINTN handle_count;
-
-    if (!uefi_get_protocol_handles(&gop_guid, &gop_handles, &handle_count)) {
-        print_warn("no GOP handles found, graphics won't be available\n");
-        return;
-    }
-
-    picked_handle = choose_gop_handle(gop_handles, handle_count);
-    g_st->BootServices->FreePool(gop_handles);
 
-    ret = g_st->BootServices->HandleProtocol(picked_handle, &gop_guid, (void**)&gfx);
-    if (unlikely_efi_error(ret)) {
-        struct string_view err_msg = uefi_status_to_string(ret);
-        print_warn("unexpected error for GOP handle: %pSV, graphics won't be available\n", &err_msg);
+    edid_fetched = true;
+    if (!gop_handle)
         return;
-    }
-
-    gfx_modes_init();
 
-    ret = g_st->BootServices->HandleProtocol(picked_handle, &active_edid_guid, (void**)&edid_blob);
+    ret = g_st->BootServices->HandleProtocol(gop_handle, &active_edid_guid, (void**)&edid_blob);
     if (EFI_ERROR(ret))
-        ret = g_st->BootServices->HandleProtocol(picked_handle, &discovered_edid_guid, (void**)&edid_blob);
+        ret = g_st->BootServices->HandleProtocol(gop_handle, &discovered_edid_guid, (void**)&edid_blob);
 
     if (EFI_ERROR(ret)) {
         struct string_view err_msg = uefi_status_to_string(ret);
@@ -377,6 +408,125 @@ static void gop_init(void)
     edid_init(edid_blob);
 }
 
+bool vs_query_native_resolution(struct resolution *out_resolution)
+{
+    SERVICE_FUNCTION();
+
+    if (!edid_fetched)
+        fetch_edid();
+
+    if (!native_height || !native_width)
+        return false;
+
+    out_resolution->width = native_width;
+    out_resolution->height = native_height;
+    return true;
+}
+
+bool vs_get_current_mode(struct video_mode *out_mode)
+{
+    SERVICE_FUNCTION();
+
+    // The firmware already tells us everything about it, no need to enumerate
+    if (!gfx || !gfx->Mode || !gfx->Mode->Info)
+        return false;
+    if (gfx->Mode->SizeOfInfo != sizeof(*gfx->Mode->Info))
+        return false;
+
+    return mode_from_info(gfx->Mode->Info, gfx->Mode->Mode, out_mode);
+}
+
+bool vs_set_mode(u32 id, struct framebuffer *out_framebuffer)
+{
+    SERVICE_FUNCTION();
+
+    EFI_STATUS ret;
+    EFI_GRAPHICS_OUTPUT_MODE_INFORMATION *mode_info;
+    struct video_mode vm;
+
+    BUG_ON(!gfx);
+    BUG_ON(id >= gfx->Mode->MaxMode);
+
+    print_info("setting video mode %u...\n", id);
+
+    ret = gfx->SetMode(gfx, id);
+    if (unlikely_efi_error(ret)) {
+        struct string_view err_msg = uefi_status_to_string(ret);
+        print_warn("failed to set video mode %u: %pSV\n", id, &err_msg);
+        return false;
+    }
+
+    if (unlikely(!gfx->Mode)) {
+        print_warn("mode set successfully but EFI_GRAPHICS_OUTPUT_PROTOCOL::Mode is null?\n");
+        return false;
+    }
+
+    mode_info = gfx->Mode->Info;
+    if (unlikely(!mode_info)) {
+        print_warn("mode set successfully but no mode information available?\n");
+        return false;
+    }
+    if (unlikely(gfx->Mode->SizeOfInfo != sizeof(*mode_info))) {
+        print_warn("unexpected mode info: expected %zu got %zu\n",
+                   sizeof(*mode_info), gfx->Mode->SizeOfInfo);
+        return false;
+    }
+    if (unlikely(!mode_from_info(mode_info, id, &vm))) {
+        print_warn("mode %u has an unsupported pixel format after set?\n", id);
+        return false;
+    }
+
+    *out_framebuffer = (struct framebuffer) {
+        .width = vm.width,
+        .height = vm.height,
+        .physical_address = gfx->Mode->FrameBufferBase,
+        .pitch = mode_info->PixelsPerScanLine * (vm.bpp / 8),
+        .bpp = vm.bpp,
+        .format = vm.format,
+    };
+
+    // Keep the framebuffer console going in the new mode
+    if (fb_console_active())
+        fb_console_init(gfx);
+
+    return true;
+}
+
+static void uefi_video_services_cleanup(void)
+{
+    if (video_modes)
+        g_st->BootServices->FreePool(video_modes);
+    mode_count = 0;
+}
+DECLARE_CLEANUP_HANDLER(uefi_video_services_cleanup);
+
+static void gop_init(void)
+{
+    EFI_GUID gop_guid = EFI_GRAPHICS_OUTPUT_PROTOCOL_GUID;
+    EFI_HANDLE *gop_handles, picked_handle = NULL;
+    EFI_STATUS ret;
+    UINTN handle_count;
+
+    if (!uefi_get_protocol_handles(&gop_guid, &gop_handles, &handle_count)) {
+        print_warn("no GOP handles found, graphics won't be available\n");
+        return;
+    }
+
+    picked_handle = choose_gop_handle(gop_handles, handle_count);
+    g_st->BootServices->FreePool(gop_handles);
+
+    ret = g_st->BootServices->HandleProtocol(picked_handle, &gop_guid, (void**)&gfx);
+    if (unlikely_efi_error(ret)) {
+        struct string_view err_msg = uefi_status_to_string(ret);
+        print_warn("unexpected error for GOP handle: %pSV, graphics won't be available\n", &err_msg);
+        gfx = NULL;
+        return;
+    }
+
+    // Modes and EDID are only looked at once something asks for them
+    gop_handle = picked_handle;
+}
+
 void uefi_video_services_init(void)
 {
     tty_init();
@@ -1,32 +1,66 @@
+#define MSG_FMT(msg) "VMM: " msg
+
 #include "virtual_memory.h"
 #include "virtual_memory_impl.h"
 #include "allocator.h"
+#include "parallel.h"
 
 #include "common/bug.h"
 #include "common/constants.h"
 #include "common/align.h"
 #include "common/string.h"
 #include "common/minmax.h"
+#include "common/log.h"
 
 struct bulk_map_ctx {
     struct page_table *pt;
     u64 physical_base, virtual_base;
     size_t page_count;
     u64 page_attributes;
-    bool huge;
+    enum page_type type;
 };
 
-ptr_t pt_get_table_page(u64 max_address)
+static u64 pt_table_ceiling(struct page_table *pt)
 {
-    void *ptr;
-    struct allocation_spec spec = {
-        .ceiling = max_address,
-        .pages = 1,
+    u64 ceiling = pt->max_table_address;
+
+    if (!ceiling || ceiling > (4ull * GB))
+        ceiling = 4ull * GB;
+
+    return ceiling;
+}
+
+static void pt_table_alloc_spec(struct page_table *pt, size_t pages,
+                                struct allocation_spec *spec)
+{
+    *spec = (struct allocation_spec) {
+        .ceiling = pt_table_ceiling(pt),
+        .pages = pages,
     };
 
-    if (!spec.ceiling || spec.ceiling > (4ull * GB))
-        spec.ceiling = 4ull * GB;
+    if (pt->prefer_numa_node) {
+        spec->flags |= ALLOCATE_PREFER_NODE;
+        spec->node = pt->numa_node;
+    }
+}
+
+ptr_t pt_get_table_page(struct page_table *pt)
+{
+    void *ptr;
+    struct pt_page_pool *pool = &pt->pool;
+    struct allocation_spec spec;
+
+    if (pool->used < pool->capacity) {
+        /*
+         * Carve pages top-down so that the unused part of the pool ends up
+         * adjacent to the free range it was taken from once released.
+         * The entire pool is zeroed up front.
+         */
+        pool->used++;
+        return pool->base + ((u64)(pool->capacity - pool->used) << PAGE_SHIFT);
+    }
 
+    pt_table_alloc_spec(pt, 1, &spec);
     ptr = ADDR_TO_PTR(allocate_pages_ex(&spec));
     if (unlikely(ptr == NULL))
         return 0;
@@ -47,18 +81,23 @@ u8 pt_table_width_shift_for_level(struct page_table *pt, size_t idx)
     return pt->table_width_shift;
 }
 
-static size_t get_level_index(struct page_table *pt, u64 virtual_address,
-                              size_t level)
+void pt_init_levels(struct page_table *pt)
 {
-    u8 width_shift;
-    size_t table_width_mask;
+    size_t i;
 
-    width_shift = pt_table_width_shift_for_level(pt, level);
+    BUG_ON(pt->levels > PT_MAX_LEVELS);
+    BUG_ON(pt->entry_width != 4 && pt->entry_width != 8);
 
-    table_width_mask = (1 << width_shift) - 1;
-    u64 table_selector = virtual_address >> get_level_bit_offset(pt, level);
+    for (i = 0; i < pt->levels; ++i) {
+        pt->level_shift[i] = get_level_bit_offset(pt, i);
+        pt->level_mask[i] = (1 << pt_table_width_shift_for_level(pt, i)) - 1;
+    }
+}
 
-    return table_selector & table_width_mask;
+static size_t get_level_index(struct page_table *pt, u64 virtual_address,
+                              size_t level)
+{
+    return (virtual_address >> pt->level_shift[level]) & pt->level_mask[level];
 }
 
 static void *get_table_slot(struct page_table *pt, void *table, size_t idx)
@@ -71,7 +110,7 @@ static void *table_at(struct page_table *pt, void *table, size_t idx)
     u64 entry;
 
     table = get_table_slot(pt, table, idx);
-    entry = pt->read_slot(table);
+    entry = pt_read_slot(pt, table);
 
     if (entry & PAGE_PRESENT) {
         BUG_ON(pt_is_huge_page(entry));
@@ -80,11 +119,11 @@ static void *table_at(struct page_table *pt, void *table, size_t idx)
         return ADDR_TO_PTR(entry);
     }
 
-    entry = pt_get_table_page(pt->max_table_address);
+    entry = pt_get_table_page(pt);
     if (!entry)
         return NULL;
 
-    pt->write_slot(table, entry | PAGE_READWRITE | PAGE_PRESENT | PAGE_NORMAL);
+    pt_write_slot(pt, table, entry | PAGE_READWRITE | PAGE_PRESENT | PAGE_NORMAL);
     return ADDR_TO_PTR(entry);
 }
 
@@ -132,11 +171,11 @@ static bool bulk_map_pages(struct bulk_map_ctx *ctx)
 {
     void *slot;
     struct page_table *pt = ctx->pt;
-    size_t slot_idx, pages_to_map, bytes_per_page;
-    u64 bytes_mapped, pte_entry = ctx->physical_base;
-    u8 this_level = 1 + ctx->huge;
+    size_t slot_idx, pages_to_map;
+    u64 bytes_mapped, bytes_per_page, pte_entry = ctx->physical_base;
+    u8 this_level = 1 + ctx->type;
 
-    bytes_per_page = ctx->huge ? huge_page_size(pt) : page_size(pt);
+    bytes_per_page = 1ull << page_type_shift(pt, ctx->type);
 
     BUG_ON(!IS_ALIGNED(ctx->virtual_base, bytes_per_page));
     BUG_ON(!IS_ALIGNED(ctx->physical_base, bytes_per_page));
@@ -147,7 +186,8 @@ static bool bulk_map_pages(struct bulk_map_ctx *ctx)
     slot_idx = get_level_index(pt, ctx->virtual_base, this_level - 1);
     slot = get_table_slot(pt, slot, slot_idx);
 
-    pages_to_map = MIN(ctx->page_count, (1 << pt->table_width_shift) - slot_idx);
+    pages_to_map = MIN(ctx->page_count,
+                       pt->level_mask[this_level - 1] + 1u - slot_idx);
     ctx->page_count -= pages_to_map;
 
     bytes_mapped = pages_to_map;
@@ -156,14 +196,84 @@ static bool bulk_map_pages(struct bulk_map_ctx *ctx)
     ctx->physical_base += bytes_mapped;
 
     pte_entry |= ctx->page_attributes;
+    pt_write_run(pt, slot, pte_entry, bytes_per_page, pages_to_map);
+
+    return true;
+}
+
+/*
+ * Accounts every table below the root that a mapping of 'bytes' at
+ * 'virtual_base' with leaf entries at 'leaf_level' would touch. This is an
+ * upper bound, tables already accounted by a non-adjacent mapping are counted
+ * again.
+ */
+static void pt_pool_account(struct page_table *pt, u64 virtual_base,
+                            u64 bytes, size_t leaf_level)
+{
+    struct pt_page_pool *pool = &pt->pool;
+    size_t level, half = virtual_base >> 63;
+    u64 virtual_end = virtual_base + (bytes - 1);
+
+    for (level = leaf_level; level < pt->levels - 1u; ++level) {
+        size_t shift = get_level_bit_offset(pt, level + 1);
+        u64 first_table = virtual_base >> shift;
+        u64 last_table = virtual_end >> shift;
+
+        pool->pages_needed += last_table - first_table + 1;
+        if (pool->last_table[level][half] == first_table)
+            pool->pages_needed--;
 
-    while (pages_to_map--) {
-        pt->write_slot(slot, pte_entry);
-        slot += pt->entry_width;
-        pte_entry += bytes_per_page;
+        pool->last_table[level][half] = last_table;
     }
+}
 
-    return true;
+void pt_pool_begin_sizing(struct page_table *pt)
+{
+    struct pt_page_pool *pool = &pt->pool;
+
+    BUG_ON(pool->sizing || pool->capacity);
+
+    pool->sizing = true;
+    pool->pages_needed = 0;
+    memset(pool->last_table, 0xFF, sizeof(pool->last_table));
+}
+
+void pt_pool_end_sizing(struct page_table *pt)
+{
+    struct pt_page_pool *pool = &pt->pool;
+    struct allocation_spec spec;
+
+    BUG_ON(!pool->sizing);
+    pool->sizing = false;
+
+    if (!pool->pages_needed)
+        return;
+
+    pt_table_alloc_spec(pt, pool->pages_needed, &spec);
+    pool->base = allocate_pages_ex(&spec);
+    if (!pool->base) {
+        print_warn("failed to reserve %zu page table pages, "
+                   "falling back to on-demand allocation\n", spec.pages);
+        return;
+    }
+
+    parallel_bulk_zero(ADDR_TO_PTR(pool->base), spec.pages << PAGE_SHIFT);
+    pool->capacity = spec.pages;
+    pool->used = 0;
+}
+
+void pt_pool_release(struct page_table *pt)
+{
+    struct pt_page_pool *pool = &pt->pool;
+    size_t unused = pool->capacity - pool->used;
+
+    BUG_ON(pool->sizing);
+
+    if (unused)
+        free_pages(ADDR_TO_PTR(pool->base), unused);
+
+    pool->base += (u64)unused << PAGE_SHIFT;
+    pool->capacity = pool->used;
 }
 
 bool map_pages(const struct page_mapping_spec *spec)
@@ -174,20 +284,31 @@ bool map_pages(const struct page_mapping_spec *spec)
         .virtual_base = spec->virtual_base,
         .page_count = spec->count,
         .page_attributes = PAGE_READWRITE | PAGE_PRESENT,
+        .type = spec->type,
     };
 
     switch (spec->type) {
     case PAGE_TYPE_NORMAL:
         ctx.page_attributes |= PAGE_NORMAL;
         break;
+    case PAGE_TYPE_GIGANTIC:
+        BUG_ON(!ctx.pt->gigantic_pages);
+        FALLTHROUGH;
     case PAGE_TYPE_HUGE:
         ctx.page_attributes |= PAGE_HUGE;
-        ctx.huge = true;
         break;
     default:
         BUG();
     }
 
+    if (ctx.pt->pool.sizing) {
+        u64 bytes = (u64)spec->count << page_type_shift(ctx.pt, ctx.type);
+
+        if (bytes)
+            pt_pool_account(ctx.pt, spec->virtual_base, bytes, ctx.type);
+        return true;
+    }
+
     while (ctx.page_count) {
         bool ok;
 
@@ -202,8 +323,75 @@ error_out:
     if (!spec->critical)
         return false;
 
-    panic("Out of memory while mapping %zu pages at 0x%016llX to phys 0x%016llX (huge: %d)\n",
-          spec->count, spec->virtual_base, spec->physical_base, ctx.huge);
+    panic("Out of memory while mapping %zu pages at 0x%016llX to phys 0x%016llX (type: %d)\n",
+          spec->count, spec->virtual_base, spec->physical_base, ctx.type);
+}
+
+static bool share_level(struct page_table *pt, void *src_table, void *dst_table,
+                        size_t level, u64 src, u64 dst, u64 length)
+{
+    u64 coverage = pt_level_entry_virtual_coverage(pt, level);
+
+    while (length) {
+        void *src_slot, *dst_slot, *dst_next;
+        u64 entry, chunk;
+
+        // Never cross an entry boundary on either side
+        chunk = MIN(coverage - (src & (coverage - 1)),
+                    coverage - (dst & (coverage - 1)));
+        chunk = MIN(chunk, length);
+
+        src_slot = get_table_slot(pt, src_table, get_level_index(pt, src, level));
+        dst_slot = get_table_slot(pt, dst_table, get_level_index(pt, dst, level));
+
+        entry = pt_read_slot(pt, src_slot);
+        if (!(entry & PAGE_PRESENT))
+            goto next;
+
+        if (chunk == coverage) {
+            if (!(pt_read_slot(pt, dst_slot) & PAGE_PRESENT))
+                pt_write_slot(pt, dst_slot, entry);
+            goto next;
+        }
+
+        // Partially shared leaves would have to be split, which we never do
+        BUG_ON(level == 0 || pt_is_huge_page(entry));
+
+        dst_next = table_at(pt, dst_table, get_level_index(pt, dst, level));
+        if (!dst_next)
+            return false;
+
+        if (!share_level(pt, ADDR_TO_PTR(entry & pt->entry_address_mask),
+                         dst_next, level - 1, src, dst, chunk))
+            return false;
+
+    next:
+        src += chunk;
+        dst += chunk;
+        length -= chunk;
+    }
+
+    return true;
+}
+
+bool map_share_range(struct page_table *pt, u64 src_virtual_base,
+                     u64 dst_virtual_base, u64 length)
+{
+    BUG_ON(!IS_ALIGNED(src_virtual_base | dst_virtual_base | length,
+                       page_size(pt)));
+
+    if (pt->pool.sizing) {
+        /*
+         * Assuming both ranges are equally aligned, only the tables on the
+         * path to the unaligned edges of the range are ever allocated,
+         * everything else is aliased.
+         */
+        pt->pool.pages_needed += 2 * (pt->levels - 1u);
+        return true;
+    }
+
+    return share_level(pt, pt->root, pt->root, pt->levels - 1,
+                       src_virtual_base, dst_virtual_base, length);
 }
 
 void map_copy_root_entry(struct page_table* pt, u64 src_virtual_address,
@@ -0,0 +1,87 @@
+#!/usr/bin/python3
+"""
+A minimal threaded HTTP server for the network boot tests. Serves a directory
+and honors single-range "Range: bytes=a-b" requests the way the loader issues
+them, keeping count so tests can tell whether ranged GETs were actually used.
+"""
+import os
+import re
+import threading
+from http import HTTPStatus
+from http.server import SimpleHTTPRequestHandler, ThreadingHTTPServer
+
+_RANGE_RE = re.compile(r"bytes=(\d+)-(\d*)$")
+
+
+class _RangeHandler(SimpleHTTPRequestHandler):
+    protocol_version = "HTTP/1.1"
+
+    def log_message(self, format, *args):
+        pass
+
+    def do_GET(self):
+        path = self.translate_path(self.path)
+        if not os.path.isfile(path):
+            self.send_error(HTTPStatus.NOT_FOUND)
+            return
+
+        size = os.path.getsize(path)
+        first, last = 0, size - 1
+        status = HTTPStatus.OK
+
+        match = _RANGE_RE.match(self.headers.get("Range", ""))
+        if match:
+            first = int(match.group(1))
+            if match.group(2):
+                last = min(int(match.group(2)), size - 1)
+
+            if first >= size:
+                self.send_response(HTTPStatus.REQUESTED_RANGE_NOT_SATISFIABLE)
+                self.send_header("Content-Range", f"bytes */{size}")
+                self.send_header("Content-Length", "0")
+                self.end_headers()
+                return
+
+            status = HTTPStatus.PARTIAL_CONTENT
+            self.server.range_requests += 1
+
+        self.send_response(status)
+        self.send_header("Content-Length", str(last - first + 1))
+        self.send_header("Accept-Ranges", "bytes")
+        if status == HTTPStatus.PARTIAL_CONTENT:
+            self.send_header("Content-Range", f"bytes {first}-{last}/{size}")
+        self.end_headers()
+
+        with open(path, "rb") as f:
+            f.seek(first)
+            self.wfile.write(f.read(last - first + 1))
+
+
+class HttpServer:
+    """
+    Serves 'root' on an ephemeral loopback port for the duration of a 'with'
+    block. QEMU's user-mode networking makes it reachable by the guest at
+    10.0.2.2:<port>.
+    """
+    def __init__(self, root: str):
+        handler = lambda *args: _RangeHandler(*args, directory=root)
+        self._server = ThreadingHTTPServer(("127.0.0.1", 0), handler)
+        self._server.range_requests = 0
+        self._thread = threading.Thread(target=self._server.serve_forever,
+                                        daemon=True)
+
+    @property
+    def port(self) -> int:
+        return self._server.server_address[1]
+
+    @property
+    def range_requests(self) -> int:
+        return self._server.range_requests
+
+    def __enter__(self):
+        self._thread.start()
+        return self
+
+    def __exit__(self, *exc):
+        self._server.shutdown()
+        self._server.server_close()
@@ -1,5 +1,5 @@
 #include "fb_tty.h"
-#include "fb_font.h"
+#include "common/fb_font.h"
 #include "mmio.h"
 #include "ultra_protocol.h"
 #include "ultra_helpers.h"
@@ -74,21 +74,22 @@ void fb_tty_init(struct ultra_boot_context *bctx)
     fb_ptr = mmio_map(bctx, fb->physical_address, fb->pitch * fb->height,
                       MMIO_WC);
 
-    rows = fb_height / FONT_HEIGHT;
-    columns = fb_width / FONT_WIDTH;
+    rows = fb_height / FB_FONT_HEIGHT;
+    columns = fb_width / FB_FONT_WIDTH;
 }
 
 void fb_write_one(char c)
 {
-    size_t x_initial = FONT_WIDTH * tty_x;
-    size_t y_initial = FONT_HEIGHT * tty_y;
+    size_t x_initial = FB_FONT_WIDTH * tty_x;
+    size_t y_initial = FB_FONT_HEIGHT * tty_y;
+    const u8 *glyph = fb_font[(u8)c < FB_FONT_GLYPH_COUNT ? (u8)c : '?'];
     size_t y, x;
 
-    for (y = 0; y < FONT_HEIGHT; ++y) {
-        for (x = 0; x < FONT_WIDTH; ++x) {
+    for (y = 0; y < FB_FONT_HEIGHT; ++y) {
+        for (x = 0; x < FB_FONT_WIDTH; ++x) {
             u32 *fb_at_y = fb_ptr + (y_initial + y) * fb_pitch;
 
-            bool present = fb_font[(size_t)c][y] & (1 << x);
+            bool present = glyph[y] & (1 << x);
             fb_at_y[x_initial + x] = 0xFFFFFFFF * present;
         }
     }
@@ -1,7 +0,0 @@
-#pragma once
-#include "common/types.h"
-
-#define FONT_WIDTH  8
-#define FONT_HEIGHT 16
-
-extern u8 fb_font[256][16];
@@ -1,13 +1,16 @@
 #include "common/log.h"
 #include "common/types.h"
 #include "common/align.h"
+#include "common/minmax.h"
 #include "common/range.h"
 #include "common/string_ex.h"
 #include "common/string_view.h"
 #include "common/conversions.h"
 #include "test_ctl.h"
+#include "test_ctl_impl.h"
 #include "fb_tty.h"
 #include "ultra_protocol.h"
+#include "ultra_extensions.h"
 #include "ultra_helpers.h"
 
 static const char *me_type_to_str(u64 type)
@@ -453,6 +456,313 @@ static void validate_uefi_info(struct ultra_uefi_info_attribute *ui,
           count, ui->descriptor_size);
 }
 
+/*
+ * Every fixed point is recorded exactly once, in order, with a module point
+ * per module loaded from the configuration. The kernel binary loaded as a
+ * module doesn't go through the module path, so it doesn't get one.
+ */
+static void validate_boot_timeline(struct ultra_boot_timeline_attribute *bt,
+                                   struct ultra_module_info_attribute *modules,
+                                   size_t module_count)
+{
+    size_t i, count = ULTRA_BOOT_TIMELINE_ENTRY_COUNT(*bt);
+    size_t modules_loaded = 0, expected_modules = module_count;
+    u32 seen_events = 0, expected_events = 0;
+
+    for (i = 0; i < module_count; ++i, modules = next_module(modules)) {
+        if (strcmp(modules->name, "__KERNEL__") == 0)
+            expected_modules--;
+    }
+
+    if (count < 2)
+        test_fail("boot timeline is too short (%zu entries)\n", count);
+    if (bt->entries[0].event != ULTRA_BOOT_TIMELINE_LOADER_ENTRY)
+        test_fail("boot timeline doesn't start at loader entry\n");
+    if (bt->entries[count - 1].event != ULTRA_BOOT_TIMELINE_HANDOVER)
+        test_fail("boot timeline doesn't end at handover\n");
+
+    for (i = 0; i < count; ++i) {
+        struct ultra_boot_timeline_entry *te = &bt->entries[i];
+
+        if (te->event < ULTRA_BOOT_TIMELINE_LOADER_ENTRY ||
+            te->event > ULTRA_BOOT_TIMELINE_HANDOVER)
+            test_fail("invalid boot timeline event %u\n", te->event);
+
+        if (i && te->timestamp < bt->entries[i - 1].timestamp)
+            test_fail("boot timeline goes back in time at entry %zu\n", i);
+
+        if (te->event == ULTRA_BOOT_TIMELINE_MODULE_LOADED) {
+            modules_loaded++;
+            continue;
+        }
+
+        if (seen_events & (1u << te->event))
+            test_fail("duplicate boot timeline event %u\n", te->event);
+        seen_events |= 1u << te->event;
+    }
+
+    for (i = ULTRA_BOOT_TIMELINE_LOADER_ENTRY;
+         i <= ULTRA_BOOT_TIMELINE_HANDOVER; ++i) {
+        if (i != ULTRA_BOOT_TIMELINE_MODULE_LOADED)
+            expected_events |= 1u << i;
+    }
+
+    if (seen_events != expected_events)
+        test_fail("missing boot timeline events (0x%08X vs 0x%08X)\n",
+                  seen_events, expected_events);
+
+    if (modules_loaded != expected_modules)
+        test_fail("expected %zu module boot timeline events, got %zu\n",
+                  expected_modules, modules_loaded);
+
+    print("boot timeline OK (%zu entries, %llu cycles @ %llu Hz)\n", count,
+          bt->entries[count - 1].timestamp - bt->entries[0].timestamp,
+          bt->frequency);
+}
+
+#define SMP_TEST_MAX_CPUS 16
+#define SMP_TEST_STACK_SIZE 4096
+#define SMP_TEST_ARGUMENT 0xC0FFEE
+#define SMP_TEST_SPIN_LIMIT 100000000
+
+static u8 ap_stacks[SMP_TEST_MAX_CPUS][SMP_TEST_STACK_SIZE]
+    __attribute__((aligned(16)));
+static u32 aps_online;
+static u32 aps_bad_argument;
+
+static void ap_entry(struct ultra_smp_cpu *self, u64 argument)
+{
+    if (argument != SMP_TEST_ARGUMENT ||
+        !(self->flags & ULTRA_SMP_CPU_PARKED))
+        __atomic_fetch_add(&aps_bad_argument, 1, __ATOMIC_RELAXED);
+
+    __atomic_fetch_add(&aps_online, 1, __ATOMIC_RELEASE);
+    arch_halt_cpu();
+}
+
+/*
+ * Exactly one BSP at the advertised index, every other CPU parked, and all of
+ * them actually run kernel code once released.
+ */
+static void validate_smp_info(struct ultra_smp_info_attribute *si,
+                              struct ultra_command_line_attribute *cl)
+{
+    struct ultra_smp_cpu *cpus = (struct ultra_smp_cpu*)(ptr_t)si->cpus_address;
+    size_t i, spins, released = 0;
+    u32 want_cpus;
+
+    if (si->header.size != sizeof(*si))
+        test_fail("bad SMP info attribute size %u\n", si->header.size);
+    if (!si->cpu_count || si->bsp_index >= si->cpu_count)
+        test_fail("bad BSP index %u (%u CPUs)\n", si->bsp_index, si->cpu_count);
+    if (!IS_ALIGNED(si->cpus_address, sizeof(struct ultra_smp_cpu)))
+        test_fail("misaligned CPU descriptors at 0x%016llX\n", si->cpus_address);
+
+    if (cmdline_get_u32(cl, SV("expect-cpus"), &want_cpus) &&
+        want_cpus != si->cpu_count)
+        test_fail("expected %u CPUs, got %u\n", want_cpus, si->cpu_count);
+
+    if (si->cpu_count > SMP_TEST_MAX_CPUS)
+        test_fail("too many CPUs to test (%u)\n", si->cpu_count);
+
+    for (i = 0; i < si->cpu_count; ++i) {
+        struct ultra_smp_cpu *cpu = &cpus[i];
+        bool is_bsp = cpu->flags & ULTRA_SMP_CPU_BSP;
+
+        if (is_bsp != (i == si->bsp_index))
+            test_fail("CPU %zu has a bad BSP flag\n", i);
+        if (!(cpu->flags & ULTRA_SMP_CPU_PARKED))
+            test_fail("CPU %zu (0x%llX) is not parked\n", i, cpu->hardware_id);
+        if (cpu->entrypoint)
+            test_fail("CPU %zu already has an entrypoint\n", i);
+        if (is_bsp)
+            continue;
+
+        cpu->stack = (ptr_t)ap_stacks[i] + SMP_TEST_STACK_SIZE;
+        cpu->argument = SMP_TEST_ARGUMENT;
+        __atomic_store_n(&cpu->entrypoint, (ptr_t)ap_entry, __ATOMIC_RELEASE);
+        released++;
+    }
+
+    for (spins = 0; spins < SMP_TEST_SPIN_LIMIT; ++spins) {
+        if (__atomic_load_n(&aps_online, __ATOMIC_ACQUIRE) == released)
+            break;
+    }
+
+    if (aps_online != released)
+        test_fail("only %u out of %zu released CPUs came online\n",
+                  aps_online, released);
+    if (aps_bad_argument)
+        test_fail("%u CPUs got bad entry arguments\n", aps_bad_argument);
+
+    print("SMP info OK (%u CPUs, BSP 0x%llX)\n", si->cpu_count,
+          cpus[si->bsp_index].hardware_id);
+}
+
+static bool bitmap_page_is_free(const u64 *bitmap, u64 page)
+{
+    return bitmap[page / 64] & (1ull << (page % 64));
+}
+
+/*
+ * Every page is free in the bitmap if and only if it's entirely within a free
+ * memory map range, and the bitmap itself lives in loader-reclaimable memory.
+ */
+static void validate_free_page_bitmap(struct ultra_free_page_bitmap_attribute *fpb,
+                                      struct ultra_memory_map_attribute *mm,
+                                      struct ultra_platform_info_attribute *pi)
+{
+    size_t i, entries = ULTRA_MEMORY_MAP_ENTRY_COUNT(mm->header);
+    const u64 *bitmap = (const u64*)(ptr_t)fpb->bitmap_address;
+    u64 phys = fpb->bitmap_address, page, free_pages = 0, map_free_pages = 0;
+    u64 prev_end = 0;
+
+    if (fpb->header.size != sizeof(*fpb))
+        test_fail("bad free page bitmap attribute size %u\n", fpb->header.size);
+    if (fpb->bitmap_size < CEILING_DIVIDE(fpb->page_count, 8) ||
+        !IS_ALIGNED(fpb->bitmap_size, 8))
+        test_fail("bad free page bitmap size %llu for %llu pages\n",
+                  fpb->bitmap_size, fpb->page_count);
+
+    if (phys >= pi->higher_half_base)
+        phys -= pi->higher_half_base;
+    memory_map_ensure_range_is_of_type(mm, phys, fpb->bitmap_size,
+                                       ULTRA_MEMORY_TYPE_LOADER_RECLAIMABLE);
+
+    for (i = 0; i < entries; ++i) {
+        struct ultra_memory_map_entry *me = &mm->entries[i];
+        u64 first = PAGE_ROUND_UP(me->physical_address) >> PAGE_SHIFT;
+        u64 end = PAGE_ROUND_DOWN(me->physical_address + me->size) >> PAGE_SHIFT;
+        bool is_free = me->type == ULTRA_MEMORY_TYPE_FREE;
+
+        if (is_free && end > fpb->page_count)
+            test_fail("free range 0x%016llX->0x%016llX is past the bitmap\n",
+                      me->physical_address, me->physical_address + me->size);
+
+        // Holes in the map are never free
+        for (page = prev_end; page < MIN(first, fpb->page_count); ++page) {
+            if (bitmap_page_is_free(bitmap, page))
+                test_fail("page 0x%016llX in a memory map hole is free\n",
+                          page << PAGE_SHIFT);
+        }
+        prev_end = MAX(prev_end, end);
+
+        for (page = first; page < MIN(end, fpb->page_count); ++page) {
+            if (bitmap_page_is_free(bitmap, page) != is_free)
+                test_fail("page 0x%016llX is %sfree in the bitmap, "
+                          "expected type '%s'\n", page << PAGE_SHIFT,
+                          is_free ? "not " : "", me_type_to_str(me->type));
+        }
+
+        if (is_free)
+            map_free_pages += end - first;
+    }
+
+    for (page = 0; page < fpb->page_count; ++page)
+        free_pages += bitmap_page_is_free(bitmap, page);
+
+    if (free_pages != map_free_pages)
+        test_fail("free page bitmap has %llu free pages, memory map %llu\n",
+                  free_pages, map_free_pages);
+
+    print("free page bitmap OK (%llu out of %llu pages free)\n",
+          free_pages, fpb->page_count);
+}
+
+/*
+ * The harness names modules after where they're supposed to end up: 'hot' on
+ * the BSP's node, 'node-N' on node N (see test_loader.py). The kernel itself
+ * is expected to be on the BSP's node whenever that's known.
+ */
+static void validate_numa_info(struct ultra_numa_info_attribute *ni,
+                               struct ultra_module_info_attribute *mi,
+                               size_t module_count,
+                               struct ultra_command_line_attribute *cl)
+{
+    size_t i, want_size;
+    u32 want_bsp_node;
+
+    want_size = sizeof(*ni) + module_count * sizeof(uint32_t);
+    want_size = CEILING_DIVIDE(want_size, 8) * 8;
+
+    if (ni->header.size != want_size)
+        test_fail("bad NUMA info attribute size %u\n", ni->header.size);
+    if (ni->module_count != module_count)
+        test_fail("NUMA info has %u modules, expected %zu\n",
+                  ni->module_count, module_count);
+
+    if (cmdline_get_u32(cl, SV("expect-bsp-node"), &want_bsp_node) &&
+        ni->bsp_node != want_bsp_node)
+        test_fail("expected BSP on node %u, got %u\n", want_bsp_node,
+                  ni->bsp_node);
+
+    if (ni->bsp_node != ULTRA_NUMA_NODE_UNKNOWN &&
+        ni->kernel_node != ni->bsp_node)
+        test_fail("kernel is on node %u, BSP on node %u\n", ni->kernel_node,
+                  ni->bsp_node);
+
+    for (i = 0; i < module_count; ++i, mi = next_module(mi)) {
+        u32 node = ni->module_nodes[i], want_node;
+
+        if (strcmp(mi->name, "hot") == 0) {
+            want_node = ni->bsp_node;
+        } else if (strlen(mi->name) > 5 && memcmp(mi->name, "node-", 5) == 0) {
+            struct string_view num = { mi->name + 5, strlen(mi->name) - 5 };
+
+            if (!str_to_u32_with_base(num, &want_node, 10))
+                test_fail("invalid node module name: %s\n", mi->name);
+        } else {
+            continue;
+        }
+
+        if (node != want_node)
+            test_fail("module %s is on node %u, expected %u\n", mi->name,
+                      node, want_node);
+    }
+
+    print("NUMA info OK (BSP on node %u)\n", ni->bsp_node);
+}
+
+/*
+ * With expect-loader-log=1 the harness also loads a module called 'log-test'
+ * (see test_loader.py), so the loader must've said so regardless of whether
+ * that line made it to the console. With print-loader-log=1 the log is echoed
+ * to our output for the harness to look for specific lines in.
+ */
+static void validate_loader_log(struct ultra_loader_log_attribute *ll,
+                                struct ultra_command_line_attribute *cl)
+{
+    size_t capacity, len;
+    struct string_view text;
+    u32 want_log_test, print_log;
+
+    if (ll->header.size <= sizeof(*ll) || !IS_ALIGNED(ll->header.size, 8))
+        test_fail("bad loader log attribute size %u\n", ll->header.size);
+
+    capacity = ll->header.size - sizeof(*ll);
+    for (len = 0; len < capacity && ll->text[len]; ++len);
+
+    if (len == capacity)
+        test_fail("loader log is not NUL-terminated\n");
+    if (!len || ll->total_bytes < len)
+        test_fail("bad loader log length %zu (%llu bytes total)\n", len,
+                  ll->total_bytes);
+
+    text = (struct string_view) { ll->text, len };
+    if (cmdline_get_u32(cl, SV("expect-loader-log"), &want_log_test) &&
+        want_log_test &&
+        sv_find(text, SV("loading module \"log-test\""), 0) < 0)
+        test_fail("loader log is missing the module load message\n");
+
+    if (cmdline_get_u32(cl, SV("print-loader-log"), &print_log) && print_log) {
+        print("============== BEGINNING OF LOADER LOG =============\n");
+        test_write_string(text.text, text.size);
+        print("================ END OF LOADER LOG ================\n");
+    }
+
+    print("loader log OK (%zu out of %llu bytes)\n", len, ll->total_bytes);
+}
+
 static void validate_platform_info(struct ultra_platform_info_attribute *pi,
                                    struct ultra_kernel_info_attribute *ki)
 {
@@ -721,6 +1031,11 @@ static void attribute_array_verify(struct ultra_boot_context *bctx)
     struct ultra_memory_map_attribute *mm = NULL;
     struct ultra_apm_attribute *apm_info = NULL;
     struct ultra_uefi_info_attribute *uefi_info = NULL;
+    struct ultra_boot_timeline_attribute *timeline = NULL;
+    struct ultra_smp_info_attribute *smp_info = NULL;
+    struct ultra_free_page_bitmap_attribute *free_page_bitmap = NULL;
+    struct ultra_numa_info_attribute *numa_info = NULL;
+    struct ultra_loader_log_attribute *loader_log = NULL;
     struct ultra_module_info_attribute *modules_begin = NULL;
     size_t i, module_count = 0;
     bool modules_eof = false;
@@ -804,6 +1119,41 @@ static void attribute_array_verify(struct ultra_boot_context *bctx)
             uefi_info = cursor;
             break;
 
+        case ULTRA_ATTRIBUTE_BOOT_TIMELINE:
+            if (timeline)
+                test_fail_on_non_unique("boot timeline attributes");
+
+            timeline = cursor;
+            break;
+
+        case ULTRA_ATTRIBUTE_SMP_INFO:
+            if (smp_info)
+                test_fail_on_non_unique("SMP info attributes");
+
+            smp_info = cursor;
+            break;
+
+        case ULTRA_ATTRIBUTE_FREE_PAGE_BITMAP:
+            if (free_page_bitmap)
+                test_fail_on_non_unique("free page bitmap attributes");
+
+            free_page_bitmap = cursor;
+            break;
+
+        case ULTRA_ATTRIBUTE_NUMA_INFO:
+            if (numa_info)
+                test_fail_on_non_unique("NUMA info attributes");
+
+            numa_info = cursor;
+            break;
+
+        case ULTRA_ATTRIBUTE_LOADER_LOG:
+            if (loader_log)
+                test_fail_on_non_unique("loader log attributes");
+
+            loader_log = cursor;
+            break;
+
         default:
             test_fail("invalid attribute type %u\n", hdr->type);
         }
@@ -845,6 +1195,71 @@ static void attribute_array_verify(struct ultra_boot_context *bctx)
     if (uefi_info)
         validate_uefi_info(uefi_info, pi);
 
+    {
+        u32 want_timeline;
+
+        if (cmdline_get_u32(cl, SV("expect-boot-timeline"), &want_timeline) &&
+            want_timeline != (timeline != NULL)) {
+            test_fail("expected boot timeline present=%u, got %u\n",
+                      want_timeline, timeline != NULL);
+        }
+    }
+
+    if (timeline)
+        validate_boot_timeline(timeline, modules_begin, module_count);
+
+    {
+        u32 want_smp_info;
+
+        if (cmdline_get_u32(cl, SV("expect-smp-info"), &want_smp_info) &&
+            want_smp_info != (smp_info != NULL)) {
+            test_fail("expected SMP info present=%u, got %u\n",
+                      want_smp_info, smp_info != NULL);
+        }
+    }
+
+    if (smp_info)
+        validate_smp_info(smp_info, cl);
+
+    {
+        u32 want_bitmap;
+
+        if (cmdline_get_u32(cl, SV("expect-free-page-bitmap"), &want_bitmap) &&
+            want_bitmap != (free_page_bitmap != NULL)) {
+            test_fail("expected free page bitmap present=%u, got %u\n",
+                      want_bitmap, free_page_bitmap != NULL);
+        }
+    }
+
+    if (free_page_bitmap)
+        validate_free_page_bitmap(free_page_bitmap, mm, pi);
+
+    {
+        u32 want_numa_info;
+
+        if (cmdline_get_u32(cl, SV("expect-numa-info"), &want_numa_info) &&
+            want_numa_info != (numa_info != NULL)) {
+            test_fail("expected NUMA info present=%u, got %u\n",
+                      want_numa_info, numa_info != NULL);
+        }
+    }
+
+    if (numa_info)
+        validate_numa_info(numa_info, modules_begin, module_count, cl);
+
+    {
+        u32 want_loader_log;
+
+        if (cmdline_get_u32(cl, SV("expect-loader-log"), &want_loader_log) &&
+            want_loader_log != (loader_log != NULL)) {
+            test_fail("expected loader log present=%u, got %u\n",
+                      want_loader_log, loader_log != NULL);
+        }
+    }
+
+    if (loader_log)
+        validate_loader_log(loader_log, cl);
+
     print("\nLoader info: %s (version %d.%d) on %s\n",
           pi->loader_name, pi->loader_major, pi->loader_minor,
           platform_to_string(pi->platform_type));
@@ -44,3 +44,9 @@ void arch_hang_or_shutdown(void)
     }
     for (;;) asm volatile("wfi" ::: "memory");
 }
+
+void arch_halt_cpu(void)
+{
+    asm volatile("msr daifset, #0b1111" ::: "memory");
+    for (;;) asm volatile("wfi" ::: "memory");
+}
@@ -13,6 +13,10 @@ void arch_put_byte(char c);
 // Optional, arch_put_byte is called per char if not implemented
 void arch_write_string(const char *str, size_t count);
 
+// Stops the calling CPU forever, used for application processors
+NORETURN
+void arch_halt_cpu(void);
+
 // *MUST* shutdown to make tests pass, allowed to hang if on real HW
 NORETURN
 void arch_hang_or_shutdown(void);
@@ -46,6 +46,11 @@ void arch_write_string(const char *str, size_t len)
         e9_put_byte(*str++);
 }
 
+void arch_halt_cpu(void)
+{
+    for (;;) asm volatile("cli; hlt" ::: "memory");
+}
+
 // Try various methods, then give up
 void arch_hang_or_shutdown()
 {
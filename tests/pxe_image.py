@@ -48,3 +48,11 @@ def build_pxe_root(kernel_dir: str, kernel_type: str,
         return pxe.build_tftp_root(boot_image, boot_name, config, files)
     finally:
         os.remove(cc_module)
+
+
+def build_config_only_root(boot_image: str, boot_name: str, config: str) -> str:
+    """
+    Same as build_pxe_root, except only the boot image and 'config' are served,
+    for tests where the config points the loader elsewhere for everything else.
+    """
+    return pxe.build_tftp_root(boot_image, boot_name, config, {})
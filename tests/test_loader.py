@@ -1,5 +1,8 @@
+import re
 import shutil
+import struct
 import subprocess
+import sys
 import os
 import tempfile
 import pytest
@@ -7,7 +10,8 @@ import options
 import disk_image as di
 from image_utils import multipart as mp
 import pxe_image as pxe
-from typing import List
+from http_server import HttpServer
+from typing import List, Sequence
 from image_utils import ultra
 
 
@@ -104,10 +108,11 @@ def do_run_qemu(
 
 
 def run_qemu_x86(
-    disk_image: ultra.DiskImage, is_uefi: bool, config: str
+    disk_image: ultra.DiskImage, is_uefi: bool, config: str,
+    extra_args: Sequence[str] = (), com1: str = "mon:null"
 ) -> bytes:
-    qemu_args = ["-debugcon", "stdio", "-serial", "mon:null",
-                 "-cpu", "qemu64,la57=on"]
+    qemu_args = ["-debugcon", "stdio", "-serial", com1,
+                 "-cpu", "qemu64,la57=on", *extra_args]
 
     if is_uefi:
         firmware_path = config.getoption(options.X64_UEFI_FIRMWARE_OPT)
@@ -121,7 +126,8 @@ def run_qemu_x86(
 
 
 def run_qemu_aarch64(
-    disk_image: ultra.DiskImage, config: str, el2: bool = False
+    disk_image: ultra.DiskImage, config: str, el2: bool = False,
+    extra_args: Sequence[str] = ()
 ) -> bytes:
     # By default the loader is handed EL1. 'el2' boots at EL2 instead
     # (virtualization=on) to exercise the VHE handover path, which needs a
@@ -133,7 +139,8 @@ def run_qemu_aarch64(
         machine, cpu = "virt", "cortex-a72"
 
     qemu_args = ["-M", machine, "-cpu", cpu, "-device", "ramfb",
-                 "-bios", config.getoption(options.AA64_UEFI_FIRMWARE_OPT)]
+                 "-bios", config.getoption(options.AA64_UEFI_FIRMWARE_OPT),
+                 *extra_args]
     return do_run_qemu("aarch64", qemu_args, disk_image, config, 30)
 
 
@@ -193,18 +200,32 @@ def check_qemu_run(stdout: bytes) -> None:
     raise RuntimeError("Kernel reported an error")
 
 
-def boot_and_check(disk_image, firmware: str, config) -> None:
+def boot_and_check(disk_image, firmware: str, config,
+                   extra_args: Sequence[str] = (),
+                   com1: str = "mon:null") -> bytes:
     """
     Boot 'disk_image' under the given firmware ("bios", "uefi_x64" or
     "uefi_aarch64") and assert the kernel reported success. Collapses the
     per-test "run the right qemu, then check_qemu_run" boilerplate.
+    'extra_args' are appended to the qemu command line as is. 'com1' is the
+    chardev backing the first x86 serial port, discarded by default.
+    Returns the raw output for tests that look for specific lines in it.
     """
     if firmware == "uefi_aarch64":
-        res = run_qemu_aarch64(disk_image, config)
+        res = run_qemu_aarch64(disk_image, config, extra_args=extra_args)
     else:
-        res = run_qemu_x86(disk_image, firmware == "uefi_x64", config)
+        res = run_qemu_x86(disk_image, firmware == "uefi_x64", config,
+                           extra_args, com1)
 
     check_qemu_run(res)
+    return res
+
+
+# Config & kernel command line that make the kernel echo the loader log into
+# its output, so that a test can look for specific loader messages in what
+# boot_and_check() returns regardless of the console the loader logged to.
+_PRINT_LOADER_LOG_EXTRA = "pass-loader-log = true\n"
+_PRINT_LOADER_LOG_CMDLINE = "print-loader-log=1"
 
 
 @pytest.fixture
@@ -803,6 +824,185 @@ def test_boot_partition_selection(layout, boot_index, is_uefi, pytestconfig):
         shutil.rmtree(tmp)
 
 
+#
+# Installer blocklist (--blocklist).
+#
+# The installer records the extents of the default entry's kernel & modules
+# right after stage2 and the loader reads them from those directly. Whenever
+# the record can't be trusted the loader must notice and fall back to walking
+# the filesystem, so every variant has to boot the exact same files:
+# - "record": the record itself is corrupted, it's ignored as a whole
+# - "dirent": the kernel's directory entry changed (mtime bumped) after install,
+#   its extents are not used
+# - "contents": the module was rewritten in place after install, its extents
+#   are used but the whole-file checksum doesn't match
+# The loader log, echoed by the kernel, tells which path was actually taken.
+#
+_BLOCKLIST_STAGE2_LBA_OFF = 0x1B0
+_BLOCKLIST_STAGE2_SECTORS_OFF = 0x1AE
+_BLOCKLIST_HEADER_SIZE = 32
+_BLOCKLIST_FILE_COUNT_OFF = 16
+_BLOCKLIST_PATH_ALIGN = 8
+# Keep in sync with struct blocklist_entry/blocklist_extent in blocklist.c
+_BLOCKLIST_ENTRY = struct.Struct("<QQQHHIIIHH11s9x")
+_BLOCKLIST_EXTENT = struct.Struct("<QQ")
+_FAT_DIRENT_MTIME_OFF = 22
+
+_BLOCKLIST_MODULE = "/boot/blmod.bin"
+_BLOCKLIST_MODULE_SIZE = 4096
+_BLOCKLIST_MODULE_EXTRA = (
+    "module:\n"
+    '    name = "blocklist-test"\n'
+    f'    path = "{_BLOCKLIST_MODULE}"\n'
+)
+
+_BLOCKLIST_RECORD_RE = re.compile(rb"BLOCKLIST: \d+ file\(s\) recorded at LBA")
+_BLOCKLIST_OPENED_RE = re.compile(
+    rb"BLOCKLIST: opened /?boot/kernel_\S+ from [1-9]\d* extent\(s\)")
+_BLOCKLIST_CORRUPT_LINE = b"BLOCKLIST: record checksum mismatch, ignoring it"
+_BLOCKLIST_DIRENT_CHANGED_RE = re.compile(
+    rb"BLOCKLIST: /?boot/kernel_\S+ changed since install, "
+    rb"not using its extents")
+_BLOCKLIST_MODULE_REREAD_RE = re.compile(
+    rb"BLOCKLIST: checksum mismatch for /?boot/blmod\.bin, "
+    rb"re-reading via the filesystem")
+
+
+def _blocklist_record_offset(f) -> int:
+    f.seek(0)
+    mbr = f.read(512)
+    lba = int.from_bytes(mbr[_BLOCKLIST_STAGE2_LBA_OFF:
+                             _BLOCKLIST_STAGE2_LBA_OFF + 8], "little")
+    sectors = int.from_bytes(mbr[_BLOCKLIST_STAGE2_SECTORS_OFF:
+                                 _BLOCKLIST_STAGE2_SECTORS_OFF + 2], "little")
+    record = (lba + sectors) * 512
+
+    f.seek(record)
+    assert f.read(8) == b"HyperBL1"
+    return record
+
+
+def _blocklist_entry(f, path_suffix: str):
+    """
+    The (partition_lba, dirent_lba, dirent_offset, extents) of the recorded
+    file whose path ends with 'path_suffix'.
+    """
+    record = _blocklist_record_offset(f)
+    f.seek(record)
+    header = f.read(_BLOCKLIST_HEADER_SIZE)
+    size = int.from_bytes(header[8:12], "little")
+    count = int.from_bytes(header[_BLOCKLIST_FILE_COUNT_OFF:
+                                  _BLOCKLIST_FILE_COUNT_OFF + 4], "little")
+    data = header + f.read(size - _BLOCKLIST_HEADER_SIZE)
+
+    off = _BLOCKLIST_HEADER_SIZE
+    for _ in range(count):
+        (part_lba, _, dirent_lba, dirent_off, path_len, extent_count,
+         *_) = _BLOCKLIST_ENTRY.unpack_from(data, off)
+        off += _BLOCKLIST_ENTRY.size
+        path = data[off:off + path_len].decode("latin-1")
+        off += path_len + (-path_len % _BLOCKLIST_PATH_ALIGN)
+
+        extents = [_BLOCKLIST_EXTENT.unpack_from(data, off + i * 16)
+                   for i in range(extent_count)]
+        off += extent_count * _BLOCKLIST_EXTENT.size
+
+        if path.endswith(path_suffix):
+            return part_lba, dirent_lba, dirent_off, extents
+
+    raise AssertionError(f"{path_suffix} is not in the blocklist record")
+
+
+def _tamper_blocklist(img: str, how: str) -> None:
+    with open(img, "r+b") as f:
+        if how == "record":
+            # Claim an extra file without fixing up the checksum
+            record = _blocklist_record_offset(f)
+            f.seek(record + _BLOCKLIST_FILE_COUNT_OFF)
+            count = int.from_bytes(f.read(4), "little")
+            f.seek(record + _BLOCKLIST_FILE_COUNT_OFF)
+            f.write((count + 1).to_bytes(4, "little"))
+        elif how == "dirent":
+            # What touching the kernel after install would do
+            _, dirent_lba, dirent_off, _ = \
+                _blocklist_entry(f, f"/kernel_{PART_KERNEL}")
+            mtime_off = dirent_lba * 512 + dirent_off + _FAT_DIRENT_MTIME_OFF
+            f.seek(mtime_off)
+            mtime = int.from_bytes(f.read(2), "little")
+            f.seek(mtime_off)
+            f.write((mtime ^ 1).to_bytes(2, "little"))
+        elif how == "contents":
+            # A rewrite in place that left the directory entry alone
+            part_lba, _, _, extents = _blocklist_entry(f, _BLOCKLIST_MODULE)
+            f.seek((part_lba + extents[0][0]) * 512)
+            f.write(b"\xCD" * min(_BLOCKLIST_MODULE_SIZE, extents[0][1] * 512))
+        else:
+            raise ValueError(how)
+
+
+@pytest.mark.parametrize("tamper", (None, "record", "dirent", "contents"),
+                         ids=("blocklist", "blocklist-corrupt",
+                              "blocklist-stale-dirent",
+                              "blocklist-stale-contents"))
+@pytest.mark.bios
+@pytest.mark.fat
+@pytest.mark.hdd
+def test_blocklist_boot(tamper, pytestconfig):
+    getopt = pytestconfig.getoption
+    options.check_availability(getopt)
+    installer = getopt(options.INSTALLER_OPT)
+
+    kernel_src = os.path.join(getopt(options.KERNEL_DIR_OPT),
+                              f"kernel_{PART_KERNEL}")
+    tmp = tempfile.mkdtemp()
+    cfg_path = os.path.join(tmp, "hyper.cfg")
+    with open(cfg_path, "w") as f:
+        f.write(di.make_single_entry_config(
+            f"/boot/kernel_{PART_KERNEL}",
+            "part-type=mbr disk-index=0 part-index=0 " +
+            _PRINT_LOADER_LOG_CMDLINE,
+            extra=_PRINT_LOADER_LOG_EXTRA + _BLOCKLIST_MODULE_EXTRA))
+
+    module_src = os.path.join(tmp, "blmod.bin")
+    with open(module_src, "wb") as f:
+        f.write(b"\xAB" * _BLOCKLIST_MODULE_SIZE)
+
+    img = os.path.join(tmp, "disk.img")
+    try:
+        mp.build_mbr_image(img, [mp.Partition(files={
+            "hyper.cfg": cfg_path,
+            f"boot/kernel_{PART_KERNEL}": kernel_src,
+            _BLOCKLIST_MODULE[1:]: module_src,
+        })], installer_path=installer, boot_partition=0)
+
+        # Reinstalling is idempotent, this only adds the record
+        subprocess.run([sys.executable, installer, img,
+                        "--boot-partition", "0", "--blocklist"], check=True)
+        if tamper:
+            _tamper_blocklist(img, tamper)
+
+        out = boot_and_check(_RawImage(img), "bios", pytestconfig)
+    finally:
+        shutil.rmtree(tmp)
+
+    if tamper == "record":
+        assert _BLOCKLIST_CORRUPT_LINE in out
+        assert _BLOCKLIST_OPENED_RE.search(out) is None
+        return
+
+    assert _BLOCKLIST_RECORD_RE.search(out) is not None
+
+    if tamper == "dirent":
+        assert _BLOCKLIST_DIRENT_CHANGED_RE.search(out) is not None
+        assert _BLOCKLIST_OPENED_RE.search(out) is None
+    elif tamper == "contents":
+        assert _BLOCKLIST_OPENED_RE.search(out) is not None
+        assert _BLOCKLIST_MODULE_REREAD_RE.search(out) is not None
+    else:
+        assert _BLOCKLIST_OPENED_RE.search(out) is not None
+        assert _BLOCKLIST_MODULE_REREAD_RE.search(out) is None
+
+
 #
 # Network (PXE) boot.
 #
@@ -846,6 +1046,63 @@ def test_pxe_boot(kernel_type, is_uefi, pytestconfig):
         shutil.rmtree(tftp)
 
 
+#
+# Files over HTTP.
+#
+# The UEFI loader is PXE booted as above, but its config points it at an HTTP
+# server on the host (10.0.2.2 from the guest) for the kernel and a module.
+# The module spans multiple 1 MiB ranges so that the reads are split over
+# several connections, and the server must see ranged GETs rather than full
+# downloads.
+#
+_HTTP_MODULE_SIZE = 3 * 1024 * 1024 + 0x123
+
+
+def _http_config(port: int) -> str:
+    extra = (
+        "module:\n"
+        '    name = "ab-fill"\n'
+        '    path = "HTTP::/modules/ab-fill.bin"\n'
+    )
+    cfg = di.make_single_entry_config("HTTP::/boot/kernel_amd64_higher_half",
+                                      extra=extra)
+    return f'http-root = "http://10.0.2.2:{port}/"\n' + cfg
+
+
+@pytest.mark.uefi_x64
+@pytest.mark.pxe
+def test_http_files(pytestconfig):
+    getopt = pytestconfig.getoption
+    boot_image, boot_name = _pxe_boot_image(getopt, True)
+
+    http_root = tempfile.mkdtemp()
+    tftp = None
+
+    try:
+        os.makedirs(os.path.join(http_root, "boot"))
+        os.makedirs(os.path.join(http_root, "modules"))
+        shutil.copy(
+            os.path.join(getopt(options.KERNEL_DIR_OPT),
+                         "kernel_amd64_higher_half"),
+            os.path.join(http_root, "boot")
+        )
+        with open(os.path.join(http_root, "modules", "ab-fill.bin"), "wb") as f:
+            f.write(b"\xAB" * _HTTP_MODULE_SIZE)
+
+        with HttpServer(http_root) as server:
+            tftp = pxe.build_config_only_root(boot_image, boot_name,
+                                              _http_config(server.port))
+            res = run_qemu_x86_pxe(tftp, boot_name, True, pytestconfig)
+            check_qemu_run(res)
+
+            # The kernel headers, its segments and every module range
+            assert server.range_requests > 4
+    finally:
+        shutil.rmtree(http_root)
+        if tftp:
+            shutil.rmtree(tftp)
+
+
 #
 # Huge command line test.
 #
@@ -998,3 +1255,438 @@ def _uefi_info_image(br_type: str, fs_type: str, kernel_type: str, expect: int):
 )
 def test_uefi_info(feature_image: ultra.DiskImage, firmware, pytestconfig):
     boot_and_check(feature_image, firmware, pytestconfig)
+
+
+#
+# Boot timeline test.
+#
+# With `boot-timeline = true` the loader stamps a handful of fixed points
+# (entry, disks, config, kernel, page tables, handover) plus one per loaded
+# module with the architectural cycle counter, and hands them to the kernel as
+# an ultra_boot_timeline_attribute. The kernel checks that each fixed point
+# shows up exactly once, that time never goes backwards and that there's one
+# module point per module (see validate_boot_timeline in tests/kernel/kernel.c).
+# `print-boot-timeline` is turned on as well so the human readable dump gets
+# exercised on every platform.
+#
+
+
+_BOOT_TIMELINE_EXTRA = (
+    "boot-timeline = true\n"
+    "print-boot-timeline = true\n"
+    "module:\n"
+    '    name = "timeline-a"\n'
+    '    type = "memory"\n'
+    "    size = 0x1000\n"
+    "module:\n"
+    '    name = "timeline-b"\n'
+    '    type = "memory"\n'
+    "    size = 0x2000\n"
+)
+
+
+def _boot_timeline_image(br_type: str, fs_type: str, kernel_type: str):
+    cfg = di.make_single_entry_config(f"/boot/kernel_{kernel_type}",
+                                      "expect-boot-timeline=1",
+                                      extra=_BOOT_TIMELINE_EXTRA)
+    return (br_type, fs_type, cfg)
+
+
+@pytest.mark.parametrize(
+    "feature_image,firmware",
+    (
+        pytest.param(_boot_timeline_image("MBR", "FAT32", "amd64_higher_half"),
+                     "bios", marks=_BIOS_MARKS, id="MBR-FAT32-amd64_higher_half"),
+        pytest.param(_boot_timeline_image("GPT", "FAT32", "amd64_higher_half"),
+                     "uefi_x64", marks=_UEFI_MARKS,
+                     id="GPT-FAT32-amd64_higher_half"),
+        pytest.param(_boot_timeline_image("MBR", "FAT32", "aarch64_higher_half"),
+                     "uefi_aarch64", marks=_AA64_MARKS,
+                     id="MBR-FAT32-aarch64_higher_half"),
+    ),
+    indirect=["feature_image"],
+)
+def test_boot_timeline(feature_image: ultra.DiskImage, firmware, pytestconfig):
+    boot_and_check(feature_image, firmware, pytestconfig)
+
+
+#
+# SMP bring-up test.
+#
+# With `smp = true` the loader starts every application processor and parks it
+# on a per-CPU descriptor, handing the array to the kernel as an
+# ultra_smp_info_attribute. The kernel checks the CPU count against
+# `expect-cpus`, then releases every parked CPU onto a stack of its own and
+# waits for all of them to check in (see validate_smp_info in
+# tests/kernel/kernel.c). Both the i386 and the amd64 parking paths are
+# exercised under BIOS. Under UEFI the APs are only woken up after
+# ExitBootServices(), as the firmware would otherwise take them back.
+#
+
+
+_SMP_CPUS = 4
+
+
+def _smp_image(br_type: str, fs_type: str, kernel_type: str):
+    cfg = di.make_single_entry_config(f"/boot/kernel_{kernel_type}",
+                                      f"expect-smp-info=1 "
+                                      f"expect-cpus={_SMP_CPUS}",
+                                      extra="smp = true\n")
+    return (br_type, fs_type, cfg)
+
+
+@pytest.mark.parametrize(
+    "feature_image,firmware",
+    (
+        pytest.param(_smp_image("MBR", "FAT32", "i686_higher_half"),
+                     "bios", marks=_BIOS_MARKS, id="MBR-FAT32-i686_higher_half"),
+        pytest.param(_smp_image("MBR", "FAT32", "amd64_higher_half"),
+                     "bios", marks=_BIOS_MARKS, id="MBR-FAT32-amd64_higher_half"),
+        pytest.param(_smp_image("GPT", "FAT32", "amd64_higher_half"),
+                     "uefi_x64", marks=_UEFI_MARKS,
+                     id="GPT-FAT32-amd64_higher_half"),
+        pytest.param(_smp_image("MBR", "FAT32", "aarch64_higher_half"),
+                     "uefi_aarch64", marks=_AA64_MARKS,
+                     id="MBR-FAT32-aarch64_higher_half"),
+    ),
+    indirect=["feature_image"],
+)
+def test_smp(feature_image: ultra.DiskImage, firmware, pytestconfig):
+    boot_and_check(feature_image, firmware, pytestconfig,
+                   ["-smp", str(_SMP_CPUS)])
+
+
+#
+# Parallel zeroing test.
+#
+# Large memory modules are zeroed in chunks spread over every CPU the firmware
+# lets the loader use (EFI_MP_SERVICES_PROTOCOL), and serially wherever that's
+# not available. The module size is deliberately not a multiple of the chunk
+# size so the short trailing chunk is exercised too. The kernel verifies the
+# whole module reads back as zero (see validate_modules in
+# tests/kernel/kernel.c). Under OVMF at least one chunk must have been zeroed
+# by an application processor.
+#
+
+
+_PARALLEL_ZERO_EXTRA = (
+    "module:\n"
+    '    name = "parallel-zero"\n'
+    '    type = "memory"\n'
+    "    size = 0x1234000\n"
+)
+
+
+def _parallel_zero_image(br_type: str, fs_type: str, kernel_type: str):
+    cfg = di.make_single_entry_config(f"/boot/kernel_{kernel_type}",
+                                      _PRINT_LOADER_LOG_CMDLINE,
+                                      extra=_PRINT_LOADER_LOG_EXTRA +
+                                            _PARALLEL_ZERO_EXTRA)
+    return (br_type, fs_type, cfg)
+
+
+@pytest.mark.parametrize(
+    "feature_image,firmware",
+    (
+        pytest.param(_parallel_zero_image("MBR", "FAT32", "amd64_higher_half"),
+                     "bios", marks=_BIOS_MARKS, id="MBR-FAT32-amd64_higher_half"),
+        pytest.param(_parallel_zero_image("GPT", "FAT32", "amd64_higher_half"),
+                     "uefi_x64", marks=_UEFI_MARKS,
+                     id="GPT-FAT32-amd64_higher_half"),
+        pytest.param(_parallel_zero_image("MBR", "FAT32", "aarch64_higher_half"),
+                     "uefi_aarch64", marks=_AA64_MARKS,
+                     id="MBR-FAT32-aarch64_higher_half"),
+    ),
+    indirect=["feature_image"],
+)
+def test_parallel_zero(feature_image: ultra.DiskImage, firmware, pytestconfig):
+    out = boot_and_check(feature_image, firmware, pytestconfig, ["-smp", "4"])
+    if firmware != "uefi_x64":
+        return
+
+    remote_jobs = re.findall(rb"PARALLEL: (\d+) out of \d+ job\(s\) ran on "
+                             rb"other CPUs", out)
+    assert remote_jobs, "nothing was dispatched to other CPUs"
+    assert any(int(n) > 0 for n in remote_jobs), "no job ran on an AP"
+
+
+#
+# Free page bitmap test.
+#
+# With `free-page-bitmap = true` the loader hands the kernel a bitmap of every
+# free physical page, built from the final memory map. The kernel checks it
+# against the memory map page by page (see validate_free_page_bitmap in
+# tests/kernel/kernel.c).
+#
+
+
+def _free_page_bitmap_image(br_type: str, fs_type: str, kernel_type: str):
+    cfg = di.make_single_entry_config(f"/boot/kernel_{kernel_type}",
+                                      "expect-free-page-bitmap=1",
+                                      extra="free-page-bitmap = true\n")
+    return (br_type, fs_type, cfg)
+
+
+@pytest.mark.parametrize(
+    "feature_image,firmware",
+    (
+        pytest.param(_free_page_bitmap_image("MBR", "FAT32", "i686_higher_half"),
+                     "bios", marks=_BIOS_MARKS, id="MBR-FAT32-i686_higher_half"),
+        pytest.param(_free_page_bitmap_image("MBR", "FAT32", "amd64_higher_half"),
+                     "bios", marks=_BIOS_MARKS, id="MBR-FAT32-amd64_higher_half"),
+        pytest.param(_free_page_bitmap_image("GPT", "FAT32", "amd64_higher_half"),
+                     "uefi_x64", marks=_UEFI_MARKS,
+                     id="GPT-FAT32-amd64_higher_half"),
+        pytest.param(_free_page_bitmap_image("MBR", "FAT32", "aarch64_higher_half"),
+                     "uefi_aarch64", marks=_AA64_MARKS,
+                     id="MBR-FAT32-aarch64_higher_half"),
+    ),
+    indirect=["feature_image"],
+)
+def test_free_page_bitmap(feature_image: ultra.DiskImage, firmware,
+                          pytestconfig):
+    boot_and_check(feature_image, firmware, pytestconfig)
+
+
+#
+# NUMA placement test.
+#
+# QEMU is given two nodes with a CPU and half of the memory each, which it
+# describes in the ACPI SRAT. The kernel, its stack & page tables as well as
+# 'hot' modules are expected on the BSP's node, modules with an explicit
+# `numa-node` on that node. With `numa-info = true` the loader reports where
+# everything ended up, which the kernel checks against the module names (see
+# validate_numa_info in tests/kernel/kernel.c).
+#
+
+
+_NUMA_QEMU_ARGS = [
+    "-m", "512M", "-smp", "2",
+    "-object", "memory-backend-ram,id=mem0,size=256M",
+    "-object", "memory-backend-ram,id=mem1,size=256M",
+    "-numa", "node,nodeid=0,cpus=0,memdev=mem0",
+    "-numa", "node,nodeid=1,cpus=1,memdev=mem1",
+]
+
+_NUMA_EXTRA = (
+    "numa-info = true\n"
+    "module:\n"
+    '    name = "hot"\n'
+    '    type = "memory"\n'
+    "    size = 0x10000\n"
+    "    hot = true\n"
+    "module:\n"
+    '    name = "node-1"\n'
+    '    type = "memory"\n'
+    "    size = 0x10000\n"
+    "    numa-node = 1\n"
+)
+
+
+def _numa_image(br_type: str, fs_type: str, kernel_type: str):
+    cfg = di.make_single_entry_config(f"/boot/kernel_{kernel_type}",
+                                      "expect-numa-info=1 expect-bsp-node=0",
+                                      extra=_NUMA_EXTRA)
+    return (br_type, fs_type, cfg)
+
+
+@pytest.mark.parametrize(
+    "feature_image,firmware",
+    (
+        pytest.param(_numa_image("MBR", "FAT32", "i686_higher_half"),
+                     "bios", marks=_BIOS_MARKS, id="MBR-FAT32-i686_higher_half"),
+        pytest.param(_numa_image("MBR", "FAT32", "amd64_higher_half"),
+                     "bios", marks=_BIOS_MARKS, id="MBR-FAT32-amd64_higher_half"),
+        pytest.param(_numa_image("GPT", "FAT32", "amd64_higher_half"),
+                     "uefi_x64", marks=_UEFI_MARKS,
+                     id="GPT-FAT32-amd64_higher_half"),
+        pytest.param(_numa_image("MBR", "FAT32", "aarch64_higher_half"),
+                     "uefi_aarch64", marks=_AA64_MARKS,
+                     id="MBR-FAT32-aarch64_higher_half"),
+    ),
+    indirect=["feature_image"],
+)
+def test_numa(feature_image: ultra.DiskImage, firmware, pytestconfig):
+    boot_and_check(feature_image, firmware, pytestconfig, _NUMA_QEMU_ARGS)
+
+
+#
+# Loader log hand-off test.
+#
+# Console output is batched (or dropped for everything below a warning), but
+# the whole log must still reach the kernel intact via the loader log
+# attribute. The kernel looks for the 'log-test' module load message in there
+# (see validate_loader_log in tests/kernel/kernel.c). In errors-only mode that
+# message must not make it to the console either: under OVMF ConOut (and the
+# loader's own serial log, if built in) ends up on COM1, which is checked too.
+#
+
+
+_LOADER_LOG_EXTRA = (
+    "pass-loader-log = true\n"
+    "module:\n"
+    '    name = "log-test"\n'
+    '    type = "memory"\n'
+    "    size = 0x1000\n"
+)
+_LOADER_LOG_MODULE_LINE = b'loading module "log-test"'
+
+
+def _loader_log_image(br_type: str, fs_type: str, kernel_type: str,
+                      flush_mode: str):
+    cfg = f'log-flush = "{flush_mode}"\n'
+    cfg += di.make_single_entry_config(f"/boot/kernel_{kernel_type}",
+                                       "expect-loader-log=1",
+                                       extra=_LOADER_LOG_EXTRA)
+    return (br_type, fs_type, cfg)
+
+
+@pytest.mark.parametrize(
+    "feature_image,firmware,errors_only",
+    (
+        pytest.param(_loader_log_image("MBR", "FAT32", "i686_higher_half",
+                                       "batched"),
+                     "bios", False, marks=_BIOS_MARKS,
+                     id="MBR-FAT32-i686_higher_half"),
+        pytest.param(_loader_log_image("MBR", "FAT32", "amd64_higher_half",
+                                       "batched"),
+                     "bios", False, marks=_BIOS_MARKS,
+                     id="MBR-FAT32-amd64_higher_half"),
+        pytest.param(_loader_log_image("GPT", "FAT32", "amd64_higher_half",
+                                       "errors-only"),
+                     "uefi_x64", True, marks=_UEFI_MARKS,
+                     id="GPT-FAT32-amd64_higher_half"),
+        pytest.param(_loader_log_image("MBR", "FAT32", "aarch64_higher_half",
+                                       "batched"),
+                     "uefi_aarch64", False, marks=_AA64_MARKS,
+                     id="MBR-FAT32-aarch64_higher_half"),
+    ),
+    indirect=["feature_image"],
+)
+def test_loader_log(feature_image: ultra.DiskImage, firmware,
+                    errors_only: bool, pytestconfig, tmp_path):
+    com1_log = tmp_path / "com1.log"
+
+    if not errors_only:
+        boot_and_check(feature_image, firmware, pytestconfig)
+        return
+
+    boot_and_check(feature_image, firmware, pytestconfig,
+                   com1=f"file:{com1_log}")
+
+    assert _LOADER_LOG_MODULE_LINE not in com1_log.read_bytes(), \
+        "info messages reached the console in errors-only mode"
+
+
+#
+# Framebuffer console test.
+#
+# The loader logs straight into the GOP framebuffer instead of going through
+# ConOut, optionally still mirroring to the firmware serial console. There's
+# nothing for the kernel to check, the boot simply has to make it there with
+# the whole log (plenty of scrolling) rendered along the way. Under OVMF the
+# firmware serial console is COM1, which must carry the module load message
+# (logged well after the switch) only if the mirror was asked for. The loader's
+# own serial log, if built in, is moved to COM2 so as not to interfere.
+#
+
+
+_FB_CONSOLE_EXTRA = (
+    "module:\n"
+    '    name = "fb-console-test"\n'
+    '    type = "memory"\n'
+    "    size = 0x1000\n"
+)
+_FB_CONSOLE_MIRRORED_LINE = b'loading module "fb-console-test"'
+
+
+def _fb_console_image(br_type: str, fs_type: str, kernel_type: str,
+                      console: str):
+    cfg = f'loader-console = "{console}"\n'
+    cfg += "serial-port = 0x2F8\n"
+    cfg += di.make_single_entry_config(f"/boot/kernel_{kernel_type}",
+                                       extra=_FB_CONSOLE_EXTRA)
+    return (br_type, fs_type, cfg)
+
+
+@pytest.mark.parametrize(
+    "feature_image,firmware,mirrored",
+    (
+        pytest.param(_fb_console_image("GPT", "FAT32", "amd64_higher_half",
+                                       "framebuffer"),
+                     "uefi_x64", False, marks=_UEFI_MARKS,
+                     id="GPT-FAT32-amd64_higher_half-framebuffer"),
+        pytest.param(_fb_console_image("GPT", "FAT32", "amd64_higher_half",
+                                       "framebuffer+serial"),
+                     "uefi_x64", True, marks=_UEFI_MARKS,
+                     id="GPT-FAT32-amd64_higher_half-framebuffer+serial"),
+        pytest.param(_fb_console_image("MBR", "FAT32", "aarch64_higher_half",
+                                       "framebuffer"),
+                     "uefi_aarch64", False, marks=_AA64_MARKS,
+                     id="MBR-FAT32-aarch64_higher_half-framebuffer"),
+    ),
+    indirect=["feature_image"],
+)
+def test_framebuffer_console(feature_image: ultra.DiskImage, firmware,
+                             mirrored: bool, pytestconfig, tmp_path):
+    com1_log = tmp_path / "com1.log"
+
+    if firmware != "uefi_x64":
+        boot_and_check(feature_image, firmware, pytestconfig)
+        return
+
+    boot_and_check(feature_image, firmware, pytestconfig,
+                   ["-serial", "null"], com1=f"file:{com1_log}")
+
+    found = _FB_CONSOLE_MIRRORED_LINE in com1_log.read_bytes()
+    if mirrored:
+        assert found, "log wasn't mirrored to the serial console"
+    else:
+        assert not found, "log went to the serial console regardless"
+
+
+#
+# Serial log test.
+#
+# `serial-port` moves the serial log sink at runtime. QEMU's second UART
+# (COM2, 0x2F8) is backed by a file here, so the log has to make it through
+# the divisor & FIFO programming to be found in there. The loader only logs to
+# serial if it was built with HYPER_SERIAL_LOG, which it says in the log handed
+# to the kernel, the test is skipped otherwise.
+#
+
+
+_SERIAL_LOG_PORT = 0x2F8
+_SERIAL_LOG_LINE = f"logging to serial port 0x{_SERIAL_LOG_PORT:04X}".encode()
+
+
+def _serial_log_image(br_type: str, fs_type: str, kernel_type: str):
+    cfg = f"serial-port = 0x{_SERIAL_LOG_PORT:X}\n"
+    cfg += di.make_single_entry_config(f"/boot/kernel_{kernel_type}",
+                                       _PRINT_LOADER_LOG_CMDLINE,
+                                       extra=_PRINT_LOADER_LOG_EXTRA)
+    return (br_type, fs_type, cfg)
+
+
+@pytest.mark.parametrize(
+    "feature_image,firmware",
+    (
+        pytest.param(_serial_log_image("MBR", "FAT32", "amd64_higher_half"),
+                     "bios", marks=_BIOS_MARKS, id="MBR-FAT32-amd64_higher_half"),
+        pytest.param(_serial_log_image("GPT", "FAT32", "amd64_higher_half"),
+                     "uefi_x64", marks=_UEFI_MARKS,
+                     id="GPT-FAT32-amd64_higher_half"),
+    ),
+    indirect=["feature_image"],
+)
+def test_serial_log(feature_image: ultra.DiskImage, firmware, pytestconfig,
+                    tmp_path):
+    serial_log = tmp_path / "serial.log"
+
+    out = boot_and_check(feature_image, firmware, pytestconfig,
+                         ["-serial", f"file:{serial_log}"])
+    if _SERIAL_LOG_LINE not in out:
+        pytest.skip("loader built without HYPER_SERIAL_LOG")
+
+    assert _SERIAL_LOG_LINE in serial_log.read_bytes(), \
+           "serial log didn't reach the chardev"